@@ -9,12 +9,14 @@ ext = Extension(
         'src/python/Whisper.c',
         'src/python/WhisperMetadata.c',
         'src/python/WhisperArchive.c',
+        'src/python/WhisperSeries.c',
     ],
     extra_compile_args=[
         '-I./src'
     ],
     extra_link_args=[
-        'wsp.a'
+        'wsp.a',
+        '-pthread'
     ]
 )
 
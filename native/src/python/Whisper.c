@@ -1,5 +1,10 @@
 #include "Whisper.h"
 #include "WhisperArchive.h"
+#include "WhisperSeries.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 
 typedef Whisper C;
 
@@ -8,9 +13,11 @@ static PyObject* Whisper_open(C *self, PyObject *args) {
     wsp_t *base = NULL;
     PyObject *py_meta = NULL;
     PyObject *py_archives = NULL;
+    PyObject *tmp;
     wsp_mapping_t mapping = WSP_MAPPING_NONE;
+    int io_flags = WSP_IO_DEFAULT;
 
-    if (!PyArg_ParseTuple(args, "s|i", &path, &mapping)) {
+    if (!PyArg_ParseTuple(args, "s|ii", &path, &mapping, &io_flags)) {
         return NULL;
     }
 
@@ -18,38 +25,44 @@ static PyObject* Whisper_open(C *self, PyObject *args) {
         mapping = WSP_MMAP;
     }
 
-    if (self->py_meta != Py_None) {
-        PyObject *tmp = self->py_meta;
-        self->py_meta = Py_None;
-        Py_DECREF(tmp);
-        Py_INCREF(self->py_meta);
-    }
-
-    if (self->py_archives != Py_None) {
-        PyObject *tmp = self->py_archives;
-        self->py_archives = Py_None;
-        Py_DECREF(tmp);
-        Py_INCREF(self->py_archives);
-    }
-
     base = PyMem_Malloc(sizeof(wsp_t));
 
     if (base == NULL) {
-        return NULL;
+        return PyErr_NoMemory();
     }
 
     WSP_INIT(base);
+    base->io_flags = io_flags;
 
     wsp_error_t e;
     WSP_ERROR_INIT(&e);
 
-    if (wsp_open(base, path, mapping, &e) == WSP_ERROR) {
+    wsp_return_t result;
+
+    Py_BEGIN_ALLOW_THREADS
+    result = wsp_open(base, path, mapping, &e);
+    Py_END_ALLOW_THREADS
+
+    if (result == WSP_ERROR) {
         PyMem_Free(base);
         PyErr_Whisper(&e);
         return NULL;
     }
 
+    // waits for other threads to be done with the previous base, they never
+    // take the GIL while holding the lock.
+    PyThread_acquire_lock(self->lock, WAIT_LOCK);
+    wsp_t *previous = self->base;
     self->base = base;
+    PyThread_release_lock(self->lock);
+
+    if (previous != NULL) {
+        Py_BEGIN_ALLOW_THREADS
+        wsp_close(previous, &e);
+        Py_END_ALLOW_THREADS
+
+        PyMem_Free(previous);
+    }
 
     py_meta = WhisperMetadata_new((PyObject *)self);
 
@@ -76,88 +89,187 @@ static PyObject* Whisper_open(C *self, PyObject *args) {
         Py_DECREF(archive);
     }
 
-    PyObject *tmp;
-
+    // other threads see the objects of the previous base until now, which
+    // stay usable as archives are checked against the base in use.
     tmp = self->py_meta;
     self->py_meta = py_meta;
-    Py_INCREF(self->py_meta);
     Py_DECREF(tmp);
 
     tmp = self->py_archives;
     self->py_archives = py_archives;
-    Py_INCREF(self->py_archives);
     Py_DECREF(tmp);
 
     Py_RETURN_NONE;
 
 error:
-    if (base != NULL) {
-        wsp_close(base, NULL);
-        PyMem_Free(base);
-    }
-
+    // the database stays open, without metadata and archive objects.
     Py_XDECREF(py_meta);
     Py_XDECREF(py_archives);
-    return NULL;
-}
 
-static PyObject* Whisper_load_points(C *self, PyObject *args) {
-    PyObject *p_archive;
+    tmp = self->py_meta;
+    self->py_meta = Py_None;
+    Py_INCREF(self->py_meta);
+    Py_DECREF(tmp);
 
-    if (!PyArg_ParseTuple(args, "O", &p_archive)) {
-        return NULL;
-    }
+    tmp = self->py_archives;
+    self->py_archives = Py_None;
+    Py_INCREF(self->py_archives);
+    Py_DECREF(tmp);
+    return NULL;
+}
 
+/*
+ * Get the index of an archive of this database.
+ */
+static int Whisper__archive(C *self, PyObject *p_archive, uint32_t *index) {
     switch (PyObject_IsInstance(p_archive, (PyObject *)&WhisperArchive_T)) {
         case -1:
-            return NULL;
+            return -1;
         case 0:
             PyErr_SetString(PyExc_TypeError, "Expected type 'WhisperArchive'");
-            return NULL;
+            return -1;
         default:
             break;
     }
 
+    if (self->base == NULL) {
+        PyErr_SetString(PyExc_Exception, "Base not initialized");
+        return -1;
+    }
+
     WhisperArchive *py_archive = (WhisperArchive *)p_archive;
 
-    PyObject *result = PyList_New(0);
+    if (py_archive->index >= self->base->archives_count) {
+        PyErr_SetString(PyExc_IndexError, "Archive does not belong to this database");
+        return -1;
+    }
 
-    if (result == NULL) {
+    *index = py_archive->index;
+    return 0;
+}
+
+/*
+ * Load all points of an archive, called with the lock held.
+ */
+static wsp_return_t Whisper__load_points(
+    wsp_t *base,
+    uint32_t index,
+    wsp_point_t **points,
+    uint32_t *count,
+    wsp_error_t *e
+)
+{
+    // the database may have been reopened since the archive was checked.
+    if (base == NULL || index >= base->archives_count) {
+        e->type = WSP_ERROR_NOT_OPEN;
+        return WSP_ERROR;
+    }
+
+    wsp_archive_t *archive = &base->archives[index];
+
+    *points = malloc(sizeof(wsp_point_t) * (archive->count > 0 ? archive->count : 1));
+
+    if (*points == NULL) {
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    if (wsp_load_all_points(base, archive, *points, e) == WSP_ERROR) {
+        free(*points);
+        *points = NULL;
+        return WSP_ERROR;
+    }
+
+    *count = archive->count;
+    return WSP_OK;
+}
+
+static PyObject* Whisper_load_points(C *self, PyObject *args) {
+    PyObject *p_archive;
+    uint32_t index;
+
+    if (!PyArg_ParseTuple(args, "O", &p_archive)) {
+        return NULL;
+    }
+
+    if (Whisper__archive(self, p_archive, &index) == -1) {
         return NULL;
     }
 
     wsp_error_t e;
     WSP_ERROR_INIT(&e);
 
-    wsp_archive_t *archive = &self->base->archives[py_archive->index];
-    wsp_point_t points[archive->count];
+    wsp_point_t *points = NULL;
+    uint32_t count = 0;
+    wsp_return_t result;
 
-    if (wsp_load_all_points(self->base, archive, points, &e) == WSP_ERROR) {
+    WHISPER_BEGIN_LOCKED(self);
+    result = Whisper__load_points(self->base, index, &points, &count, &e);
+    WHISPER_END_LOCKED(self);
+
+    if (result == WSP_ERROR) {
         PyErr_Whisper(&e);
-        Py_DECREF(result);
         return NULL;
     }
 
-    uint32_t i;
-    wsp_point_t point;
+    PyObject *list = PyList_New(count);
+
+    if (list == NULL) {
+        free(points);
+        return NULL;
+    }
 
-    for (i = 0; i < archive->count; i++) {
-        point = points[i];
+    uint32_t i;
 
-        PyObject *tuple = Py_BuildValue("(Ld)", point.timestamp, point.value);
+    for (i = 0; i < count; i++) {
+        PyObject *tuple = Py_BuildValue("(Id)", points[i].timestamp, points[i].value);
 
-        if (tuple == NULL || PyList_Append(result, tuple) == -1) {
-            Py_XDECREF(tuple);
-            Py_DECREF(result);
+        if (tuple == NULL) {
+            free(points);
+            Py_DECREF(list);
             return NULL;
         }
 
-        // tuple is now owner by result list.
-        Py_DECREF(tuple);
+        // tuple is now owned by result list.
+        PyList_SET_ITEM(list, i, tuple);
+    }
+
+    free(points);
+    return list;
+}
+
+static PyObject* Whisper_load_series(C *self, PyObject *args) {
+    PyObject *p_archive;
+    int offset = 0;
+    unsigned int count = UINT32_MAX;
+    uint32_t index;
+
+    if (!PyArg_ParseTuple(args, "O|iI", &p_archive, &offset, &count)) {
+        return NULL;
+    }
+
+    if (Whisper__archive(self, p_archive, &index) == -1) {
+        return NULL;
+    }
+
+    return WhisperSeries_load(self, index, offset, count);
+}
+
+static PyObject* Whisper_iter_series(C *self, PyObject *args) {
+    PyObject *p_archive;
+    unsigned int block = 4096;
+    uint32_t index;
+
+    if (!PyArg_ParseTuple(args, "O|I", &p_archive, &block)) {
+        return NULL;
     }
 
-    Py_INCREF(result);
-    return result;
+    if (Whisper__archive(self, p_archive, &index) == -1) {
+        return NULL;
+    }
+
+    return WhisperSeriesIter_new(self, index, block);
 }
 
 static PyObject* Whisper_update_point(C *self, PyObject *args) {
@@ -183,7 +295,196 @@ static PyObject* Whisper_update_point(C *self, PyObject *args) {
         .value = value
     };
 
-    if (wsp_update(self->base, &p, &e) == WSP_ERROR) {
+    wsp_return_t result;
+
+    WHISPER_BEGIN_LOCKED(self);
+    result = wsp_update(self->base, &p, &e);
+    WHISPER_END_LOCKED(self);
+
+    if (result == WSP_ERROR) {
+        PyErr_Whisper(&e);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+/*
+ * Size of a packed (uint32, double) record, as in struct.pack('=Id', ...).
+ */
+#define WHISPER_RECORD_SIZE (sizeof(uint32_t) + sizeof(double))
+
+/*
+ * Convert packed records in native byte order to points.
+ */
+static wsp_point_t *Whisper__unpack_points(const char *buf, Py_ssize_t len, uint32_t *count) {
+    if (len % WHISPER_RECORD_SIZE != 0 || len / WHISPER_RECORD_SIZE > UINT32_MAX) {
+        PyErr_SetString(PyExc_ValueError, "Expected a buffer of packed (uint32, double) records");
+        return NULL;
+    }
+
+    *count = (uint32_t)(len / WHISPER_RECORD_SIZE);
+
+    wsp_point_t *points = PyMem_Malloc(sizeof(wsp_point_t) * (*count > 0 ? *count : 1));
+
+    if (points == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    uint32_t i;
+
+    for (i = 0; i < *count; i++) {
+        const char *record = buf + (size_t)i * WHISPER_RECORD_SIZE;
+
+        memcpy(&points[i].timestamp, record, sizeof(uint32_t));
+        memcpy(&points[i].value, record + sizeof(uint32_t), sizeof(double));
+    }
+
+    return points;
+}
+
+/*
+ * Convert a sequence of (timestamp, value) pairs to points, timestamps are
+ * truncated like int() does.
+ */
+static wsp_point_t *Whisper__sequence_points(PyObject *py_points, uint32_t *count) {
+    PyObject *seq = PySequence_Fast(py_points, "Expected a sequence of (timestamp, value) or a buffer");
+
+    if (seq == NULL) {
+        return NULL;
+    }
+
+    Py_ssize_t size = PySequence_Fast_GET_SIZE(seq);
+
+    if (size > UINT32_MAX) {
+        Py_DECREF(seq);
+        PyErr_SetString(PyExc_ValueError, "Too many points");
+        return NULL;
+    }
+
+    wsp_point_t *points = PyMem_Malloc(sizeof(wsp_point_t) * (size > 0 ? size : 1));
+
+    if (points == NULL) {
+        Py_DECREF(seq);
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    Py_ssize_t i;
+
+    for (i = 0; i < size; i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+
+        if (!PyTuple_Check(item) || PyTuple_GET_SIZE(item) != 2) {
+            PyErr_SetString(PyExc_TypeError, "Expected (timestamp, value) tuples");
+            goto error;
+        }
+
+        double timestamp = PyFloat_AsDouble(PyTuple_GET_ITEM(item, 0));
+        double value = PyFloat_AsDouble(PyTuple_GET_ITEM(item, 1));
+
+        if (PyErr_Occurred()) {
+            goto error;
+        }
+
+        if (!(timestamp >= 0 && timestamp < 4294967296.0)) {
+            PyErr_SetString(PyExc_ValueError, "Timestamp out of range");
+            goto error;
+        }
+
+        points[i].timestamp = (wsp_time_t)timestamp;
+        points[i].value = value;
+    }
+
+    Py_DECREF(seq);
+    *count = (uint32_t)size;
+    return points;
+
+error:
+    Py_DECREF(seq);
+    PyMem_Free(points);
+    return NULL;
+}
+
+static PyObject* Whisper_update_many(C *self, PyObject *args) {
+    PyObject *py_points;
+
+    if (!PyArg_ParseTuple(args, "O", &py_points)) {
+        return NULL;
+    }
+
+    if (self->base == NULL) {
+        PyErr_SetString(PyExc_Exception, "Base not initialized");
+        return NULL;
+    }
+
+    wsp_point_t *points = NULL;
+    uint32_t count = 0;
+
+    if (PyObject_CheckBuffer(py_points)) {
+        Py_buffer view;
+
+        if (PyObject_GetBuffer(py_points, &view, PyBUF_SIMPLE) == -1) {
+            return NULL;
+        }
+
+        points = Whisper__unpack_points(view.buf, view.len, &count);
+        PyBuffer_Release(&view);
+    }
+    else if (PyObject_CheckReadBuffer(py_points)) {
+        const void *buf;
+        Py_ssize_t len;
+
+        if (PyObject_AsReadBuffer(py_points, &buf, &len) == -1) {
+            return NULL;
+        }
+
+        points = Whisper__unpack_points(buf, len, &count);
+    }
+    else {
+        points = Whisper__sequence_points(py_points, &count);
+    }
+
+    if (points == NULL) {
+        return NULL;
+    }
+
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    wsp_return_t result;
+
+    WHISPER_BEGIN_LOCKED(self);
+    result = wsp_update_many(self->base, points, count, &e);
+    WHISPER_END_LOCKED(self);
+
+    PyMem_Free(points);
+
+    if (result == WSP_ERROR) {
+        PyErr_Whisper(&e);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject* Whisper_sync(C *self, PyObject *args) {
+    if (self->base == NULL) {
+        PyErr_SetString(PyExc_Exception, "Base not initialized");
+        return NULL;
+    }
+
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    wsp_return_t result;
+
+    WHISPER_BEGIN_LOCKED(self);
+    result = wsp_sync(self->base, &e);
+    WHISPER_END_LOCKED(self);
+
+    if (result == WSP_ERROR) {
         PyErr_Whisper(&e);
         return NULL;
     }
@@ -194,7 +495,11 @@ static PyObject* Whisper_update_point(C *self, PyObject *args) {
 static PyMethodDef Whisper_methods[] = {
     {"open", (PyCFunction)Whisper_open, METH_VARARGS, "Open the specified path"},
     {"load_points", (PyCFunction)Whisper_load_points, METH_VARARGS, "Load points"},
+    {"load_series", (PyCFunction)Whisper_load_series, METH_VARARGS, "Load points as a buffer of values, see WhisperSeries"},
+    {"iter_series", (PyCFunction)Whisper_iter_series, METH_VARARGS, "Iterate over the points of an archive in series of at most block points"},
     {"update_point", (PyCFunction)Whisper_update_point, METH_VARARGS, "Update point"},
+    {"update_many", (PyCFunction)Whisper_update_many, METH_VARARGS, "Update many points, from (timestamp, value) tuples or packed (uint32, double) records"},
+    {"sync", (PyCFunction)Whisper_sync, METH_NOARGS, "Make written points durable"},
     {NULL}
 };
 
@@ -204,8 +509,32 @@ static PyMemberDef Whisper_members[] = {
     {NULL}
 };
 
+static PyObject *
+Whisper_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+    C *self = (C *)type->tp_alloc(type, 0);
+
+    if (self == NULL) {
+        return NULL;
+    }
+
+    self->lock = PyThread_allocate_lock();
+
+    if (self->lock == NULL) {
+        Py_DECREF(self);
+        PyErr_SetString(PyExc_MemoryError, "Unable to allocate lock");
+        return NULL;
+    }
+
+    return (PyObject *)self;
+}
+
 static int
 Whisper_init(C *self, PyObject *args, PyObject *kwds) {
+    if (self->py_meta != NULL) {
+        PyErr_SetString(PyExc_Exception, "Already initialized");
+        return -1;
+    }
+
     self->base = NULL;
 
     self->py_meta = Py_None;
@@ -221,7 +550,20 @@ static void
 Whisper_dealloc(C *self) {
     Py_XDECREF(self->py_meta);
     Py_XDECREF(self->py_archives);
-    printf("Dealloc\n");
+
+    if (self->base != NULL) {
+        wsp_error_t e;
+        WSP_ERROR_INIT(&e);
+
+        wsp_close(self->base, &e);
+        PyMem_Free(self->base);
+    }
+
+    if (self->lock != NULL) {
+        PyThread_free_lock(self->lock);
+    }
+
+    Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
 PyTypeObject Whisper_T = {
@@ -267,7 +609,7 @@ PyTypeObject Whisper_T = {
 };
 
 void init_Whisper_T(PyObject *m) {
-    Whisper_T.tp_new = PyType_GenericNew;
+    Whisper_T.tp_new = Whisper_new;
 
     if (PyType_Ready(&Whisper_T) == 0) {
         Py_INCREF(&Whisper_T);
@@ -3,6 +3,7 @@
 
 #include <Python.h>
 #include <structmember.h>
+#include <pythread.h>
 
 #include <wsp.h>
 
@@ -11,6 +12,9 @@
 typedef struct {
     PyObject_HEAD;
     /* Type-specific fields go here. */
+    /* held while base is in use without the GIL */
+    PyThread_type_lock lock;
+    /* replaced only while holding both the GIL and lock */
     wsp_t *base;
     /* reference to metadata object */
     PyObject *py_meta;
@@ -18,6 +22,18 @@ typedef struct {
     PyObject *py_archives;
 } Whisper;
 
+/*
+ * Run a block with the GIL released and the lock of a database held, the
+ * block may only use C data and must not return.
+ */
+#define WHISPER_BEGIN_LOCKED(self) \
+    Py_BEGIN_ALLOW_THREADS \
+    PyThread_acquire_lock((self)->lock, WAIT_LOCK);
+
+#define WHISPER_END_LOCKED(self) \
+    PyThread_release_lock((self)->lock); \
+    Py_END_ALLOW_THREADS
+
 extern PyTypeObject Whisper_T;
 
 void init_Whisper_T(PyObject *m);
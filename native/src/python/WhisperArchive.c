@@ -112,8 +112,10 @@ PyObject *WhisperArchive_new(PyObject *file, uint32_t index)
         return NULL;
     }
 
-    Py_INCREF(args);
-    return PyObject_CallObject((PyObject *)&WhisperArchive_T, args);
+    PyObject *self = PyObject_CallObject((PyObject *)&WhisperArchive_T, args);
+
+    Py_DECREF(args);
+    return self;
 }
 
 void init_WhisperArchive_T(PyObject *m) {
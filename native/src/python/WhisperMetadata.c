@@ -103,10 +103,10 @@ PyObject *WhisperMetadata_new(PyObject *py_database)
         return args;
     }
 
-    Py_INCREF(args);
-
     PyObject *self = PyObject_CallObject((PyObject *)&WhisperMetadata_T, args);
 
+    Py_DECREF(args);
+
     return self;
 }
 
@@ -0,0 +1,300 @@
+#include "WhisperSeries.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+typedef WhisperSeries C;
+
+static Py_ssize_t WhisperSeries_length(C *self) {
+    return self->shape;
+}
+
+static int WhisperSeries_getbuffer(C *self, Py_buffer *view, int flags) {
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "WhisperSeries is read-only");
+        return -1;
+    }
+
+    view->obj = (PyObject *)self;
+    Py_INCREF(self);
+
+    view->buf = self->series.values;
+    view->len = self->shape * self->stride;
+    view->readonly = 1;
+    view->itemsize = sizeof(double);
+    view->format = (flags & PyBUF_FORMAT) ? "d" : NULL;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? &self->shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? &self->stride : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+/*
+ * Old style buffer, used by numpy.frombuffer and array on Python 2.
+ */
+static Py_ssize_t WhisperSeries_getreadbuffer(C *self, Py_ssize_t segment, void **ptr) {
+    if (segment != 0) {
+        PyErr_SetString(PyExc_SystemError, "Accessing non-existent segment");
+        return -1;
+    }
+
+    *ptr = self->series.values;
+    return self->shape * self->stride;
+}
+
+static Py_ssize_t WhisperSeries_getsegcount(C *self, Py_ssize_t *lenp) {
+    if (lenp != NULL) {
+        *lenp = self->shape * self->stride;
+    }
+
+    return 1;
+}
+
+static Py_ssize_t WhisperSeries_getcharbuffer(C *self, Py_ssize_t segment, char **ptr) {
+    return WhisperSeries_getreadbuffer(self, segment, (void **)ptr);
+}
+
+static PyBufferProcs WhisperSeries_as_buffer = {
+    (readbufferproc)WhisperSeries_getreadbuffer,
+    0,
+    (segcountproc)WhisperSeries_getsegcount,
+    (charbufferproc)WhisperSeries_getcharbuffer,
+    (getbufferproc)WhisperSeries_getbuffer,
+    0,
+};
+
+static PySequenceMethods WhisperSeries_as_sequence = {
+    (lenfunc)WhisperSeries_length, /*sq_length*/
+};
+
+static PyMemberDef WhisperSeries_members[] = {
+    {"start", T_UINT, offsetof(WhisperSeries, series.start), READONLY, "Timestamp of the first point"},
+    {"step", T_UINT, offsetof(WhisperSeries, series.step), READONLY, "Seconds between points"},
+    {"count", T_UINT, offsetof(WhisperSeries, series.count), READONLY, "Points Count"},
+    {NULL}
+};
+
+static void
+WhisperSeries_dealloc(C *self) {
+    free(self->series.values);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+PyTypeObject WhisperSeries_T = {
+    PyObject_HEAD_INIT(NULL)
+    0, /*ob_size*/
+    "WhisperSeries", /*tp_name*/
+    sizeof(C), /*tp_basicsize*/
+    0, /*tp_itemsize*/
+    (destructor)WhisperSeries_dealloc, /*tp_dealloc*/
+    0, /*tp_print*/
+    0, /*tp_getattr*/
+    0, /*tp_setattr*/
+    0, /*tp_compare*/
+    0, /*tp_repr*/
+    0, /*tp_as_number*/
+    &WhisperSeries_as_sequence, /*tp_as_sequence*/
+    0, /*tp_as_mapping*/
+    0, /*tp_hash */
+    0, /*tp_call*/
+    0, /*tp_str*/
+    0, /*tp_getattro*/
+    0, /*tp_setattro*/
+    &WhisperSeries_as_buffer, /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER, /*tp_flags*/
+    "Whisper Series", /*tp_doc*/
+    0, /*tp_traverse*/
+    0, /*tp_clear*/
+    0, /*tp_richcompare*/
+    0, /*tp_weaklistoffset*/
+    0, /*tp_iter*/
+    0, /*tp_iternext*/
+    0, /*tp_methods*/
+    WhisperSeries_members, /*tp_members*/
+    0, /*tp_getset*/
+    0, /*tp_base*/
+    0, /*tp_dict*/
+    0, /*tp_descr_get*/
+    0, /*tp_descr_set*/
+    0, /*tp_dictoffset*/
+    0, /*tp_init*/
+    0, /*tp_alloc*/
+    0, /*tp_new*/
+};
+
+/*
+ * Load points into a new series, called with the lock held.
+ */
+static wsp_return_t WhisperSeries__load(
+    wsp_t *base,
+    uint32_t index,
+    int offset,
+    uint32_t count,
+    wsp_series_t *series,
+    wsp_error_t *e
+)
+{
+    // the database may have been reopened since the archive was checked.
+    if (base == NULL || index >= base->archives_count) {
+        e->type = WSP_ERROR_NOT_OPEN;
+        return WSP_ERROR;
+    }
+
+    wsp_archive_t *archive = &base->archives[index];
+
+    if (count > archive->count) {
+        count = archive->count;
+    }
+
+    double *values = malloc(sizeof(double) * (count > 0 ? count : 1));
+
+    if (values == NULL) {
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    WSP_SERIES_INIT(series, values, NULL);
+
+    if (wsp_load_series(base, archive, offset, count, series, e) == WSP_ERROR) {
+        free(values);
+        series->values = NULL;
+        return WSP_ERROR;
+    }
+
+    return WSP_OK;
+}
+
+PyObject *WhisperSeries_load(Whisper *database, uint32_t index, int offset, uint32_t count)
+{
+    if (database->base == NULL) {
+        PyErr_SetString(PyExc_Exception, "Base not initialized");
+        return NULL;
+    }
+
+    wsp_series_t series;
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    wsp_return_t result;
+
+    WHISPER_BEGIN_LOCKED(database);
+    result = WhisperSeries__load(database->base, index, offset, count, &series, &e);
+    WHISPER_END_LOCKED(database);
+
+    if (result == WSP_ERROR) {
+        PyErr_Whisper(&e);
+        return NULL;
+    }
+
+    C *self = PyObject_New(C, &WhisperSeries_T);
+
+    if (self == NULL) {
+        free(series.values);
+        return NULL;
+    }
+
+    self->series = series;
+    self->shape = series.count;
+    self->stride = sizeof(double);
+    return (PyObject *)self;
+}
+
+static PyObject *WhisperSeriesIter_next(WhisperSeriesIter *self) {
+    if (self->left == 0) {
+        return NULL;
+    }
+
+    uint32_t count = self->left < self->block ? self->left : self->block;
+
+    PyObject *series = WhisperSeries_load((Whisper *)self->py_database, self->index, (int)self->offset, count);
+
+    if (series == NULL) {
+        return NULL;
+    }
+
+    self->offset += count;
+    self->left -= count;
+    return series;
+}
+
+static void
+WhisperSeriesIter_dealloc(WhisperSeriesIter *self) {
+    Py_XDECREF(self->py_database);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+PyTypeObject WhisperSeriesIter_T = {
+    PyObject_HEAD_INIT(NULL)
+    0, /*ob_size*/
+    "WhisperSeriesIter", /*tp_name*/
+    sizeof(WhisperSeriesIter), /*tp_basicsize*/
+    0, /*tp_itemsize*/
+    (destructor)WhisperSeriesIter_dealloc, /*tp_dealloc*/
+    0, /*tp_print*/
+    0, /*tp_getattr*/
+    0, /*tp_setattr*/
+    0, /*tp_compare*/
+    0, /*tp_repr*/
+    0, /*tp_as_number*/
+    0, /*tp_as_sequence*/
+    0, /*tp_as_mapping*/
+    0, /*tp_hash */
+    0, /*tp_call*/
+    0, /*tp_str*/
+    0, /*tp_getattro*/
+    0, /*tp_setattro*/
+    0, /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_ITER, /*tp_flags*/
+    "Whisper Series Iterator", /*tp_doc*/
+    0, /*tp_traverse*/
+    0, /*tp_clear*/
+    0, /*tp_richcompare*/
+    0, /*tp_weaklistoffset*/
+    PyObject_SelfIter, /*tp_iter*/
+    (iternextfunc)WhisperSeriesIter_next, /*tp_iternext*/
+    0, /*tp_methods*/
+    0, /*tp_members*/
+    0, /*tp_getset*/
+    0, /*tp_base*/
+    0, /*tp_dict*/
+    0, /*tp_descr_get*/
+    0, /*tp_descr_set*/
+    0, /*tp_dictoffset*/
+    0, /*tp_init*/
+    0, /*tp_alloc*/
+    0, /*tp_new*/
+};
+
+PyObject *WhisperSeriesIter_new(Whisper *database, uint32_t index, uint32_t block)
+{
+    if (database->base == NULL) {
+        PyErr_SetString(PyExc_Exception, "Base not initialized");
+        return NULL;
+    }
+
+    WhisperSeriesIter *self = PyObject_New(WhisperSeriesIter, &WhisperSeriesIter_T);
+
+    if (self == NULL) {
+        return NULL;
+    }
+
+    self->py_database = (PyObject *)database;
+    Py_INCREF(self->py_database);
+    self->index = index;
+    self->offset = 0;
+    self->left = database->base->archives[index].count;
+    self->block = block > 0 ? block : 1;
+    return (PyObject *)self;
+}
+
+void init_WhisperSeries_T(PyObject *m) {
+    if (PyType_Ready(&WhisperSeries_T) == 0) {
+        Py_INCREF(&WhisperSeries_T);
+        PyModule_AddObject(m, "WhisperSeries", (PyObject *)&WhisperSeries_T);
+    }
+
+    PyType_Ready(&WhisperSeriesIter_T);
+}
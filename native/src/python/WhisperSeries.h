@@ -0,0 +1,55 @@
+#ifndef _PY_WHISPER_SERIES_H_
+#define _PY_WHISPER_SERIES_H_
+
+#include <Python.h>
+#include <structmember.h>
+
+#include <wsp.h>
+
+#include "WhisperException.h"
+#include "Whisper.h"
+
+/*
+ * Points of an archive as a read-only buffer of doubles (NAN if unknown),
+ * usable without copying by memoryview, array and numpy.
+ */
+typedef struct {
+    PyObject_HEAD;
+    /* Type-specific fields go here. */
+    // the values are owned by the series.
+    wsp_series_t series;
+    // shape and stride of the exported buffer.
+    Py_ssize_t shape;
+    Py_ssize_t stride;
+} WhisperSeries;
+
+/*
+ * Iterator over the points of an archive, in series of bounded size.
+ */
+typedef struct {
+    PyObject_HEAD;
+    /* Type-specific fields go here. */
+    PyObject *py_database;
+    // archive index.
+    uint32_t index;
+    // offset of the next series, relative to the base point.
+    uint32_t offset;
+    // number of points not iterated yet.
+    uint32_t left;
+    // maximum number of points in a series.
+    uint32_t block;
+} WhisperSeriesIter;
+
+extern PyTypeObject WhisperSeries_T;
+extern PyTypeObject WhisperSeriesIter_T;
+
+void init_WhisperSeries_T(PyObject *m);
+
+/*
+ * Load points of an archive of an open database into a new series.
+ */
+PyObject *WhisperSeries_load(Whisper *database, uint32_t index, int offset, uint32_t count);
+
+PyObject *WhisperSeriesIter_new(Whisper *database, uint32_t index, uint32_t block);
+
+#endif /* _PY_WHISPER_SERIES_H_ */
@@ -5,28 +5,349 @@
 #include "WhisperArchive.h"
 #include "WhisperMetadata.h"
 #include "WhisperException.h"
+#include "WhisperSeries.h"
 
 #include <wsp.h>
+#include <wsp_header.h>
+#include <wsp_resize.h>
+#include <wsp_merge.h>
 
 
 static PyObject* _wsp_open(PyObject *self, PyObject *args) {
     PyObject *w = PyObject_CallObject((PyObject *)&Whisper_T, NULL);
 
+    if (w == NULL) {
+        return NULL;
+    }
+
     PyObject *w_open = PyObject_GetAttrString(w, "open");
 
     if (w_open == NULL) {
+        Py_DECREF(w);
         return NULL;
     }
 
-    if (PyObject_CallObject(w_open, args) == NULL) {
+    PyObject *result = PyObject_CallObject(w_open, args);
+
+    Py_DECREF(w_open);
+
+    if (result == NULL) {
+        Py_DECREF(w);
         return NULL;
     }
 
+    Py_DECREF(result);
     return w;
 }
 
+static PyObject* _wsp_header_cache_enable(PyObject *self, PyObject *args) {
+    unsigned int size;
+    wsp_error_t e;
+
+    if (!PyArg_ParseTuple(args, "I", &size)) {
+        return NULL;
+    }
+
+    WSP_ERROR_INIT(&e);
+    wsp_header_cache_enable(size, &e);
+    Py_RETURN_NONE;
+}
+
+static PyObject* _wsp_header_cache_disable(PyObject *self, PyObject *args) {
+    wsp_error_t e;
+
+    WSP_ERROR_INIT(&e);
+    wsp_header_cache_disable(&e);
+    Py_RETURN_NONE;
+}
+
+/*
+ * Convert a sequence of (spp, points) tuples to archives, which must be
+ * freed with PyMem_Free.
+ */
+static wsp_archive_t *_wsp_archives(PyObject *py_archives, uint32_t *count) {
+    PyObject *seq = PySequence_Fast(py_archives, "archives must be a sequence");
+
+    if (seq == NULL) {
+        return NULL;
+    }
+
+    Py_ssize_t size = PySequence_Fast_GET_SIZE(seq);
+    wsp_archive_t *archives = PyMem_Malloc(sizeof(wsp_archive_t) * (size > 0 ? size : 1));
+
+    if (archives == NULL) {
+        Py_DECREF(seq);
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    Py_ssize_t i;
+
+    for (i = 0; i < size; i++) {
+        unsigned int spp, points;
+
+        if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(seq, i), "II", &spp, &points)) {
+            PyMem_Free(archives);
+            Py_DECREF(seq);
+            return NULL;
+        }
+
+        archives[i].spp = spp;
+        archives[i].count = points;
+    }
+
+    Py_DECREF(seq);
+
+    *count = (uint32_t)size;
+    return archives;
+}
+
+static PyObject* _wsp_create(PyObject *self, PyObject *args) {
+    char *path;
+    PyObject *py_archives;
+    float x_files_factor = 0.5;
+    int aggregation = WSP_AVERAGE;
+    int mode = WSP_CREATE_ZERO;
+
+    if (!PyArg_ParseTuple(args, "sO|fii", &path, &py_archives, &x_files_factor, &aggregation, &mode)) {
+        return NULL;
+    }
+
+    uint32_t count;
+    wsp_archive_t *archives = _wsp_archives(py_archives, &count);
+
+    if (archives == NULL) {
+        return NULL;
+    }
+
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    wsp_return_t result;
+
+    Py_BEGIN_ALLOW_THREADS
+    result = wsp_create(path, archives, count, x_files_factor, aggregation, mode, &e);
+    Py_END_ALLOW_THREADS
+
+    PyMem_Free(archives);
+
+    if (result == WSP_ERROR) {
+        PyErr_Whisper(&e);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject* _wsp_create_template(PyObject *self, PyObject *args) {
+    char *path;
+    char *template_path;
+
+    if (!PyArg_ParseTuple(args, "ss", &path, &template_path)) {
+        return NULL;
+    }
+
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    wsp_return_t result;
+
+    Py_BEGIN_ALLOW_THREADS
+    result = wsp_create_template(path, template_path, &e);
+    Py_END_ALLOW_THREADS
+
+    if (result == WSP_ERROR) {
+        PyErr_Whisper(&e);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject* _wsp_resize(PyObject *self, PyObject *args) {
+    char *path;
+    PyObject *py_archives;
+    float x_files_factor = -1;
+    int aggregation = 0;
+    char *new_path = NULL;
+
+    if (!PyArg_ParseTuple(args, "sO|fiz", &path, &py_archives, &x_files_factor, &aggregation, &new_path)) {
+        return NULL;
+    }
+
+    uint32_t count;
+    wsp_archive_t *archives = _wsp_archives(py_archives, &count);
+
+    if (archives == NULL) {
+        return NULL;
+    }
+
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    wsp_return_t result;
+
+    Py_BEGIN_ALLOW_THREADS
+    result = wsp_resize(path, new_path, archives, count, x_files_factor, aggregation, &e);
+    Py_END_ALLOW_THREADS
+
+    PyMem_Free(archives);
+
+    if (result == WSP_ERROR) {
+        PyErr_Whisper(&e);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject* _wsp_resize_dir(PyObject *self, PyObject *args) {
+    char *dir;
+    PyObject *py_archives;
+    unsigned int threads = 1;
+    float x_files_factor = -1;
+    int aggregation = 0;
+
+    if (!PyArg_ParseTuple(args, "sO|Ifi", &dir, &py_archives, &threads, &x_files_factor, &aggregation)) {
+        return NULL;
+    }
+
+    uint32_t count;
+    wsp_archive_t *archives = _wsp_archives(py_archives, &count);
+
+    if (archives == NULL) {
+        return NULL;
+    }
+
+    uint64_t resized = 0;
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    wsp_return_t result;
+
+    Py_BEGIN_ALLOW_THREADS
+    result = wsp_resize_dir(dir, archives, count, x_files_factor, aggregation, threads, &resized, &e);
+    Py_END_ALLOW_THREADS
+
+    PyMem_Free(archives);
+
+    if (result == WSP_ERROR) {
+        PyErr_Whisper(&e);
+        return NULL;
+    }
+
+    return PyLong_FromUnsignedLongLong(resized);
+}
+
+static PyObject* _wsp_merge(PyObject *self, PyObject *args) {
+    char *path_from;
+    char *path_to;
+
+    if (!PyArg_ParseTuple(args, "ss", &path_from, &path_to)) {
+        return NULL;
+    }
+
+    uint64_t merged = 0;
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    wsp_return_t result;
+
+    Py_BEGIN_ALLOW_THREADS
+    result = wsp_merge(path_from, path_to, &merged, &e);
+    Py_END_ALLOW_THREADS
+
+    if (result == WSP_ERROR) {
+        PyErr_Whisper(&e);
+        return NULL;
+    }
+
+    return PyLong_FromUnsignedLongLong(merged);
+}
+
+/*
+ * Unknown values are None.
+ */
+static PyObject* _wsp_diff_value(double value) {
+    if (isnan(value)) {
+        Py_RETURN_NONE;
+    }
+
+    return PyFloat_FromDouble(value);
+}
+
+static wsp_return_t _wsp_diff_append(
+    void *data,
+    uint32_t archive,
+    wsp_time_t timestamp,
+    double from,
+    double to,
+    wsp_error_t *e
+)
+{
+    PyObject *a = _wsp_diff_value(from);
+    PyObject *b = _wsp_diff_value(to);
+    PyObject *item = NULL;
+
+    if (a != NULL && b != NULL) {
+        item = Py_BuildValue("(IIOO)", archive, timestamp, a, b);
+    }
+
+    Py_XDECREF(a);
+    Py_XDECREF(b);
+
+    if (item == NULL || PyList_Append((PyObject *)data, item) == -1) {
+        Py_XDECREF(item);
+        e->type = WSP_ERROR_MALLOC;
+        return WSP_ERROR;
+    }
+
+    Py_DECREF(item);
+    return WSP_OK;
+}
+
+static PyObject* _wsp_diff(PyObject *self, PyObject *args) {
+    char *path_from;
+    char *path_to;
+    int ignore_empty = 0;
+
+    if (!PyArg_ParseTuple(args, "ss|i", &path_from, &path_to, &ignore_empty)) {
+        return NULL;
+    }
+
+    PyObject *diffs = PyList_New(0);
+
+    if (diffs == NULL) {
+        return NULL;
+    }
+
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    if (wsp_diff(path_from, path_to, ignore_empty, _wsp_diff_append, diffs, &e) == WSP_ERROR) {
+        Py_DECREF(diffs);
+
+        // keep the Python error of a failed append.
+        if (!PyErr_Occurred()) {
+            PyErr_Whisper(&e);
+        }
+
+        return NULL;
+    }
+
+    return diffs;
+}
+
 static PyMethodDef py_wsp_methods[] = {
     {"open", _wsp_open, METH_VARARGS, "Open a whisper file"},
+    {"create", _wsp_create, METH_VARARGS, "Create a whisper file"},
+    {"create_template", _wsp_create_template, METH_VARARGS, "Create a whisper file as a copy of a template"},
+    {"resize", _wsp_resize, METH_VARARGS, "Resize a whisper file"},
+    {"resize_dir", _wsp_resize_dir, METH_VARARGS, "Resize every whisper file below a directory, returns the number resized"},
+    {"merge", _wsp_merge, METH_VARARGS, "Merge a whisper file into another, returns the number of points written"},
+    {"diff", _wsp_diff, METH_VARARGS, "Compare two whisper files, returns (archive, timestamp, from, to) for every point that differs"},
+    {"header_cache_enable", _wsp_header_cache_enable, METH_VARARGS, "Cache the headers of up to size closed whisper files"},
+    {"header_cache_disable", _wsp_header_cache_disable, METH_NOARGS, "Disable the header cache"},
     {NULL, NULL, 0, NULL}
 };
 
@@ -35,6 +356,17 @@ PyMODINIT_FUNC initwsp(void) {
 
     PyModule_AddIntConstant(m, "MMAP", WSP_MMAP);
     PyModule_AddIntConstant(m, "FILE", WSP_FILE);
+    PyModule_AddIntConstant(m, "PREAD", WSP_PREAD);
+
+    PyModule_AddIntConstant(m, "IO_RANDOM", WSP_IO_RANDOM);
+    PyModule_AddIntConstant(m, "IO_SEQUENTIAL", WSP_IO_SEQUENTIAL);
+    PyModule_AddIntConstant(m, "IO_WILLNEED", WSP_IO_WILLNEED);
+    PyModule_AddIntConstant(m, "IO_POPULATE", WSP_IO_POPULATE);
+    PyModule_AddIntConstant(m, "IO_HUGEPAGE", WSP_IO_HUGEPAGE);
+
+    PyModule_AddIntConstant(m, "CREATE_ZERO", WSP_CREATE_ZERO);
+    PyModule_AddIntConstant(m, "CREATE_SPARSE", WSP_CREATE_SPARSE);
+    PyModule_AddIntConstant(m, "CREATE_FALLOCATE", WSP_CREATE_FALLOCATE);
 
     PyModule_AddIntConstant(m, "AVERAGE", WSP_AVERAGE);
     PyModule_AddIntConstant(m, "SUM", WSP_SUM);
@@ -47,4 +379,5 @@ PyMODINIT_FUNC initwsp(void) {
     init_Whisper_T(m);
     init_WhisperMetadata_T(m);
     init_WhisperArchive_T(m);
+    init_WhisperSeries_T(m);
 }
@@ -1,4 +1,5 @@
 #include "wsp.h"
+#include "wsp_view.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -15,6 +16,7 @@ int main(int argc, const char **argv) {
     const char *p = argv[1];
     wsp_t w;
     WSP_INIT(&w);
+    w.io_flags = WSP_IO_SEQUENTIAL | WSP_IO_WILLNEED;
 
     if (wsp_open(&w, p, WSP_MMAP, &e) == WSP_ERROR) {
         printf("%s: %s: %s\n", wsp_strerror(&e), strerror(e.syserr), p);
@@ -44,17 +46,17 @@ int main(int argc, const char **argv) {
         printf("  points_size = %zu\n", archive->points_size);
         printf("\n");
 
-        wsp_point_t points[archive->count];
+        wsp_view_t view;
 
-        if (wsp_load_points(&w, archive, 0, archive->count, points, &e) == WSP_ERROR) {
+        if (wsp_view_points(&w, archive, 0, archive->count, &view, &e) == WSP_ERROR) {
             printf("%s: %s: %s\n", wsp_strerror(&e), strerror(e.syserr), p);
             return 1;
         }
 
         printf("Archive #%u data:\n", i);
 
-        for (j = 0; j < archive->count; j++) {
-            point = points[j];
+        for (j = 0; j < view.count; j++) {
+            wsp_view_point(&view, j, &point);
             printf("%u: %u, %.4f\n", j, point.timestamp, point.value);
         }
 
@@ -1,10 +1,17 @@
 // vim: foldmethod=marker
+// syscall, for copy_file_range
+#define _DEFAULT_SOURCE
 
 #include "wsp.h"
 #include "wsp_private.h"
 #include "wsp_time.h"
 #include "wsp_io_file.h"
 #include "wsp_io_mmap.h"
+#include "wsp_io_pread.h"
+
+#ifdef __linux__
+#include "wsp_io_uring.h"
+#endif /* __linux__ */
 
 #include <time.h>
 #include <errno.h>
@@ -12,6 +19,16 @@
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif /* __linux__ */
 
 // static initialization {{{
 const char *wsp_error_strings[WSP_ERROR_SIZE] = {
@@ -44,7 +61,19 @@ const char *wsp_error_strings[WSP_ERROR_SIZE] = {
     /* WSP_ERROR_ARCHIVE_MISALIGNED */
     "Archive headers are not aligned",
     /* WSP_ERROR_TIME_INTERVAL */
-    "Invalid time interval"
+    "Invalid time interval",
+    /* WSP_ERROR_CACHE_FULL */
+    "Cache is full",
+    /* WSP_ERROR_THREAD */
+    "Thread failure",
+    /* WSP_ERROR_INVALID */
+    "Invalid argument",
+    /* WSP_ERROR_NOT_MAPPED */
+    "Whisper file not memory mapped",
+    /* WSP_ERROR_POOL_FULL */
+    "All pooled handles are in use",
+    /* WSP_ERROR_ARCHIVE_CONFIG */
+    "Invalid archive configuration"
 }; // static initialization }}}
 
 const char *wsp_strerror(wsp_error_t *e)
@@ -52,365 +81,1781 @@ const char *wsp_strerror(wsp_error_t *e)
     return wsp_error_strings[e->type];
 }
 
-// wsp_open {{{
-wsp_return_t wsp_open(
-    wsp_t *w,
-    const char *path,
-    wsp_mapping_t mapping,
+/*
+ * Size of the block of zeros written by WSP_CREATE_ZERO, and the number of
+ * blocks written with a single system call.
+ */
+#define WSP_CREATE_ZEROS 65536
+#define WSP_CREATE_IOV 64
+
+static const char __wsp_zeros[WSP_CREATE_ZEROS];
+
+// __wsp_sort_archives {{{
+/*
+ * Copy archives sorted by precision.
+ */
+static wsp_archive_t *__wsp_sort_archives(
+    wsp_archive_t *archives,
+    uint32_t count,
     wsp_error_t *e
 )
 {
-    if (w->io_fd != NULL || w->io_mmap != NULL) {
-        e->type = WSP_ERROR_ALREADY_OPEN;
-        return WSP_ERROR;
-    }
+    wsp_archive_t *sorted = malloc(sizeof(wsp_archive_t) * count);
 
-    if (mapping == WSP_MMAP) {
-        w->io = &wsp_io_mmap;
-    }
-    else if (mapping == WSP_FILE) {
-        w->io = &wsp_io_file;
-    }
-    else {
-        e->type = WSP_ERROR_IO;
-        return WSP_ERROR;
+    if (sorted == NULL) {
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+        return NULL;
     }
 
-    if (w->io->open(w, path, e) == WSP_ERROR) {
-        return WSP_ERROR;
-    }
+    uint32_t i, j;
 
-    wsp_metadata_t meta;
-    WSP_METADATA_INIT(&meta);
+    for (i = 0; i < count; i++) {
+        wsp_archive_t archive = archives[i];
 
-    if (__wsp_read_metadata(w, &meta, e) == WSP_ERROR) {
-        return WSP_ERROR;
+        for (j = i; j > 0 && sorted[j - 1].spp > archive.spp; j--) {
+            sorted[j] = sorted[j - 1];
+        }
+
+        sorted[j] = archive;
     }
 
-    w->meta = meta;
+    return sorted;
+} // __wsp_sort_archives }}}
 
-    w->archives = NULL;
-    w->archives_size = sizeof(wsp_archive_t) * meta.archives_count;
-    w->archives_count = 0;
+// __wsp_valid_archive_list {{{
+/*
+ * Validate archives sorted by precision, see wsp_validate_archives.
+ */
+static wsp_return_t __wsp_valid_archive_list(
+    wsp_archive_t *archives,
+    uint32_t count,
+    wsp_error_t *e
+)
+{
+    uint32_t i;
 
-    if (__wsp_load_archives(w, e) == WSP_ERROR) {
-        return WSP_ERROR;
-    }
+    for (i = 0; i < count; i++) {
+        wsp_archive_t *archive = archives + i;
 
-    return WSP_OK;
-} // wsp_open }}}
+        if (archive->spp == 0 || archive->count == 0) {
+            e->type = WSP_ERROR_ARCHIVE_CONFIG;
+            return WSP_ERROR;
+        }
 
-// wsp_close {{{
-wsp_return_t wsp_close(wsp_t *w, wsp_error_t *e)
-{
-    if (w->archives != NULL) {
-        uint32_t i;
+        if (i == count - 1) {
+            break;
+        }
 
-        wsp_metadata_t m = w->meta;
+        wsp_archive_t *next = archive + 1;
 
-        for (i = 0; i < m.archives_count; i++) {
-            wsp_archive_t *archive = w->archives + i;
+        // no two archives may have the same precision.
+        if (!(archive->spp < next->spp)) {
+            e->type = WSP_ERROR_ARCHIVE_CONFIG;
+            return WSP_ERROR;
+        }
 
-            if (__wsp_archive_free(archive, e) == WSP_ERROR) {
-                return WSP_ERROR;
-            }
+        if (next->spp % archive->spp != 0) {
+            e->type = WSP_ERROR_ARCHIVE_MISALIGNED;
+            return WSP_ERROR;
         }
 
-        free(w->archives);
-        w->archives = NULL;
-    }
+        uint64_t retention = (uint64_t)archive->spp * archive->count;
+        uint64_t next_retention = (uint64_t)next->spp * next->count;
 
-    if (w->io->close(w, e) == WSP_ERROR) {
-        return WSP_ERROR;
-    }
+        if (!(next_retention > retention)) {
+            e->type = WSP_ERROR_ARCHIVE_CONFIG;
+            return WSP_ERROR;
+        }
 
-    w->archives = NULL;
-    w->archives_size = 0;
-    w->meta.aggregation = 0l;
-    w->meta.max_retention = 0l;
-    w->meta.x_files_factor = 0.0f;
-    w->meta.archives_count = 0l;
+        // enough points to consolidate into the next archive.
+        if (archive->count < next->spp / archive->spp) {
+            e->type = WSP_ERROR_ARCHIVE_CONFIG;
+            return WSP_ERROR;
+        }
+    }
 
     return WSP_OK;
-} // wsp_close }}}
-
-// wsp_load_all_points {{{
-wsp_return_t wsp_load_all_points(
-    wsp_t *w,
-    wsp_archive_t *archive,
-    wsp_point_t *points,
-    wsp_error_t *e
-)
-{
-    return wsp_load_points(w, archive, 0, archive->count, points, e);
-} // wsp_load_all_points }}}
+} // __wsp_valid_archive_list }}}
 
-wsp_return_t wsp_load_time_points(
-    wsp_t *w,
-    wsp_archive_t *archive,
-    wsp_time_t time_from,
-    wsp_time_t time_until,
-    wsp_point_t *result,
-    uint32_t *size,
+// wsp_validate_archives {{{
+wsp_return_t wsp_validate_archives(
+    wsp_archive_t *archives,
+    uint32_t count,
     wsp_error_t *e
 )
 {
-    wsp_point_t base;
-
-    if (wsp_load_point(w, archive, 0, &base, e) == WSP_ERROR) {
+    if (count == 0) {
+        e->type = WSP_ERROR_ARCHIVE_CONFIG;
         return WSP_ERROR;
     }
 
-    if (!(time_from < time_until)) {
-        e->type = WSP_ERROR_TIME_INTERVAL;
-        return WSP_ERROR;
-    }
-
-    int from = wsp_time_floor(time_from, archive->spp) / archive->spp;
-    int offset = from - (base.timestamp / archive->spp);
-    int until = wsp_time_floor(time_until, archive->spp) / archive->spp;
-    uint32_t count = until - from;
-
-    if (count > archive->count) {
-        count = archive->count;
-    }
+    wsp_archive_t *sorted = __wsp_sort_archives(archives, count, e);
 
-    if (wsp_load_points(w, archive, offset, count, result, e) == WSP_ERROR) {
+    if (sorted == NULL) {
         return WSP_ERROR;
     }
 
-    *size = count;
+    wsp_return_t result = __wsp_valid_archive_list(sorted, count, e);
 
-    return WSP_OK;
-}
+    free(sorted);
+    return result;
+} // wsp_validate_archives }}}
 
-wsp_return_t wsp_load_points(
-    wsp_t *w,
-    wsp_archive_t *archive,
-    int offset,
-    uint32_t count,
-    wsp_point_t *result,
+// __wsp_writev_all {{{
+/*
+ * Write all segments, continuing after partial writes.
+ */
+static wsp_return_t __wsp_writev_all(
+    int fd,
+    struct iovec *iov,
+    int count,
     wsp_error_t *e
 )
 {
-    wsp_point_t base;
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
 
-    if (wsp_load_point(w, archive, 0, &base, e) == WSP_ERROR) {
-        return WSP_ERROR;
-    }
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
 
-    if (offset < -((int)archive->count)) {
-        offset = -((int)archive->count);
-    }
+            e->type = WSP_ERROR_IO;
+            e->syserr = errno;
+            return WSP_ERROR;
+        }
 
-    if (offset > archive->count) {
-        offset = archive->count;
-    }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
 
-    if (count > archive->count) {
-        count = archive->count;
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
     }
 
-    uint32_t from = __wsp_point_mod(offset, archive->count);
-    uint32_t until = __wsp_point_mod(offset + count, archive->count);
-
-    wsp_point_t read_points[count];
-
-    // wrap around
-    if (until < from) {
-        uint32_t a_from = from;
-        uint32_t a_size = archive->count - from;
-        wsp_point_t *a_points = read_points;
+    return WSP_OK;
+} // __wsp_writev_all }}}
+
+// __wsp_create_fill {{{
+/*
+ * Write the header of a new database, and allocate the space of its
+ * archives.
+ */
+static wsp_return_t __wsp_create_fill(
+    int fd,
+    char *header,
+    size_t header_size,
+    uint64_t size,
+    wsp_create_mode_t mode,
+    wsp_error_t *e
+)
+{
+    struct iovec iov[WSP_CREATE_IOV + 1];
+    uint64_t remaining = size - header_size;
+    int count = 0;
 
-        uint32_t b_from = 0;
-        uint32_t b_size = until;
-        wsp_point_t *b_points = read_points + a_size;
+    iov[count].iov_base = header;
+    iov[count].iov_len = header_size;
+    count++;
 
-        if (__wsp_load_points(w, archive, a_from, a_size, a_points, e) == WSP_ERROR) {
+    if (mode == WSP_CREATE_SPARSE) {
+        if (__wsp_writev_all(fd, iov, count, e) == WSP_ERROR) {
             return WSP_ERROR;
         }
 
-        if (__wsp_load_points(w, archive, b_from, b_size, b_points, e) == WSP_ERROR) {
+        if (ftruncate(fd, size) == -1) {
+            e->type = WSP_ERROR_IO;
+            e->syserr = errno;
             return WSP_ERROR;
         }
+
+        return WSP_OK;
     }
-    else {
-        uint32_t size = until - from;
 
-        if (__wsp_load_points(w, archive, from, size, read_points, e) == WSP_ERROR) {
+    if (mode == WSP_CREATE_FALLOCATE) {
+        if (__wsp_writev_all(fd, iov, count, e) == WSP_ERROR) {
             return WSP_ERROR;
         }
-    }
 
-    uint32_t counter = base.timestamp + (archive->spp * offset);
-    uint32_t i;
-    for (i = 0; i < count; i++) {
-        wsp_point_t p = read_points[i];
+        int error = posix_fallocate(fd, header_size, remaining);
 
-        if (p.timestamp == counter) {
-            result[i] = p;
-        }
-        else {
-            wsp_point_t zero = { .timestamp = counter, .value = NAN };
-            result[i] = zero;
+        if (error != 0) {
+            e->type = WSP_ERROR_IO;
+            e->syserr = error;
+            return WSP_ERROR;
         }
 
-        counter += archive->spp;
+        return WSP_OK;
     }
 
-    return WSP_OK;
-} // wsp_load_points
+    if (mode != WSP_CREATE_ZERO) {
+        e->type = WSP_ERROR_INVALID;
+        return WSP_ERROR;
+    }
 
-wsp_return_t wsp_load_point(
-    wsp_t *w,
-    wsp_archive_t *archive,
-    uint32_t index,
-    wsp_point_t *point,
-    wsp_error_t *e
-)
-{
-    wsp_point_b buf;
-    wsp_point_b *rbuf = &buf;
+    // the header goes out with the first zeros.
+    while (remaining > 0 || count > 0) {
+        while (remaining > 0 && count < WSP_CREATE_IOV + 1) {
+            size_t length = remaining < WSP_CREATE_ZEROS ? remaining : WSP_CREATE_ZEROS;
 
-    size_t read_offset = WSP_POINT_OFFSET(archive, index);
-    size_t read_size = sizeof(wsp_point_b);
+            iov[count].iov_base = (void *)__wsp_zeros;
+            iov[count].iov_len = length;
+            remaining -= length;
+            count++;
+        }
 
-    if (w->io->read(w, read_offset, read_size, (void **)&rbuf, e) == WSP_ERROR) {
-        return WSP_ERROR;
-    }
+        if (__wsp_writev_all(fd, iov, count, e) == WSP_ERROR) {
+            return WSP_ERROR;
+        }
 
-    __wsp_parse_point(rbuf, point);
+        count = 0;
+    }
 
     return WSP_OK;
-} // wsp_load_point
+} // __wsp_create_fill }}}
 
-wsp_return_t wsp_save_point(
-    wsp_t *w,
-    wsp_archive_t *archive,
-    long index,
-    wsp_point_t *point,
+// wsp_create {{{
+wsp_return_t wsp_create(
+    const char *path,
+    wsp_archive_t *archives,
+    uint32_t count,
+    float x_files_factor,
+    wsp_aggregation_t aggregation,
+    wsp_create_mode_t mode,
     wsp_error_t *e
 )
 {
-    wsp_point_b buf;
-
-    if (index >= archive->count) {
-        e->type = WSP_ERROR_POINT_OOB;
+    if (aggregation < WSP_AVERAGE || aggregation > WSP_MIN) {
+        e->type = WSP_ERROR_UNKNOWN_AGGREGATION;
         return WSP_ERROR;
     }
 
-    size_t write_offset = WSP_POINT_OFFSET(archive, index);
-    size_t write_size = sizeof(wsp_point_b);
-
-    __wsp_dump_point(point, &buf);
-
-    if (w->io->write(w, write_offset, write_size, (void *)&buf, e) == WSP_ERROR) {
+    if (!(x_files_factor >= 0.0f && x_files_factor <= 1.0f)) {
+        e->type = WSP_ERROR_INVALID;
         return WSP_ERROR;
     }
 
-    return WSP_OK;
-} // wsp_save_point
-
-inline uint32_t wsp_point_index(
-    wsp_archive_t *archive,
-    wsp_point_t *base,
-    wsp_time_t floored
-)
-{
-    wsp_time_t distance = floored - base->timestamp;
-    return (distance / archive->spp) % archive->count;
-}
-
-wsp_return_t wsp_update_point(
-    wsp_t *w,
-    wsp_archive_t *archive,
-    wsp_time_t time,
-    double value,
-    wsp_point_t *base,
-    wsp_error_t *e
-)
-{
-    wsp_point_t base_point;
-    WSP_POINT_INIT(&base_point);
-
-    if (wsp_load_point(w, archive, 0, &base_point, e) == WSP_ERROR) {
+    if (count == 0) {
+        e->type = WSP_ERROR_ARCHIVE_CONFIG;
         return WSP_ERROR;
     }
 
-    uint32_t write_index = 0;
+    wsp_archive_t *sorted = __wsp_sort_archives(archives, count, e);
 
-    wsp_time_t floored = wsp_time_floor(time, archive->spp);
+    if (sorted == NULL) {
+        return WSP_ERROR;
+    }
 
-    /* this not is the first point being written */
-    if (base_point.timestamp != 0) {
-        write_index = wsp_point_index(archive, &base_point, floored);
+    if (__wsp_valid_archive_list(sorted, count, e) == WSP_ERROR) {
+        free(sorted);
+        return WSP_ERROR;
     }
 
-    wsp_point_t p = { .timestamp = floored, .value = value };
+    size_t header_size = sizeof(wsp_metadata_b) + sizeof(wsp_archive_b) * count;
+    char *header = malloc(header_size);
 
-    if (wsp_save_point(w, archive, write_index, &p, e) == WSP_ERROR) {
+    if (header == NULL) {
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+        free(sorted);
         return WSP_ERROR;
     }
 
-    *base = base_point;
+    wsp_metadata_t meta;
+    WSP_METADATA_INIT(&meta);
 
-    return WSP_OK;
-}
+    meta.aggregation = aggregation;
+    meta.x_files_factor = x_files_factor;
+    meta.archives_count = count;
 
-wsp_return_t wsp_update(wsp_t *w, wsp_point_t *p, wsp_error_t *e)
-{
-    wsp_time_t now = wsp_time_now();
+    uint64_t size = header_size;
+    uint64_t max_retention = 0;
+    uint32_t i;
 
-    wsp_time_t timestamp = p->timestamp;
-    double value = p->value;
+    for (i = 0; i < count; i++) {
+        wsp_archive_t *archive = sorted + i;
+        uint64_t retention = (uint64_t)archive->spp * archive->count;
 
-    if (timestamp == 0) {
-        timestamp = now;
+        archive->offset = (uint32_t)size;
+        size += sizeof(wsp_point_b) * (uint64_t)archive->count;
+
+        if (retention > max_retention) {
+            max_retention = retention;
+        }
+
+        __wsp_dump_archive(archive, (wsp_archive_b *)(header + sizeof(wsp_metadata_b)) + i);
     }
 
-    if (timestamp > now) {
-        e->type = WSP_ERROR_FUTURE_TIMESTAMP;
+    free(sorted);
+
+    // offsets and the retention are stored in 32 bits.
+    if (size > UINT32_MAX || max_retention > UINT32_MAX) {
+        free(header);
+        e->type = WSP_ERROR_ARCHIVE_CONFIG;
         return WSP_ERROR;
     }
 
-    wsp_time_t diff = now - timestamp;
+    meta.max_retention = (uint32_t)max_retention;
+    __wsp_dump_metadata(&meta, (wsp_metadata_b *)header);
 
-    wsp_archive_t *low = NULL;
-    uint32_t low_size = 0;
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0666);
 
-    if (__wsp_find_highest_precision(diff, w, &low, &low_size, e) == WSP_ERROR) {
+    if (fd == -1) {
+        free(header);
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
         return WSP_ERROR;
     }
 
-    wsp_point_t prev_base;
+    wsp_return_t result = __wsp_create_fill(fd, header, header_size, size, mode, e);
 
-    if (wsp_update_point(w, low, timestamp, value, &prev_base, e) == WSP_ERROR) {
-        return WSP_ERROR;
-    }
+    free(header);
 
-    uint32_t i = 0;
-    int skip = 0;
+    if (close(fd) == -1 && result == WSP_OK) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        result = WSP_ERROR;
+    }
 
-    wsp_archive_t *prev = low;
+    if (result == WSP_ERROR) {
+        unlink(path);
+    }
 
-    // Propagate changes to lower precision archive.
-    for (i = 1; i < low_size; i++) {
-        wsp_archive_t *cur = low + i;
+    return result;
+} // wsp_create }}}
+
+// __wsp_copy_file {{{
+/*
+ * Copy a file of the given size into a new, empty file.
+ */
+static wsp_return_t __wsp_copy_file(
+    int src,
+    int dst,
+    off_t size,
+    wsp_error_t *e
+)
+{
+    off_t copied = 0;
 
-        wsp_time_t floor = wsp_time_floor(timestamp, cur->spp);
-        uint32_t prev_index = wsp_point_index(prev, &prev_base, floor);
-        uint32_t prev_count = cur->spp / prev->spp;
+#ifdef __linux__
+#ifdef FICLONE
+    // share the blocks of the template.
+    if (ioctl(dst, FICLONE, src) == 0) {
+        return WSP_OK;
+    }
+#endif /* FICLONE */
 
-        wsp_point_t prev_points[prev_count];
+#ifdef SYS_copy_file_range
+    // copy in the kernel, falling back to reading and writing if the
+    // filesystems do not support it.
+    while (copied < size) {
+        long n = syscall(SYS_copy_file_range, src, NULL, dst, NULL, (size_t)(size - copied), 0);
 
-        // Load array of points from the previous archive of points.
-        if (wsp_load_points(w, prev, prev_index, prev_count, prev_points, e) == WSP_ERROR) {
-            return WSP_ERROR;
+        if (n <= 0) {
+            break;
         }
 
-        double value = 0;
+        copied += n;
+    }
+#endif /* SYS_copy_file_range */
+#endif /* __linux__ */
 
-        if (w->meta.aggregate(w, prev_points, prev_count, &value, &skip, e) == WSP_ERROR) {
+    char *buf = malloc(WSP_CREATE_ZEROS);
+
+    if (buf == NULL) {
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    while (copied < size) {
+        size_t length = size - copied < WSP_CREATE_ZEROS ? size - copied : WSP_CREATE_ZEROS;
+        ssize_t n = pread(src, buf, length, copied);
+
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            free(buf);
+            e->type = WSP_ERROR_IO;
+            e->syserr = n == 0 ? EIO : errno;
+            return WSP_ERROR;
+        }
+
+        struct iovec iov = { .iov_base = buf, .iov_len = n };
+
+        if (__wsp_writev_all(dst, &iov, 1, e) == WSP_ERROR) {
+            free(buf);
+            return WSP_ERROR;
+        }
+
+        copied += n;
+    }
+
+    free(buf);
+    return WSP_OK;
+} // __wsp_copy_file }}}
+
+// wsp_create_template {{{
+wsp_return_t wsp_create_template(
+    const char *path,
+    const char *template_path,
+    wsp_error_t *e
+)
+{
+    int src = open(template_path, O_RDONLY);
+
+    if (src == -1) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    struct stat st;
+
+    if (fstat(src, &st) == -1) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        close(src);
+        return WSP_ERROR;
+    }
+
+    int dst = open(path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+
+    if (dst == -1) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        close(src);
+        return WSP_ERROR;
+    }
+
+    wsp_return_t result = __wsp_copy_file(src, dst, st.st_size, e);
+
+    close(src);
+
+    if (close(dst) == -1 && result == WSP_OK) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        result = WSP_ERROR;
+    }
+
+    if (result == WSP_ERROR) {
+        unlink(path);
+    }
+
+    return result;
+} // wsp_create_template }}}
+
+// wsp_open {{{
+wsp_return_t wsp_open(
+    wsp_t *w,
+    const char *path,
+    wsp_mapping_t mapping,
+    wsp_error_t *e
+)
+{
+    if (w->io_fd != NULL || w->io_mmap != NULL || w->io_fileno != -1) {
+        e->type = WSP_ERROR_ALREADY_OPEN;
+        return WSP_ERROR;
+    }
+
+    if (mapping == WSP_MMAP) {
+        w->io = &wsp_io_mmap;
+    }
+    else if (mapping == WSP_PREAD) {
+        w->io = &wsp_io_pread;
+    }
+    else if (mapping == WSP_FILE) {
+        w->io = &wsp_io_file;
+    }
+#ifdef __linux__
+    else if (mapping == WSP_URING) {
+        w->io = &wsp_io_uring;
+    }
+#endif /* __linux__ */
+    else {
+        e->type = WSP_ERROR_IO;
+        return WSP_ERROR;
+    }
+
+    if (w->io->open(w, path, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    if (__wsp_header_open(w, e) == WSP_ERROR) {
+        wsp_error_t ignored;
+        WSP_ERROR_INIT(&ignored);
+
+        wsp_close(w, &ignored);
+        return WSP_ERROR;
+    }
+
+    // base points are read when first needed.
+    if (mapping != WSP_MMAP && w->archives_count > 0) {
+        w->bases = malloc(sizeof(wsp_point_t) * w->archives_count);
+        w->bases_valid = 0;
+
+        if (w->bases == NULL) {
+            wsp_error_t ignored;
+            WSP_ERROR_INIT(&ignored);
+
+            e->type = WSP_ERROR_MALLOC;
+            e->syserr = errno;
+            wsp_close(w, &ignored);
+            return WSP_ERROR;
+        }
+    }
+
+    return WSP_OK;
+} // wsp_open }}}
+
+// wsp_sync {{{
+wsp_return_t wsp_sync(
+    wsp_t *w,
+    wsp_error_t *e
+)
+{
+    if (w->io == NULL) {
+        e->type = WSP_ERROR_NOT_OPEN;
+        return WSP_ERROR;
+    }
+
+    if (w->io_dirty_from == w->io_dirty_until) {
+        return WSP_OK;
+    }
+
+    long offset = w->io_dirty_from;
+    size_t size = w->io_dirty_until - w->io_dirty_from;
+
+    if (w->io->sync(w, offset, size, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    w->io_dirty_from = 0;
+    w->io_dirty_until = 0;
+    w->io_dirty_bytes = 0;
+    return WSP_OK;
+} // wsp_sync }}}
+
+// wsp_close {{{
+wsp_return_t wsp_close(wsp_t *w, wsp_error_t *e)
+{
+    if (w->rollup != NULL) {
+        free(w->rollup);
+        w->rollup = NULL;
+    }
+
+    free(w->bases);
+    w->bases = NULL;
+    w->bases_valid = 0;
+
+    if (w->header != NULL) {
+        __wsp_header_close(w);
+    }
+    else if (w->archives != NULL) {
+        uint32_t i;
+
+        wsp_metadata_t m = w->meta;
+
+        for (i = 0; i < m.archives_count; i++) {
+            wsp_archive_t *archive = w->archives + i;
+
+            if (__wsp_archive_free(archive, e) == WSP_ERROR) {
+                return WSP_ERROR;
+            }
+        }
+
+        free(w->archives);
+        w->archives = NULL;
+    }
+
+    if (w->io->close(w, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    w->archives = NULL;
+    w->archives_size = 0;
+    w->io_dirty_from = 0;
+    w->io_dirty_until = 0;
+    w->io_dirty_bytes = 0;
+    w->meta.aggregation = 0l;
+    w->meta.max_retention = 0l;
+    w->meta.x_files_factor = 0.0f;
+    w->meta.archives_count = 0l;
+
+    return WSP_OK;
+} // wsp_close }}}
+
+// wsp_rollup_enable {{{
+wsp_return_t wsp_rollup_enable(wsp_t *w, wsp_error_t *e)
+{
+    if (w->archives == NULL) {
+        e->type = WSP_ERROR_NOT_OPEN;
+        return WSP_ERROR;
+    }
+
+    if (w->rollup != NULL) {
+        return WSP_OK;
+    }
+
+    wsp_rollup_t *rollup = malloc(sizeof(wsp_rollup_t) * w->archives_count);
+
+    if (rollup == NULL) {
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    uint32_t i;
+
+    for (i = 0; i < w->archives_count; i++) {
+        WSP_ROLLUP_INIT(rollup + i);
+    }
+
+    w->rollup = rollup;
+    return WSP_OK;
+} // wsp_rollup_enable }}}
+
+// __wsp_bases_stat {{{
+/*
+ * Record the modification time and size of the file the cached base points
+ * are read from.
+ */
+static wsp_return_t __wsp_bases_stat(
+    wsp_t *w,
+    struct timespec *mtime,
+    off_t *size,
+    wsp_error_t *e
+)
+{
+    struct stat st;
+    int fd = w->io_fileno != -1 ? w->io_fileno : fileno(w->io_fd);
+
+    if (fstat(fd, &st) == -1) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    *mtime = st.st_mtim;
+    *size = st.st_size;
+    return WSP_OK;
+} // __wsp_bases_stat }}}
+
+// __wsp_bases_load {{{
+/*
+ * Read the base point of every archive into the cache, in a single vectored
+ * read.
+ */
+static wsp_return_t __wsp_bases_load(
+    wsp_t *w,
+    wsp_error_t *e
+)
+{
+    uint32_t count = w->archives_count;
+
+    w->bases_racy = 0;
+
+    // stat first, a write in between is then noticed by the next check.
+    if (!(w->io_flags & WSP_IO_EXCLUSIVE)) {
+        if (__wsp_bases_stat(w, &w->bases_mtime, &w->bases_size, e) == WSP_ERROR) {
+            return WSP_ERROR;
+        }
+
+        w->bases_racy = w->bases_mtime.tv_sec + 1 >= time(NULL);
+    }
+
+    wsp_point_b *buf = __wsp_scratch_alloc(w, sizeof(wsp_point_b) * count, e);
+
+    if (buf == NULL) {
+        return WSP_ERROR;
+    }
+
+    wsp_iov_t *iov = __wsp_scratch_alloc(w, sizeof(wsp_iov_t) * count, e);
+
+    if (iov == NULL) {
+        __wsp_scratch_free(w, buf);
+        return WSP_ERROR;
+    }
+
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        iov[i].offset = w->archives[i].offset;
+        iov[i].size = sizeof(wsp_point_b);
+        iov[i].buf = buf + i;
+    }
+
+    wsp_return_t result = __wsp_io_readv(w, iov, count, e);
+
+    if (result == WSP_OK) {
+        for (i = 0; i < count; i++) {
+            __wsp_parse_point(buf + i, w->bases + i);
+        }
+
+        w->bases_valid = 1;
+    }
+
+    __wsp_scratch_free(w, iov);
+    __wsp_scratch_free(w, buf);
+    return result;
+} // __wsp_bases_load }}}
+
+// __wsp_bases_check {{{
+/*
+ * Drop the cached base points if the file may have been written by another
+ * process since they were read, called once at the start of every
+ * operation.
+ */
+static wsp_return_t __wsp_bases_check(
+    wsp_t *w,
+    wsp_error_t *e
+)
+{
+    if (!w->bases_valid || (w->io_flags & WSP_IO_EXCLUSIVE)) {
+        return WSP_OK;
+    }
+
+    if (w->bases_racy) {
+        w->bases_valid = 0;
+        return WSP_OK;
+    }
+
+    struct timespec mtime;
+    off_t size;
+
+    if (__wsp_bases_stat(w, &mtime, &size, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    if (mtime.tv_sec != w->bases_mtime.tv_sec
+        || mtime.tv_nsec != w->bases_mtime.tv_nsec
+        || size != w->bases_size
+    ) {
+        w->bases_valid = 0;
+    }
+
+    return WSP_OK;
+} // __wsp_bases_check }}}
+
+// __wsp_bases_written {{{
+/*
+ * Called at the end of every operation that wrote to the file. The writes
+ * kept the cache current, but they also changed the modification time, so
+ * a write by another process in between could not be told apart: only an
+ * exclusive handle keeps the cache. Writes queued on a ring fail after the
+ * operation has returned, so a WSP_URING handle never keeps it.
+ */
+static void __wsp_bases_written(
+    wsp_t *w
+)
+{
+    if (!(w->io_flags & WSP_IO_EXCLUSIVE) || w->io_mapping == WSP_URING) {
+        w->bases_valid = 0;
+    }
+} // __wsp_bases_written }}}
+
+// __wsp_base {{{
+/*
+ * Get the base point of an archive, from the cache when the handle has one.
+ */
+static wsp_return_t __wsp_base(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    wsp_point_t *base,
+    wsp_error_t *e
+)
+{
+    // archives that are not part of the handle are read directly.
+    if (w->bases == NULL || archive < w->archives || archive >= w->archives + w->archives_count) {
+        return wsp_load_point(w, archive, 0, base, e);
+    }
+
+    if (!w->bases_valid && __wsp_bases_load(w, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    *base = w->bases[archive - w->archives];
+    return WSP_OK;
+} // __wsp_base }}}
+
+// wsp_load_all_points {{{
+wsp_return_t wsp_load_all_points(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    wsp_point_t *points,
+    wsp_error_t *e
+)
+{
+    return wsp_load_points(w, archive, 0, archive->count, points, e);
+} // wsp_load_all_points }}}
+
+/*
+ * Build the segments covering count raw points starting at the ring index of
+ * an archive, taking care of any wrap around.
+ *
+ * count must not be larger than the number of points in the archive.
+ *
+ * Returns the number of segments used, at most 2.
+ */
+static uint32_t __wsp_range_iov(
+    wsp_archive_t *archive,
+    uint32_t index,
+    uint32_t count,
+    wsp_point_b *buf,
+    wsp_iov_t *iov
+)
+{
+    uint32_t a_size = archive->count - index;
+
+    if (a_size >= count) {
+        wsp_iov_t a = {
+            .offset = WSP_POINT_OFFSET(archive, index),
+            .size = sizeof(wsp_point_b) * count,
+            .buf = buf
+        };
+
+        iov[0] = a;
+        return 1;
+    }
+
+    // wrap around
+    wsp_iov_t a = {
+        .offset = WSP_POINT_OFFSET(archive, index),
+        .size = sizeof(wsp_point_b) * a_size,
+        .buf = buf
+    };
+
+    wsp_iov_t b = {
+        .offset = archive->offset,
+        .size = sizeof(wsp_point_b) * (count - a_size),
+        .buf = buf + a_size
+    };
+
+    iov[0] = a;
+    iov[1] = b;
+    return 2;
+} // __wsp_range_iov
+
+/*
+ * Parse count raw points that were read into result in place.
+ *
+ * Points whose timestamp does not match the expected timestamp for their slot
+ * (expected, expected + spp, ...) are returned with a NAN value.
+ */
+static void __wsp_range_parse(
+    wsp_archive_t *archive,
+    uint32_t count,
+    wsp_time_t expected,
+    wsp_point_t *result
+)
+{
+    __wsp_parse_points_expected((wsp_point_b *)result, count, expected, archive->spp, result);
+} // __wsp_range_parse
+
+/*
+ * Read count points starting at the ring index of an archive, taking care of
+ * any wrap around.
+ *
+ * Points whose timestamp does not match the expected timestamp for their slot
+ * (expected, expected + spp, ...) are returned with a NAN value.
+ */
+static wsp_return_t __wsp_load_range(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    uint32_t index,
+    uint32_t count,
+    wsp_time_t expected,
+    wsp_point_t *result,
+    wsp_error_t *e
+)
+{
+    if (count > archive->count) {
+        count = archive->count;
+    }
+
+    if (count == 0) {
+        return WSP_OK;
+    }
+
+    wsp_iov_t iov[2];
+
+    // the raw points fit in result, and are parsed in place.
+    uint32_t iov_count = __wsp_range_iov(archive, index, count, (wsp_point_b *)result, iov);
+
+    if (__wsp_io_readv(w, iov, iov_count, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    __wsp_range_parse(archive, count, expected, result);
+    return WSP_OK;
+} // __wsp_load_range
+
+/*
+ * Read count points starting at an offset from the base point of an archive.
+ */
+static wsp_return_t __wsp_load_offset(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    wsp_point_t *base,
+    int offset,
+    uint32_t count,
+    wsp_point_t *result,
+    wsp_error_t *e
+)
+{
+    uint32_t index = __wsp_point_mod(offset, archive->count);
+    wsp_time_t expected = base->timestamp + (archive->spp * offset);
+
+    return __wsp_load_range(w, archive, index, count, expected, result, e);
+} // __wsp_load_offset
+
+wsp_return_t wsp_load_points(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    int offset,
+    uint32_t count,
+    wsp_point_t *result,
+    wsp_error_t *e
+)
+{
+    wsp_point_t base;
+
+    if (__wsp_bases_check(w, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    if (__wsp_base(w, archive, &base, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    return __wsp_load_offset(w, archive, &base, offset, count, result, e);
+} // wsp_load_points
+
+wsp_return_t wsp_load_time_points(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    wsp_time_t time_from,
+    wsp_time_t time_until,
+    wsp_point_t *result,
+    uint32_t *size,
+    wsp_error_t *e
+)
+{
+    wsp_point_t base;
+
+    if (__wsp_bases_check(w, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    if (__wsp_base(w, archive, &base, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    int offset;
+    uint32_t count;
+
+    if (__wsp_time_range(archive, &base, time_from, time_until, &offset, &count, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    if (__wsp_load_offset(w, archive, &base, offset, count, result, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    *size = count;
+
+    return WSP_OK;
+}
+
+wsp_return_t wsp_load_point(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    uint32_t index,
+    wsp_point_t *point,
+    wsp_error_t *e
+)
+{
+    wsp_point_b buf;
+    wsp_point_b *rbuf = &buf;
+
+    size_t read_offset = WSP_POINT_OFFSET(archive, index);
+    size_t read_size = sizeof(wsp_point_b);
+
+    if (w->io->read(w, read_offset, read_size, (void **)&rbuf, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    __wsp_parse_point(rbuf, point);
+
+    return WSP_OK;
+} // wsp_load_point
+
+wsp_return_t wsp_save_point(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    long index,
+    wsp_point_t *point,
+    wsp_error_t *e
+)
+{
+    wsp_point_b buf;
+
+    if (index >= archive->count) {
+        e->type = WSP_ERROR_POINT_OOB;
+        return WSP_ERROR;
+    }
+
+    size_t write_offset = WSP_POINT_OFFSET(archive, index);
+    size_t write_size = sizeof(wsp_point_b);
+
+    __wsp_dump_point(point, &buf);
+
+    if (w->io->write(w, write_offset, write_size, (void *)&buf, e) == WSP_ERROR) {
+        // the write may have partly happened, sync it all the same.
+        w->bases_valid = 0;
+        __wsp_io_dirty(w, write_offset, write_size, &buf);
+        return WSP_ERROR;
+    }
+
+    __wsp_io_dirty(w, write_offset, write_size, &buf);
+    return WSP_OK;
+} // wsp_save_point
+
+static inline uint32_t wsp_point_index(
+    wsp_archive_t *archive,
+    wsp_point_t *base,
+    wsp_time_t floored
+)
+{
+    int distance = (int)(floored - base->timestamp) / (int)archive->spp;
+    return __wsp_point_mod(distance, archive->count);
+}
+
+/*
+ * Write a run of already dumped points to an archive, starting at the ring
+ * index and taking care of any wrap around.
+ */
+static wsp_return_t __wsp_save_run(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    uint32_t index,
+    wsp_point_b *buf,
+    uint32_t count,
+    wsp_error_t *e
+)
+{
+    wsp_iov_t iov[2];
+    uint32_t iov_count = __wsp_range_iov(archive, index, count, buf, iov);
+
+    return __wsp_io_writev(w, iov, iov_count, e);
+} // __wsp_save_run
+
+wsp_return_t __wsp_load_values(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    wsp_point_t *base,
+    wsp_time_t from,
+    uint32_t count,
+    wsp_point_b *buf,
+    double *values,
+    wsp_error_t *e
+)
+{
+    uint32_t i;
+
+    // nothing was ever written to the archive.
+    if (base->timestamp == 0) {
+        for (i = 0; i < count; i++) {
+            values[i] = NAN;
+        }
+
+        return WSP_OK;
+    }
+
+    uint32_t index = wsp_point_index(archive, base, from);
+    wsp_point_b *scratch = NULL;
+
+    // mappings that do not provide their own memory read into scratch memory
+    // rather than allocating for every read.
+    if (buf == NULL && w->io_manual_buf) {
+        scratch = __wsp_scratch_alloc(w, sizeof(wsp_point_b) * count, e);
+
+        if (scratch == NULL) {
+            return WSP_ERROR;
+        }
+
+        buf = scratch;
+    }
+
+    // at most two segments, the second one after the wrap around.
+    while (count > 0) {
+        uint32_t size = archive->count - index;
+
+        if (size > count) {
+            size = count;
+        }
+
+        wsp_point_b *raw = buf;
+
+        if (w->io->read(w, WSP_POINT_OFFSET(archive, index), sizeof(wsp_point_b) * size, (void **)&raw, e) == WSP_ERROR) {
+            __wsp_scratch_free(w, scratch);
+            return WSP_ERROR;
+        }
+
+        __wsp_parse_columns(raw, size, from, archive->spp, NULL, values);
+
+        if (w->io_manual_buf && raw != buf) {
+            free(raw);
+        }
+
+        from += size * archive->spp;
+        values += size;
+        count -= size;
+        index = 0;
+    }
+
+    __wsp_scratch_free(w, scratch);
+    return WSP_OK;
+} // __wsp_load_values
+
+/*
+ * Fill the bitmap of known values of a series, if it has one.
+ */
+static void __wsp_series_valid(
+    wsp_series_t *series
+)
+{
+    if (series->valid == NULL) {
+        return;
+    }
+
+    uint32_t i;
+
+    memset(series->valid, 0, (series->count + 7) / 8);
+
+    for (i = 0; i < series->count; i++) {
+        if (!isnan(series->values[i])) {
+            series->valid[i / 8] |= 1 << (i % 8);
+        }
+    }
+}
+
+/*
+ * Load count values starting at an offset from the base point of an archive.
+ */
+static wsp_return_t __wsp_load_series(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    wsp_point_t *base,
+    int offset,
+    uint32_t count,
+    wsp_series_t *series,
+    wsp_error_t *e
+)
+{
+    if (count > archive->count) {
+        count = archive->count;
+    }
+
+    series->start = base->timestamp + archive->spp * offset;
+    series->step = archive->spp;
+    series->count = count;
+
+    // raw points are read where the mapping has them, or into temporary
+    // memory, the values have no room for them.
+    if (__wsp_load_values(w, archive, base, series->start, count, NULL, series->values, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    __wsp_series_valid(series);
+    return WSP_OK;
+} // __wsp_load_series
+
+wsp_return_t wsp_load_series(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    int offset,
+    uint32_t count,
+    wsp_series_t *series,
+    wsp_error_t *e
+)
+{
+    wsp_point_t base;
+
+    if (__wsp_bases_check(w, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    if (__wsp_base(w, archive, &base, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    return __wsp_load_series(w, archive, &base, offset, count, series, e);
+} // wsp_load_series
+
+wsp_return_t wsp_load_time_series(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    wsp_time_t time_from,
+    wsp_time_t time_until,
+    wsp_series_t *series,
+    wsp_error_t *e
+)
+{
+    wsp_point_t base;
+
+    if (__wsp_bases_check(w, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    if (__wsp_base(w, archive, &base, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    int offset;
+    uint32_t count;
+
+    if (__wsp_time_range(archive, &base, time_from, time_until, &offset, &count, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    return __wsp_load_series(w, archive, &base, offset, count, series, e);
+} // wsp_load_time_series
+
+// wsp_fetch {{{
+wsp_return_t wsp_fetch(
+    wsp_t *w,
+    wsp_time_t from,
+    wsp_time_t until,
+    wsp_time_t now,
+    wsp_series_t *series,
+    wsp_error_t *e
+)
+{
+    if (from > until) {
+        e->type = WSP_ERROR_TIME_INTERVAL;
+        return WSP_ERROR;
+    }
+
+    if (w->archives_count == 0) {
+        e->type = WSP_ERROR_ARCHIVE;
+        return WSP_ERROR;
+    }
+
+    if (now == 0) {
+        now = wsp_time_now();
+    }
+
+    series->start = 0;
+    series->step = 0;
+    series->count = 0;
+
+    int64_t oldest = (int64_t)now - w->meta.max_retention;
+
+    if (from > now || until < oldest) {
+        return WSP_OK;
+    }
+
+    if (from < oldest) {
+        from = (wsp_time_t)oldest;
+    }
+
+    if (until > now) {
+        until = now;
+    }
+
+    wsp_archive_t *archive = NULL;
+    uint32_t i;
+
+    // the most precise archive covering the range, or the last one.
+    for (i = 0; i < w->archives_count; i++) {
+        archive = w->archives + i;
+
+        if (archive->retention >= now - from) {
+            break;
+        }
+    }
+
+    uint32_t spp = archive->spp;
+    wsp_time_t from_interval = wsp_time_floor(from, spp) + spp;
+    wsp_time_t until_interval = wsp_time_floor(until, spp) + spp;
+
+    if (from_interval == until_interval) {
+        until_interval += spp;
+    }
+
+    wsp_point_t base;
+
+    if (__wsp_bases_check(w, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    if (__wsp_base(w, archive, &base, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    // the range is within the retention of the archive, so it never has more
+    // than archive->count points.
+    series->start = from_interval;
+    series->step = spp;
+    series->count = (until_interval - from_interval) / spp;
+
+    if (series->count > archive->count) {
+        series->count = archive->count;
+    }
+
+    if (__wsp_load_values(w, archive, &base, series->start, series->count, NULL, series->values, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    __wsp_series_valid(series);
+    return WSP_OK;
+} // wsp_fetch }}}
+
+/*
+ * Write a single point to an archive, see wsp_update_point.
+ */
+static wsp_return_t __wsp_update_point(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    wsp_time_t time,
+    double value,
+    wsp_point_t *base,
+    wsp_error_t *e
+)
+{
+    wsp_point_t base_point;
+    WSP_POINT_INIT(&base_point);
+
+    if (__wsp_base(w, archive, &base_point, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    uint32_t write_index = 0;
+
+    wsp_time_t floored = wsp_time_floor(time, archive->spp);
+
+    wsp_point_t p = { .timestamp = floored, .value = value };
+
+    /* this not is the first point being written */
+    if (base_point.timestamp != 0) {
+        write_index = wsp_point_index(archive, &base_point, floored);
+    }
+    else {
+        base_point = p;
+    }
+
+    if (wsp_save_point(w, archive, write_index, &p, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    *base = base_point;
+
+    return WSP_OK;
+} // __wsp_update_point
+
+wsp_return_t wsp_update_point(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    wsp_time_t time,
+    double value,
+    wsp_point_t *base,
+    wsp_error_t *e
+)
+{
+    if (__wsp_bases_check(w, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    wsp_return_t result = __wsp_update_point(w, archive, time, value, base, e);
+
+    __wsp_bases_written(w);
+    return result;
+} // wsp_update_point
+
+
+/*
+ * Rebuild the running aggregate of an interval from the points of the higher
+ * archive window.
+ */
+static void __wsp_rollup_load(
+    wsp_rollup_t *state,
+    wsp_time_t interval,
+    wsp_point_t *points,
+    uint32_t count
+)
+{
+    __wsp_summarize(points, count, state);
+    state->interval = interval;
+} // __wsp_rollup_load
+
+/*
+ * Fold a point written to the higher archive into the running aggregate of
+ * the interval containing it.
+ *
+ * Returns 1 if the state is current, or 0 if it has to be reloaded from the
+ * higher archive.
+ */
+static int __wsp_rollup_fold(
+    wsp_t *w,
+    wsp_rollup_t *state,
+    wsp_time_t interval,
+    wsp_time_t timestamp,
+    double value
+)
+{
+    if (state->interval == 0 || state->interval != interval || isnan(value)) {
+        return 0;
+    }
+
+    // a new point in this interval.
+    if (state->known == 0 || timestamp > state->last_timestamp) {
+        if (state->known == 0 || value < state->min) {
+            state->min = value;
+        }
+
+        if (state->known == 0 || value > state->max) {
+            state->max = value;
+        }
+
+        state->sum += value;
+        state->last = value;
+        state->last_timestamp = timestamp;
+        state->known++;
+        return 1;
+    }
+
+    // anything but replacing the most recent point requires a reload.
+    if (timestamp != state->last_timestamp) {
+        return 0;
+    }
+
+    switch (w->meta.aggregation) {
+    case WSP_MAX:
+        if (value < state->last) {
+            return 0;
+        }
+
+        if (value > state->max) {
+            state->max = value;
+        }
+
+        break;
+    case WSP_MIN:
+        if (value > state->last) {
+            return 0;
+        }
+
+        if (value < state->min) {
+            state->min = value;
+        }
+
+        break;
+    default:
+        break;
+    }
+
+    state->sum += value - state->last;
+    state->last = value;
+    return 1;
+} // __wsp_rollup_fold
+
+/*
+ * Calculate the aggregated value of a running aggregate.
+ *
+ * Returns 1 if there are enough known points to propagate the value.
+ */
+static int __wsp_rollup_value(
+    wsp_t *w,
+    wsp_rollup_t *state,
+    uint32_t count,
+    double *value
+)
+{
+    if (state->known == 0) {
+        return 0;
+    }
+
+    if ((float)state->known / (float)count < w->meta.x_files_factor) {
+        return 0;
+    }
+
+    switch (w->meta.aggregation) {
+    case WSP_AVERAGE:
+        *value = state->sum / state->known;
+        break;
+    case WSP_SUM:
+        *value = state->sum;
+        break;
+    case WSP_LAST:
+        *value = state->last;
+        break;
+    case WSP_MAX:
+        *value = state->max;
+        break;
+    case WSP_MIN:
+        *value = state->min;
+        break;
+    }
+
+    return 1;
+} // __wsp_rollup_value
+
+/*
+ * Propagate the interval of the lower archive which contains timestamp by
+ * aggregating the corresponding points of the higher archive.
+ *
+ * If the running aggregate cache is enabled, it is reloaded for the
+ * propagated interval.
+ *
+ * w: Whisper database.
+ * higher: Archive to aggregate points from.
+ * lower: Archive to write the aggregated value to.
+ * timestamp: Timestamp covered by the interval to propagate.
+ * value: Where to store the value written to the lower archive.
+ * propagated: Will be set to 1 if a value was written, or 0 if there were not
+ * enough known points and propagation should stop.
+ * e: Error object.
+ */
+static wsp_return_t __wsp_propagate(
+    wsp_t *w,
+    wsp_archive_t *higher,
+    wsp_archive_t *lower,
+    wsp_time_t timestamp,
+    double *value,
+    int *propagated,
+    wsp_error_t *e
+)
+{
+    wsp_point_t base;
+
+    *propagated = 0;
+
+    if (__wsp_base(w, higher, &base, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    wsp_time_t interval = wsp_time_floor(timestamp, lower->spp);
+    uint32_t index = 0;
+
+    if (base.timestamp != 0) {
+        index = wsp_point_index(higher, &base, interval);
+    }
+
+    uint32_t count = lower->spp / higher->spp;
+
+    wsp_point_t *points = __wsp_scratch_alloc(w, sizeof(wsp_point_t) * count, e);
+
+    if (points == NULL) {
+        return WSP_ERROR;
+    }
+
+    if (__wsp_load_range(w, higher, index, count, interval, points, e) == WSP_ERROR) {
+        __wsp_scratch_free(w, points);
+        return WSP_ERROR;
+    }
+
+    int skip = 0;
+
+    if (w->rollup != NULL) {
+        wsp_rollup_t *state = w->rollup + (lower - w->archives);
+
+        __wsp_rollup_load(state, interval, points, count);
+        skip = !__wsp_rollup_value(w, state, count, value);
+    }
+    else if (w->meta.aggregate(w, points, count, value, &skip, e) == WSP_ERROR) {
+        __wsp_scratch_free(w, points);
+        return WSP_ERROR;
+    }
+
+    __wsp_scratch_free(w, points);
+
+    if (skip) {
+        return WSP_OK;
+    }
+
+    wsp_point_t lower_base;
+
+    if (__wsp_update_point(w, lower, interval, *value, &lower_base, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    *propagated = 1;
+    return WSP_OK;
+} // __wsp_propagate
+
+/*
+ * Propagate a point that was just written to the higher archive using the
+ * running aggregate of the lower archive interval, reloading it from the
+ * higher archive only if it can not be updated in place.
+ *
+ * w: Whisper database.
+ * higher: Archive the point was written to.
+ * lower: Archive to write the aggregated value to.
+ * timestamp: Interval of the point written to the higher archive.
+ * value: Value written to the higher archive, will be replaced with the value
+ * written to the lower archive.
+ * propagated: Will be set to 1 if a value was written, or 0 if there were not
+ * enough known points and propagation should stop.
+ * e: Error object.
+ */
+static wsp_return_t __wsp_rollup_propagate(
+    wsp_t *w,
+    wsp_archive_t *higher,
+    wsp_archive_t *lower,
+    wsp_time_t timestamp,
+    double *value,
+    int *propagated,
+    wsp_error_t *e
+)
+{
+    wsp_rollup_t *state = w->rollup + (lower - w->archives);
+    wsp_time_t interval = wsp_time_floor(timestamp, lower->spp);
+
+    if (!__wsp_rollup_fold(w, state, interval, timestamp, *value)) {
+        return __wsp_propagate(w, higher, lower, timestamp, value, propagated, e);
+    }
+
+    *propagated = 0;
+
+    if (!__wsp_rollup_value(w, state, lower->spp / higher->spp, value)) {
+        return WSP_OK;
+    }
+
+    wsp_point_t lower_base;
+
+    if (__wsp_update_point(w, lower, interval, *value, &lower_base, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    *propagated = 1;
+    return WSP_OK;
+} // __wsp_rollup_propagate
+
+/*
+ * State of every archive of a vectored update.
+ */
+typedef struct {
+    // the raw point written.
+    wsp_point_b buf;
+    // the point written to the archive, its ring index and the base of the
+    // archive after it has been written.
+    wsp_point_t point;
+    uint32_t index;
+    wsp_point_t base;
+    // size of the propagation window read from the archive before.
+    uint32_t count;
+} wsp_update_level_t;
+
+/*
+ * Vectored update using caller provided state, see __wsp_update_vectored.
+ * The windows are stored in windows_p, to be freed by the caller.
+ */
+static wsp_return_t __wsp_update_levels(
+    wsp_t *w,
+    wsp_archive_t *low,
+    uint32_t low_size,
+    wsp_time_t timestamp,
+    double value,
+    wsp_update_level_t *levels,
+    wsp_iov_t *iov,
+    wsp_point_t **windows_p,
+    wsp_error_t *e
+)
+{
+    uint32_t i;
+
+    for (i = 0; i < low_size; i++) {
+        wsp_update_level_t *level = levels + i;
+
+        level->point.timestamp = wsp_time_floor(timestamp, low[i].spp);
+        level->point.value = value;
+
+        if (__wsp_base(w, low + i, &level->base, e) == WSP_ERROR) {
+            return WSP_ERROR;
+        }
+
+        /* this not is the first point being written */
+        if (level->base.timestamp != 0) {
+            level->index = wsp_point_index(low + i, &level->base, level->point.timestamp);
+        }
+        else {
+            level->base = level->point;
+            level->index = 0;
+        }
+    }
+
+    uint32_t total = 0;
+
+    levels[0].count = 0;
+
+    for (i = 1; i < low_size; i++) {
+        levels[i].count = low[i].spp / low[i - 1].spp;
+
+        if (levels[i].count > low[i - 1].count) {
+            levels[i].count = low[i - 1].count;
+        }
+
+        total += levels[i].count;
+    }
+
+    wsp_point_t *windows = NULL;
+
+    if (total > 0) {
+        windows = __wsp_scratch_alloc(w, sizeof(wsp_point_t) * total, e);
+
+        if (windows == NULL) {
+            return WSP_ERROR;
+        }
+
+        *windows_p = windows;
+    }
+
+    uint32_t iov_count = 0;
+    wsp_point_t *window = windows;
+
+    for (i = 1; i < low_size; i++) {
+        wsp_archive_t *higher = low + i - 1;
+
+        if (levels[i].count > 0) {
+            uint32_t start = wsp_point_index(higher, &levels[i - 1].base, levels[i].point.timestamp);
+            iov_count += __wsp_range_iov(higher, start, levels[i].count, (wsp_point_b *)window, iov + iov_count);
+        }
+
+        window += levels[i].count;
+    }
+
+    if (__wsp_io_readv(w, iov, iov_count, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    uint32_t written = 1;
+
+    window = windows;
+
+    for (i = 1; i < low_size; i++) {
+        wsp_archive_t *higher = low + i - 1;
+
+        wsp_update_level_t *level = levels + i;
+
+        __wsp_range_parse(higher, level->count, level->point.timestamp, window);
+
+        uint32_t j = (levels[i - 1].point.timestamp - level->point.timestamp) / higher->spp;
+
+        if (j < level->count) {
+            window[j] = levels[i - 1].point;
+        }
+
+        int skip = 0;
+
+        if (w->meta.aggregate(w, window, level->count, &level->point.value, &skip, e) == WSP_ERROR) {
             return WSP_ERROR;
         }
 
@@ -418,12 +1863,328 @@ wsp_return_t wsp_update(wsp_t *w, wsp_point_t *p, wsp_error_t *e)
             break;
         }
 
-        if (wsp_update_point(w, cur, timestamp, value, &prev_base, e) == WSP_ERROR) {
+        window += level->count;
+        written++;
+    }
+
+    for (i = 0; i < written; i++) {
+        wsp_iov_t segment = {
+            .offset = WSP_POINT_OFFSET(low + i, levels[i].index),
+            .size = sizeof(wsp_point_b),
+            .buf = &levels[i].buf
+        };
+
+        __wsp_dump_point(&levels[i].point, &levels[i].buf);
+        iov[i] = segment;
+    }
+
+    return __wsp_io_writev(w, iov, written, e);
+} // __wsp_update_levels
+
+/*
+ * Write a point to the first of a sequence of archives and propagate it to
+ * the rest, without using the running aggregate cache.
+ *
+ * Instead of reading and writing every archive in turn, the propagation
+ * windows of all lower archives are read with one vectored read, and every
+ * point is written with a single vectored write. Since windows are read
+ * before anything is written, the point written to the higher archive is
+ * patched into each window.
+ *
+ * w: Whisper database.
+ * low: First archive, the point is written to.
+ * low_size: Number of archives, starting at low.
+ * timestamp: Timestamp of the point.
+ * value: Value of the point.
+ * e: Error object.
+ */
+static wsp_return_t __wsp_update_vectored(
+    wsp_t *w,
+    wsp_archive_t *low,
+    uint32_t low_size,
+    wsp_time_t timestamp,
+    double value,
+    wsp_error_t *e
+)
+{
+    wsp_update_level_t *levels = __wsp_scratch_alloc(w, sizeof(wsp_update_level_t) * low_size, e);
+
+    if (levels == NULL) {
+        return WSP_ERROR;
+    }
+
+    wsp_iov_t *iov = __wsp_scratch_alloc(w, sizeof(wsp_iov_t) * low_size * 2, e);
+
+    if (iov == NULL) {
+        __wsp_scratch_free(w, levels);
+        return WSP_ERROR;
+    }
+
+    wsp_point_t *windows = NULL;
+    wsp_return_t result = __wsp_update_levels(w, low, low_size, timestamp, value, levels, iov, &windows, e);
+
+    __wsp_scratch_free(w, windows);
+    __wsp_scratch_free(w, iov);
+    __wsp_scratch_free(w, levels);
+    return result;
+} // __wsp_update_vectored
+
+/*
+ * Write a point to the archives covering it, see wsp_update.
+ */
+static wsp_return_t __wsp_update(wsp_t *w, wsp_point_t *p, wsp_error_t *e)
+{
+    wsp_time_t now = wsp_time_now();
+
+    wsp_time_t timestamp = p->timestamp;
+    double value = p->value;
+
+    if (timestamp == 0) {
+        timestamp = now;
+    }
+
+    if (timestamp > now) {
+        e->type = WSP_ERROR_FUTURE_TIMESTAMP;
+        return WSP_ERROR;
+    }
+
+    wsp_time_t diff = now - timestamp;
+
+    wsp_archive_t *low = NULL;
+    uint32_t low_size = 0;
+
+    if (__wsp_find_highest_precision(diff, w, &low, &low_size, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    if (w->rollup == NULL) {
+        return __wsp_update_vectored(w, low, low_size, timestamp, value, e);
+    }
+
+    wsp_point_t base;
+
+    if (__wsp_update_point(w, low, timestamp, value, &base, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    uint32_t i = 0;
+
+    wsp_time_t written = wsp_time_floor(timestamp, low->spp);
+
+    // Propagate changes to lower precision archive.
+    for (i = 1; i < low_size; i++) {
+        wsp_archive_t *cur = low + i;
+        int propagated = 0;
+
+        if (__wsp_rollup_propagate(w, cur - 1, cur, written, &value, &propagated, e) == WSP_ERROR) {
             return WSP_ERROR;
         }
 
-        prev = cur;
+        if (!propagated) {
+            break;
+        }
+
+        written = wsp_time_floor(timestamp, cur->spp);
     }
 
     return WSP_OK;
+} // __wsp_update
+
+wsp_return_t wsp_update(wsp_t *w, wsp_point_t *p, wsp_error_t *e)
+{
+    if (__wsp_bases_check(w, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    wsp_return_t result = __wsp_update(w, p, e);
+
+    __wsp_bases_written(w);
+    return result;
 } // wsp_update
+
+/*
+ * Write a batch of points, sorted by timestamp, to a single archive and
+ * propagate every distinct interval of the lower archives once.
+ *
+ * Points sharing the same interval are reduced to the last one, and every
+ * contiguous run of intervals is written using a single (wrap-aware) write.
+ */
+wsp_return_t __wsp_archive_update_many(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    wsp_point_t *points,
+    uint32_t count,
+    wsp_error_t *e
+)
+{
+    wsp_point_t base;
+
+    if (__wsp_base(w, archive, &base, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    wsp_point_b *buf = __wsp_scratch_alloc(w, sizeof(wsp_point_b) * count, e);
+
+    if (buf == NULL) {
+        return WSP_ERROR;
+    }
+
+    uint32_t i = 0;
+
+    while (i < count) {
+        wsp_time_t start = wsp_time_floor(points[i].timestamp, archive->spp);
+        wsp_time_t last = start;
+        uint32_t size = 0;
+
+        for (; i < count; i++) {
+            wsp_point_t p = {
+                .timestamp = wsp_time_floor(points[i].timestamp, archive->spp),
+                .value = points[i].value
+            };
+
+            // take the last value of duplicate intervals.
+            if (size > 0 && p.timestamp == last) {
+                __wsp_dump_point(&p, buf + size - 1);
+                continue;
+            }
+
+            if (size > 0 && p.timestamp != last + archive->spp) {
+                break;
+            }
+
+            __wsp_dump_point(&p, buf + size);
+            last = p.timestamp;
+            size++;
+        }
+
+        wsp_point_b *run = buf;
+
+        // only the most recent points of a run can fit in the archive.
+        if (size > archive->count) {
+            run += size - archive->count;
+            start += (size - archive->count) * archive->spp;
+            size = archive->count;
+        }
+
+        // this file's first update, use the first run as base.
+        if (base.timestamp == 0) {
+            base.timestamp = start;
+        }
+
+        uint32_t index = wsp_point_index(archive, &base, start);
+
+        if (__wsp_save_run(w, archive, index, run, size, e) == WSP_ERROR) {
+            __wsp_scratch_free(w, buf);
+            return WSP_ERROR;
+        }
+    }
+
+    __wsp_scratch_free(w, buf);
+
+    wsp_archive_t *higher = archive;
+    wsp_archive_t *lower = NULL;
+    wsp_archive_t *end = w->archives + w->archives_count;
+
+    // Propagate every distinct interval of the lower precision archives.
+    for (lower = archive + 1; lower < end; lower++) {
+        int further = 0;
+        wsp_time_t last = 0;
+
+        for (i = 0; i < count; i++) {
+            wsp_time_t interval = wsp_time_floor(points[i].timestamp, lower->spp);
+
+            // points are sorted, so duplicate intervals are adjacent.
+            if (i > 0 && interval == last) {
+                continue;
+            }
+
+            last = interval;
+
+            int propagated = 0;
+            double value = 0;
+
+            if (__wsp_propagate(w, higher, lower, interval, &value, &propagated, e) == WSP_ERROR) {
+                return WSP_ERROR;
+            }
+
+            further |= propagated;
+        }
+
+        if (!further) {
+            break;
+        }
+
+        higher = lower;
+    }
+
+    return WSP_OK;
+} // __wsp_archive_update_many
+
+wsp_return_t wsp_update_many(
+    wsp_t *w,
+    wsp_point_t *points,
+    uint32_t count,
+    wsp_error_t *e
+)
+{
+    if (count == 0) {
+        return WSP_OK;
+    }
+
+    wsp_time_t now = wsp_time_now();
+
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        if (points[i].timestamp == 0) {
+            points[i].timestamp = now;
+        }
+    }
+
+    if (__wsp_sort_points(w, points, count, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    // points [0, end) have not been assigned to an archive yet, the most
+    // recent ones go to the highest precision archive that covers them.
+    uint32_t end = count;
+
+    // like whisper.py, points in the future do not fail the batch, they are
+    // dropped.
+    while (end > 0 && points[end - 1].timestamp > now) {
+        end--;
+    }
+
+    if (end == 0) {
+        return WSP_OK;
+    }
+
+    if (__wsp_bases_check(w, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    for (i = 0; i < w->archives_count && end > 0; i++) {
+        wsp_archive_t *archive = w->archives + i;
+        uint32_t start = end;
+
+        while (start > 0 && now - points[start - 1].timestamp <= archive->retention) {
+            start--;
+        }
+
+        if (start == end) {
+            continue;
+        }
+
+        if (__wsp_archive_update_many(w, archive, points + start, end - start, e) == WSP_ERROR) {
+            __wsp_bases_written(w);
+            return WSP_ERROR;
+        }
+
+        end = start;
+    }
+
+    // any remaining points are not covered by the database and are dropped.
+
+    __wsp_bases_written(w);
+    return WSP_OK;
+} // wsp_update_many
@@ -39,6 +39,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include "wsp_time.h"
 
@@ -50,6 +51,12 @@ struct wsp_archive_b;
 struct wsp_archive_t;
 struct wsp_metadata_b;
 struct wsp_metadata_t;
+struct wsp_rollup_t;
+struct wsp_uring_t;
+struct wsp_header_t;
+struct wsp_iov_t;
+struct wsp_series_t;
+struct wsp_arena_t;
 
 typedef enum {
     WSP_ERROR = -1,
@@ -59,9 +66,43 @@ typedef enum {
 typedef enum {
     WSP_MAPPING_NONE = 0,
     WSP_FILE = 1,
-    WSP_MMAP = 2
+    WSP_MMAP = 2,
+    WSP_URING = 3,
+    WSP_PREAD = 4
 } wsp_mapping_t;
 
+/*
+ * Hints about how a database will be accessed, see io_flags.
+ */
+typedef enum {
+    WSP_IO_DEFAULT = 0,
+    // single points at random offsets, disables readahead (writers).
+    WSP_IO_RANDOM = 1 << 0,
+    // whole archives in order, enables aggressive readahead (scans).
+    WSP_IO_SEQUENTIAL = 1 << 1,
+    // start reading the whole file in the background.
+    WSP_IO_WILLNEED = 1 << 2,
+    // fault in the whole mapping when opening, WSP_MMAP only.
+    WSP_IO_POPULATE = 1 << 3,
+    // back large mappings with transparent huge pages, WSP_MMAP only.
+    WSP_IO_HUGEPAGE = 1 << 4,
+    // the handle is the only writer of the database, cached base points are
+    // never checked against the file.
+    WSP_IO_EXCLUSIVE = 1 << 5
+} wsp_io_flags_t;
+
+/*
+ * How wsp_create allocates the space of the archives.
+ */
+typedef enum {
+    // write zeros, like whisper.py create.
+    WSP_CREATE_ZERO = 0,
+    // only extend the file, leaving a hole.
+    WSP_CREATE_SPARSE = 1,
+    // allocate blocks without writing them (posix_fallocate).
+    WSP_CREATE_FALLOCATE = 2
+} wsp_create_mode_t;
+
 typedef enum {
     WSP_ERROR_NONE = 0,
     WSP_ERROR_NOT_INITIALIZED = 1,
@@ -78,7 +119,13 @@ typedef enum {
     WSP_ERROR_UNKNOWN_AGGREGATION = 12,
     WSP_ERROR_ARCHIVE_MISALIGNED = 13,
     WSP_ERROR_TIME_INTERVAL = 14,
-    WSP_ERROR_SIZE = 15
+    WSP_ERROR_CACHE_FULL = 15,
+    WSP_ERROR_THREAD = 16,
+    WSP_ERROR_INVALID = 17,
+    WSP_ERROR_NOT_MAPPED = 18,
+    WSP_ERROR_POOL_FULL = 19,
+    WSP_ERROR_ARCHIVE_CONFIG = 20,
+    WSP_ERROR_SIZE = 21
 } wsp_errornum_t;
 
 typedef enum {
@@ -97,6 +144,12 @@ typedef struct wsp_archive_b wsp_archive_b;
 typedef struct wsp_archive_t wsp_archive_t;
 typedef struct wsp_metadata_b wsp_metadata_b;
 typedef struct wsp_metadata_t wsp_metadata_t;
+typedef struct wsp_rollup_t wsp_rollup_t;
+typedef struct wsp_uring_t wsp_uring_t;
+typedef struct wsp_header_t wsp_header_t;
+typedef struct wsp_iov_t wsp_iov_t;
+typedef struct wsp_series_t wsp_series_t;
+typedef struct wsp_arena_t wsp_arena_t;
 
 const char *wsp_strerror(wsp_error_t *);
 
@@ -146,6 +199,66 @@ typedef wsp_return_t(*wsp_io_write_f)(
     wsp_error_t *e
 );
 
+/**
+ * A single segment of a vectored read or write.
+ */
+struct wsp_iov_t {
+    // offset in the database.
+    long offset;
+    // size of the segment.
+    size_t size;
+    // buffer to read into or write from.
+    void *buf;
+};
+
+/**
+ * I/O mapping vectored reader function.
+ *
+ * Unlike wsp_io_read_f, always reads into the buffers of the segments.
+ *
+ * w: Whisper database.
+ * iov: Segments to read.
+ * count: Number of segments.
+ * e: Error object.
+ */
+typedef wsp_return_t(*wsp_io_readv_f)(
+    wsp_t *w,
+    wsp_iov_t *iov,
+    uint32_t count,
+    wsp_error_t *e
+);
+
+/**
+ * I/O mapping vectored writer function.
+ *
+ * w: Whisper database.
+ * iov: Segments to write, in order.
+ * count: Number of segments.
+ * e: Error object.
+ */
+typedef wsp_return_t(*wsp_io_writev_f)(
+    wsp_t *w,
+    wsp_iov_t *iov,
+    uint32_t count,
+    wsp_error_t *e
+);
+
+/**
+ * I/O mapping sync function, makes a range of the database that has been
+ * written durable.
+ *
+ * w: Whisper database.
+ * offset: Offset of the range.
+ * size: Size of the range.
+ * e: Error object.
+ */
+typedef wsp_return_t(*wsp_io_sync_f)(
+    wsp_t *w,
+    long offset,
+    size_t size,
+    wsp_error_t *e
+);
+
 /**
  * I/O mapping open function.
  *
@@ -216,11 +329,47 @@ struct wsp_metadata_t {
     (m)->aggregate = NULL;\
 } while(0)
 
+/**
+ * Running aggregate of the current interval of a lower precision archive.
+ *
+ * Only known (non-NAN) points of the higher precision archive are folded into
+ * the state.
+ */
+struct wsp_rollup_t {
+    // start of the interval, 0 if the state is cold.
+    wsp_time_t interval;
+    // timestamp of the most recent known point.
+    wsp_time_t last_timestamp;
+    // number of known points.
+    uint32_t known;
+    double sum;
+    double min;
+    double max;
+    // value of the most recent known point.
+    double last;
+};
+
+#define WSP_ROLLUP_INIT(r) do {\
+    (r)->interval = 0;\
+    (r)->last_timestamp = 0;\
+    (r)->known = 0;\
+    (r)->sum = 0;\
+    (r)->min = 0;\
+    (r)->max = 0;\
+    (r)->last = 0;\
+} while(0)
+
 typedef struct {
     wsp_io_open_f open;
     wsp_io_close_f close;
     wsp_io_read_f read;
     wsp_io_write_f write;
+    // optional vectored operations, mappings which do not implement them
+    // fall back to one read or write per segment.
+    wsp_io_readv_f readv;
+    wsp_io_writev_f writev;
+    // makes written ranges durable, see wsp_sync.
+    wsp_io_sync_f sync;
 } wsp_io;
 
 struct wsp_t {
@@ -228,6 +377,8 @@ struct wsp_t {
     wsp_metadata_t meta;
     // file descriptor (as returned by fopen)
     FILE *io_fd;
+    // file descriptor (as returned by open), -1 if not used by the mapping.
+    int io_fileno;
     // mapped memory of file.
     void *io_mmap;
     // size of the file, for later munmap call.
@@ -239,36 +390,157 @@ struct wsp_t {
     int io_manual_buf;
     // io functions.
     wsp_io *io;
+    // ring used by WSP_URING mappings, must be set prior to wsp_open.
+    wsp_uring_t *io_uring;
+    // access hints (wsp_io_flags_t), must be set prior to wsp_open.
+    int io_flags;
+    // range of the file written since the last wsp_sync, empty if from and
+    // until are equal, and the number of bytes written to it.
+    long io_dirty_from;
+    long io_dirty_until;
+    uint64_t io_dirty_bytes;
     // archives
     // these are empty (NULL) until wsp_load_archives has been called.
     wsp_archive_t *archives;
+    // cached header the archives belong to, NULL if they are owned by the
+    // handle (see wsp_header.h).
+    wsp_header_t *header;
     // Size in bytes of the archive block in the database.
     size_t archives_size;
     // Real archive count that has *actually* been loaded.
     // This might differ from metadata if laoding fails.
     uint32_t archives_count;
+    // running aggregates, one for each archive, indexed by the lower
+    // archive of a propagation.
+    // NULL unless wsp_rollup_enable has been called.
+    wsp_rollup_t *rollup;
+    // scratch memory for reads and updates, NULL to use the arena of the
+    // calling thread (see wsp_arena.h).
+    wsp_arena_t *arena;
+    // base point of every archive, read once and kept current by the writes
+    // of this handle. NULL with WSP_MMAP, where reading them is free.
+    wsp_point_t *bases;
+    // whether bases are current, and the modification time and size of the
+    // file when they were read, to notice writes by other processes.
+    int bases_valid;
+    struct timespec bases_mtime;
+    off_t bases_size;
+    // the file was modified just before bases were read, so a later write
+    // may not change the modification time, bases are only used for the
+    // current operation.
+    int bases_racy;
 };
 
 #define WSP_INIT(w) do {\
     (w)->io_fd = NULL;\
+    (w)->io_fileno = -1;\
     (w)->io_mmap = NULL;\
     (w)->io_size = 0;\
     (w)->io_mapping = 0;\
     (w)->io_manual_buf = 0;\
     (w)->io = NULL;\
+    (w)->io_uring = NULL;\
+    (w)->io_flags = WSP_IO_DEFAULT;\
+    (w)->io_dirty_from = 0;\
+    (w)->io_dirty_until = 0;\
+    (w)->io_dirty_bytes = 0;\
     (w)->archives = NULL;\
+    (w)->header = NULL;\
     (w)->archives_size = 0;\
     (w)->archives_count = 0;\
+    (w)->rollup = NULL;\
+    (w)->arena = NULL;\
+    (w)->bases = NULL;\
+    (w)->bases_valid = 0;\
+    (w)->bases_mtime.tv_sec = 0;\
+    (w)->bases_mtime.tv_nsec = 0;\
+    (w)->bases_size = 0;\
+    (w)->bases_racy = 0;\
 } while(0)
 
+/**
+ * Validate a list of archives like whisper.py validateArchiveList: there is
+ * at least one archive, and sorted by precision, every archive has a
+ * precision that divides the precision of the next one, covers a shorter
+ * time interval and has enough points to consolidate into it.
+ *
+ * archives: Archives to validate, only spp and count are used.
+ * count: Number of archives.
+ * e: Error object.
+ */
+wsp_return_t wsp_validate_archives(
+    wsp_archive_t *archives,
+    uint32_t count,
+    wsp_error_t *e
+);
+
+/**
+ * Create a new whisper database, failing if path already exists.
+ *
+ * The header is written with a single system call, and if the database
+ * cannot be completed, the partial file is removed.
+ *
+ * path: Path of the new database.
+ * archives: Archives of the database, in any order, only spp and count are
+ * used.
+ * count: Number of archives.
+ * x_files_factor: Fraction of known points needed to propagate.
+ * aggregation: Aggregation method used when propagating.
+ * mode: How to allocate the space of the archives.
+ * e: Error object.
+ */
+wsp_return_t wsp_create(
+    const char *path,
+    wsp_archive_t *archives,
+    uint32_t count,
+    float x_files_factor,
+    wsp_aggregation_t aggregation,
+    wsp_create_mode_t mode,
+    wsp_error_t *e
+);
+
+/**
+ * Create a new whisper database as a copy of a template, failing if path
+ * already exists.
+ *
+ * The template should be a database created by wsp_create for the schema,
+ * and never updated. On Linux the copy shares the blocks of the template
+ * where the filesystem supports it (reflinks), or is made by the kernel with
+ * copy_file_range.
+ *
+ * path: Path of the new database.
+ * template_path: Path of the template database.
+ * e: Error object.
+ */
+wsp_return_t wsp_create_template(
+    const char *path,
+    const char *template_path,
+    wsp_error_t *e
+);
+
 /**
  * Open the specified path as a whisper database.
  *
  * w: Whisper database handle, should have been initialized using WSP_INIT
  * prior to this function.
  * path: Path to the file containing the whisper database.
- * mapping: The file mapping method to use; WSP_MMAP or WSP_FILE.
+ * mapping: The file mapping method to use; WSP_MMAP, WSP_PREAD, WSP_FILE or
+ * WSP_URING (Linux only, see wsp_io_uring.h).
  * e: Error object.
+ *
+ * The access hints in io_flags are passed on to madvise or posix_fadvise when
+ * the file is opened.
+ *
+ * Except with WSP_MMAP, the base point of every archive is cached by the
+ * handle. With WSP_IO_EXCLUSIVE in io_flags, the handle is trusted to be the
+ * only writer and the cache is kept for as long as the database is open.
+ * Otherwise it is only kept between operations that do not write, as long as
+ * the modification time and size of the file do not change, and not at all
+ * for a file modified within a second before the cache was read, since file
+ * timestamps are too coarse to notice another write in the same tick. Writes
+ * through a shared mapping do not always change the modification time, so a
+ * database that other handles write with WSP_MMAP should be read with
+ * WSP_MMAP as well.
  */
 wsp_return_t wsp_open(
     wsp_t *w,
@@ -277,6 +549,21 @@ wsp_return_t wsp_open(
     wsp_error_t *e
 );
 
+/**
+ * Make everything written to a database since the last call durable, using
+ * msync for WSP_MMAP and fdatasync for the other mappings.
+ *
+ * Written data otherwise reaches the disk whenever the kernel decides, see
+ * wsp_pool.h for syncing many databases in groups.
+ *
+ * w: Whisper database.
+ * e: Error object.
+ */
+wsp_return_t wsp_sync(
+    wsp_t *w,
+    wsp_error_t *e
+);
+
 /**
  * Close an already open whisper database.
  *
@@ -288,6 +575,27 @@ wsp_return_t wsp_close(
     wsp_error_t *e
 );
 
+/**
+ * Enable the running aggregate cache of an open database.
+ *
+ * wsp_update keeps the aggregate of the current interval of every lower
+ * precision archive, so that propagation is done in constant time instead of
+ * re-reading the higher precision window for every update. The window is only
+ * reloaded when an interval rolls over, when points arrive out of order or
+ * when the cache is cold.
+ *
+ * The cache is only kept current by wsp_update and wsp_update_many, and
+ * assumes this handle is the only writer of the database.
+ * It is released by wsp_close.
+ *
+ * w: Whisper database.
+ * e: Error object.
+ */
+wsp_return_t wsp_rollup_enable(
+    wsp_t *w,
+    wsp_error_t *e
+);
+
 /**
  * Insert an update in the database.
  *
@@ -301,6 +609,30 @@ wsp_return_t wsp_update(
     wsp_error_t *e
 );
 
+/**
+ * Insert many points in the database.
+ *
+ * Points are sorted by timestamp and written to the highest precision archive
+ * that covers them. For each archive, points sharing an interval are reduced
+ * to the last one given and every contiguous run of intervals is written
+ * using a single write. Every distinct interval of the lower precision
+ * archives is propagated exactly once.
+ *
+ * Points not covered by any archive are silently dropped, and so are points
+ * in the future, the rest of the batch is still written.
+ *
+ * w: Whisper database.
+ * points: Points to insert, these will be sorted in place.
+ * count: Number of points.
+ * e: Error object.
+ */
+wsp_return_t wsp_update_many(
+    wsp_t *w,
+    wsp_point_t *points,
+    uint32_t count,
+    wsp_error_t *e
+);
+
 wsp_return_t wsp_update_point(
     wsp_t *w,
     wsp_archive_t *archive,
@@ -383,7 +715,8 @@ wsp_return_t wsp_load_point(
  *
  * w: Whisper database,
  * archive: Archive to load points from.
- * offset: Offset of the points to load.
+ * offset: Offset of the points to load, relative to the base point. Offsets
+ * beyond the archive are not clamped, they wrap around it.
  * count: Number of points to load.
  * points: Where to store points.
  * e: Error object.
@@ -397,6 +730,82 @@ wsp_return_t wsp_load_points(
     wsp_error_t *e
 );
 
+/**
+ * Load points into a series of values, see wsp_series_t.
+ *
+ * Like wsp_load_points, but the timestamps are not stored: point i belongs
+ * to series->start + i * series->step.
+ *
+ * w: Whisper database.
+ * archive: Archive to load points from.
+ * offset: Offset of the points to load, relative to the base point.
+ * count: Number of points to load, at most archive->count.
+ * series: Where to store the points, values (and valid, if not NULL) must
+ * have room for count points.
+ * e: Error object.
+ */
+wsp_return_t wsp_load_series(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    int offset,
+    uint32_t count,
+    wsp_series_t *series,
+    wsp_error_t *e
+);
+
+/**
+ * Load points between two timestamps into a series of values, see
+ * wsp_load_time_points.
+ *
+ * w: Whisper database.
+ * archive: Archive to load points from.
+ * time_from: Start of time interval.
+ * time_until: End of time interval.
+ * series: Where to store the points, values (and valid, if not NULL) must
+ * have room for archive->count points.
+ * e: Error object.
+ */
+wsp_return_t wsp_load_time_series(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    wsp_time_t time_from,
+    wsp_time_t time_until,
+    wsp_series_t *series,
+    wsp_error_t *e
+);
+
+/**
+ * Fetch the points of a time range, see whisper.py's fetch.
+ *
+ * The range is clamped to the retention of the database and to now, and read
+ * from the most precise archive covering it. Like whisper.py, intervals are
+ * aligned to the step past their timestamp: the series starts at the interval
+ * after from, and ends with the interval after until.
+ *
+ * If from and until fall in the same interval, from == until included, the
+ * series is the single interval after it, as with later versions of
+ * whisper.py. whisper.py 0.9 reads the whole archive when from == until.
+ *
+ * A range that starts in the future or ends before the retention of the
+ * database gives an empty series, with a step of 0.
+ *
+ * w: Whisper database.
+ * from: Start of time interval.
+ * until: End of time interval.
+ * now: Current time, or 0 for wsp_time_now().
+ * series: Where to store the points, values (and valid, if not NULL) must
+ * have room for the count of the largest archive.
+ * e: Error object.
+ */
+wsp_return_t wsp_fetch(
+    wsp_t *w,
+    wsp_time_t from,
+    wsp_time_t until,
+    wsp_time_t now,
+    wsp_series_t *series,
+    wsp_error_t *e
+);
+
 struct wsp_point_b {
     char timestamp[sizeof(uint32_t)];
     char value[sizeof(double)];
@@ -407,6 +816,31 @@ struct wsp_point_t {
     double value;
 };
 
+/*
+ * Points of an archive as separate values, for consumers that do arithmetic
+ * on them: the timestamps follow from start and step.
+ */
+struct wsp_series_t {
+    // timestamp of the first value, and the time between values.
+    wsp_time_t start;
+    uint32_t step;
+    // number of values.
+    uint32_t count;
+    // values, NAN if unknown.
+    double *values;
+    // optional bitmap of known values, value i is known if
+    // valid[i / 8] & (1 << (i % 8)), may be NULL.
+    uint8_t *valid;
+};
+
+#define WSP_SERIES_INIT(s, v, b) do { \
+    (s)->start = 0; \
+    (s)->step = 0; \
+    (s)->count = 0; \
+    (s)->values = (v); \
+    (s)->valid = (b); \
+} while(0)
+
 #define WSP_POINT_INIT(p) do { \
     (p)->timestamp = 0; \
     (p)->value = 0; \
@@ -416,6 +850,6 @@ struct wsp_point_t {
  * Calculate the absolute offset for a specific point in the database.
  */
 #define WSP_POINT_OFFSET(archive, index) \
-    (archive)->offset + sizeof(wsp_point_b) * index;
+    ((archive)->offset + sizeof(wsp_point_b) * (index))
 
 #endif /* _WSP_H_ */
@@ -0,0 +1,177 @@
+// vim: foldmethod=marker
+#include "wsp_arena.h"
+#include "wsp_private.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+
+static pthread_key_t __wsp_arena_key;
+static pthread_once_t __wsp_arena_once = PTHREAD_ONCE_INIT;
+static int __wsp_arena_key_error = 0;
+
+static void __wsp_arena_key_create(void)
+{
+    __wsp_arena_key_error = pthread_key_create(&__wsp_arena_key, NULL);
+}
+
+// wsp_arena_init {{{
+wsp_return_t wsp_arena_init(
+    wsp_arena_t *arena,
+    size_t size,
+    wsp_error_t *e
+)
+{
+    WSP_ARENA_INIT(arena);
+
+    // the start of the block is aligned for any type, and every allocation
+    // is rounded up to keep the next one aligned.
+    void *data = NULL;
+    int error = posix_memalign(&data, WSP_ARENA_ALIGN, size > 0 ? size : WSP_ARENA_ALIGN);
+
+    if (error != 0) {
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = error;
+        return WSP_ERROR;
+    }
+
+    arena->data = data;
+    arena->size = size;
+    return WSP_OK;
+} // wsp_arena_init }}}
+
+// wsp_arena_free {{{
+void wsp_arena_free(
+    wsp_arena_t *arena
+)
+{
+    free(arena->data);
+    WSP_ARENA_INIT(arena);
+} // wsp_arena_free }}}
+
+// wsp_arena_alloc {{{
+void *wsp_arena_alloc(
+    wsp_arena_t *arena,
+    size_t size
+)
+{
+    // an empty allocation still takes room, otherwise it could be the end of
+    // a full arena, which __wsp_scratch_free would take for heap memory.
+    size_t aligned = ((size > 0 ? size : 1) + WSP_ARENA_ALIGN - 1) & ~(size_t)(WSP_ARENA_ALIGN - 1);
+
+    if (aligned < size || aligned > arena->size - arena->used) {
+        arena->overflows++;
+        return NULL;
+    }
+
+    void *p = arena->data + arena->used;
+
+    arena->used += aligned;
+
+    if (arena->used > arena->peak) {
+        arena->peak = arena->used;
+    }
+
+    return p;
+} // wsp_arena_alloc }}}
+
+// wsp_arena_release {{{
+void wsp_arena_release(
+    wsp_arena_t *arena,
+    void *p
+)
+{
+    arena->used = (char *)p - arena->data;
+} // wsp_arena_release }}}
+
+// wsp_arena_reset {{{
+void wsp_arena_reset(
+    wsp_arena_t *arena
+)
+{
+    arena->used = 0;
+} // wsp_arena_reset }}}
+
+// wsp_arena_attach {{{
+wsp_return_t wsp_arena_attach(
+    wsp_arena_t *arena,
+    wsp_error_t *e
+)
+{
+    pthread_once(&__wsp_arena_once, __wsp_arena_key_create);
+
+    if (__wsp_arena_key_error != 0) {
+        e->type = WSP_ERROR_THREAD;
+        e->syserr = __wsp_arena_key_error;
+        return WSP_ERROR;
+    }
+
+    int error = pthread_setspecific(__wsp_arena_key, arena);
+
+    if (error != 0) {
+        e->type = WSP_ERROR_THREAD;
+        e->syserr = error;
+        return WSP_ERROR;
+    }
+
+    return WSP_OK;
+} // wsp_arena_attach }}}
+
+// wsp_arena_thread {{{
+wsp_arena_t *wsp_arena_thread(void)
+{
+    pthread_once(&__wsp_arena_once, __wsp_arena_key_create);
+
+    if (__wsp_arena_key_error != 0) {
+        return NULL;
+    }
+
+    return pthread_getspecific(__wsp_arena_key);
+} // wsp_arena_thread }}}
+
+// __wsp_scratch_alloc {{{
+void *__wsp_scratch_alloc(
+    wsp_t *w,
+    size_t size,
+    wsp_error_t *e
+)
+{
+    wsp_arena_t *arena = w->arena != NULL ? w->arena : wsp_arena_thread();
+
+    if (arena != NULL) {
+        void *p = wsp_arena_alloc(arena, size);
+
+        if (p != NULL) {
+            return p;
+        }
+    }
+
+    void *p = malloc(size > 0 ? size : 1);
+
+    if (p == NULL) {
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+    }
+
+    return p;
+} // __wsp_scratch_alloc }}}
+
+// __wsp_scratch_free {{{
+void __wsp_scratch_free(
+    wsp_t *w,
+    void *p
+)
+{
+    if (p == NULL) {
+        return;
+    }
+
+    wsp_arena_t *arena = w->arena != NULL ? w->arena : wsp_arena_thread();
+
+    if (arena != NULL && (char *)p >= arena->data && (char *)p < arena->data + arena->size) {
+        wsp_arena_release(arena, p);
+        return;
+    }
+
+    free(p);
+} // __wsp_scratch_free }}}
@@ -0,0 +1,135 @@
+// vim: foldmethod=marker
+/**
+ * Scratch memory arenas.
+ *
+ * Reads and updates need temporary memory sized by the archives they touch,
+ * for example the window of points a propagation aggregates. An arena is a
+ * single block allocated once, from which that memory is taken and given
+ * back in constant time, so that large archives neither overflow the stack
+ * nor allocate on every call.
+ *
+ * An arena can be attached to a handle (see wsp_t arena), or to the calling
+ * thread for all handles without one. Without an arena, or when an arena has
+ * no room left, temporary memory is allocated from the heap.
+ *
+ * Example:
+ *
+ *   wsp_arena_t arena;
+ *
+ *   if (wsp_arena_init(&arena, 1 << 20, &e) == WSP_ERROR) {
+ *       return 1;
+ *   }
+ *
+ *   w.arena = &arena;
+ *   wsp_update(&w, &p, &e);
+ *
+ *   wsp_arena_free(&arena);
+ *
+ * An arena must only be used by one thread at a time.
+ */
+#ifndef _WSP_ARENA_H_
+#define _WSP_ARENA_H_
+
+#include <stddef.h>
+
+#include "wsp.h"
+
+/*
+ * Alignment of memory taken from an arena.
+ */
+#define WSP_ARENA_ALIGN 16
+
+struct wsp_arena_t {
+    char *data;
+    // size of data, and the number of bytes in use.
+    size_t size;
+    size_t used;
+    // most bytes ever in use, and the number of allocations that did not fit
+    // and went to the heap, to size arenas.
+    size_t peak;
+    uint64_t overflows;
+};
+
+#define WSP_ARENA_INIT(a) do {\
+    (a)->data = NULL;\
+    (a)->size = 0;\
+    (a)->used = 0;\
+    (a)->peak = 0;\
+    (a)->overflows = 0;\
+} while(0)
+
+/**
+ * Initialize an arena.
+ *
+ * arena: Arena to initialize.
+ * size: Size of the arena in bytes.
+ * e: Error object.
+ */
+wsp_return_t wsp_arena_init(
+    wsp_arena_t *arena,
+    size_t size,
+    wsp_error_t *e
+);
+
+/**
+ * Free the memory of an arena, which must not be attached anymore.
+ *
+ * arena: Arena to free.
+ */
+void wsp_arena_free(
+    wsp_arena_t *arena
+);
+
+/**
+ * Take memory from an arena.
+ *
+ * arena: Arena to take memory from.
+ * size: Number of bytes.
+ *
+ * Returns the memory, aligned to WSP_ARENA_ALIGN, or NULL if the arena has no
+ * room for it.
+ */
+void *wsp_arena_alloc(
+    wsp_arena_t *arena,
+    size_t size
+);
+
+/**
+ * Give back memory taken from an arena, together with all memory taken after
+ * it.
+ *
+ * arena: Arena the memory was taken from.
+ * p: Memory returned by wsp_arena_alloc.
+ */
+void wsp_arena_release(
+    wsp_arena_t *arena,
+    void *p
+);
+
+/**
+ * Give back all memory taken from an arena.
+ *
+ * arena: Arena to reset.
+ */
+void wsp_arena_reset(
+    wsp_arena_t *arena
+);
+
+/**
+ * Attach an arena to the calling thread, used by handles without an arena
+ * of their own.
+ *
+ * arena: Arena to attach, or NULL to detach the current one.
+ * e: Error object.
+ */
+wsp_return_t wsp_arena_attach(
+    wsp_arena_t *arena,
+    wsp_error_t *e
+);
+
+/**
+ * Get the arena attached to the calling thread, or NULL.
+ */
+wsp_arena_t *wsp_arena_thread(void);
+
+#endif /* _WSP_ARENA_H_ */
@@ -0,0 +1,535 @@
+// vim: foldmethod=marker
+#include "wsp_cache.h"
+#include "wsp_private.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * Initial number of buckets, doubled whenever there are more entries than
+ * buckets.
+ */
+#define WSP_CACHE_BUCKETS 1024
+
+/*
+ * Initial number of points allocated for an entry.
+ */
+#define WSP_CACHE_POINTS 8
+
+// __wsp_cache_find {{{
+static wsp_cache_entry_t *__wsp_cache_find(
+    wsp_cache_t *c,
+    const char *path,
+    uint32_t hash
+)
+{
+    wsp_cache_entry_t *entry = c->buckets[hash % c->buckets_size];
+
+    for (; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && strcmp(entry->path, path) == 0) {
+            return entry;
+        }
+    }
+
+    return NULL;
+} // __wsp_cache_find }}}
+
+// __wsp_cache_remove {{{
+/*
+ * Unlink an entry from its bucket, without freeing it.
+ */
+static void __wsp_cache_remove(
+    wsp_cache_t *c,
+    wsp_cache_entry_t *entry
+)
+{
+    wsp_cache_entry_t **link = &c->buckets[entry->hash % c->buckets_size];
+
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+
+    *link = entry->next;
+    entry->next = NULL;
+
+    c->entries_count--;
+    c->points_count -= entry->count;
+} // __wsp_cache_remove }}}
+
+// __wsp_cache_link {{{
+/*
+ * Link an entry into its bucket.
+ */
+static void __wsp_cache_link(
+    wsp_cache_t *c,
+    wsp_cache_entry_t *entry
+)
+{
+    uint32_t bucket = entry->hash % c->buckets_size;
+
+    entry->next = c->buckets[bucket];
+    c->buckets[bucket] = entry;
+
+    c->entries_count++;
+    c->points_count += entry->count;
+} // __wsp_cache_link }}}
+
+// __wsp_cache_grow {{{
+/*
+ * Double the number of buckets.
+ */
+static wsp_return_t __wsp_cache_grow(
+    wsp_cache_t *c,
+    wsp_error_t *e
+)
+{
+    uint32_t size = c->buckets_size * 2;
+    wsp_cache_entry_t **buckets = calloc(size, sizeof(wsp_cache_entry_t *));
+
+    if (buckets == NULL) {
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    uint32_t i;
+
+    for (i = 0; i < c->buckets_size; i++) {
+        wsp_cache_entry_t *entry = c->buckets[i];
+
+        while (entry != NULL) {
+            wsp_cache_entry_t *next = entry->next;
+            entry->next = buckets[entry->hash % size];
+            buckets[entry->hash % size] = entry;
+            entry = next;
+        }
+    }
+
+    free(c->buckets);
+    c->buckets = buckets;
+    c->buckets_size = size;
+    return WSP_OK;
+} // __wsp_cache_grow }}}
+
+// wsp_cache_init {{{
+wsp_return_t wsp_cache_init(
+    wsp_cache_t *c,
+    size_t max_points,
+    wsp_error_t *e
+)
+{
+    c->buckets = calloc(WSP_CACHE_BUCKETS, sizeof(wsp_cache_entry_t *));
+
+    if (c->buckets == NULL) {
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    c->buckets_size = WSP_CACHE_BUCKETS;
+    c->entries_count = 0;
+    c->points_count = 0;
+    c->max_points = max_points;
+    return WSP_OK;
+} // wsp_cache_init }}}
+
+// wsp_cache_free {{{
+wsp_return_t wsp_cache_free(
+    wsp_cache_t *c,
+    wsp_error_t *e
+)
+{
+    uint32_t i;
+
+    for (i = 0; i < c->buckets_size; i++) {
+        wsp_cache_entry_t *entry = c->buckets[i];
+
+        while (entry != NULL) {
+            wsp_cache_entry_t *next = entry->next;
+            free(entry->path);
+            free(entry->points);
+            free(entry);
+            entry = next;
+        }
+    }
+
+    free(c->buckets);
+    c->buckets = NULL;
+    c->buckets_size = 0;
+    c->entries_count = 0;
+    c->points_count = 0;
+    return WSP_OK;
+} // wsp_cache_free }}}
+
+// wsp_cache_add {{{
+wsp_return_t wsp_cache_add(
+    wsp_cache_t *c,
+    const char *path,
+    wsp_point_t *p,
+    wsp_error_t *e
+)
+{
+    if (c->max_points != 0 && c->points_count >= c->max_points) {
+        e->type = WSP_ERROR_CACHE_FULL;
+        return WSP_ERROR;
+    }
+
+    uint32_t hash = __wsp_hash_path(path);
+    wsp_cache_entry_t *entry = __wsp_cache_find(c, path, hash);
+
+    if (entry == NULL) {
+        if (c->entries_count >= c->buckets_size) {
+            if (__wsp_cache_grow(c, e) == WSP_ERROR) {
+                return WSP_ERROR;
+            }
+        }
+
+        size_t length = strlen(path);
+
+        entry = malloc(sizeof(wsp_cache_entry_t));
+
+        if (entry == NULL) {
+            e->type = WSP_ERROR_MALLOC;
+            e->syserr = errno;
+            return WSP_ERROR;
+        }
+
+        entry->path = malloc(length + 1);
+        entry->points = malloc(sizeof(wsp_point_t) * WSP_CACHE_POINTS);
+
+        if (entry->path == NULL || entry->points == NULL) {
+            free(entry->path);
+            free(entry->points);
+            free(entry);
+            e->type = WSP_ERROR_MALLOC;
+            e->syserr = errno;
+            return WSP_ERROR;
+        }
+
+        memcpy(entry->path, path, length + 1);
+        entry->hash = hash;
+        entry->count = 0;
+        entry->size = WSP_CACHE_POINTS;
+        __wsp_cache_link(c, entry);
+    }
+
+    if (entry->count == entry->size) {
+        uint32_t size = entry->size * 2;
+        wsp_point_t *points = realloc(entry->points, sizeof(wsp_point_t) * size);
+
+        if (points == NULL) {
+            e->type = WSP_ERROR_MALLOC;
+            e->syserr = errno;
+            return WSP_ERROR;
+        }
+
+        entry->points = points;
+        entry->size = size;
+    }
+
+    entry->points[entry->count] = *p;
+
+    // the point belongs to the interval it arrived in, not the one it is
+    // written in.
+    if (p->timestamp == 0) {
+        entry->points[entry->count].timestamp = wsp_time_now();
+    }
+
+    entry->count++;
+    c->points_count++;
+    return WSP_OK;
+} // wsp_cache_add }}}
+
+// wsp_cache_pop {{{
+wsp_return_t wsp_cache_pop(
+    wsp_cache_t *c,
+    char **path,
+    wsp_point_t **points,
+    uint32_t *count,
+    wsp_error_t *e
+)
+{
+    wsp_cache_entry_t *largest = NULL;
+    uint32_t i;
+
+    for (i = 0; i < c->buckets_size; i++) {
+        wsp_cache_entry_t *entry = c->buckets[i];
+
+        for (; entry != NULL; entry = entry->next) {
+            if (largest == NULL || entry->count > largest->count) {
+                largest = entry;
+            }
+        }
+    }
+
+    if (largest == NULL) {
+        *path = NULL;
+        *points = NULL;
+        *count = 0;
+        return WSP_OK;
+    }
+
+    __wsp_cache_remove(c, largest);
+
+    *path = largest->path;
+    *points = largest->points;
+    *count = largest->count;
+    free(largest);
+    return WSP_OK;
+} // wsp_cache_pop }}}
+
+// __wsp_cache_requeue {{{
+/*
+ * Put back an entry a writer failed on. Points added for the same path in
+ * the meantime are kept after it, in the order they were added.
+ */
+static wsp_return_t __wsp_cache_requeue(
+    wsp_cache_t *c,
+    wsp_cache_entry_t *entry,
+    wsp_error_t *e
+)
+{
+    wsp_cache_entry_t *added = __wsp_cache_find(c, entry->path, entry->hash);
+
+    if (added == NULL) {
+        __wsp_cache_link(c, entry);
+        return WSP_OK;
+    }
+
+    uint32_t count = entry->count + added->count;
+
+    if (count > entry->size) {
+        wsp_point_t *points = realloc(entry->points, sizeof(wsp_point_t) * count);
+
+        if (points == NULL) {
+            e->type = WSP_ERROR_MALLOC;
+            e->syserr = errno;
+            return WSP_ERROR;
+        }
+
+        entry->points = points;
+        entry->size = count;
+    }
+
+    memcpy(entry->points + entry->count, added->points, sizeof(wsp_point_t) * added->count);
+    entry->count = count;
+
+    __wsp_cache_remove(c, added);
+    __wsp_cache_link(c, entry);
+
+    free(added->path);
+    free(added->points);
+    free(added);
+    return WSP_OK;
+} // __wsp_cache_requeue }}}
+
+// wsp_cache_drain {{{
+static int __wsp_cache_compare(const void *a, const void *b)
+{
+    const wsp_cache_entry_t *x = *(const wsp_cache_entry_t **)a;
+    const wsp_cache_entry_t *y = *(const wsp_cache_entry_t **)b;
+
+    if (x->count != y->count) {
+        return x->count > y->count ? -1 : 1;
+    }
+
+    return 0;
+}
+
+wsp_return_t wsp_cache_drain(
+    wsp_cache_t *c,
+    uint32_t max_entries,
+    wsp_cache_writer_f writer,
+    void *data,
+    wsp_error_t *e
+)
+{
+    if (c->entries_count == 0) {
+        return WSP_OK;
+    }
+
+    uint32_t count = c->entries_count;
+    wsp_cache_entry_t **entries = malloc(sizeof(wsp_cache_entry_t *) * count);
+
+    if (entries == NULL) {
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    uint32_t i, n = 0;
+
+    for (i = 0; i < c->buckets_size; i++) {
+        wsp_cache_entry_t *entry = c->buckets[i];
+
+        for (; entry != NULL; entry = entry->next) {
+            entries[n++] = entry;
+        }
+    }
+
+    qsort(entries, count, sizeof(wsp_cache_entry_t *), __wsp_cache_compare);
+
+    if (max_entries == 0 || max_entries > count) {
+        max_entries = count;
+    }
+
+    wsp_return_t result = WSP_OK;
+
+    for (i = 0; i < max_entries; i++) {
+        wsp_cache_entry_t *entry = entries[i];
+        wsp_error_t write_e;
+        WSP_ERROR_INIT(&write_e);
+
+        __wsp_cache_remove(c, entry);
+
+        if (writer(data, entry->path, entry->points, entry->count, &write_e) == WSP_OK) {
+            free(entry);
+            continue;
+        }
+
+        // report the first failure, the points stay pending.
+        if (result == WSP_OK) {
+            *e = write_e;
+            result = WSP_ERROR;
+        }
+
+        if (__wsp_cache_requeue(c, entry, &write_e) == WSP_ERROR) {
+            *e = write_e;
+            free(entry->path);
+            free(entry->points);
+            free(entry);
+        }
+    }
+
+    free(entries);
+    return result;
+} // wsp_cache_drain }}}
+
+// wsp_cache_flush {{{
+/*
+ * Writer synchronously writing points to their database.
+ */
+static wsp_return_t __wsp_cache_write(
+    void *data,
+    char *path,
+    wsp_point_t *points,
+    uint32_t count,
+    wsp_error_t *e
+)
+{
+    wsp_mapping_t mapping = *(wsp_mapping_t *)data;
+    wsp_t w;
+    WSP_INIT(&w);
+
+    if (wsp_open(&w, path, mapping, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    wsp_error_t close_e;
+    WSP_ERROR_INIT(&close_e);
+
+    // wsp_update_many sorts the points in place, which keeps the last of
+    // equal timestamps last, so a retry writes the same values.
+    wsp_return_t result = wsp_update_many(&w, points, count, e);
+
+    if (wsp_close(&w, &close_e) == WSP_ERROR && result == WSP_OK) {
+        *e = close_e;
+        result = WSP_ERROR;
+    }
+
+    if (result == WSP_OK) {
+        free(path);
+        free(points);
+    }
+
+    return result;
+}
+
+wsp_return_t wsp_cache_flush(
+    wsp_cache_t *c,
+    uint32_t max_entries,
+    wsp_mapping_t mapping,
+    wsp_error_t *e
+)
+{
+    return wsp_cache_drain(c, max_entries, __wsp_cache_write, &mapping, e);
+} // wsp_cache_flush }}}
+
+// wsp_cache_load_time_points {{{
+wsp_return_t wsp_cache_load_time_points(
+    wsp_cache_t *c,
+    const char *path,
+    wsp_t *w,
+    wsp_archive_t *archive,
+    wsp_time_t time_from,
+    wsp_time_t time_until,
+    wsp_point_t *result,
+    uint32_t *size,
+    wsp_error_t *e
+)
+{
+    if (wsp_load_time_points(w, archive, time_from, time_until, result, size, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    wsp_cache_entry_t *entry = __wsp_cache_find(c, path, __wsp_hash_path(path));
+
+    if (entry == NULL || *size == 0) {
+        return WSP_OK;
+    }
+
+    // timestamp of the point used for every interval, 0 for none.
+    wsp_time_t *used = calloc(*size, sizeof(wsp_time_t));
+
+    if (used == NULL) {
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    wsp_time_t now = wsp_time_now();
+    wsp_time_t start = result[0].timestamp;
+    uint32_t i, j;
+
+    for (i = 0; i < entry->count; i++) {
+        wsp_point_t *p = entry->points + i;
+
+        // like wsp_update_many, the point only goes to the most precise
+        // archive covering it, the lower ones hold aggregates of it.
+        if (p->timestamp > now) {
+            continue;
+        }
+
+        for (j = 0; j < w->archives_count; j++) {
+            if (now - p->timestamp <= w->archives[j].retention) {
+                break;
+            }
+        }
+
+        if (j == w->archives_count || w->archives[j].spp != archive->spp) {
+            continue;
+        }
+
+        wsp_time_t interval = wsp_time_floor(p->timestamp, archive->spp);
+
+        if (interval < start) {
+            continue;
+        }
+
+        uint32_t index = (interval - start) / archive->spp;
+
+        // of the points in an interval, wsp_update_many writes the latest,
+        // or the last added of equal timestamps.
+        if (index >= *size || p->timestamp < used[index]) {
+            continue;
+        }
+
+        used[index] = p->timestamp;
+        result[index].timestamp = interval;
+        result[index].value = p->value;
+    }
+
+    free(used);
+    return WSP_OK;
+} // wsp_cache_load_time_points }}}
@@ -0,0 +1,213 @@
+// vim: foldmethod=marker
+/**
+ * Write-back point cache.
+ *
+ * Buffers points per database path in memory, and writes them in batches
+ * using wsp_update_many, the largest backlogs first.
+ *
+ * Example:
+ *
+ *   wsp_cache_t c;
+ *
+ *   if (wsp_cache_init(&c, 1000000, &e) == WSP_ERROR) {
+ *       return 1;
+ *   }
+ *
+ *   if (wsp_cache_add(&c, path, &p, &e) == WSP_ERROR) {
+ *       if (e.type == WSP_ERROR_CACHE_FULL) {
+ *           // flush some of the cache and try again.
+ *       }
+ *   }
+ *
+ *   wsp_cache_flush(&c, 0, WSP_MMAP, &e);
+ *   wsp_cache_free(&c, &e);
+ *
+ * The cache is not thread-safe.
+ */
+#ifndef _WSP_CACHE_H_
+#define _WSP_CACHE_H_
+
+#include "wsp.h"
+
+struct wsp_cache_entry_t;
+struct wsp_cache_t;
+
+typedef struct wsp_cache_entry_t wsp_cache_entry_t;
+typedef struct wsp_cache_t wsp_cache_t;
+
+struct wsp_cache_entry_t {
+    // path of the database the points belong to.
+    char *path;
+    // hash of path.
+    uint32_t hash;
+    // pending points, in the order they were added.
+    wsp_point_t *points;
+    // number of pending points.
+    uint32_t count;
+    // number of points allocated.
+    uint32_t size;
+    // next entry in the same bucket.
+    wsp_cache_entry_t *next;
+};
+
+/**
+ * Writer used when draining a cache.
+ *
+ * If the writer succeeds, ownership of path and points is transferred to it,
+ * and it must free() them. If it fails, they are left untouched and put back
+ * in the cache.
+ *
+ * data: User data given to wsp_cache_drain.
+ * path: Path of the database.
+ * points: Pending points, in the order they were added.
+ * count: Number of pending points.
+ * e: Error object.
+ */
+typedef wsp_return_t(*wsp_cache_writer_f)(
+    void *data,
+    char *path,
+    wsp_point_t *points,
+    uint32_t count,
+    wsp_error_t *e
+);
+
+struct wsp_cache_t {
+    wsp_cache_entry_t **buckets;
+    // number of buckets.
+    uint32_t buckets_size;
+    // number of entries (paths) in the cache.
+    uint32_t entries_count;
+    // number of pending points in the cache.
+    size_t points_count;
+    // maximum number of pending points, 0 means no limit.
+    size_t max_points;
+};
+
+/**
+ * Initialize a cache.
+ *
+ * c: Cache to initialize.
+ * max_points: Maximum number of pending points before wsp_cache_add starts
+ * failing with WSP_ERROR_CACHE_FULL, 0 means no limit.
+ * e: Error object.
+ */
+wsp_return_t wsp_cache_init(
+    wsp_cache_t *c,
+    size_t max_points,
+    wsp_error_t *e
+);
+
+/**
+ * Free all memory associated with a cache, dropping any pending points.
+ *
+ * c: Cache to free.
+ * e: Error object.
+ */
+wsp_return_t wsp_cache_free(
+    wsp_cache_t *c,
+    wsp_error_t *e
+);
+
+/**
+ * Add a pending point for a database.
+ *
+ * A timestamp of 0 is the time the point is added.
+ *
+ * Fails with WSP_ERROR_CACHE_FULL if the cache holds max_points points, in
+ * which case the caller is expected to flush before adding more.
+ *
+ * c: Cache to add point to.
+ * path: Path of the database.
+ * p: Point to add.
+ * e: Error object.
+ */
+wsp_return_t wsp_cache_add(
+    wsp_cache_t *c,
+    const char *path,
+    wsp_point_t *p,
+    wsp_error_t *e
+);
+
+/**
+ * Remove the entry with the most pending points from the cache.
+ *
+ * Ownership of path and points is transferred to the caller, which must
+ * free() them.
+ *
+ * c: Cache to pop entry from.
+ * path: Where to store the path, or NULL if the cache is empty.
+ * points: Where to store the pending points.
+ * count: Where to store the number of pending points.
+ * e: Error object.
+ */
+wsp_return_t wsp_cache_pop(
+    wsp_cache_t *c,
+    char **path,
+    wsp_point_t **points,
+    uint32_t *count,
+    wsp_error_t *e
+);
+
+/**
+ * Remove entries from the cache and hand them to a writer, the largest
+ * backlogs first.
+ *
+ * Entries the writer fails on are put back, together with any points added
+ * for them in the meantime, and draining goes on with the next entry. The
+ * first failure is reported once all entries have been handed over.
+ *
+ * c: Cache to drain.
+ * max_entries: Maximum number of entries to remove, 0 means all.
+ * writer: Writer to hand entries to.
+ * data: User data passed to the writer.
+ * e: Error object.
+ */
+wsp_return_t wsp_cache_drain(
+    wsp_cache_t *c,
+    uint32_t max_entries,
+    wsp_cache_writer_f writer,
+    void *data,
+    wsp_error_t *e
+);
+
+/**
+ * Write pending points to their databases, the largest backlogs first.
+ *
+ * If writing a database fails, its points stay pending, see wsp_cache_drain.
+ *
+ * c: Cache to flush.
+ * max_entries: Maximum number of databases to write, 0 means all.
+ * mapping: The file mapping method to use when opening databases.
+ * e: Error object.
+ */
+wsp_return_t wsp_cache_flush(
+    wsp_cache_t *c,
+    uint32_t max_entries,
+    wsp_mapping_t mapping,
+    wsp_error_t *e
+);
+
+/**
+ * Like wsp_load_time_points, but points still pending in the cache for the
+ * database override the values read from it.
+ *
+ * As wsp_update_many would, a pending point only overrides the most precise
+ * archive covering it, lower archives do not show it until it is written.
+ *
+ * c: Cache to read pending points from.
+ * path: Path of the database.
+ * See wsp_load_time_points for the rest of the arguments.
+ */
+wsp_return_t wsp_cache_load_time_points(
+    wsp_cache_t *c,
+    const char *path,
+    wsp_t *w,
+    wsp_archive_t *archive,
+    wsp_time_t time_from,
+    wsp_time_t time_until,
+    wsp_point_t *result,
+    uint32_t *size,
+    wsp_error_t *e
+);
+
+#endif /* _WSP_CACHE_H_ */
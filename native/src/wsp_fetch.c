@@ -0,0 +1,419 @@
+// vim: foldmethod=marker
+#include "wsp_fetch.h"
+#include "wsp_private.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+
+/*
+ * A single series, as read from its database.
+ */
+typedef struct {
+    // first interval, step and number of points, 0 if there is no data.
+    wsp_time_t from;
+    uint32_t step;
+    uint32_t count;
+    wsp_aggregation_t aggregation;
+    double *values;
+} wsp_fetch_series_t;
+
+typedef struct {
+    const char **paths;
+    wsp_fetch_series_t *series;
+    uint32_t count;
+    wsp_time_t from;
+    wsp_time_t until;
+    wsp_time_t now;
+    // next series to read, guarded by lock.
+    uint32_t next;
+    pthread_mutex_t lock;
+    // failures, guarded by lock.
+    uint32_t failed;
+    wsp_error_t error;
+} wsp_fetch_state_t;
+
+// __wsp_fetch_read {{{
+/*
+ * Read a time range of an open database, see wsp_fetch.
+ */
+static wsp_return_t __wsp_fetch_read(
+    wsp_t *w,
+    wsp_time_t from,
+    wsp_time_t until,
+    wsp_time_t now,
+    wsp_fetch_series_t *series,
+    wsp_error_t *e
+)
+{
+    uint32_t size = 0;
+    uint32_t i;
+
+    for (i = 0; i < w->archives_count; i++) {
+        if (w->archives[i].count > size) {
+            size = w->archives[i].count;
+        }
+    }
+
+    double *values = malloc(sizeof(double) * (size > 0 ? size : 1));
+
+    if (values == NULL) {
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    wsp_series_t s;
+    WSP_SERIES_INIT(&s, values, NULL);
+
+    if (wsp_fetch(w, from, until, now, &s, e) == WSP_ERROR) {
+        free(values);
+        return WSP_ERROR;
+    }
+
+    if (s.count == 0) {
+        free(values);
+        return WSP_OK;
+    }
+
+    series->from = s.start;
+    series->step = s.step;
+    series->count = s.count;
+    series->aggregation = w->meta.aggregation;
+    series->values = values;
+    return WSP_OK;
+} // __wsp_fetch_read }}}
+
+// __wsp_fetch_worker {{{
+static void *__wsp_fetch_worker(void *arg)
+{
+    wsp_fetch_state_t *state = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&state->lock);
+        uint32_t index = state->next < state->count ? state->next++ : state->count;
+        pthread_mutex_unlock(&state->lock);
+
+        if (index == state->count) {
+            break;
+        }
+
+        wsp_t w;
+        wsp_error_t e;
+
+        WSP_INIT(&w);
+        WSP_ERROR_INIT(&e);
+
+        wsp_return_t result = wsp_open(&w, state->paths[index], WSP_MMAP, &e);
+
+        if (result == WSP_OK) {
+            result = __wsp_fetch_read(&w, state->from, state->until, state->now, state->series + index, &e);
+
+            wsp_error_t ignored;
+            WSP_ERROR_INIT(&ignored);
+
+            wsp_close(&w, &ignored);
+        }
+
+        if (result == WSP_ERROR) {
+            pthread_mutex_lock(&state->lock);
+            state->failed++;
+            state->error = e;
+            pthread_mutex_unlock(&state->lock);
+        }
+    }
+
+    return NULL;
+} // __wsp_fetch_worker }}}
+
+// __wsp_fetch_consolidate {{{
+/*
+ * Consolidate the points of a series falling into every step of the time
+ * axis into one value.
+ */
+static void __wsp_fetch_consolidate(
+    wsp_fetch_series_t *series,
+    wsp_time_t from,
+    uint32_t step,
+    double *row
+)
+{
+    uint32_t known = 0;
+    double sum = 0, min = 0, max = 0, last = 0;
+    uint32_t column = (series->from - from) / step;
+    uint32_t i;
+
+    for (i = 0; i <= series->count; i++) {
+        uint32_t c = i < series->count ? (series->from + i * series->step - from) / step : column + 1;
+
+        if (c != column) {
+            if (known > 0) {
+                switch (series->aggregation) {
+                case WSP_SUM:
+                    row[column] = sum;
+                    break;
+                case WSP_LAST:
+                    row[column] = last;
+                    break;
+                case WSP_MAX:
+                    row[column] = max;
+                    break;
+                case WSP_MIN:
+                    row[column] = min;
+                    break;
+                default:
+                    row[column] = sum / known;
+                    break;
+                }
+            }
+
+            column = c;
+            known = 0;
+            sum = 0;
+        }
+
+        if (i == series->count) {
+            break;
+        }
+
+        double v = series->values[i];
+
+        if (isnan(v)) {
+            continue;
+        }
+
+        min = known == 0 || v < min ? v : min;
+        max = known == 0 || v > max ? v : max;
+        sum += v;
+        last = v;
+        known++;
+    }
+} // __wsp_fetch_consolidate }}}
+
+// __wsp_fetch_axis {{{
+static uint64_t __wsp_gcd(uint64_t a, uint64_t b)
+{
+    while (b != 0) {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/*
+ * Put the series on a single time axis.
+ */
+static wsp_return_t __wsp_fetch_axis(
+    wsp_fetch_t *f,
+    wsp_fetch_series_t *series,
+    uint32_t count,
+    wsp_error_t *e
+)
+{
+    uint64_t step = 0;
+    uint64_t from = 0;
+    uint64_t until = 0;
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        wsp_fetch_series_t *s = series + i;
+
+        if (s->count == 0) {
+            continue;
+        }
+
+        uint64_t end = (uint64_t)s->from + (uint64_t)s->count * s->step;
+
+        if (step == 0) {
+            step = s->step;
+            from = s->from;
+            until = end;
+            continue;
+        }
+
+        step = step / __wsp_gcd(step, s->step) * s->step;
+        from = s->from < from ? s->from : from;
+        until = end > until ? end : until;
+
+        if (step > UINT32_MAX) {
+            e->type = WSP_ERROR_TIME_INTERVAL;
+            return WSP_ERROR;
+        }
+    }
+
+    if (step == 0) {
+        return WSP_OK;
+    }
+
+    from -= from % step;
+    until += (step - until % step) % step;
+
+    uint64_t points = (until - from) / step;
+    uint64_t size = points * count;
+
+    if (size > SIZE_MAX / sizeof(double)) {
+        e->type = WSP_ERROR_MALLOC;
+        return WSP_ERROR;
+    }
+
+    f->values = malloc(sizeof(double) * size);
+
+    if (f->values == NULL) {
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    f->from = (wsp_time_t)from;
+    f->step = (uint32_t)step;
+    f->points_count = (uint32_t)points;
+
+    uint64_t j;
+
+    for (j = 0; j < size; j++) {
+        f->values[j] = NAN;
+    }
+
+    for (i = 0; i < count; i++) {
+        wsp_fetch_series_t *s = series + i;
+        double *row = f->values + (uint64_t)i * points;
+
+        if (s->count == 0) {
+            continue;
+        }
+
+        if (s->step == step) {
+            memcpy(row + (s->from - from) / step, s->values, sizeof(double) * s->count);
+        }
+        else {
+            __wsp_fetch_consolidate(s, f->from, f->step, row);
+        }
+    }
+
+    return WSP_OK;
+} // __wsp_fetch_axis }}}
+
+// wsp_fetch_many {{{
+wsp_return_t wsp_fetch_many(
+    wsp_fetch_t *f,
+    const char **paths,
+    uint32_t count,
+    wsp_time_t from,
+    wsp_time_t until,
+    uint32_t threads_count,
+    wsp_error_t *e
+)
+{
+    WSP_FETCH_INIT(f);
+
+    if (threads_count == 0) {
+        e->type = WSP_ERROR_INVALID;
+        return WSP_ERROR;
+    }
+
+    if (from > until) {
+        e->type = WSP_ERROR_TIME_INTERVAL;
+        return WSP_ERROR;
+    }
+
+    f->series_count = count;
+
+    if (count == 0) {
+        return WSP_OK;
+    }
+
+    if (threads_count > count) {
+        threads_count = count;
+    }
+
+    wsp_fetch_state_t state;
+    memset(&state, 0, sizeof(state));
+
+    state.paths = paths;
+    state.count = count;
+    state.from = from;
+    state.until = until;
+    state.now = wsp_time_now();
+    WSP_ERROR_INIT(&state.error);
+
+    state.series = calloc(count, sizeof(wsp_fetch_series_t));
+    pthread_t *threads = malloc(sizeof(pthread_t) * threads_count);
+
+    if (state.series == NULL || threads == NULL) {
+        free(state.series);
+        free(threads);
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    wsp_return_t result = WSP_OK;
+    uint32_t started = 0;
+    int error = pthread_mutex_init(&state.lock, NULL);
+
+    if (error != 0) {
+        e->type = WSP_ERROR_THREAD;
+        e->syserr = error;
+        result = WSP_ERROR;
+    }
+    else {
+        for (started = 0; started < threads_count; started++) {
+            error = pthread_create(threads + started, NULL, __wsp_fetch_worker, &state);
+
+            if (error != 0) {
+                break;
+            }
+        }
+
+        // the threads that did start do all the work.
+        if (started == 0) {
+            e->type = WSP_ERROR_THREAD;
+            e->syserr = error;
+            result = WSP_ERROR;
+        }
+
+        uint32_t i;
+
+        for (i = 0; i < started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+
+        pthread_mutex_destroy(&state.lock);
+    }
+
+    if (result == WSP_OK) {
+        f->failed = state.failed;
+        f->error = state.error;
+
+        result = __wsp_fetch_axis(f, state.series, count, e);
+    }
+
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        free(state.series[i].values);
+    }
+
+    free(state.series);
+    free(threads);
+
+    if (result == WSP_ERROR) {
+        wsp_fetch_free(f);
+    }
+
+    return result;
+} // wsp_fetch_many }}}
+
+// wsp_fetch_free {{{
+void wsp_fetch_free(
+    wsp_fetch_t *f
+)
+{
+    free(f->values);
+    f->values = NULL;
+    f->points_count = 0;
+} // wsp_fetch_free }}}
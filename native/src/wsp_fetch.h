@@ -0,0 +1,97 @@
+// vim: foldmethod=marker
+/**
+ * Fetching many databases at once.
+ *
+ * Every database is fetched with wsp_fetch, like whisper.py's fetch does:
+ * the time range is clamped to its retention and to now, and read from the
+ * most precise archive covering it. Databases are opened and read
+ * concurrently by a number of threads.
+ *
+ * The series are then put on a single time axis, whose step is the least
+ * common multiple of the steps of all series. A series with a smaller step
+ * is consolidated using the aggregation method of its database, from all of
+ * its known points in every step.
+ *
+ * Example:
+ *
+ *   wsp_fetch_t f;
+ *
+ *   if (wsp_fetch_many(&f, paths, 300, from, until, 16, &e) == WSP_ERROR) {
+ *       return 1;
+ *   }
+ *
+ *   // series i has the value f.values[i * f.points_count + j] at
+ *   // f.from + j * f.step, NAN if unknown.
+ *
+ *   wsp_fetch_free(&f);
+ */
+#ifndef _WSP_FETCH_H_
+#define _WSP_FETCH_H_
+
+#include "wsp.h"
+
+struct wsp_fetch_t;
+
+typedef struct wsp_fetch_t wsp_fetch_t;
+
+struct wsp_fetch_t {
+    // time axis, the first interval and the step between intervals.
+    wsp_time_t from;
+    uint32_t step;
+    // number of intervals.
+    uint32_t points_count;
+    // number of series, one for each path.
+    uint32_t series_count;
+    // values, one row of points_count values per series, NAN if unknown.
+    double *values;
+    // number of series that could not be fetched, their values are all NAN,
+    // and the error of the last of them.
+    uint32_t failed;
+    wsp_error_t error;
+};
+
+#define WSP_FETCH_INIT(f) do {\
+    (f)->from = 0;\
+    (f)->step = 0;\
+    (f)->points_count = 0;\
+    (f)->series_count = 0;\
+    (f)->values = NULL;\
+    (f)->failed = 0;\
+    WSP_ERROR_INIT(&(f)->error);\
+} while (0)
+
+/**
+ * Fetch a time range of many databases.
+ *
+ * Databases that can not be fetched, for example because they do not exist,
+ * are counted in failed rather than failing the whole fetch. The time axis is
+ * empty if no database could be fetched.
+ *
+ * f: Where to store the result, must be freed with wsp_fetch_free.
+ * paths: Paths of the databases.
+ * count: Number of paths.
+ * from: Start of the time range.
+ * until: End of the time range.
+ * threads_count: Number of threads reading databases.
+ * e: Error object.
+ */
+wsp_return_t wsp_fetch_many(
+    wsp_fetch_t *f,
+    const char **paths,
+    uint32_t count,
+    wsp_time_t from,
+    wsp_time_t until,
+    uint32_t threads_count,
+    wsp_error_t *e
+);
+
+/**
+ * Free the values of a fetch.
+ *
+ * f: Fetch to free.
+ */
+void wsp_fetch_free(
+    wsp_fetch_t *f
+);
+
+#endif /* _WSP_FETCH_H_ */
@@ -0,0 +1,358 @@
+// vim: foldmethod=marker
+#include "wsp_flush.h"
+#include "wsp_private.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+// __wsp_flush_wait {{{
+/*
+ * Wait for the next job of a worker, at most until its databases must be
+ * synced to keep the interval of the group commit policy. Returns 0 if the
+ * wait timed out and the databases were synced instead.
+ */
+static int __wsp_flush_wait(
+    wsp_flush_shard_t *shard
+)
+{
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    int64_t timeout = -1;
+
+    wsp_pool_sync_timeout(&shard->pool, &timeout, &e);
+
+    if (timeout < 0) {
+        while (sem_wait(&shard->items) == -1) {
+            /* interrupted by a signal */
+        }
+
+        return 1;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000;
+
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    while (sem_timedwait(&shard->items, &deadline) == -1) {
+        if (errno != ETIMEDOUT) {
+            /* interrupted by a signal */
+            continue;
+        }
+
+        if (wsp_pool_sync(&shard->pool, &e) == WSP_ERROR) {
+            shard->failed++;
+            shard->error = e;
+        }
+
+        return 0;
+    }
+
+    return 1;
+} // __wsp_flush_wait }}}
+
+// __wsp_flush_worker {{{
+static void *__wsp_flush_worker(void *arg)
+{
+    wsp_flush_shard_t *shard = arg;
+
+    for (;;) {
+        if (!__wsp_flush_wait(shard)) {
+            continue;
+        }
+
+        wsp_flush_job_t job = shard->jobs[shard->head];
+        shard->head = (shard->head + 1) % shard->size;
+
+        sem_post(&shard->slots);
+
+        if (job.path == NULL) {
+            break;
+        }
+
+        wsp_error_t e;
+        WSP_ERROR_INIT(&e);
+
+        wsp_t *w = NULL;
+
+        if (wsp_pool_acquire(&shard->pool, job.path, &w, &e) == WSP_OK
+            && wsp_update_many(w, job.points, job.count, &e) == WSP_OK) {
+            shard->written += job.count;
+
+            // the points are written, a failed group commit is retried.
+            if (wsp_pool_release(&shard->pool, w, &e) == WSP_ERROR) {
+                shard->failed++;
+                shard->error = e;
+            }
+        }
+        else {
+            shard->failed++;
+            shard->error = e;
+
+            // the file might be damaged, re-open it next time.
+            if (w != NULL) {
+                wsp_pool_discard(&shard->pool, w);
+            }
+        }
+
+        free(job.path);
+        free(job.points);
+    }
+
+    return NULL;
+} // __wsp_flush_worker }}}
+
+// __wsp_flush_push {{{
+static void __wsp_flush_push(
+    wsp_flush_shard_t *shard,
+    wsp_flush_job_t *job
+)
+{
+    while (sem_wait(&shard->slots) == -1) {
+        /* interrupted by a signal */
+    }
+
+    shard->jobs[shard->tail] = *job;
+    shard->tail = (shard->tail + 1) % shard->size;
+
+    sem_post(&shard->items);
+} // __wsp_flush_push }}}
+
+// __wsp_flush_join {{{
+/*
+ * Stop and release the first count shards.
+ */
+static void __wsp_flush_join(
+    wsp_flush_t *f,
+    uint32_t count
+)
+{
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        wsp_flush_job_t stop = { .path = NULL, .points = NULL, .count = 0 };
+        __wsp_flush_push(f->shards + i, &stop);
+    }
+
+    for (i = 0; i < count; i++) {
+        wsp_flush_shard_t *shard = f->shards + i;
+
+        pthread_join(shard->thread, NULL);
+        sem_destroy(&shard->items);
+        sem_destroy(&shard->slots);
+        free(shard->jobs);
+    }
+} // __wsp_flush_join }}}
+
+// wsp_flush_start {{{
+wsp_return_t wsp_flush_start(
+    wsp_flush_t *f,
+    uint32_t shards_count,
+    uint32_t queue_size,
+    wsp_mapping_t mapping,
+    wsp_error_t *e
+)
+{
+    if (shards_count == 0 || queue_size == 0) {
+        e->type = WSP_ERROR_INVALID;
+        return WSP_ERROR;
+    }
+
+    f->shards = calloc(shards_count, sizeof(wsp_flush_shard_t));
+
+    if (f->shards == NULL) {
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    uint32_t i;
+
+    for (i = 0; i < shards_count; i++) {
+        wsp_flush_shard_t *shard = f->shards + i;
+
+        shard->jobs = malloc(sizeof(wsp_flush_job_t) * queue_size);
+
+        if (shard->jobs == NULL) {
+            e->type = WSP_ERROR_MALLOC;
+            e->syserr = errno;
+            break;
+        }
+
+        shard->size = queue_size;
+        WSP_ERROR_INIT(&shard->error);
+
+        if (wsp_pool_init(&shard->pool, WSP_FLUSH_HANDLES, WSP_FLUSH_HANDLES, mapping, e) == WSP_ERROR) {
+            free(shard->jobs);
+            break;
+        }
+
+        // workers update single points at random offsets.
+        shard->pool.io_flags = WSP_IO_RANDOM;
+
+        if (sem_init(&shard->items, 0, 0) == -1) {
+            e->type = WSP_ERROR_THREAD;
+            e->syserr = errno;
+            wsp_pool_free(&shard->pool, &shard->error);
+            free(shard->jobs);
+            break;
+        }
+
+        if (sem_init(&shard->slots, 0, queue_size) == -1) {
+            e->type = WSP_ERROR_THREAD;
+            e->syserr = errno;
+            sem_destroy(&shard->items);
+            wsp_pool_free(&shard->pool, &shard->error);
+            free(shard->jobs);
+            break;
+        }
+
+        int error = pthread_create(&shard->thread, NULL, __wsp_flush_worker, shard);
+
+        if (error != 0) {
+            e->type = WSP_ERROR_THREAD;
+            e->syserr = error;
+            sem_destroy(&shard->items);
+            sem_destroy(&shard->slots);
+            wsp_pool_free(&shard->pool, &shard->error);
+            free(shard->jobs);
+            break;
+        }
+    }
+
+    if (i < shards_count) {
+        uint32_t count = i;
+
+        __wsp_flush_join(f, count);
+
+        for (i = 0; i < count; i++) {
+            wsp_pool_free(&f->shards[i].pool, &f->shards[i].error);
+        }
+
+        free(f->shards);
+        f->shards = NULL;
+        return WSP_ERROR;
+    }
+
+    f->shards_count = shards_count;
+    return WSP_OK;
+} // wsp_flush_start }}}
+
+// wsp_flush_submit {{{
+wsp_return_t wsp_flush_submit(
+    wsp_flush_t *f,
+    char *path,
+    wsp_point_t *points,
+    uint32_t count,
+    wsp_error_t *e
+)
+{
+    if (f->shards == NULL) {
+        e->type = WSP_ERROR_NOT_INITIALIZED;
+        return WSP_ERROR;
+    }
+
+    wsp_flush_shard_t *shard = f->shards + __wsp_hash_path(path) % f->shards_count;
+    wsp_flush_job_t job = { .path = path, .points = points, .count = count };
+
+    __wsp_flush_push(shard, &job);
+    return WSP_OK;
+} // wsp_flush_submit }}}
+
+// wsp_flush_sync_policy {{{
+wsp_return_t wsp_flush_sync_policy(
+    wsp_flush_t *f,
+    uint32_t interval,
+    uint64_t bytes,
+    wsp_error_t *e
+)
+{
+    if (f->shards == NULL) {
+        e->type = WSP_ERROR_NOT_INITIALIZED;
+        return WSP_ERROR;
+    }
+
+    // rounded up, so that a limit never becomes 0, which means no limit.
+    uint64_t shard_bytes = (bytes + f->shards_count - 1) / f->shards_count;
+    uint32_t i;
+
+    for (i = 0; i < f->shards_count; i++) {
+        if (wsp_pool_sync_policy(&f->shards[i].pool, interval, shard_bytes, e) == WSP_ERROR) {
+            return WSP_ERROR;
+        }
+    }
+
+    return WSP_OK;
+} // wsp_flush_sync_policy }}}
+
+// wsp_flush_cache {{{
+static wsp_return_t __wsp_flush_writer(
+    void *data,
+    char *path,
+    wsp_point_t *points,
+    uint32_t count,
+    wsp_error_t *e
+)
+{
+    // on failure, the points stay in the cache.
+    return wsp_flush_submit((wsp_flush_t *)data, path, points, count, e);
+}
+
+wsp_return_t wsp_flush_cache(
+    wsp_flush_t *f,
+    wsp_cache_t *c,
+    uint32_t max_entries,
+    wsp_error_t *e
+)
+{
+    return wsp_cache_drain(c, max_entries, __wsp_flush_writer, f, e);
+} // wsp_flush_cache }}}
+
+// wsp_flush_stop {{{
+wsp_return_t wsp_flush_stop(
+    wsp_flush_t *f,
+    wsp_error_t *e
+)
+{
+    if (f->shards == NULL) {
+        e->type = WSP_ERROR_NOT_INITIALIZED;
+        return WSP_ERROR;
+    }
+
+    __wsp_flush_join(f, f->shards_count);
+
+    wsp_return_t result = WSP_OK;
+    uint32_t i;
+
+    for (i = 0; i < f->shards_count; i++) {
+        wsp_flush_shard_t *shard = f->shards + i;
+
+        if (shard->failed > 0) {
+            *e = shard->error;
+            result = WSP_ERROR;
+        }
+
+        wsp_error_t error;
+        WSP_ERROR_INIT(&error);
+
+        // syncs the databases if a group commit policy is set.
+        if (wsp_pool_free(&shard->pool, &error) == WSP_ERROR) {
+            *e = error;
+            result = WSP_ERROR;
+        }
+    }
+
+    free(f->shards);
+    f->shards = NULL;
+    f->shards_count = 0;
+    return result;
+} // wsp_flush_stop }}}
@@ -0,0 +1,174 @@
+// vim: foldmethod=marker
+/**
+ * Multi-threaded flush engine.
+ *
+ * Database paths are sharded across worker threads by hash, so that every
+ * database is only ever written by one thread. Each worker owns a pool of
+ * open handles (see wsp_pool.h), so workers never contend for them, and
+ * receives batches of points through a bounded single-producer,
+ * single-consumer queue, which needs no locks.
+ *
+ * Example:
+ *
+ *   wsp_flush_t f;
+ *
+ *   if (wsp_flush_start(&f, 8, 1024, WSP_MMAP, &e) == WSP_ERROR) {
+ *       return 1;
+ *   }
+ *
+ *   // optionally, sync written points within a second, even once no more
+ *   // points are submitted.
+ *   wsp_flush_sync_policy(&f, 1000, 0, &e);
+ *
+ *   // hand over everything pending in a cache.
+ *   wsp_flush_cache(&f, &c, 0, &e);
+ *
+ *   wsp_flush_stop(&f, &e);
+ *
+ * All submissions must be made from the same thread.
+ */
+#ifndef _WSP_FLUSH_H_
+#define _WSP_FLUSH_H_
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "wsp.h"
+#include "wsp_cache.h"
+#include "wsp_pool.h"
+
+struct wsp_flush_job_t;
+struct wsp_flush_shard_t;
+struct wsp_flush_t;
+
+typedef struct wsp_flush_job_t wsp_flush_job_t;
+typedef struct wsp_flush_shard_t wsp_flush_shard_t;
+typedef struct wsp_flush_t wsp_flush_t;
+
+/**
+ * Maximum number of databases a worker keeps open.
+ */
+#define WSP_FLUSH_HANDLES 64
+
+struct wsp_flush_job_t {
+    // path of the database, NULL tells the worker to stop.
+    char *path;
+    wsp_point_t *points;
+    uint32_t count;
+};
+
+struct wsp_flush_shard_t {
+    pthread_t thread;
+    // number of queued jobs.
+    sem_t items;
+    // number of free queue slots.
+    sem_t slots;
+    // queue of jobs.
+    wsp_flush_job_t *jobs;
+    // size of queue.
+    uint32_t size;
+    // next job to take, only touched by the worker.
+    uint32_t head;
+    // next slot to fill, only touched by the submitting thread.
+    uint32_t tail;
+    // open handles, only used by the worker.
+    wsp_pool_t pool;
+    // number of points written.
+    uint64_t written;
+    // number of jobs that failed.
+    uint64_t failed;
+    // last error encountered by the worker.
+    wsp_error_t error;
+};
+
+struct wsp_flush_t {
+    wsp_flush_shard_t *shards;
+    uint32_t shards_count;
+};
+
+/**
+ * Start a flush engine.
+ *
+ * f: Flush engine to start.
+ * shards_count: Number of worker threads.
+ * queue_size: Number of jobs that can be queued for each worker.
+ * mapping: The file mapping method to use when opening databases.
+ * e: Error object.
+ */
+wsp_return_t wsp_flush_start(
+    wsp_flush_t *f,
+    uint32_t shards_count,
+    uint32_t queue_size,
+    wsp_mapping_t mapping,
+    wsp_error_t *e
+);
+
+/**
+ * Queue points to be written to a database by the worker owning its path.
+ *
+ * Ownership of path and points, which must have been allocated with malloc(),
+ * is transferred to the engine. Blocks if the queue of the worker is full.
+ *
+ * f: Flush engine.
+ * path: Path of the database.
+ * points: Points to write.
+ * count: Number of points.
+ * e: Error object.
+ */
+wsp_return_t wsp_flush_submit(
+    wsp_flush_t *f,
+    char *path,
+    wsp_point_t *points,
+    uint32_t count,
+    wsp_error_t *e
+);
+
+/**
+ * Set the group commit policy of the workers, see wsp_pool_sync_policy.
+ *
+ * Each worker syncs its own databases, the bytes limit is split evenly
+ * between them. A worker waiting for jobs wakes up when the interval expires
+ * to sync its databases, so that the interval also holds without traffic.
+ *
+ * f: Flush engine.
+ * interval: Maximum time between groups in milliseconds, 0 means no limit.
+ * bytes: Maximum number of unsynced bytes, 0 means no limit.
+ * e: Error object.
+ */
+wsp_return_t wsp_flush_sync_policy(
+    wsp_flush_t *f,
+    uint32_t interval,
+    uint64_t bytes,
+    wsp_error_t *e
+);
+
+/**
+ * Move pending points from a cache to the workers, the largest backlogs
+ * first.
+ *
+ * f: Flush engine.
+ * c: Cache to take pending points from.
+ * max_entries: Maximum number of databases to submit, 0 means all.
+ * e: Error object.
+ */
+wsp_return_t wsp_flush_cache(
+    wsp_flush_t *f,
+    wsp_cache_t *c,
+    uint32_t max_entries,
+    wsp_error_t *e
+);
+
+/**
+ * Write all queued jobs, stop the workers and close their databases.
+ *
+ * Fails with the last error encountered by any worker, if any job failed.
+ *
+ * f: Flush engine to stop.
+ * e: Error object.
+ */
+wsp_return_t wsp_flush_stop(
+    wsp_flush_t *f,
+    wsp_error_t *e
+);
+
+#endif /* _WSP_FLUSH_H_ */
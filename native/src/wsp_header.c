@@ -0,0 +1,328 @@
+// vim: foldmethod=marker
+#include "wsp_header.h"
+#include "wsp_private.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/*
+ * Number of buckets of the cache.
+ */
+#define WSP_HEADER_BUCKETS 4096
+
+static struct {
+    pthread_mutex_t lock;
+    int enabled;
+    // maximum number of idle headers.
+    uint32_t size;
+    // headers of files that are not open, most recently released first.
+    wsp_header_t *idle_head;
+    wsp_header_t *idle_tail;
+    uint32_t idle_count;
+    wsp_header_t *buckets[WSP_HEADER_BUCKETS];
+} __wsp_headers = { PTHREAD_MUTEX_INITIALIZER };
+
+// __wsp_header_hash {{{
+static uint32_t __wsp_header_hash(
+    dev_t dev,
+    ino_t ino
+)
+{
+    uint64_t h = ((uint64_t)ino * 0x9e3779b97f4a7c15ull) ^ (uint64_t)dev;
+    return (uint32_t)(h >> 32) ^ (uint32_t)h;
+} // __wsp_header_hash }}}
+
+// __wsp_header_find {{{
+static wsp_header_t *__wsp_header_find(
+    wsp_header_t *key
+)
+{
+    wsp_header_t *h = __wsp_headers.buckets[key->hash % WSP_HEADER_BUCKETS];
+
+    for (; h != NULL; h = h->next) {
+        if (h->dev == key->dev
+            && h->ino == key->ino
+            && h->size == key->size
+            && h->mtime == key->mtime
+            && h->mtime_nsec == key->mtime_nsec) {
+            return h;
+        }
+    }
+
+    return NULL;
+} // __wsp_header_find }}}
+
+// idle list {{{
+static void __wsp_header_idle_remove(
+    wsp_header_t *h
+)
+{
+    if (h->idle_prev != NULL) {
+        h->idle_prev->idle_next = h->idle_next;
+    }
+    else {
+        __wsp_headers.idle_head = h->idle_next;
+    }
+
+    if (h->idle_next != NULL) {
+        h->idle_next->idle_prev = h->idle_prev;
+    }
+    else {
+        __wsp_headers.idle_tail = h->idle_prev;
+    }
+
+    h->idle_prev = NULL;
+    h->idle_next = NULL;
+    __wsp_headers.idle_count--;
+} // __wsp_header_idle_remove
+
+static void __wsp_header_idle_push(
+    wsp_header_t *h
+)
+{
+    h->idle_prev = NULL;
+    h->idle_next = __wsp_headers.idle_head;
+
+    if (__wsp_headers.idle_head != NULL) {
+        __wsp_headers.idle_head->idle_prev = h;
+    }
+    else {
+        __wsp_headers.idle_tail = h;
+    }
+
+    __wsp_headers.idle_head = h;
+    __wsp_headers.idle_count++;
+} // __wsp_header_idle_push
+// }}}
+
+/*
+ * Remove an unused header from its bucket and free it.
+ */
+// __wsp_header_free {{{
+static void __wsp_header_free(
+    wsp_header_t *h
+)
+{
+    wsp_header_t **link = __wsp_headers.buckets + h->hash % WSP_HEADER_BUCKETS;
+
+    while (*link != h) {
+        link = &(*link)->next;
+    }
+
+    *link = h->next;
+
+    free(h->archives);
+    free(h);
+} // __wsp_header_free }}}
+
+/*
+ * Free the least recently released headers until at most size are left.
+ */
+// __wsp_header_evict {{{
+static void __wsp_header_evict(
+    uint32_t size
+)
+{
+    while (__wsp_headers.idle_count > size) {
+        wsp_header_t *h = __wsp_headers.idle_tail;
+        __wsp_header_idle_remove(h);
+        __wsp_header_free(h);
+    }
+} // __wsp_header_evict }}}
+
+/*
+ * Take a reference to a header and use it for a handle.
+ */
+// __wsp_header_use {{{
+static void __wsp_header_use(
+    wsp_t *w,
+    wsp_header_t *h
+)
+{
+    if (h->refs++ == 0) {
+        __wsp_header_idle_remove(h);
+    }
+
+    w->meta = h->meta;
+    w->archives = h->archives;
+    w->archives_size = sizeof(wsp_archive_t) * h->meta.archives_count;
+    w->archives_count = h->meta.archives_count;
+    w->header = h;
+} // __wsp_header_use }}}
+
+/*
+ * Read the header of the file open in a handle into it.
+ */
+// __wsp_header_read {{{
+static wsp_return_t __wsp_header_read(
+    wsp_t *w,
+    wsp_error_t *e
+)
+{
+    wsp_metadata_t meta;
+    WSP_METADATA_INIT(&meta);
+
+    if (__wsp_read_metadata(w, &meta, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    w->meta = meta;
+
+    w->archives = NULL;
+    w->archives_size = sizeof(wsp_archive_t) * meta.archives_count;
+    w->archives_count = 0;
+
+    return __wsp_load_archives(w, e);
+} // __wsp_header_read }}}
+
+// __wsp_header_open {{{
+wsp_return_t __wsp_header_open(
+    wsp_t *w,
+    wsp_error_t *e
+)
+{
+    pthread_mutex_lock(&__wsp_headers.lock);
+    int enabled = __wsp_headers.enabled;
+    pthread_mutex_unlock(&__wsp_headers.lock);
+
+    if (!enabled) {
+        return __wsp_header_read(w, e);
+    }
+
+    struct stat st;
+    int fd = w->io_fileno != -1 ? w->io_fileno : fileno(w->io_fd);
+
+    if (fstat(fd, &st) == -1) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    wsp_header_t key;
+    key.dev = st.st_dev;
+    key.ino = st.st_ino;
+    key.size = st.st_size;
+    key.mtime = st.st_mtim.tv_sec;
+    key.mtime_nsec = st.st_mtim.tv_nsec;
+    key.hash = __wsp_header_hash(st.st_dev, st.st_ino);
+
+    pthread_mutex_lock(&__wsp_headers.lock);
+
+    wsp_header_t *h = __wsp_header_find(&key);
+
+    if (h != NULL) {
+        __wsp_header_use(w, h);
+        pthread_mutex_unlock(&__wsp_headers.lock);
+        return WSP_OK;
+    }
+
+    pthread_mutex_unlock(&__wsp_headers.lock);
+
+    // parse the header without holding the lock, and share it afterwards.
+    if (__wsp_header_read(w, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    wsp_header_t *entry = malloc(sizeof(wsp_header_t));
+
+    if (entry == NULL) {
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    *entry = key;
+    entry->meta = w->meta;
+    entry->archives = w->archives;
+    entry->refs = 0;
+    entry->next = NULL;
+    entry->idle_prev = NULL;
+    entry->idle_next = NULL;
+
+    pthread_mutex_lock(&__wsp_headers.lock);
+
+    if (!__wsp_headers.enabled) {
+        // disabled in the meantime, the handle keeps its own copy.
+        pthread_mutex_unlock(&__wsp_headers.lock);
+        free(entry);
+        return WSP_OK;
+    }
+
+    // another thread might have parsed the same header in the meantime.
+    h = __wsp_header_find(&key);
+
+    if (h != NULL) {
+        __wsp_header_use(w, h);
+        pthread_mutex_unlock(&__wsp_headers.lock);
+        free(entry->archives);
+        free(entry);
+        return WSP_OK;
+    }
+
+    wsp_header_t **bucket = __wsp_headers.buckets + key.hash % WSP_HEADER_BUCKETS;
+    entry->next = *bucket;
+    *bucket = entry;
+
+    // not idle, __wsp_header_use takes it off the idle list.
+    __wsp_header_idle_push(entry);
+    __wsp_header_use(w, entry);
+
+    pthread_mutex_unlock(&__wsp_headers.lock);
+    return WSP_OK;
+} // __wsp_header_open }}}
+
+// __wsp_header_close {{{
+void __wsp_header_close(
+    wsp_t *w
+)
+{
+    wsp_header_t *h = w->header;
+
+    pthread_mutex_lock(&__wsp_headers.lock);
+
+    if (--h->refs == 0) {
+        if (__wsp_headers.enabled) {
+            __wsp_header_idle_push(h);
+            __wsp_header_evict(__wsp_headers.size);
+        }
+        else {
+            __wsp_header_free(h);
+        }
+    }
+
+    pthread_mutex_unlock(&__wsp_headers.lock);
+
+    w->header = NULL;
+    w->archives = NULL;
+    w->archives_count = 0;
+} // __wsp_header_close }}}
+
+// wsp_header_cache_enable {{{
+wsp_return_t wsp_header_cache_enable(
+    uint32_t size,
+    wsp_error_t *e
+)
+{
+    pthread_mutex_lock(&__wsp_headers.lock);
+    __wsp_headers.enabled = 1;
+    __wsp_headers.size = size;
+    __wsp_header_evict(size);
+    pthread_mutex_unlock(&__wsp_headers.lock);
+    return WSP_OK;
+} // wsp_header_cache_enable }}}
+
+// wsp_header_cache_disable {{{
+wsp_return_t wsp_header_cache_disable(
+    wsp_error_t *e
+)
+{
+    pthread_mutex_lock(&__wsp_headers.lock);
+    __wsp_headers.enabled = 0;
+    __wsp_headers.size = 0;
+    __wsp_header_evict(0);
+    pthread_mutex_unlock(&__wsp_headers.lock);
+    return WSP_OK;
+} // wsp_header_cache_disable }}}
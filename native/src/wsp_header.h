@@ -0,0 +1,75 @@
+// vim: foldmethod=marker
+/**
+ * Process-wide cache of parsed database headers.
+ *
+ * Headers are keyed on the identity of the file (device and inode) and on its
+ * size and modification time, so that a file that is rewritten or replaced is
+ * parsed again. Every handle open on a cached file shares the parsed header,
+ * which is never modified, and wsp_open does neither read nor allocate it.
+ *
+ * Writing points also changes the modification time of a file, so the cache
+ * mostly helps processes that read databases.
+ *
+ * Example:
+ *
+ *   if (wsp_header_cache_enable(10000, &e) == WSP_ERROR) {
+ *       return 1;
+ *   }
+ *
+ *   // ... wsp_open / wsp_close any number of databases ...
+ *
+ *   wsp_header_cache_disable(&e);
+ *
+ * The cache is thread-safe, and is disabled until enabled.
+ */
+#ifndef _WSP_HEADER_H_
+#define _WSP_HEADER_H_
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "wsp.h"
+
+struct wsp_header_t {
+    // identity of the file.
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    long mtime_nsec;
+    uint32_t hash;
+    // parsed header, shared by every handle of the file.
+    wsp_metadata_t meta;
+    wsp_archive_t *archives;
+    // number of open handles using the header.
+    uint32_t refs;
+    // next entry in the same bucket.
+    wsp_header_t *next;
+    // unused headers, least recently released last.
+    wsp_header_t *idle_prev;
+    wsp_header_t *idle_next;
+};
+
+/**
+ * Enable the header cache, or change the number of headers it keeps.
+ *
+ * size: Maximum number of headers kept for files that are not open. Headers
+ * of open files are always kept.
+ * e: Error object.
+ */
+wsp_return_t wsp_header_cache_enable(
+    uint32_t size,
+    wsp_error_t *e
+);
+
+/**
+ * Disable the header cache and release the headers of files that are not
+ * open. Headers of open files are released when they are closed.
+ *
+ * e: Error object.
+ */
+wsp_return_t wsp_header_cache_disable(
+    wsp_error_t *e
+);
+
+#endif /* _WSP_HEADER_H_ */
@@ -1,7 +1,9 @@
 #include "wsp_io_file.h"
+#include "wsp_private.h"
 
 #include <stdlib.h>
 #include <errno.h>
+#include <unistd.h>
 
 static int __wsp_io_open__file(
     wsp_t *w,
@@ -24,6 +26,8 @@ static int __wsp_io_open__file(
     w->io_manual_buf = 1;
     w->io = &wsp_io_file;
 
+    __wsp_io_fadvise(fileno(io_fd), w->io_flags);
+
     return WSP_OK;
 }
 
@@ -71,7 +75,7 @@ static int __wsp_io_read__file(
     }
 
     if (ftell(w->io_fd) != offset) {
-        if (!no_buffer) {
+        if (no_buffer) {
             free(tmp);
         }
 
@@ -81,7 +85,7 @@ static int __wsp_io_read__file(
     }
 
     if (fread(tmp, size, 1, w->io_fd) != 1) {
-        if (!no_buffer) {
+        if (no_buffer) {
             free(tmp);
         }
 
@@ -90,7 +94,7 @@ static int __wsp_io_read__file(
         return WSP_ERROR;
     }
 
-    if (!no_buffer) {
+    if (no_buffer) {
         *buf = tmp;
     }
 
@@ -125,9 +129,32 @@ static int __wsp_io_write__file(
     return WSP_OK;
 } // __wsp_io_write__file
 
+/*
+ * Sync function for WSP_FILE mappings, flushes the stream buffer before
+ * syncing the file.
+ *
+ * See wsp_io_sync_f for documentation on arguments.
+ */
+static int __wsp_io_sync__file(
+    wsp_t *w,
+    long offset,
+    size_t size,
+    wsp_error_t *e
+)
+{
+    if (fflush(w->io_fd) == EOF || fdatasync(fileno(w->io_fd)) == -1) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    return WSP_OK;
+} // __wsp_io_sync__file
+
 wsp_io wsp_io_file = {
     .open = __wsp_io_open__file,
     .close = __wsp_io_close__file,
     .read = __wsp_io_read__file,
-    .write = __wsp_io_write__file
+    .write = __wsp_io_write__file,
+    .sync = __wsp_io_sync__file
 };
@@ -1,10 +1,48 @@
+// madvise and MAP_POPULATE
+#define _DEFAULT_SOURCE
+
 #include "wsp_io_mmap.h"
 
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 
+/*
+ * Smallest mapping that is backed by huge pages when WSP_IO_HUGEPAGE is
+ * given, smaller ones could never fill one.
+ */
+#define WSP_HUGEPAGE_MIN (2 * 1024 * 1024)
+
+/*
+ * Apply the access hints of io_flags to a mapping. The hints are advisory,
+ * failures are ignored.
+ */
+static void __wsp_io_madvise__mmap(
+    void *addr,
+    size_t size,
+    int flags
+)
+{
+    if (flags & WSP_IO_RANDOM) {
+        madvise(addr, size, MADV_RANDOM);
+    }
+    else if (flags & WSP_IO_SEQUENTIAL) {
+        madvise(addr, size, MADV_SEQUENTIAL);
+    }
+
+    if (flags & WSP_IO_WILLNEED) {
+        madvise(addr, size, MADV_WILLNEED);
+    }
+
+#ifdef MADV_HUGEPAGE
+    if ((flags & WSP_IO_HUGEPAGE) && size >= WSP_HUGEPAGE_MIN) {
+        madvise(addr, size, MADV_HUGEPAGE);
+    }
+#endif /* MADV_HUGEPAGE */
+}
+
 static int __wsp_io_open__mmap(
     wsp_t *w,
     const char *path,
@@ -24,12 +62,21 @@ static int __wsp_io_open__mmap(
     int fn = fileno(io_fd);
 
     if (fstat(fn, &st) == -1) {
+        fclose(io_fd);
         e->type = WSP_ERROR_IO;
         e->syserr = errno;
         return WSP_ERROR;
     }
 
-    void *tmp = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fn, 0);
+    int flags = MAP_SHARED;
+
+#ifdef MAP_POPULATE
+    if (w->io_flags & WSP_IO_POPULATE) {
+        flags |= MAP_POPULATE;
+    }
+#endif /* MAP_POPULATE */
+
+    void *tmp = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, flags, fn, 0);
 
     if (tmp == MAP_FAILED) {
         fclose(io_fd);
@@ -38,6 +85,8 @@ static int __wsp_io_open__mmap(
         return WSP_ERROR;
     }
 
+    __wsp_io_madvise__mmap(tmp, st.st_size, w->io_flags);
+
     w->io_fd = io_fd;
     w->io_mmap = tmp;
     w->io_size = st.st_size;
@@ -100,9 +149,35 @@ static int __wsp_io_write__mmap(
     return WSP_OK;
 } // __wsp_io_write__mmap
 
+/*
+ * Sync function for WSP_MMAP mappings, writes back the pages of the range.
+ *
+ * See wsp_io_sync_f for documentation on arguments.
+ */
+static int __wsp_io_sync__mmap(
+    wsp_t *w,
+    long offset,
+    size_t size,
+    wsp_error_t *e
+)
+{
+    // msync needs a page aligned address.
+    long page = sysconf(_SC_PAGESIZE);
+    long aligned = offset - offset % page;
+
+    if (msync((char *)w->io_mmap + aligned, size + (offset - aligned), MS_SYNC) == -1) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    return WSP_OK;
+} // __wsp_io_sync__mmap
+
 wsp_io wsp_io_mmap = {
     .open = __wsp_io_open__mmap,
     .close = __wsp_io_close__mmap,
     .read = __wsp_io_read__mmap,
     .write = __wsp_io_write__mmap,
+    .sync = __wsp_io_sync__mmap,
 };
@@ -0,0 +1,330 @@
+// preadv and pwritev
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "wsp_io_pread.h"
+#include "wsp_private.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+/*
+ * Maximum number of buffers in a single preadv or pwritev call.
+ */
+#define WSP_PREAD_IOV 64
+
+/*
+ * Largest gap between two segments of a vectored read which is read into a
+ * scratch buffer, rather than splitting the read in two calls.
+ */
+#define WSP_PREAD_GAP 4096
+
+static int __wsp_io_open__pread(
+    wsp_t *w,
+    const char *path,
+    wsp_error_t *e
+)
+{
+    int fd = open(path, O_RDWR);
+
+    if (fd == -1) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    w->io_fd = NULL;
+    w->io_fileno = fd;
+    w->io_mmap = NULL;
+    w->io_size = 0;
+    w->io_mapping = WSP_PREAD;
+    w->io_manual_buf = 1;
+
+    __wsp_io_fadvise(fd, w->io_flags);
+
+    return WSP_OK;
+}
+
+static int __wsp_io_close__pread(
+    wsp_t *w,
+    wsp_error_t *e
+)
+{
+    if (w->io_fileno != -1) {
+        close(w->io_fileno);
+        w->io_fileno = -1;
+    }
+
+    return WSP_OK;
+}
+
+/*
+ * Reader function for WSP_PREAD mappings.
+ *
+ * Reads into the given buffer if there is one, since no file position is
+ * used, concurrent reads of the same database are safe.
+ *
+ * See wsp_read_f for documentation on arguments.
+ */
+static int __wsp_io_read__pread(
+    wsp_t *w,
+    long offset,
+    size_t size,
+    void **buf,
+    wsp_error_t *e
+)
+{
+    char *tmp = *buf;
+
+    if (tmp == NULL) {
+        tmp = malloc(size);
+
+        if (tmp == NULL) {
+            e->type = WSP_ERROR_MALLOC;
+            e->syserr = errno;
+            return WSP_ERROR;
+        }
+    }
+
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t n = pread(w->io_fileno, tmp + done, size - done, offset + done);
+
+        if (n > 0) {
+            done += n;
+            continue;
+        }
+
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (*buf == NULL) {
+            free(tmp);
+        }
+
+        // reading past the end of the file.
+        if (n == 0) {
+            e->type = WSP_ERROR_OFFSET;
+            e->syserr = 0;
+            return WSP_ERROR;
+        }
+
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    *buf = tmp;
+    return WSP_OK;
+} // __wsp_io_read__pread
+
+/*
+ * Writer function for WSP_PREAD mappings.
+ *
+ * See wsp_write_f for documentation on arguments.
+ */
+static int __wsp_io_write__pread(
+    wsp_t *w,
+    long offset,
+    size_t size,
+    void *buf,
+    wsp_error_t *e
+)
+{
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t n = pwrite(w->io_fileno, (char *)buf + done, size - done, offset + done);
+
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            e->type = WSP_ERROR_IO;
+            e->syserr = (n == -1) ? errno : 0;
+            return WSP_ERROR;
+        }
+
+        done += n;
+    }
+
+    return WSP_OK;
+} // __wsp_io_write__pread
+
+/*
+ * Transfer buffers from or to consecutive bytes of a file, continuing short
+ * transfers.
+ */
+static wsp_return_t __wsp_pread_transfer(
+    int fd,
+    struct iovec *vec,
+    int count,
+    off_t offset,
+    int write,
+    wsp_error_t *e
+)
+{
+    while (count > 0) {
+        ssize_t n = write ? pwritev(fd, vec, count, offset) : preadv(fd, vec, count, offset);
+
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (n == -1) {
+            e->type = WSP_ERROR_IO;
+            e->syserr = errno;
+            return WSP_ERROR;
+        }
+
+        // reading past the end of the file.
+        if (n == 0) {
+            e->type = write ? WSP_ERROR_IO : WSP_ERROR_OFFSET;
+            e->syserr = 0;
+            return WSP_ERROR;
+        }
+
+        offset += n;
+
+        while (count > 0 && (size_t)n >= vec->iov_len) {
+            n -= vec->iov_len;
+            vec++;
+            count--;
+        }
+
+        if (count > 0) {
+            vec->iov_base = (char *)vec->iov_base + n;
+            vec->iov_len -= n;
+        }
+    }
+
+    return WSP_OK;
+} // __wsp_pread_transfer
+
+/*
+ * Transfer segments, using a single call for every group of segments that
+ * follow each other in the file, with gaps of at most max_gap bytes read into
+ * a scratch buffer.
+ */
+static wsp_return_t __wsp_pread_transfer_v(
+    wsp_t *w,
+    wsp_iov_t *iov,
+    uint32_t count,
+    long max_gap,
+    int write,
+    wsp_error_t *e
+)
+{
+    char gap[WSP_PREAD_GAP];
+    struct iovec vec[WSP_PREAD_IOV];
+    uint32_t i = 0;
+
+    while (i < count) {
+        int n = 0;
+        long start = 0;
+        long end = 0;
+
+        for (; i < count; i++) {
+            if (iov[i].size == 0) {
+                continue;
+            }
+
+            if (n == 0) {
+                start = iov[i].offset;
+            }
+            else {
+                long distance = iov[i].offset - end;
+
+                if (distance < 0 || distance > max_gap || n + 2 > WSP_PREAD_IOV) {
+                    break;
+                }
+
+                if (distance > 0) {
+                    vec[n].iov_base = gap;
+                    vec[n].iov_len = distance;
+                    n++;
+                }
+            }
+
+            vec[n].iov_base = iov[i].buf;
+            vec[n].iov_len = iov[i].size;
+            n++;
+
+            end = iov[i].offset + iov[i].size;
+        }
+
+        if (n > 0 && __wsp_pread_transfer(w->io_fileno, vec, n, start, write, e) == WSP_ERROR) {
+            return WSP_ERROR;
+        }
+    }
+
+    return WSP_OK;
+} // __wsp_pread_transfer_v
+
+/*
+ * Vectored reader function for WSP_PREAD mappings.
+ *
+ * See wsp_readv_f for documentation on arguments.
+ */
+static int __wsp_io_readv__pread(
+    wsp_t *w,
+    wsp_iov_t *iov,
+    uint32_t count,
+    wsp_error_t *e
+)
+{
+    return __wsp_pread_transfer_v(w, iov, count, WSP_PREAD_GAP, 0, e);
+} // __wsp_io_readv__pread
+
+/*
+ * Vectored writer function for WSP_PREAD mappings.
+ *
+ * See wsp_writev_f for documentation on arguments.
+ */
+static int __wsp_io_writev__pread(
+    wsp_t *w,
+    wsp_iov_t *iov,
+    uint32_t count,
+    wsp_error_t *e
+)
+{
+    return __wsp_pread_transfer_v(w, iov, count, 0, 1, e);
+} // __wsp_io_writev__pread
+
+/*
+ * Sync function for WSP_PREAD mappings.
+ *
+ * See wsp_io_sync_f for documentation on arguments.
+ */
+static int __wsp_io_sync__pread(
+    wsp_t *w,
+    long offset,
+    size_t size,
+    wsp_error_t *e
+)
+{
+    if (fdatasync(w->io_fileno) == -1) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    return WSP_OK;
+} // __wsp_io_sync__pread
+
+wsp_io wsp_io_pread = {
+    .open = __wsp_io_open__pread,
+    .close = __wsp_io_close__pread,
+    .read = __wsp_io_read__pread,
+    .write = __wsp_io_write__pread,
+    .readv = __wsp_io_readv__pread,
+    .writev = __wsp_io_writev__pread,
+    .sync = __wsp_io_sync__pread
+};
@@ -0,0 +1,8 @@
+#ifndef _WSP_IO_PREAD_H_
+#define _WSP_IO_PREAD_H_
+
+#include "wsp.h"
+
+extern wsp_io wsp_io_pread;
+
+#endif /* _WSP_IO_PREAD_H_ */
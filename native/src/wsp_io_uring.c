@@ -0,0 +1,843 @@
+// vim: foldmethod=marker
+#define _GNU_SOURCE
+
+#include "wsp_io_uring.h"
+#include "wsp_private.h"
+
+#ifdef __linux__
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// system calls {{{
+static int __wsp_uring_setup(
+    uint32_t entries,
+    struct io_uring_params *p
+)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int __wsp_uring_enter(
+    int fd,
+    uint32_t to_submit,
+    uint32_t min_complete,
+    uint32_t flags
+)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+} // system calls }}}
+
+// __wsp_uring_overlaps {{{
+/*
+ * Check if a range of a file overlaps a queued or in flight write, in which
+ * case an operation on it has to wait for all earlier operations to complete.
+ */
+static int __wsp_uring_overlaps(
+    wsp_uring_t *ring,
+    wsp_uring_slot_t *op
+)
+{
+    uint32_t i;
+
+    for (i = 0; i < ring->entries; i++) {
+        wsp_uring_slot_t *slot = ring->slots + i;
+
+        if (slot == op || !slot->busy || !slot->write || slot->done || slot->fd != op->fd) {
+            continue;
+        }
+
+        if (slot->offset < op->offset + (long)op->length && op->offset < slot->offset + (long)slot->length) {
+            return 1;
+        }
+    }
+
+    return 0;
+} // __wsp_uring_overlaps }}}
+
+// __wsp_uring_reap {{{
+/*
+ * Process all available completions.
+ *
+ * Completed writes release their slot, while completed reads are left to be
+ * released by the reader.
+ */
+static void __wsp_uring_reap(
+    wsp_uring_t *ring
+)
+{
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = ring->cqes + (head & *ring->cq_mask);
+        wsp_uring_slot_t *slot = ring->slots + cqe->user_data;
+
+        slot->res = cqe->res;
+        slot->done = 1;
+        ring->inflight--;
+
+        if (!slot->write) {
+            continue;
+        }
+
+        if (ring->error.type == WSP_ERROR_NONE) {
+            if (slot->res < 0) {
+                ring->error.type = WSP_ERROR_IO;
+                ring->error.syserr = -slot->res;
+            }
+            else if ((size_t)slot->res != slot->length) {
+                ring->error.type = WSP_ERROR_IO;
+                ring->error.syserr = 0;
+            }
+        }
+
+        slot->busy = 0;
+        slot->next = ring->free_slots;
+        ring->free_slots = slot;
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+} // __wsp_uring_reap }}}
+
+// __wsp_uring_busy {{{
+/*
+ * Check if any operation on a file is queued or in flight, -1 means any file.
+ */
+static int __wsp_uring_busy(
+    wsp_uring_t *ring,
+    int fd
+)
+{
+    if (fd == -1) {
+        return ring->queued + ring->inflight > 0;
+    }
+
+    uint32_t i;
+
+    for (i = 0; i < ring->entries; i++) {
+        wsp_uring_slot_t *slot = ring->slots + i;
+
+        if (slot->busy && !slot->done && slot->fd == fd) {
+            return 1;
+        }
+    }
+
+    return 0;
+} // __wsp_uring_busy }}}
+
+// __wsp_uring_fail {{{
+/*
+ * Give up on a ring after a submission failed with syserr.
+ *
+ * Operations in flight might write into buffers of callers, so they are
+ * waited for, without submitting the queued ones, which are then never
+ * submitted.
+ */
+static wsp_return_t __wsp_uring_fail(
+    wsp_uring_t *ring,
+    int syserr,
+    wsp_error_t *e
+)
+{
+    if (!ring->failed) {
+        ring->failed = syserr;
+
+        for (;;) {
+            __wsp_uring_reap(ring);
+
+            if (ring->inflight == 0) {
+                break;
+            }
+
+            if (__wsp_uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR) {
+                break;
+            }
+        }
+    }
+
+    e->type = WSP_ERROR_IO;
+    e->syserr = ring->failed;
+    return WSP_ERROR;
+} // __wsp_uring_fail }}}
+
+// __wsp_uring_wait_until {{{
+/*
+ * Submit all queued operations, and wait until either the given slot has
+ * completed or, if slot is NULL, until no operations on the given file are
+ * left in flight.
+ *
+ * Queued operations are submitted in the same system call used to wait.
+ */
+static wsp_return_t __wsp_uring_wait_until(
+    wsp_uring_t *ring,
+    wsp_uring_slot_t *slot,
+    int fd,
+    wsp_error_t *e
+)
+{
+    if (ring->failed) {
+        return __wsp_uring_fail(ring, ring->failed, e);
+    }
+
+    for (;;) {
+        __wsp_uring_reap(ring);
+
+        if (slot != NULL ? slot->done : !__wsp_uring_busy(ring, fd)) {
+            return WSP_OK;
+        }
+
+        int submitted = __wsp_uring_enter(ring->fd, ring->queued, 1, IORING_ENTER_GETEVENTS);
+
+        if (submitted == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return __wsp_uring_fail(ring, errno, e);
+        }
+
+        ring->queued -= submitted;
+        ring->inflight += submitted;
+    }
+} // __wsp_uring_wait_until }}}
+
+// __wsp_uring_slot {{{
+/*
+ * Take a free slot, waiting for operations to complete if there are none.
+ */
+static wsp_uring_slot_t *__wsp_uring_slot(
+    wsp_uring_t *ring,
+    wsp_error_t *e
+)
+{
+    if (ring->failed) {
+        __wsp_uring_fail(ring, ring->failed, e);
+        return NULL;
+    }
+
+    while (ring->free_slots == NULL) {
+        uint32_t inflight = ring->inflight + ring->queued;
+
+        // wait for at least one write to complete.
+        while (ring->inflight + ring->queued == inflight) {
+            int submitted = __wsp_uring_enter(ring->fd, ring->queued, 1, IORING_ENTER_GETEVENTS);
+
+            if (submitted == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                __wsp_uring_fail(ring, errno, e);
+                return NULL;
+            }
+
+            ring->queued -= submitted;
+            ring->inflight += submitted;
+
+            __wsp_uring_reap(ring);
+        }
+    }
+
+    wsp_uring_slot_t *slot = ring->free_slots;
+    ring->free_slots = slot->next;
+    slot->next = NULL;
+    slot->busy = 1;
+    slot->done = 0;
+    slot->res = 0;
+    return slot;
+} // __wsp_uring_slot }}}
+
+// __wsp_uring_push {{{
+/*
+ * Queue an operation on the submission queue.
+ */
+static void __wsp_uring_push(
+    wsp_uring_t *ring,
+    wsp_uring_slot_t *slot,
+    uint8_t opcode,
+    void *buf
+)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = ring->sqes + index;
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    sqe->opcode = opcode;
+    sqe->fd = slot->fd;
+    sqe->off = slot->offset;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = slot->length;
+    sqe->user_data = slot - ring->slots;
+
+    // operations overlapping a write must not be reordered with it.
+    if (__wsp_uring_overlaps(ring, slot)) {
+        sqe->flags |= IOSQE_IO_DRAIN;
+    }
+
+    ring->sq_array[index] = index;
+
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    ring->queued++;
+} // __wsp_uring_push }}}
+
+// wsp_uring_init {{{
+wsp_return_t wsp_uring_init(
+    wsp_uring_t *ring,
+    uint32_t entries,
+    wsp_error_t *e
+)
+{
+    if (entries == 0) {
+        e->type = WSP_ERROR_INVALID;
+        return WSP_ERROR;
+    }
+
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(struct io_uring_params));
+    memset(ring, 0, sizeof(wsp_uring_t));
+    WSP_ERROR_INIT(&ring->error);
+
+    ring->fd = __wsp_uring_setup(entries, &p);
+
+    if (ring->fd == -1) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(
+        NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        ring->fd, IORING_OFF_SQ_RING);
+
+    if (ring->sq_ring == MAP_FAILED) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        close(ring->fd);
+        return WSP_ERROR;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    }
+    else {
+        ring->cq_ring = mmap(
+            NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            ring->fd, IORING_OFF_CQ_RING);
+
+        if (ring->cq_ring == MAP_FAILED) {
+            e->type = WSP_ERROR_IO;
+            e->syserr = errno;
+            munmap(ring->sq_ring, ring->sq_ring_size);
+            close(ring->fd);
+            return WSP_ERROR;
+        }
+    }
+
+    ring->sqes = mmap(
+        NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        ring->fd, IORING_OFF_SQES);
+
+    ring->slots = calloc(p.sq_entries, sizeof(wsp_uring_slot_t));
+
+    if (ring->sqes == MAP_FAILED || ring->slots == NULL) {
+        if (ring->sqes == MAP_FAILED) {
+            e->type = WSP_ERROR_IO;
+            e->syserr = errno;
+        }
+        else {
+            e->type = WSP_ERROR_MALLOC;
+            e->syserr = errno;
+            munmap(ring->sqes, ring->sqes_size);
+        }
+
+        free(ring->slots);
+
+        if (ring->cq_ring != ring->sq_ring) {
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        }
+
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring->fd);
+        return WSP_ERROR;
+    }
+
+    char *sq = ring->sq_ring;
+    char *cq = ring->cq_ring;
+
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // never have more operations in flight than the submission queue holds,
+    // so that the completion queue (twice as large) can not overflow.
+    ring->entries = p.sq_entries;
+
+    uint32_t i;
+
+    for (i = ring->entries; i > 0; i--) {
+        wsp_uring_slot_t *slot = ring->slots + i - 1;
+        slot->fd = -1;
+        slot->next = ring->free_slots;
+        ring->free_slots = slot;
+    }
+
+    return WSP_OK;
+} // wsp_uring_init }}}
+
+// wsp_uring_free {{{
+wsp_return_t wsp_uring_free(
+    wsp_uring_t *ring,
+    wsp_error_t *e
+)
+{
+    if (ring->slots == NULL) {
+        e->type = WSP_ERROR_NOT_INITIALIZED;
+        return WSP_ERROR;
+    }
+
+    wsp_return_t result = wsp_uring_wait(ring, e);
+
+    uint32_t i;
+
+    for (i = 0; i < ring->entries; i++) {
+        free(ring->slots[i].buf);
+    }
+
+    free(ring->slots);
+    ring->slots = NULL;
+    ring->free_slots = NULL;
+
+    munmap(ring->sqes, ring->sqes_size);
+
+    if (ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+    ring->fd = -1;
+    return result;
+} // wsp_uring_free }}}
+
+// wsp_uring_submit {{{
+wsp_return_t wsp_uring_submit(
+    wsp_uring_t *ring,
+    wsp_error_t *e
+)
+{
+    if (ring->failed) {
+        return __wsp_uring_fail(ring, ring->failed, e);
+    }
+
+    while (ring->queued > 0) {
+        int submitted = __wsp_uring_enter(ring->fd, ring->queued, 0, 0);
+
+        if (submitted == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return __wsp_uring_fail(ring, errno, e);
+        }
+
+        ring->queued -= submitted;
+        ring->inflight += submitted;
+    }
+
+    __wsp_uring_reap(ring);
+    return WSP_OK;
+} // wsp_uring_submit }}}
+
+// wsp_uring_wait {{{
+wsp_return_t wsp_uring_wait(
+    wsp_uring_t *ring,
+    wsp_error_t *e
+)
+{
+    if (__wsp_uring_wait_until(ring, NULL, -1, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    if (ring->error.type != WSP_ERROR_NONE) {
+        *e = ring->error;
+        WSP_ERROR_INIT(&ring->error);
+        return WSP_ERROR;
+    }
+
+    return WSP_OK;
+} // wsp_uring_wait }}}
+
+// __wsp_uring_finish_read {{{
+/*
+ * Check the result of a completed read and release its slot.
+ */
+static wsp_return_t __wsp_uring_finish_read(
+    wsp_uring_t *ring,
+    wsp_uring_slot_t *slot,
+    wsp_error_t *e
+)
+{
+    wsp_return_t result = WSP_OK;
+
+    if (slot->res < 0) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = -slot->res;
+        result = WSP_ERROR;
+    }
+    // reading past the end of the file.
+    else if ((size_t)slot->res != slot->length) {
+        e->type = WSP_ERROR_OFFSET;
+        e->syserr = 0;
+        result = WSP_ERROR;
+    }
+
+    slot->busy = 0;
+    slot->next = ring->free_slots;
+    ring->free_slots = slot;
+    return result;
+} // __wsp_uring_finish_read }}}
+
+static int __wsp_io_open__uring(
+    wsp_t *w,
+    const char *path,
+    wsp_error_t *e
+)
+{
+    if (w->io_uring == NULL || w->io_uring->slots == NULL) {
+        e->type = WSP_ERROR_NOT_INITIALIZED;
+        return WSP_ERROR;
+    }
+
+    int fd = open(path, O_RDWR);
+
+    if (fd == -1) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    w->io_fd = NULL;
+    w->io_fileno = fd;
+    w->io_mmap = NULL;
+    w->io_size = 0;
+    w->io_mapping = WSP_URING;
+    w->io_manual_buf = 1;
+
+    __wsp_io_fadvise(fd, w->io_flags);
+
+    return WSP_OK;
+}
+
+static int __wsp_io_close__uring(
+    wsp_t *w,
+    wsp_error_t *e
+)
+{
+    if (w->io_fileno == -1) {
+        return WSP_OK;
+    }
+
+    wsp_uring_t *ring = w->io_uring;
+    wsp_return_t result = WSP_OK;
+
+    // the descriptor must outlive every operation using it.
+    if (__wsp_uring_wait_until(ring, NULL, w->io_fileno, e) == WSP_ERROR) {
+        result = WSP_ERROR;
+    }
+    else if (ring->error.type != WSP_ERROR_NONE) {
+        *e = ring->error;
+        WSP_ERROR_INIT(&ring->error);
+        result = WSP_ERROR;
+    }
+
+    close(w->io_fileno);
+    w->io_fileno = -1;
+    return result;
+}
+
+/*
+ * Reader function for WSP_URING mappings.
+ *
+ * Submits any queued operations together with the read and waits for it to
+ * complete.
+ *
+ * See wsp_read_f for documentation on arguments.
+ */
+static int __wsp_io_read__uring(
+    wsp_t *w,
+    long offset,
+    size_t size,
+    void **buf,
+    wsp_error_t *e
+)
+{
+    wsp_uring_t *ring = w->io_uring;
+    void *tmp = *buf;
+
+    if (tmp == NULL) {
+        tmp = malloc(size);
+
+        if (tmp == NULL) {
+            e->type = WSP_ERROR_MALLOC;
+            e->syserr = errno;
+            return WSP_ERROR;
+        }
+    }
+
+    wsp_uring_slot_t *slot = __wsp_uring_slot(ring, e);
+
+    if (slot == NULL) {
+        if (*buf == NULL) {
+            free(tmp);
+        }
+
+        return WSP_ERROR;
+    }
+
+    slot->fd = w->io_fileno;
+    slot->offset = offset;
+    slot->length = size;
+    slot->write = 0;
+
+    __wsp_uring_push(ring, slot, IORING_OP_READ, tmp);
+
+    if (__wsp_uring_wait_until(ring, slot, -1, e) == WSP_ERROR) {
+        // the ring failed, the read has completed or is never submitted,
+        // unless operations in flight could not be waited for.
+        if (*buf == NULL && ring->inflight == 0) {
+            free(tmp);
+        }
+
+        return WSP_ERROR;
+    }
+
+    if (__wsp_uring_finish_read(ring, slot, e) == WSP_ERROR) {
+        if (*buf == NULL) {
+            free(tmp);
+        }
+
+        return WSP_ERROR;
+    }
+
+    *buf = tmp;
+    return WSP_OK;
+} // __wsp_io_read__uring
+
+/*
+ * Submit and wait for reads, using room for count pending slots.
+ */
+static int __wsp_io_readv_pending__uring(
+    wsp_t *w,
+    wsp_iov_t *iov,
+    uint32_t count,
+    wsp_uring_slot_t **pending,
+    wsp_error_t *e
+)
+{
+    wsp_uring_t *ring = w->io_uring;
+    wsp_return_t result = WSP_OK;
+    uint32_t i = 0;
+
+    while (i < count) {
+        uint32_t n = 0;
+
+        // only the first read of a batch may wait for a slot to free up.
+        for (; i < count && (n == 0 || ring->free_slots != NULL); i++) {
+            if (iov[i].size == 0) {
+                continue;
+            }
+
+            wsp_uring_slot_t *slot = __wsp_uring_slot(ring, e);
+
+            if (slot == NULL) {
+                return WSP_ERROR;
+            }
+
+            slot->fd = w->io_fileno;
+            slot->offset = iov[i].offset;
+            slot->length = iov[i].size;
+            slot->write = 0;
+
+            __wsp_uring_push(ring, slot, IORING_OP_READ, iov[i].buf);
+            pending[n++] = slot;
+        }
+
+        uint32_t k;
+
+        for (k = 0; k < n; k++) {
+            if (__wsp_uring_wait_until(ring, pending[k], -1, e) == WSP_ERROR) {
+                // the ring failed, see __wsp_uring_fail.
+                return WSP_ERROR;
+            }
+
+            wsp_error_t read_e;
+            WSP_ERROR_INIT(&read_e);
+
+            if (__wsp_uring_finish_read(ring, pending[k], &read_e) == WSP_ERROR && result == WSP_OK) {
+                *e = read_e;
+                result = WSP_ERROR;
+            }
+        }
+
+        if (result == WSP_ERROR) {
+            return WSP_ERROR;
+        }
+    }
+
+    return WSP_OK;
+} // __wsp_io_readv_pending__uring
+
+/*
+ * Vectored reader function for WSP_URING mappings.
+ *
+ * Reads are submitted in a single call together with any queued operations,
+ * as long as there are free slots.
+ *
+ * See wsp_readv_f for documentation on arguments.
+ */
+static int __wsp_io_readv__uring(
+    wsp_t *w,
+    wsp_iov_t *iov,
+    uint32_t count,
+    wsp_error_t *e
+)
+{
+    if (count == 0) {
+        return WSP_OK;
+    }
+
+    wsp_uring_slot_t **pending = __wsp_scratch_alloc(w, sizeof(wsp_uring_slot_t *) * count, e);
+
+    if (pending == NULL) {
+        return WSP_ERROR;
+    }
+
+    int result = __wsp_io_readv_pending__uring(w, iov, count, pending, e);
+
+    __wsp_scratch_free(w, pending);
+    return result;
+} // __wsp_io_readv__uring
+
+/*
+ * Writer function for WSP_URING mappings.
+ *
+ * The data is copied and the write queued, errors are reported when waiting
+ * for the ring or closing the database.
+ *
+ * See wsp_write_f for documentation on arguments.
+ */
+static int __wsp_io_write__uring(
+    wsp_t *w,
+    long offset,
+    size_t size,
+    void *buf,
+    wsp_error_t *e
+)
+{
+    wsp_uring_t *ring = w->io_uring;
+    wsp_uring_slot_t *slot = __wsp_uring_slot(ring, e);
+
+    if (slot == NULL) {
+        return WSP_ERROR;
+    }
+
+    if (slot->size < size) {
+        void *tmp = realloc(slot->buf, size);
+
+        if (tmp == NULL) {
+            e->type = WSP_ERROR_MALLOC;
+            e->syserr = errno;
+            slot->busy = 0;
+            slot->next = ring->free_slots;
+            ring->free_slots = slot;
+            return WSP_ERROR;
+        }
+
+        slot->buf = tmp;
+        slot->size = size;
+    }
+
+    memcpy(slot->buf, buf, size);
+
+    slot->fd = w->io_fileno;
+    slot->offset = offset;
+    slot->length = size;
+    slot->write = 1;
+
+    __wsp_uring_push(ring, slot, IORING_OP_WRITE, slot->buf);
+    return WSP_OK;
+} // __wsp_io_write__uring
+
+/*
+ * Sync function for WSP_URING mappings.
+ *
+ * Waits for the queued writes to the database to complete first, failing
+ * with their error if any failed.
+ *
+ * See wsp_io_sync_f for documentation on arguments.
+ */
+static int __wsp_io_sync__uring(
+    wsp_t *w,
+    long offset,
+    size_t size,
+    wsp_error_t *e
+)
+{
+    wsp_uring_t *ring = w->io_uring;
+
+    if (__wsp_uring_wait_until(ring, NULL, w->io_fileno, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    if (ring->error.type != WSP_ERROR_NONE) {
+        *e = ring->error;
+        WSP_ERROR_INIT(&ring->error);
+        return WSP_ERROR;
+    }
+
+    if (fdatasync(w->io_fileno) == -1) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    return WSP_OK;
+} // __wsp_io_sync__uring
+
+wsp_io wsp_io_uring = {
+    .open = __wsp_io_open__uring,
+    .close = __wsp_io_close__uring,
+    .read = __wsp_io_read__uring,
+    .write = __wsp_io_write__uring,
+    .readv = __wsp_io_readv__uring,
+    .sync = __wsp_io_sync__uring,
+};
+
+#endif /* __linux__ */
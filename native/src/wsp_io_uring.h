@@ -0,0 +1,162 @@
+// vim: foldmethod=marker
+/**
+ * io_uring I/O mapping (Linux only).
+ *
+ * A single ring is shared by many databases. Writes are copied and queued on
+ * the ring, and are submitted in batches with a single system call, either
+ * when the ring fills up, when a read needs to be made or by an explicit
+ * wsp_uring_submit. Reads are submitted together with any queued writes and
+ * wait for their completion.
+ *
+ * Example:
+ *
+ *   wsp_uring_t ring;
+ *
+ *   if (wsp_uring_init(&ring, 256, &e) == WSP_ERROR) {
+ *       return 1;
+ *   }
+ *
+ *   w.io_uring = &ring;
+ *
+ *   if (wsp_open(&w, p, WSP_URING, &e) == WSP_ERROR) {
+ *       return 1;
+ *   }
+ *
+ *   // ... updates to many databases ...
+ *
+ *   wsp_uring_wait(&ring, &e);
+ *
+ * Errors of queued writes are reported by the next wsp_uring_wait,
+ * wsp_uring_free or wsp_close of a database using the ring.
+ *
+ * A ring, and all databases using it, must only be used by one thread at a
+ * time.
+ */
+#ifndef _WSP_IO_URING_H_
+#define _WSP_IO_URING_H_
+
+#include "wsp.h"
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+
+struct wsp_uring_slot_t;
+
+typedef struct wsp_uring_slot_t wsp_uring_slot_t;
+
+struct wsp_uring_slot_t {
+    // buffer owned by the slot, writes are copied here.
+    void *buf;
+    // allocated size of buf.
+    size_t size;
+    // file descriptor, offset and size of the operation.
+    int fd;
+    long offset;
+    size_t length;
+    // set if the operation is a write.
+    int write;
+    // set while the operation is queued or in flight.
+    int busy;
+    // set once the operation has completed.
+    int done;
+    // result of the completed operation.
+    int res;
+    // next free slot.
+    wsp_uring_slot_t *next;
+};
+
+struct wsp_uring_t {
+    // ring file descriptor.
+    int fd;
+    // submission queue.
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    // completion queue.
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    // mapped ring memory, for munmap.
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    // number of submission queue entries.
+    uint32_t entries;
+    // number of operations queued but not yet submitted.
+    uint32_t queued;
+    // number of operations submitted but not yet completed.
+    uint32_t inflight;
+    // one slot for every operation that can be in flight.
+    wsp_uring_slot_t *slots;
+    wsp_uring_slot_t *free_slots;
+    // first error of a completed write since the last wait.
+    wsp_error_t error;
+    // errno of a failed submission, 0 if none failed. A failed ring is never
+    // submitted again, see wsp_uring_wait.
+    int failed;
+};
+
+extern wsp_io wsp_io_uring;
+
+/**
+ * Set up a ring.
+ *
+ * ring: Ring to set up.
+ * entries: Maximum number of operations in flight.
+ * e: Error object.
+ */
+wsp_return_t wsp_uring_init(
+    wsp_uring_t *ring,
+    uint32_t entries,
+    wsp_error_t *e
+);
+
+/**
+ * Wait for all operations of a ring and release it.
+ *
+ * ring: Ring to release.
+ * e: Error object.
+ */
+wsp_return_t wsp_uring_free(
+    wsp_uring_t *ring,
+    wsp_error_t *e
+);
+
+/**
+ * Submit all queued operations without waiting for them to complete.
+ *
+ * ring: Ring to submit.
+ * e: Error object.
+ */
+wsp_return_t wsp_uring_submit(
+    wsp_uring_t *ring,
+    wsp_error_t *e
+);
+
+/**
+ * Submit all queued operations and wait for every operation in flight to
+ * complete.
+ *
+ * Fails with the first error of a write that completed since the last wait.
+ *
+ * If submitting or waiting fails, the operations already submitted are
+ * waited for when possible, and the ring fails every operation from then on.
+ * Operations still queued are never submitted, so no read writes into the
+ * buffer of a call that has returned.
+ *
+ * ring: Ring to wait for.
+ * e: Error object.
+ */
+wsp_return_t wsp_uring_wait(
+    wsp_uring_t *ring,
+    wsp_error_t *e
+);
+
+#endif /* __linux__ */
+
+#endif /* _WSP_IO_URING_H_ */
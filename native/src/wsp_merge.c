@@ -0,0 +1,332 @@
+// vim: foldmethod=marker
+#include "wsp_merge.h"
+#include "wsp_private.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+
+/*
+ * Number of points compared at a time.
+ */
+#define WSP_MERGE_POINTS 4096
+
+/*
+ * Receives a block of consecutive intervals of an archive, with the values of
+ * both databases.
+ */
+typedef wsp_return_t(*wsp_merge_block_f)(
+    void *data,
+    wsp_t *to,
+    uint32_t index,
+    wsp_time_t from,
+    uint32_t count,
+    double *from_values,
+    double *to_values,
+    wsp_error_t *e
+);
+
+// __wsp_merge_compatible {{{
+/*
+ * Check that two databases have the same archives.
+ */
+static wsp_return_t __wsp_merge_compatible(
+    wsp_t *a,
+    wsp_t *b,
+    wsp_error_t *e
+)
+{
+    uint32_t i;
+
+    if (a->archives_count != b->archives_count) {
+        e->type = WSP_ERROR_ARCHIVE_CONFIG;
+        return WSP_ERROR;
+    }
+
+    for (i = 0; i < a->archives_count; i++) {
+        if (a->archives[i].spp != b->archives[i].spp
+            || a->archives[i].count != b->archives[i].count) {
+            e->type = WSP_ERROR_ARCHIVE_CONFIG;
+            return WSP_ERROR;
+        }
+    }
+
+    return WSP_OK;
+} // __wsp_merge_compatible }}}
+
+// __wsp_merge_archive {{{
+/*
+ * Compare the intervals [start, end) of an archive block by block.
+ */
+static wsp_return_t __wsp_merge_archive(
+    wsp_t *from,
+    wsp_t *to,
+    uint32_t index,
+    int64_t start,
+    int64_t end,
+    wsp_point_b *buf,
+    double *from_values,
+    double *to_values,
+    wsp_merge_block_f block,
+    void *data,
+    wsp_error_t *e
+)
+{
+    wsp_archive_t *from_archive = from->archives + index;
+    wsp_archive_t *to_archive = to->archives + index;
+    uint32_t spp = from_archive->spp;
+    int64_t t;
+
+    for (t = start; t < end; t += (int64_t)WSP_MERGE_POINTS * spp) {
+        uint32_t count = WSP_MERGE_POINTS;
+
+        if ((end - t) / spp < count) {
+            count = (end - t) / spp;
+        }
+
+        wsp_point_t from_base;
+        wsp_point_t to_base;
+
+        // the base of the destination changes when its archive was empty.
+        if (wsp_load_point(from, from_archive, 0, &from_base, e) == WSP_ERROR) {
+            return WSP_ERROR;
+        }
+
+        if (wsp_load_point(to, to_archive, 0, &to_base, e) == WSP_ERROR) {
+            return WSP_ERROR;
+        }
+
+        if (__wsp_load_values(from, from_archive, &from_base, (wsp_time_t)t, count, buf, from_values, e) == WSP_ERROR) {
+            return WSP_ERROR;
+        }
+
+        if (__wsp_load_values(to, to_archive, &to_base, (wsp_time_t)t, count, buf, to_values, e) == WSP_ERROR) {
+            return WSP_ERROR;
+        }
+
+        if (block(data, to, index, (wsp_time_t)t, count, from_values, to_values, e) == WSP_ERROR) {
+            return WSP_ERROR;
+        }
+    }
+
+    return WSP_OK;
+} // __wsp_merge_archive }}}
+
+// __wsp_merge_walk {{{
+/*
+ * Walk the archives of two databases in lockstep.
+ *
+ * Every archive covers its whole retention, or, unless whole is set, its
+ * retention up to the start of the archive before it.
+ */
+static wsp_return_t __wsp_merge_walk(
+    const char *path_from,
+    const char *path_to,
+    int whole,
+    wsp_merge_block_f block,
+    void *data,
+    wsp_error_t *e
+)
+{
+    wsp_t from;
+    wsp_t to;
+
+    WSP_INIT(&from);
+    WSP_INIT(&to);
+
+    from.io_flags = WSP_IO_SEQUENTIAL;
+    to.io_flags = WSP_IO_SEQUENTIAL;
+
+    if (wsp_open(&from, path_from, WSP_MMAP, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    if (wsp_open(&to, path_to, WSP_MMAP, e) == WSP_ERROR) {
+        wsp_close(&from, e);
+        return WSP_ERROR;
+    }
+
+    wsp_return_t result = __wsp_merge_compatible(&from, &to, e);
+
+    wsp_point_b *buf = NULL;
+    double *from_values = NULL;
+    double *to_values = NULL;
+
+    if (result == WSP_OK) {
+        buf = malloc(sizeof(wsp_point_b) * WSP_MERGE_POINTS);
+        from_values = malloc(sizeof(double) * WSP_MERGE_POINTS);
+        to_values = malloc(sizeof(double) * WSP_MERGE_POINTS);
+
+        if (buf == NULL || from_values == NULL || to_values == NULL) {
+            e->type = WSP_ERROR_MALLOC;
+            e->syserr = errno;
+            result = WSP_ERROR;
+        }
+    }
+
+    int64_t now = wsp_time_now();
+    int64_t until = now;
+    uint32_t i;
+
+    for (i = 0; i < from.archives_count && result == WSP_OK; i++) {
+        wsp_archive_t *archive = from.archives + i;
+        int64_t spp = archive->spp;
+        int64_t since = now - (int64_t)archive->retention;
+
+        if (since < 0) {
+            since = 0;
+        }
+
+        int64_t start = since - since % spp + spp;
+        int64_t end = until - until % spp + spp;
+
+        if (start < end) {
+            result = __wsp_merge_archive(&from, &to, i, start, end,
+                buf, from_values, to_values, block, data, e);
+        }
+
+        if (!whole) {
+            until = since;
+        }
+    }
+
+    free(buf);
+    free(from_values);
+    free(to_values);
+
+    wsp_error_t ignored;
+    WSP_ERROR_INIT(&ignored);
+
+    wsp_close(&from, &ignored);
+
+    if (wsp_close(&to, result == WSP_OK ? e : &ignored) == WSP_ERROR) {
+        result = WSP_ERROR;
+    }
+
+    return result;
+} // __wsp_merge_walk }}}
+
+// wsp_merge {{{
+typedef struct {
+    // differing points of the current block.
+    wsp_point_t points[WSP_MERGE_POINTS];
+    uint64_t merged;
+} wsp_merge_state_t;
+
+static wsp_return_t __wsp_merge_block(
+    void *data,
+    wsp_t *to,
+    uint32_t index,
+    wsp_time_t from,
+    uint32_t count,
+    double *from_values,
+    double *to_values,
+    wsp_error_t *e
+)
+{
+    wsp_merge_state_t *state = data;
+    wsp_archive_t *archive = to->archives + index;
+    uint32_t size = 0;
+    uint32_t i = 0;
+
+    while ((i = __wsp_next_difference(from_values, to_values, i, count)) < count) {
+        // points only the destination knows are kept.
+        if (!isnan(from_values[i])) {
+            state->points[size].timestamp = from + i * archive->spp;
+            state->points[size].value = from_values[i];
+            size++;
+        }
+
+        i++;
+    }
+
+    if (size == 0) {
+        return WSP_OK;
+    }
+
+    state->merged += size;
+    return __wsp_archive_update_many(to, archive, state->points, size, e);
+}
+
+wsp_return_t wsp_merge(
+    const char *path_from,
+    const char *path_to,
+    uint64_t *merged,
+    wsp_error_t *e
+)
+{
+    wsp_merge_state_t *state = malloc(sizeof(wsp_merge_state_t));
+
+    if (state == NULL) {
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    state->merged = 0;
+
+    wsp_return_t result = __wsp_merge_walk(path_from, path_to, 1, __wsp_merge_block, state, e);
+
+    if (merged != NULL) {
+        *merged = state->merged;
+    }
+
+    free(state);
+    return result;
+} // wsp_merge }}}
+
+// wsp_diff {{{
+typedef struct {
+    int ignore_empty;
+    wsp_diff_f callback;
+    void *data;
+} wsp_diff_state_t;
+
+static wsp_return_t __wsp_diff_block(
+    void *data,
+    wsp_t *to,
+    uint32_t index,
+    wsp_time_t from,
+    uint32_t count,
+    double *from_values,
+    double *to_values,
+    wsp_error_t *e
+)
+{
+    wsp_diff_state_t *state = data;
+    uint32_t spp = to->archives[index].spp;
+    uint32_t i = 0;
+
+    while ((i = __wsp_next_difference(from_values, to_values, i, count)) < count) {
+        double a = from_values[i];
+        double b = to_values[i];
+
+        if (!state->ignore_empty || (!isnan(a) && !isnan(b))) {
+            if (state->callback(state->data, index, from + i * spp, a, b, e) == WSP_ERROR) {
+                return WSP_ERROR;
+            }
+        }
+
+        i++;
+    }
+
+    return WSP_OK;
+}
+
+wsp_return_t wsp_diff(
+    const char *path_from,
+    const char *path_to,
+    int ignore_empty,
+    wsp_diff_f callback,
+    void *data,
+    wsp_error_t *e
+)
+{
+    wsp_diff_state_t state = {
+        .ignore_empty = ignore_empty,
+        .callback = callback,
+        .data = data
+    };
+
+    return __wsp_merge_walk(path_from, path_to, 0, __wsp_diff_block, &state, e);
+} // wsp_diff }}}
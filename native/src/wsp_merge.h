@@ -0,0 +1,89 @@
+// vim: foldmethod=marker
+/**
+ * Native merging and diffing of databases.
+ *
+ * Both databases must have the same archives. Archives are compared in
+ * lockstep, like whisper.py's merge and diff do: merge compares every archive
+ * over its whole retention, diff every archive over its retention minus the
+ * period covered by the more precise archives before it. Points are compared
+ * in blocks, and only points whose timestamp belongs to their interval are
+ * known.
+ *
+ * Example:
+ *
+ *   uint64_t merged;
+ *
+ *   if (wsp_merge("from.wsp", "to.wsp", &merged, &e) == WSP_ERROR) {
+ *       return 1;
+ *   }
+ *
+ * Neither database may be written by anything else meanwhile.
+ */
+#ifndef _WSP_MERGE_H_
+#define _WSP_MERGE_H_
+
+#include "wsp.h"
+
+/**
+ * Receives the points that differ between two databases.
+ *
+ * Returning WSP_ERROR stops the diff, which fails with the error set.
+ *
+ * data: User data given to wsp_diff.
+ * archive: Index of the archive the point belongs to.
+ * timestamp: Interval of the point.
+ * from: Value in the first database, NAN if unknown.
+ * to: Value in the second database, NAN if unknown.
+ * e: Error object.
+ */
+typedef wsp_return_t(*wsp_diff_f)(
+    void *data,
+    uint32_t archive,
+    wsp_time_t timestamp,
+    double from,
+    double to,
+    wsp_error_t *e
+);
+
+/**
+ * Merge the known points of a database into another one.
+ *
+ * Only the points that are unknown or different in the destination are
+ * written, one write per run of consecutive points, and propagated to its
+ * lower precision archives. Archives are merged from the most precise one, so
+ * the points of the lower precision archives of the source replace the ones
+ * propagated.
+ *
+ * path_from: Database to merge from.
+ * path_to: Database to merge into.
+ * merged: Where to store the number of points written, or NULL.
+ * e: Error object.
+ */
+wsp_return_t wsp_merge(
+    const char *path_from,
+    const char *path_to,
+    uint64_t *merged,
+    wsp_error_t *e
+);
+
+/**
+ * Compare two databases, passing every point that differs to a callback in
+ * the order of archives and time.
+ *
+ * path_from: First database.
+ * path_to: Second database.
+ * ignore_empty: Skip points unknown in either database.
+ * callback: Called for every point that differs.
+ * data: User data for the callback.
+ * e: Error object.
+ */
+wsp_return_t wsp_diff(
+    const char *path_from,
+    const char *path_to,
+    int ignore_empty,
+    wsp_diff_f callback,
+    void *data,
+    wsp_error_t *e
+);
+
+#endif /* _WSP_MERGE_H_ */
@@ -0,0 +1,718 @@
+// vim: foldmethod=marker
+#include "wsp_pool.h"
+#include "wsp_private.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+/*
+ * Number of buckets of a pool without budgets.
+ */
+#define WSP_POOL_BUCKETS 1024
+
+// __wsp_pool_capacity {{{
+/*
+ * Maximum number of entries allowed by the budgets of a pool, 0 means
+ * unlimited.
+ */
+static uint32_t __wsp_pool_capacity(
+    wsp_pool_t *pool
+)
+{
+    uint32_t capacity = pool->max_files;
+
+    if (pool->mapping == WSP_MMAP && pool->max_maps != 0) {
+        if (capacity == 0 || pool->max_maps < capacity) {
+            capacity = pool->max_maps;
+        }
+    }
+
+    return capacity;
+} // __wsp_pool_capacity }}}
+
+// __wsp_pool_find {{{
+static wsp_pool_entry_t *__wsp_pool_find(
+    wsp_pool_t *pool,
+    uint32_t hash,
+    const char *path
+)
+{
+    wsp_pool_entry_t *entry = pool->buckets[hash % pool->buckets_count];
+
+    for (; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && strcmp(entry->path, path) == 0) {
+            return entry;
+        }
+    }
+
+    return NULL;
+} // __wsp_pool_find }}}
+
+// dirty list {{{
+static void __wsp_pool_dirty_remove(
+    wsp_pool_t *pool,
+    wsp_pool_entry_t *entry
+)
+{
+    if (entry->dirty_prev != NULL) {
+        entry->dirty_prev->dirty_next = entry->dirty_next;
+    }
+    else {
+        pool->dirty_head = entry->dirty_next;
+    }
+
+    if (entry->dirty_next != NULL) {
+        entry->dirty_next->dirty_prev = entry->dirty_prev;
+    }
+
+    pool->dirty_bytes -= entry->dirty_bytes;
+
+    entry->dirty = 0;
+    entry->dirty_bytes = 0;
+    entry->dirty_prev = NULL;
+    entry->dirty_next = NULL;
+} // __wsp_pool_dirty_remove
+
+/*
+ * Account for the unsynced writes of a released entry.
+ */
+static void __wsp_pool_dirty_update(
+    wsp_pool_t *pool,
+    wsp_pool_entry_t *entry
+)
+{
+    wsp_t *w = &entry->w;
+
+    if (w->io_dirty_from == w->io_dirty_until) {
+        if (entry->dirty) {
+            __wsp_pool_dirty_remove(pool, entry);
+        }
+
+        return;
+    }
+
+    if (!entry->dirty) {
+        entry->dirty = 1;
+        entry->dirty_prev = NULL;
+        entry->dirty_next = pool->dirty_head;
+
+        if (pool->dirty_head != NULL) {
+            pool->dirty_head->dirty_prev = entry;
+        }
+
+        pool->dirty_head = entry;
+    }
+
+    pool->dirty_bytes += w->io_dirty_bytes - entry->dirty_bytes;
+    entry->dirty_bytes = w->io_dirty_bytes;
+} // __wsp_pool_dirty_update
+// }}}
+
+// __wsp_pool_syncing {{{
+/*
+ * Check if the pool has a group commit policy.
+ */
+static int __wsp_pool_syncing(
+    wsp_pool_t *pool
+)
+{
+    return pool->sync_interval != 0 || pool->sync_bytes != 0;
+} // __wsp_pool_syncing }}}
+
+// __wsp_pool_left {{{
+/*
+ * Time left in milliseconds until the interval of the group commit policy
+ * expires, 0 if it has, -1 if there is nothing to sync or no interval.
+ */
+static int64_t __wsp_pool_left(
+    wsp_pool_t *pool
+)
+{
+    if (pool->dirty_head == NULL || pool->sync_interval == 0) {
+        return -1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    int64_t elapsed = (int64_t)(now.tv_sec - pool->synced.tv_sec) * 1000
+        + (now.tv_nsec - pool->synced.tv_nsec) / 1000000;
+
+    return elapsed >= pool->sync_interval ? 0 : pool->sync_interval - elapsed;
+} // __wsp_pool_left }}}
+
+// __wsp_pool_due {{{
+/*
+ * Check if a group commit is due.
+ */
+static int __wsp_pool_due(
+    wsp_pool_t *pool
+)
+{
+    if (pool->dirty_head == NULL) {
+        return 0;
+    }
+
+    if (pool->sync_bytes != 0 && pool->dirty_bytes >= pool->sync_bytes) {
+        return 1;
+    }
+
+    return __wsp_pool_left(pool) == 0;
+} // __wsp_pool_due }}}
+
+// __wsp_pool_unlink {{{
+/*
+ * Remove an entry from its bucket.
+ */
+static void __wsp_pool_unlink(
+    wsp_pool_t *pool,
+    wsp_pool_entry_t *entry
+)
+{
+    wsp_pool_entry_t **link = pool->buckets + entry->hash % pool->buckets_count;
+
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+
+    *link = entry->next;
+    entry->next = NULL;
+    pool->count--;
+
+    if (entry->dirty) {
+        __wsp_pool_dirty_remove(pool, entry);
+    }
+} // __wsp_pool_unlink }}}
+
+// idle list {{{
+static void __wsp_pool_idle_remove(
+    wsp_pool_t *pool,
+    wsp_pool_entry_t *entry
+)
+{
+    if (entry->idle_prev != NULL) {
+        entry->idle_prev->idle_next = entry->idle_next;
+    }
+    else {
+        pool->idle_head = entry->idle_next;
+    }
+
+    if (entry->idle_next != NULL) {
+        entry->idle_next->idle_prev = entry->idle_prev;
+    }
+    else {
+        pool->idle_tail = entry->idle_prev;
+    }
+
+    entry->idle_prev = NULL;
+    entry->idle_next = NULL;
+} // __wsp_pool_idle_remove
+
+static void __wsp_pool_idle_push(
+    wsp_pool_t *pool,
+    wsp_pool_entry_t *entry
+)
+{
+    entry->idle_prev = NULL;
+    entry->idle_next = pool->idle_head;
+
+    if (pool->idle_head != NULL) {
+        pool->idle_head->idle_prev = entry;
+    }
+    else {
+        pool->idle_tail = entry;
+    }
+
+    pool->idle_head = entry;
+} // __wsp_pool_idle_push
+// }}}
+
+// __wsp_pool_entry_free {{{
+/*
+ * Close the database of an entry that is no longer in the pool, syncing it
+ * first if sync is set, and free it.
+ */
+static wsp_return_t __wsp_pool_entry_free(
+    wsp_pool_entry_t *entry,
+    int sync,
+    wsp_error_t *e
+)
+{
+    wsp_return_t result = WSP_OK;
+
+    if (entry->w.io != NULL) {
+        if (sync && wsp_sync(&entry->w, e) == WSP_ERROR) {
+            result = WSP_ERROR;
+        }
+
+        wsp_error_t ignored;
+        WSP_ERROR_INIT(&ignored);
+
+        wsp_close(&entry->w, &ignored);
+    }
+
+    free(entry->path);
+    free(entry);
+    return result;
+} // __wsp_pool_entry_free }}}
+
+// __wsp_pool_remove {{{
+/*
+ * Take a busy entry out of the pool, and free it.
+ */
+static void __wsp_pool_remove(
+    wsp_pool_t *pool,
+    wsp_pool_entry_t *entry
+)
+{
+    pthread_mutex_lock(&pool->lock);
+    __wsp_pool_unlink(pool, entry);
+    int sync = __wsp_pool_syncing(pool);
+    pthread_cond_broadcast(&pool->released);
+    pthread_mutex_unlock(&pool->lock);
+
+    wsp_error_t ignored;
+    WSP_ERROR_INIT(&ignored);
+
+    __wsp_pool_entry_free(entry, sync, &ignored);
+} // __wsp_pool_remove }}}
+
+// __wsp_pool_commit {{{
+/*
+ * Sync all idle entries with unsynced writes as a group. Called with the lock
+ * held, which is released while syncing.
+ */
+static wsp_return_t __wsp_pool_commit(
+    wsp_pool_t *pool,
+    wsp_error_t *e
+)
+{
+    wsp_pool_entry_t *group = NULL;
+    wsp_pool_entry_t *entry;
+    wsp_pool_entry_t *next;
+    uint32_t count = 0;
+
+    for (entry = pool->dirty_head; entry != NULL; entry = next) {
+        next = entry->dirty_next;
+
+        if (entry->busy) {
+            continue;
+        }
+
+        // busy while syncing, the idle links chain the group.
+        entry->busy = 1;
+        __wsp_pool_idle_remove(pool, entry);
+        __wsp_pool_dirty_remove(pool, entry);
+        entry->idle_next = group;
+        group = entry;
+        count++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &pool->synced);
+    pool->committing += count;
+
+    pthread_mutex_unlock(&pool->lock);
+
+    wsp_return_t result = WSP_OK;
+
+    for (entry = group; entry != NULL; entry = entry->idle_next) {
+        if (wsp_sync(&entry->w, e) == WSP_ERROR) {
+            result = WSP_ERROR;
+        }
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    pool->committing -= count;
+
+    for (entry = group; entry != NULL; entry = next) {
+        next = entry->idle_next;
+        entry->busy = 0;
+        __wsp_pool_idle_push(pool, entry);
+        // entries that failed to sync are still dirty.
+        __wsp_pool_dirty_update(pool, entry);
+    }
+
+    pthread_cond_broadcast(&pool->released);
+    return result;
+} // __wsp_pool_commit }}}
+
+// __wsp_pool_open {{{
+/*
+ * Open the database of a busy entry and record the identity of its file.
+ */
+static wsp_return_t __wsp_pool_open(
+    wsp_pool_t *pool,
+    wsp_pool_entry_t *entry,
+    wsp_error_t *e
+)
+{
+    wsp_t *w = &entry->w;
+
+    WSP_INIT(w);
+    w->io_flags = pool->io_flags;
+
+    if (wsp_open(w, entry->path, pool->mapping, e) == WSP_ERROR) {
+        w->io = NULL;
+        return WSP_ERROR;
+    }
+
+    struct stat st;
+    int fd = w->io_fileno != -1 ? w->io_fileno : fileno(w->io_fd);
+
+    if (fstat(fd, &st) == -1) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    return WSP_OK;
+} // __wsp_pool_open }}}
+
+// __wsp_pool_check {{{
+/*
+ * Open the database of a busy entry again if its path now refers to another
+ * file.
+ */
+static wsp_return_t __wsp_pool_check(
+    wsp_pool_t *pool,
+    wsp_pool_entry_t *entry,
+    wsp_error_t *e
+)
+{
+    struct stat st;
+
+    if (stat(entry->path, &st) == -1) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    if (st.st_dev == entry->dev && st.st_ino == entry->ino) {
+        return WSP_OK;
+    }
+
+    wsp_error_t ignored;
+    WSP_ERROR_INIT(&ignored);
+
+    wsp_close(&entry->w, &ignored);
+    entry->w.io = NULL;
+
+    return __wsp_pool_open(pool, entry, e);
+} // __wsp_pool_check }}}
+
+// wsp_pool_init {{{
+wsp_return_t wsp_pool_init(
+    wsp_pool_t *pool,
+    uint32_t max_files,
+    uint32_t max_maps,
+    wsp_mapping_t mapping,
+    wsp_error_t *e
+)
+{
+    pool->max_files = max_files;
+    pool->max_maps = max_maps;
+    pool->mapping = mapping;
+    pool->io_flags = WSP_IO_DEFAULT;
+    pool->count = 0;
+    pool->idle_head = NULL;
+    pool->idle_tail = NULL;
+    pool->sync_interval = 0;
+    pool->sync_bytes = 0;
+    pool->dirty_head = NULL;
+    pool->dirty_bytes = 0;
+    pool->committing = 0;
+    clock_gettime(CLOCK_MONOTONIC, &pool->synced);
+
+    uint32_t capacity = __wsp_pool_capacity(pool);
+
+    if (capacity == 0) {
+        pool->buckets_count = WSP_POOL_BUCKETS;
+    }
+    else {
+        pool->buckets_count = 16;
+
+        while (pool->buckets_count < capacity && pool->buckets_count < (1u << 20)) {
+            pool->buckets_count <<= 1;
+        }
+    }
+
+    pool->buckets = calloc(pool->buckets_count, sizeof(wsp_pool_entry_t *));
+
+    if (pool->buckets == NULL) {
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    int error;
+
+    if ((error = pthread_mutex_init(&pool->lock, NULL)) != 0) {
+        e->type = WSP_ERROR_THREAD;
+        e->syserr = error;
+        free(pool->buckets);
+        pool->buckets = NULL;
+        return WSP_ERROR;
+    }
+
+    if ((error = pthread_cond_init(&pool->released, NULL)) != 0) {
+        e->type = WSP_ERROR_THREAD;
+        e->syserr = error;
+        pthread_mutex_destroy(&pool->lock);
+        free(pool->buckets);
+        pool->buckets = NULL;
+        return WSP_ERROR;
+    }
+
+    return WSP_OK;
+} // wsp_pool_init }}}
+
+// wsp_pool_acquire {{{
+wsp_return_t wsp_pool_acquire(
+    wsp_pool_t *pool,
+    const char *path,
+    wsp_t **w,
+    wsp_error_t *e
+)
+{
+    if (pool->buckets == NULL) {
+        e->type = WSP_ERROR_NOT_INITIALIZED;
+        return WSP_ERROR;
+    }
+
+    uint32_t hash = __wsp_hash_path(path);
+    uint32_t capacity = __wsp_pool_capacity(pool);
+    wsp_pool_entry_t *entry;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (;;) {
+        entry = __wsp_pool_find(pool, hash, path);
+
+        // entries being synced by a group commit are released shortly.
+        int waiting = entry != NULL
+            ? entry->busy
+            : capacity != 0 && pool->count >= capacity
+                && pool->idle_tail == NULL && pool->committing > 0;
+
+        if (!waiting) {
+            break;
+        }
+
+        pthread_cond_wait(&pool->released, &pool->lock);
+    }
+
+    if (entry != NULL) {
+        entry->busy = 1;
+        __wsp_pool_idle_remove(pool, entry);
+        pthread_mutex_unlock(&pool->lock);
+
+        if (__wsp_pool_check(pool, entry, e) == WSP_ERROR) {
+            __wsp_pool_remove(pool, entry);
+            return WSP_ERROR;
+        }
+
+        *w = &entry->w;
+        return WSP_OK;
+    }
+
+    // make room for the new entry, the evicted ones are closed after
+    // releasing the lock.
+    wsp_pool_entry_t *evicted = NULL;
+    int sync = __wsp_pool_syncing(pool);
+
+    while (capacity != 0 && pool->count >= capacity && pool->idle_tail != NULL) {
+        wsp_pool_entry_t *victim = pool->idle_tail;
+        __wsp_pool_idle_remove(pool, victim);
+        __wsp_pool_unlink(pool, victim);
+        victim->next = evicted;
+        evicted = victim;
+    }
+
+    if (capacity != 0 && pool->count >= capacity) {
+        e->type = WSP_ERROR_POOL_FULL;
+    }
+    else if ((entry = malloc(sizeof(wsp_pool_entry_t))) == NULL
+        || (entry->path = strdup(path)) == NULL) {
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+        free(entry);
+        entry = NULL;
+    }
+    else {
+        wsp_pool_entry_t **bucket = pool->buckets + hash % pool->buckets_count;
+
+        entry->w.io = NULL;
+        entry->hash = hash;
+        entry->busy = 1;
+        entry->idle_prev = NULL;
+        entry->idle_next = NULL;
+        entry->dirty = 0;
+        entry->dirty_bytes = 0;
+        entry->dirty_prev = NULL;
+        entry->dirty_next = NULL;
+        entry->next = *bucket;
+        *bucket = entry;
+        pool->count++;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    while (evicted != NULL) {
+        wsp_pool_entry_t *next = evicted->next;
+        wsp_error_t ignored;
+        WSP_ERROR_INIT(&ignored);
+
+        __wsp_pool_entry_free(evicted, sync, &ignored);
+        evicted = next;
+    }
+
+    if (entry == NULL) {
+        return WSP_ERROR;
+    }
+
+    if (__wsp_pool_open(pool, entry, e) == WSP_ERROR) {
+        __wsp_pool_remove(pool, entry);
+        return WSP_ERROR;
+    }
+
+    *w = &entry->w;
+    return WSP_OK;
+} // wsp_pool_acquire }}}
+
+// wsp_pool_release {{{
+wsp_return_t wsp_pool_release(
+    wsp_pool_t *pool,
+    wsp_t *w,
+    wsp_error_t *e
+)
+{
+    wsp_pool_entry_t *entry = (wsp_pool_entry_t *)w;
+    wsp_return_t result = WSP_OK;
+
+    pthread_mutex_lock(&pool->lock);
+    entry->busy = 0;
+    __wsp_pool_idle_push(pool, entry);
+    pthread_cond_broadcast(&pool->released);
+
+    if (__wsp_pool_syncing(pool)) {
+        __wsp_pool_dirty_update(pool, entry);
+
+        if (__wsp_pool_due(pool)) {
+            result = __wsp_pool_commit(pool, e);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return result;
+} // wsp_pool_release }}}
+
+// wsp_pool_discard {{{
+void wsp_pool_discard(
+    wsp_pool_t *pool,
+    wsp_t *w
+)
+{
+    __wsp_pool_remove(pool, (wsp_pool_entry_t *)w);
+} // wsp_pool_discard }}}
+
+// wsp_pool_sync_policy {{{
+wsp_return_t wsp_pool_sync_policy(
+    wsp_pool_t *pool,
+    uint32_t interval,
+    uint64_t bytes,
+    wsp_error_t *e
+)
+{
+    if (pool->buckets == NULL) {
+        e->type = WSP_ERROR_NOT_INITIALIZED;
+        return WSP_ERROR;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->sync_interval = interval;
+    pool->sync_bytes = bytes;
+    pthread_mutex_unlock(&pool->lock);
+    return WSP_OK;
+} // wsp_pool_sync_policy }}}
+
+// wsp_pool_sync {{{
+wsp_return_t wsp_pool_sync(
+    wsp_pool_t *pool,
+    wsp_error_t *e
+)
+{
+    if (pool->buckets == NULL) {
+        e->type = WSP_ERROR_NOT_INITIALIZED;
+        return WSP_ERROR;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    wsp_return_t result = __wsp_pool_commit(pool, e);
+    pthread_mutex_unlock(&pool->lock);
+    return result;
+} // wsp_pool_sync }}}
+
+// wsp_pool_sync_timeout {{{
+wsp_return_t wsp_pool_sync_timeout(
+    wsp_pool_t *pool,
+    int64_t *timeout,
+    wsp_error_t *e
+)
+{
+    if (pool->buckets == NULL) {
+        e->type = WSP_ERROR_NOT_INITIALIZED;
+        return WSP_ERROR;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    *timeout = __wsp_pool_left(pool);
+    pthread_mutex_unlock(&pool->lock);
+    return WSP_OK;
+} // wsp_pool_sync_timeout }}}
+
+// wsp_pool_free {{{
+wsp_return_t wsp_pool_free(
+    wsp_pool_t *pool,
+    wsp_error_t *e
+)
+{
+    if (pool->buckets == NULL) {
+        e->type = WSP_ERROR_NOT_INITIALIZED;
+        return WSP_ERROR;
+    }
+
+    wsp_return_t result = WSP_OK;
+    int sync = __wsp_pool_syncing(pool);
+    uint32_t i;
+
+    for (i = 0; i < pool->buckets_count; i++) {
+        wsp_pool_entry_t *entry = pool->buckets[i];
+
+        while (entry != NULL) {
+            wsp_pool_entry_t *next = entry->next;
+
+            if (__wsp_pool_entry_free(entry, sync, e) == WSP_ERROR) {
+                result = WSP_ERROR;
+            }
+
+            entry = next;
+        }
+    }
+
+    pthread_cond_destroy(&pool->released);
+    pthread_mutex_destroy(&pool->lock);
+
+    free(pool->buckets);
+    pool->buckets = NULL;
+    pool->idle_head = NULL;
+    pool->idle_tail = NULL;
+    pool->dirty_head = NULL;
+    pool->dirty_bytes = 0;
+    pool->count = 0;
+    return result;
+} // wsp_pool_free }}}
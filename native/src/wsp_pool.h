@@ -0,0 +1,235 @@
+// vim: foldmethod=marker
+/**
+ * Pool of open database handles.
+ *
+ * Opening a database costs an open, an fstat and, with WSP_MMAP, an mmap,
+ * and closing it an munmap and a close. A pool keeps the handles of recently
+ * used databases open, and closes the least recently used ones to stay within
+ * a budget of file descriptors and of memory mappings (see
+ * vm.max_map_count).
+ *
+ * A database replaced by rename(), as done by whisper-resize.py, is detected
+ * by comparing the inode of the path with the one of the open handle, and is
+ * opened again.
+ *
+ * A pool can also bound how much written data is lost on power failure
+ * without syncing every update (see wsp_pool_sync_policy): released handles
+ * with unsynced writes are synced together, once enough time has passed or
+ * enough bytes have been written since the last group was synced. The pool
+ * has no thread of its own, so that the time limit also holds once updates
+ * stop, its user waits at most wsp_pool_sync_timeout between calls to
+ * wsp_pool_sync, as the flush engine does (see wsp_flush.h).
+ *
+ * Example:
+ *
+ *   wsp_pool_t pool;
+ *   wsp_t *w;
+ *
+ *   if (wsp_pool_init(&pool, 1024, 1024, WSP_MMAP, &e) == WSP_ERROR) {
+ *       return 1;
+ *   }
+ *
+ *   if (wsp_pool_acquire(&pool, "foo.wsp", &w, &e) == WSP_OK) {
+ *       wsp_update(w, &p, &e);
+ *       wsp_pool_release(&pool, w, &e);
+ *   }
+ *
+ *   wsp_pool_free(&pool, &e);
+ *
+ * The pool is thread-safe, a handle is only ever acquired by one thread at a
+ * time.
+ */
+#ifndef _WSP_POOL_H_
+#define _WSP_POOL_H_
+
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "wsp.h"
+
+struct wsp_pool_entry_t;
+struct wsp_pool_t;
+
+typedef struct wsp_pool_entry_t wsp_pool_entry_t;
+typedef struct wsp_pool_t wsp_pool_t;
+
+struct wsp_pool_entry_t {
+    // the handle, must be the first member.
+    wsp_t w;
+    char *path;
+    uint32_t hash;
+    // identity of the file the handle has open.
+    dev_t dev;
+    ino_t ino;
+    // acquired by a thread, or being opened.
+    int busy;
+    // next entry in the same bucket.
+    wsp_pool_entry_t *next;
+    // idle entries, least recently released last.
+    wsp_pool_entry_t *idle_prev;
+    wsp_pool_entry_t *idle_next;
+    // entries with unsynced writes, and the number of bytes counted for the
+    // entry in the pool.
+    int dirty;
+    uint64_t dirty_bytes;
+    wsp_pool_entry_t *dirty_prev;
+    wsp_pool_entry_t *dirty_next;
+};
+
+struct wsp_pool_t {
+    pthread_mutex_t lock;
+    // signalled when an entry stops being busy.
+    pthread_cond_t released;
+    wsp_pool_entry_t **buckets;
+    uint32_t buckets_count;
+    wsp_pool_entry_t *idle_head;
+    wsp_pool_entry_t *idle_tail;
+    // budgets, 0 means unlimited.
+    uint32_t max_files;
+    uint32_t max_maps;
+    // number of entries, each holds a file descriptor, and a mapping if the
+    // mapping is WSP_MMAP.
+    uint32_t count;
+    // mapping used when opening databases.
+    wsp_mapping_t mapping;
+    // access hints used when opening databases (see wsp_io_flags_t), may be
+    // changed after wsp_pool_init.
+    int io_flags;
+    // group commit policy, 0 disables either limit.
+    uint32_t sync_interval;
+    uint64_t sync_bytes;
+    // released entries with unsynced writes, and the bytes written to them.
+    wsp_pool_entry_t *dirty_head;
+    uint64_t dirty_bytes;
+    // when the last group was synced.
+    struct timespec synced;
+    // number of entries being synced.
+    uint32_t committing;
+};
+
+/**
+ * Initialize a pool.
+ *
+ * pool: Pool to initialize.
+ * max_files: Maximum number of file descriptors held by the pool, 0 means
+ * unlimited.
+ * max_maps: Maximum number of memory mappings held by the pool, 0 means
+ * unlimited. Only used with WSP_MMAP.
+ * mapping: The file mapping method to use when opening databases.
+ * e: Error object.
+ */
+wsp_return_t wsp_pool_init(
+    wsp_pool_t *pool,
+    uint32_t max_files,
+    uint32_t max_maps,
+    wsp_mapping_t mapping,
+    wsp_error_t *e
+);
+
+/**
+ * Acquire the handle of a database, opening it if necessary.
+ *
+ * Blocks while another thread holds the handle of the same database. Fails
+ * with WSP_ERROR_POOL_FULL if the budgets are used up by acquired handles.
+ *
+ * pool: Pool to acquire from.
+ * path: Path of the database.
+ * w: Where to store the handle, which stays valid until released.
+ * e: Error object.
+ */
+wsp_return_t wsp_pool_acquire(
+    wsp_pool_t *pool,
+    const char *path,
+    wsp_t **w,
+    wsp_error_t *e
+);
+
+/**
+ * Release an acquired handle, keeping the database open.
+ *
+ * If a group commit is due, syncs the released handles with unsynced writes
+ * and fails if any of them could not be synced. Those are synced again later.
+ *
+ * pool: Pool the handle was acquired from.
+ * w: Handle to release.
+ * e: Error object.
+ */
+wsp_return_t wsp_pool_release(
+    wsp_pool_t *pool,
+    wsp_t *w,
+    wsp_error_t *e
+);
+
+/**
+ * Release an acquired handle and close the database, for example after an
+ * operation on it failed.
+ *
+ * pool: Pool the handle was acquired from.
+ * w: Handle to discard.
+ */
+void wsp_pool_discard(
+    wsp_pool_t *pool,
+    wsp_t *w
+);
+
+/**
+ * Sync released handles in groups, see wsp_sync.
+ *
+ * A group is synced when a handle is released and either interval
+ * milliseconds have passed or bytes bytes have been written since the last
+ * group. Handles are also synced before they are closed. Releases alone do
+ * not bound the time unsynced writes wait once updates stop, see
+ * wsp_pool_sync_timeout.
+ *
+ * pool: Pool to set the policy of.
+ * interval: Maximum time between groups in milliseconds, 0 means no limit.
+ * bytes: Maximum number of unsynced bytes, 0 means no limit. Setting both to
+ * 0 disables syncing, which is the default.
+ * e: Error object.
+ */
+wsp_return_t wsp_pool_sync_policy(
+    wsp_pool_t *pool,
+    uint32_t interval,
+    uint64_t bytes,
+    wsp_error_t *e
+);
+
+/**
+ * Sync all released handles with unsynced writes now.
+ *
+ * pool: Pool to sync.
+ * e: Error object.
+ */
+wsp_return_t wsp_pool_sync(
+    wsp_pool_t *pool,
+    wsp_error_t *e
+);
+
+/**
+ * Get the time left before the released handles with unsynced writes must be
+ * synced with wsp_pool_sync to keep the interval of the group commit policy.
+ *
+ * pool: Pool to check.
+ * timeout: Where to store the time left in milliseconds, 0 if a group is due
+ * now, or -1 if there is nothing to sync or no interval.
+ * e: Error object.
+ */
+wsp_return_t wsp_pool_sync_timeout(
+    wsp_pool_t *pool,
+    int64_t *timeout,
+    wsp_error_t *e
+);
+
+/**
+ * Close all databases and free the pool. No handle may be acquired.
+ *
+ * pool: Pool to free.
+ * e: Error object.
+ */
+wsp_return_t wsp_pool_free(
+    wsp_pool_t *pool,
+    wsp_error_t *e
+);
+
+#endif /* _WSP_POOL_H_ */
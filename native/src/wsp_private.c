@@ -1,9 +1,12 @@
 // vim: foldmethod=marker
 #include "wsp.h"
+#include "wsp_private.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <math.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/mman.h>
@@ -65,32 +68,6 @@ void __wsp_dump_point(
     READ8(buf->value, (char *)&p->value);
 } // __wsp_dump_point
 
-void __wsp_parse_points(
-    wsp_point_b *buf,
-    uint32_t count,
-    wsp_point_t *points
-)
-{
-    uint32_t i;
-
-    for (i = 0; i < count; i++) {
-        __wsp_parse_point(buf + i, points + i);
-    }
-} // __wsp_parse_points
-
-void __wsp_dump_points(
-    wsp_point_t *points,
-    uint32_t count,
-    wsp_point_b *buf
-)
-{
-    uint32_t i;
-
-    for (i = 0; i < count; i++) {
-        __wsp_dump_point(points + i, buf + i);
-    }
-} // __wsp_dump_points
-
 void __wsp_parse_metadata(
     wsp_metadata_b *buf,
     wsp_metadata_t *m
@@ -135,50 +112,49 @@ void __wsp_dump_archive(
 // parse & dump functions }}}
 
 // aggregate functions {{{
-static wsp_return_t __wsp_aggregate_average(
+/*
+ * Summarize the points to aggregate.
+ *
+ * Returns 1 if there are known points, and enough of them for the
+ * xFilesFactor of the database. Otherwise the value is NAN and skip is set.
+ */
+static int __wsp_aggregate_summary(
     wsp_t *w,
     wsp_point_t *points,
     uint32_t count,
+    wsp_rollup_t *state,
     double *value,
-    int *skip,
-    wsp_error_t *e
+    int *skip
 )
 {
-    if (count == 0) {
+    __wsp_summarize(points, count, state);
+
+    if (state->known == 0 || (float)state->known / (float)count < w->meta.x_files_factor) {
         *value = NAN;
-        return WSP_OK;
+        *skip = 1;
+        return 0;
     }
 
-    uint32_t valid = 0;
-    uint32_t i = 0;
-    double total = 0;
+    return 1;
+} // __wsp_aggregate_summary
 
-    for (i = 0; i < count; i++) {
-        wsp_point_t *p = points + i;
-
-        double c = p->value;
-
-        if (c == NAN) {
-            continue;
-        }
-
-        ++valid;
+static wsp_return_t __wsp_aggregate_average(
+    wsp_t *w,
+    wsp_point_t *points,
+    uint32_t count,
+    double *value,
+    int *skip,
+    wsp_error_t *e
+)
+{
+    wsp_rollup_t state;
 
-        total += c;
+    if (__wsp_aggregate_summary(w, points, count, &state, value, skip)) {
+        *value = state.sum / state.known;
     }
 
-    float known = (float)valid / (float)count;
-
-    if (known < w->meta.x_files_factor) {
-        *value = NAN;
-        *skip = 1;
-        return WSP_OK;
-    }
-
-    *value = total / valid;
-
     return WSP_OK;
-}
+} // __wsp_aggregate_average
 
 static wsp_return_t __wsp_aggregate_sum(
     wsp_t *w,
@@ -189,41 +165,14 @@ static wsp_return_t __wsp_aggregate_sum(
     wsp_error_t *e
 )
 {
-    if (count == 0) {
-        *value = NAN;
-        return WSP_OK;
-    }
-
-    uint32_t valid = 0;
-    uint32_t i = 0;
-    double total = 0;
-
-    for (i = 0; i < count; i++) {
-        wsp_point_t *p = points + i;
-
-        double c = p->value;
-
-        if (c == NAN) {
-            continue;
-        }
-
-        ++valid;
-
-        total += c;
-    }
-
-    float known = (float)valid / (float)count;
+    wsp_rollup_t state;
 
-    if (known < w->meta.x_files_factor) {
-        *value = NAN;
-        *skip = 1;
-        return WSP_OK;
+    if (__wsp_aggregate_summary(w, points, count, &state, value, skip)) {
+        *value = state.sum;
     }
 
-    *value = total;
-
     return WSP_OK;
-}
+} // __wsp_aggregate_sum
 
 static wsp_return_t __wsp_aggregate_last(
     wsp_t *w,
@@ -234,14 +183,14 @@ static wsp_return_t __wsp_aggregate_last(
     wsp_error_t *e
 )
 {
-    if (count == 0) {
-        *value = NAN;
-        return WSP_OK;
+    wsp_rollup_t state;
+
+    if (__wsp_aggregate_summary(w, points, count, &state, value, skip)) {
+        *value = state.last;
     }
 
-    *value = (points + count - 1)->value;
     return WSP_OK;
-}
+} // __wsp_aggregate_last
 
 static wsp_return_t __wsp_aggregate_max(
     wsp_t *w,
@@ -252,45 +201,14 @@ static wsp_return_t __wsp_aggregate_max(
     wsp_error_t *e
 )
 {
-    if (count == 0) {
-        *value = NAN;
-        return WSP_OK;
-    }
-
-    uint32_t valid = 0;
-    uint32_t i = 0;
-    double max = NAN;
-
-    for (i = 0; i < count; i++) {
-        wsp_point_t *p = points + i;
-
-        double c = p->value;
-
-        if (c == NAN) {
-            continue;
-        }
-
-        ++valid;
-
-        if (max != NAN && max >= c) {
-            continue;
-        }
-
-        max = c;
-    }
-
-    float known = (float)valid / (float)count;
+    wsp_rollup_t state;
 
-    if (known < w->meta.x_files_factor) {
-        *value = NAN;
-        *skip = 1;
-        return WSP_OK;
+    if (__wsp_aggregate_summary(w, points, count, &state, value, skip)) {
+        *value = state.max;
     }
 
-    *value = max;
-
     return WSP_OK;
-}
+} // __wsp_aggregate_max
 
 static wsp_return_t __wsp_aggregate_min(
     wsp_t *w,
@@ -301,45 +219,14 @@ static wsp_return_t __wsp_aggregate_min(
     wsp_error_t *e
 )
 {
-    if (count == 0) {
-        *value = NAN;
-        return WSP_OK;
-    }
-
-    uint32_t valid = 0;
-    uint32_t i = 0;
-    double min = NAN;
-
-    for (i = 0; i < count; i++) {
-        wsp_point_t *p = points + i;
-
-        double c = p->value;
+    wsp_rollup_t state;
 
-        if (c == NAN) {
-            continue;
-        }
-
-        ++valid;
-
-        if (min != NAN && min <= c) {
-            continue;
-        }
-
-        min = c;
+    if (__wsp_aggregate_summary(w, points, count, &state, value, skip)) {
+        *value = state.min;
     }
 
-    float known = (float)valid / (float)count;
-
-    if (known < w->meta.x_files_factor) {
-        *value = NAN;
-        *skip = 1;
-        return WSP_OK;
-    }
-
-    *value = min;
-
     return WSP_OK;
-}
+} // __wsp_aggregate_min
 // }}}
 
 /*
@@ -382,6 +269,24 @@ wsp_return_t __wsp_setup_mmap(
     return WSP_OK;
 } // }}} __wsp_setup_mmap
 
+// __wsp_io_fadvise {{{
+void __wsp_io_fadvise(
+    int fd,
+    int flags
+)
+{
+    if (flags & WSP_IO_RANDOM) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+    }
+    else if (flags & WSP_IO_SEQUENTIAL) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    if (flags & WSP_IO_WILLNEED) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    }
+} // __wsp_io_fadvise }}}
+
 // __wsp_read_metadata {{{
 wsp_return_t __wsp_read_metadata(
     wsp_t *w,
@@ -389,7 +294,8 @@ wsp_return_t __wsp_read_metadata(
     wsp_error_t *e
 )
 {
-    wsp_metadata_b *buf;
+    wsp_metadata_b tmp_buf;
+    wsp_metadata_b *buf = &tmp_buf;
 
     if (w->io->read(w, 0, sizeof(wsp_metadata_b), (void **)&buf, e) == WSP_ERROR) {
         return WSP_ERROR;
@@ -399,7 +305,7 @@ wsp_return_t __wsp_read_metadata(
 
     __wsp_parse_metadata(buf, &tmp);
 
-    if (w->io_manual_buf) {
+    if (w->io_manual_buf && buf != &tmp_buf) {
         free(buf);
     }
 
@@ -443,7 +349,8 @@ wsp_return_t __wsp_read_archive(
     wsp_error_t *e
 )
 {
-    wsp_archive_b *buf;
+    wsp_archive_b tmp_buf;
+    wsp_archive_b *buf = &tmp_buf;
 
     size_t offset = sizeof(wsp_metadata_b) + sizeof(wsp_archive_b) * index;
 
@@ -456,7 +363,7 @@ wsp_return_t __wsp_read_archive(
     ai->points_size = sizeof(wsp_point_t) * ai->count;
     ai->retention = ai->spp * ai->count;
 
-    if (w->io_manual_buf) {
+    if (w->io_manual_buf && buf != &tmp_buf) {
         free(buf);
     }
 
@@ -604,7 +511,9 @@ int __wsp_load_points(
     size_t read_offset = archive->offset + sizeof(wsp_point_b) * offset;
     size_t read_size = sizeof(wsp_point_b) * size;
 
-    wsp_point_b *buf = NULL;
+    // read straight into result, which is larger than the points on disk
+    // and parsed in place, unless the mapping provides its own memory.
+    wsp_point_b *buf = (wsp_point_b *)result;
 
     if (w->io->read(w, read_offset, read_size, (void **)&buf, e) == WSP_ERROR) {
         return WSP_ERROR;
@@ -612,7 +521,7 @@ int __wsp_load_points(
 
     __wsp_parse_points(buf, size, result);
 
-    if (w->io_manual_buf) {
+    if (w->io_manual_buf && buf != (wsp_point_b *)result) {
         free(buf);
     }
 
@@ -630,3 +539,258 @@ uint32_t __wsp_point_mod(int value, uint32_t div)
 
     return (uint32_t)result;
 } // __wsp_point_mod }}}
+
+// __wsp_time_range {{{
+wsp_return_t __wsp_time_range(
+    wsp_archive_t *archive,
+    wsp_point_t *base,
+    wsp_time_t time_from,
+    wsp_time_t time_until,
+    int *offset,
+    uint32_t *count,
+    wsp_error_t *e
+)
+{
+    if (!(time_from < time_until)) {
+        e->type = WSP_ERROR_TIME_INTERVAL;
+        return WSP_ERROR;
+    }
+
+    int from = wsp_time_floor(time_from, archive->spp) / archive->spp;
+    int until = wsp_time_floor(time_until, archive->spp) / archive->spp;
+
+    *offset = from - (base->timestamp / archive->spp);
+    *count = until - from;
+
+    if (*count > archive->count) {
+        *count = archive->count;
+    }
+
+    return WSP_OK;
+} // __wsp_time_range }}}
+
+// __wsp_io_readv {{{
+wsp_return_t __wsp_io_readv(
+    wsp_t *w,
+    wsp_iov_t *iov,
+    uint32_t count,
+    wsp_error_t *e
+)
+{
+    if (w->io->readv != NULL) {
+        return w->io->readv(w, iov, count, e);
+    }
+
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        void *buf = iov[i].buf;
+
+        if (w->io->read(w, iov[i].offset, iov[i].size, &buf, e) == WSP_ERROR) {
+            return WSP_ERROR;
+        }
+
+        // the mapping provided its own memory.
+        if (buf != iov[i].buf) {
+            memcpy(iov[i].buf, buf, iov[i].size);
+
+            if (w->io_manual_buf) {
+                free(buf);
+            }
+        }
+    }
+
+    return WSP_OK;
+} // __wsp_io_readv }}}
+
+// __wsp_io_writev {{{
+wsp_return_t __wsp_io_writev(
+    wsp_t *w,
+    wsp_iov_t *iov,
+    uint32_t count,
+    wsp_error_t *e
+)
+{
+    wsp_return_t result = WSP_OK;
+    uint32_t i;
+
+    if (w->io->writev != NULL) {
+        result = w->io->writev(w, iov, count, e);
+    }
+    else {
+        for (i = 0; i < count && result == WSP_OK; i++) {
+            result = w->io->write(w, iov[i].offset, iov[i].size, iov[i].buf, e);
+        }
+    }
+
+    // the cache must not see a write that failed, which may have partly
+    // happened and is synced all the same.
+    if (result == WSP_ERROR) {
+        w->bases_valid = 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        __wsp_io_dirty(w, iov[i].offset, iov[i].size, iov[i].buf);
+    }
+
+    return result;
+} // __wsp_io_writev }}}
+
+// __wsp_io_dirty {{{
+void __wsp_io_dirty(
+    wsp_t *w,
+    long offset,
+    size_t size,
+    void *buf
+)
+{
+    long until = offset + (long)size;
+
+    if (w->bases_valid) {
+        uint32_t i;
+
+        for (i = 0; i < w->archives_count; i++) {
+            long base = w->archives[i].offset;
+            long base_until = base + (long)sizeof(wsp_point_b);
+
+            if (until <= base || base_until <= offset) {
+                continue;
+            }
+
+            // keep the cached base point current, unless only part of it is
+            // written.
+            if (offset <= base && base_until <= until) {
+                __wsp_parse_point((wsp_point_b *)((char *)buf + (base - offset)), w->bases + i);
+            }
+            else {
+                w->bases_valid = 0;
+            }
+        }
+    }
+
+    if (w->io_dirty_from == w->io_dirty_until) {
+        w->io_dirty_from = offset;
+        w->io_dirty_until = until;
+    }
+    else {
+        if (offset < w->io_dirty_from) {
+            w->io_dirty_from = offset;
+        }
+
+        if (until > w->io_dirty_until) {
+            w->io_dirty_until = until;
+        }
+    }
+
+    w->io_dirty_bytes += size;
+} // __wsp_io_dirty }}}
+
+// __wsp_sort_points {{{
+/*
+ * Points are merged in runs of this size, which are sorted with an insertion
+ * sort first.
+ */
+#define WSP_SORT_RUN 16
+
+static void __wsp_insertion_sort(
+    wsp_point_t *points,
+    uint32_t count
+)
+{
+    uint32_t i, j;
+
+    for (i = 1; i < count; i++) {
+        wsp_point_t p = points[i];
+
+        for (j = i; j > 0 && points[j - 1].timestamp > p.timestamp; j--) {
+            points[j] = points[j - 1];
+        }
+
+        points[j] = p;
+    }
+}
+
+wsp_return_t __wsp_sort_points(
+    wsp_t *w,
+    wsp_point_t *points,
+    uint32_t count,
+    wsp_error_t *e
+)
+{
+    uint32_t i;
+
+    // points usually arrive in order.
+    for (i = 1; i < count; i++) {
+        if (points[i - 1].timestamp > points[i].timestamp) {
+            break;
+        }
+    }
+
+    if (i >= count) {
+        return WSP_OK;
+    }
+
+    for (i = 0; i < count; i += WSP_SORT_RUN) {
+        uint32_t size = count - i < WSP_SORT_RUN ? count - i : WSP_SORT_RUN;
+        __wsp_insertion_sort(points + i, size);
+    }
+
+    if (count <= WSP_SORT_RUN) {
+        return WSP_OK;
+    }
+
+    wsp_point_t *tmp = __wsp_scratch_alloc(w, sizeof(wsp_point_t) * count, e);
+
+    if (tmp == NULL) {
+        return WSP_ERROR;
+    }
+
+    wsp_point_t *from = points;
+    wsp_point_t *to = tmp;
+    uint32_t width;
+
+    for (width = WSP_SORT_RUN; width < count; width *= 2) {
+        for (i = 0; i < count; i += 2 * width) {
+            uint32_t mid = i + width < count ? i + width : count;
+            uint32_t end = i + 2 * width < count ? i + 2 * width : count;
+            uint32_t a = i, b = mid, k = i;
+
+            // take from the left run on ties to keep the sort stable.
+            while (a < mid && b < end) {
+                to[k++] = from[b].timestamp < from[a].timestamp ? from[b++] : from[a++];
+            }
+
+            while (a < mid) {
+                to[k++] = from[a++];
+            }
+
+            while (b < end) {
+                to[k++] = from[b++];
+            }
+        }
+
+        wsp_point_t *swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != points) {
+        memcpy(points, from, sizeof(wsp_point_t) * count);
+    }
+
+    __wsp_scratch_free(w, tmp);
+    return WSP_OK;
+} // __wsp_sort_points }}}
+
+// __wsp_hash_path {{{
+uint32_t __wsp_hash_path(const char *path)
+{
+    uint32_t hash = 2166136261u;
+
+    for (; *path != '\0'; path++) {
+        hash ^= (unsigned char)*path;
+        hash *= 16777619u;
+    }
+
+    return hash;
+} // __wsp_hash_path }}}
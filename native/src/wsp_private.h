@@ -16,18 +16,83 @@ void __wsp_dump_point(
     wsp_point_b *buf
 );
 
+/*
+ * The bulk functions below are implemented by the fastest kernels the CPU
+ * supports, see wsp_simd.c.
+ */
 void __wsp_parse_points(
     wsp_point_b *buf,
     uint32_t points_count,
     wsp_point_t *points
 );
 
+/*
+ * Parse points that are expected to have the timestamps expected,
+ * expected + spp, ... in a single pass. Points with any other timestamp are
+ * replaced by the expected timestamp and a NAN value.
+ *
+ * Like __wsp_parse_points, buf and points may be the same memory.
+ */
+void __wsp_parse_points_expected(
+    wsp_point_b *buf,
+    uint32_t points_count,
+    wsp_time_t expected,
+    uint32_t spp,
+    wsp_point_t *points
+);
+
+/*
+ * Parse points into separate arrays of timestamps and values, checking the
+ * timestamps like __wsp_parse_points_expected: the raw timestamps are kept,
+ * but the values of unexpected ones are NAN.
+ *
+ * timestamps may be NULL. The arrays must not overlap buf.
+ */
+void __wsp_parse_columns(
+    wsp_point_b *buf,
+    uint32_t points_count,
+    wsp_time_t expected,
+    uint32_t spp,
+    wsp_time_t *timestamps,
+    double *values
+);
+
 void __wsp_dump_points(
     wsp_point_t *points,
     uint32_t points_count,
     wsp_point_b *buf
 );
 
+/*
+ * Summarize the known (non-NAN) points of a window in a single pass: their
+ * number, sum, minimum, maximum and the most recent of them. The interval of
+ * the state is left alone.
+ *
+ * The min, max and last of a state without known points are 0.
+ */
+void __wsp_summarize(
+    wsp_point_t *points,
+    uint32_t points_count,
+    wsp_rollup_t *state
+);
+
+typedef enum {
+    WSP_SIMD_NONE = 0,
+    WSP_SIMD_SSSE3 = 1,
+    WSP_SIMD_AVX2 = 2
+} wsp_simd_t;
+
+/*
+ * Use the kernels of an instruction set, or of the best one below it that
+ * the CPU supports. Returns the instruction set used.
+ *
+ * The best kernels are selected when the library is loaded, this is meant for
+ * tests and benchmarks, and must not be called while points are parsed.
+ */
+wsp_simd_t __wsp_simd_select(
+    wsp_simd_t simd
+);
+
 void __wsp_parse_metadata(
     wsp_metadata_b *buf,
     wsp_metadata_t *m
@@ -64,6 +129,18 @@ wsp_return_t __wsp_setup_mmap(
     wsp_error_t *e
 );
 
+/*
+ * Apply the access hints of io_flags to a file descriptor with
+ * posix_fadvise. The hints are advisory, failures are ignored.
+ *
+ * fd: File descriptor of the database.
+ * flags: Access hints (wsp_io_flags_t).
+ */
+void __wsp_io_fadvise(
+    int fd,
+    int flags
+);
+
 /*
  * Read metadata from file.
  *
@@ -100,6 +177,22 @@ wsp_return_t __wsp_archive_free(
     wsp_error_t *e
 );
 
+/*
+ * Load the header of the file open in a handle, from the header cache if it
+ * is enabled (see wsp_header.c).
+ */
+wsp_return_t __wsp_header_open(
+    wsp_t *w,
+    wsp_error_t *e
+);
+
+/*
+ * Release the cached header of a handle.
+ */
+void __wsp_header_close(
+    wsp_t *w
+);
+
 wsp_return_t __wsp_find_highest_precision(
     wsp_time_t diff,
     wsp_t *w,
@@ -119,4 +212,179 @@ int __wsp_load_points(
 
 uint32_t __wsp_point_mod(int value, uint32_t div);
 
+/*
+ * Calculate the points of an archive covering a time interval.
+ *
+ * archive: Archive to calculate points for.
+ * base: Base point of the archive.
+ * time_from: Start of the interval.
+ * time_until: End of the interval.
+ * offset: Where to store the offset of the first point, relative to base.
+ * count: Where to store the number of points.
+ * e: Error object.
+ */
+wsp_return_t __wsp_time_range(
+    wsp_archive_t *archive,
+    wsp_point_t *base,
+    wsp_time_t time_from,
+    wsp_time_t time_until,
+    int *offset,
+    uint32_t *count,
+    wsp_error_t *e
+);
+
+/*
+ * Read the values of consecutive intervals of an archive, checking the
+ * timestamp of every point: the values of points that do not belong to their
+ * interval are NAN.
+ *
+ * w: Whisper database.
+ * archive: Archive to read from.
+ * base: Base point of the archive.
+ * from: First interval, aligned to the precision of the archive.
+ * count: Number of intervals, at most the number of points in the archive.
+ * buf: Space for count raw points, not used by mappings that provide their
+ * own memory.
+ * values: Where to store the values.
+ * e: Error object.
+ */
+wsp_return_t __wsp_load_values(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    wsp_point_t *base,
+    wsp_time_t from,
+    uint32_t count,
+    wsp_point_b *buf,
+    double *values,
+    wsp_error_t *e
+);
+
+/*
+ * Write points, sorted by timestamp, to a single archive and propagate them
+ * to the lower precision archives, see wsp_update_many.
+ *
+ * w: Whisper database.
+ * archive: Archive to write to.
+ * points: Points to write.
+ * count: Number of points.
+ * e: Error object.
+ */
+wsp_return_t __wsp_archive_update_many(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    wsp_point_t *points,
+    uint32_t count,
+    wsp_error_t *e
+);
+
+/*
+ * Find the first of count pairs of values, from start on, that differ. Two
+ * unknown (NAN) values are equal.
+ *
+ * Returns count if all pairs are equal. Implemented by the fastest kernel
+ * the CPU supports, see wsp_simd.c.
+ */
+uint32_t __wsp_next_difference(
+    const double *a,
+    const double *b,
+    uint32_t start,
+    uint32_t count
+);
+
+/*
+ * Read segments using the vectored reader of the mapping, or one read per
+ * segment if the mapping has none.
+ *
+ * w: Whisper database.
+ * iov: Segments to read, always read into their buffers.
+ * count: Number of segments.
+ * e: Error object.
+ */
+wsp_return_t __wsp_io_readv(
+    wsp_t *w,
+    wsp_iov_t *iov,
+    uint32_t count,
+    wsp_error_t *e
+);
+
+/*
+ * Write segments using the vectored writer of the mapping, or one write per
+ * segment if the mapping has none.
+ *
+ * w: Whisper database.
+ * iov: Segments to write, in order.
+ * count: Number of segments.
+ * e: Error object.
+ */
+wsp_return_t __wsp_io_writev(
+    wsp_t *w,
+    wsp_iov_t *iov,
+    uint32_t count,
+    wsp_error_t *e
+);
+
+/*
+ * Record a write in the dirty range of a database, see wsp_sync, and in the
+ * cached base points of its archives. Called once the write is done, a
+ * failed write must invalidate the cache first.
+ *
+ * w: Whisper database.
+ * offset: Offset of the write.
+ * size: Size of the write.
+ * buf: Data written.
+ */
+void __wsp_io_dirty(
+    wsp_t *w,
+    long offset,
+    size_t size,
+    void *buf
+);
+
+/*
+ * Stable sort of points by timestamp.
+ *
+ * w: Whisper database, whose scratch memory is used.
+ * points: Points to sort in place.
+ * count: Number of points.
+ * e: Error object.
+ */
+wsp_return_t __wsp_sort_points(
+    wsp_t *w,
+    wsp_point_t *points,
+    uint32_t count,
+    wsp_error_t *e
+);
+
+/*
+ * FNV-1a hash of a path.
+ */
+uint32_t __wsp_hash_path(const char *path);
+
+/*
+ * Take temporary memory for an operation on a database, from the arena of
+ * the handle or of the calling thread if it has room, or from the heap.
+ *
+ * Memory must be given back with __wsp_scratch_free, in the reverse order it
+ * was taken.
+ *
+ * w: Whisper database.
+ * size: Number of bytes.
+ * e: Error object.
+ *
+ * Returns NULL if the memory could not be allocated.
+ */
+void *__wsp_scratch_alloc(
+    wsp_t *w,
+    size_t size,
+    wsp_error_t *e
+);
+
+/*
+ * Give back memory taken with __wsp_scratch_alloc, may be NULL.
+ */
+void __wsp_scratch_free(
+    wsp_t *w,
+    void *p
+);
+
 #endif /* _WSP_PRIVATE_H_ */
@@ -0,0 +1,615 @@
+// vim: foldmethod=marker
+#include "wsp_resize.h"
+#include "wsp_private.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * Number of points read from an old archive, and written to a new archive,
+ * at a time.
+ */
+#define WSP_RESIZE_POINTS 4096
+
+// __wsp_resize_source {{{
+/*
+ * Find the most precise archive of the old database that still has a point
+ * for the given time.
+ */
+static wsp_archive_t *__wsp_resize_source(
+    wsp_t *src,
+    int64_t t,
+    wsp_time_t now
+)
+{
+    wsp_archive_t *best = NULL;
+    uint32_t i;
+
+    for (i = 0; i < src->archives_count; i++) {
+        wsp_archive_t *archive = src->archives + i;
+        int64_t newest = now - now % archive->spp;
+        int64_t oldest = newest - (int64_t)(archive->count - 1) * archive->spp;
+
+        if (oldest <= t && (best == NULL || archive->spp < best->spp)) {
+            best = archive;
+        }
+    }
+
+    return best;
+} // __wsp_resize_source }}}
+
+// __wsp_resize_archive {{{
+/*
+ * Fill an archive of the new database, which must be empty, from the old
+ * database.
+ *
+ * Intervals are visited from the oldest to the newest. The first known
+ * interval is written to the first point of the archive, which makes it the
+ * base of the ring, and the following intervals to the following points.
+ */
+static wsp_return_t __wsp_resize_archive(
+    wsp_t *src,
+    wsp_t *dst,
+    wsp_archive_t *archive,
+    wsp_time_t now,
+    wsp_error_t *e
+)
+{
+    uint32_t s = archive->spp;
+    int64_t last = now - now % s;
+    int64_t first = last - (int64_t)(archive->count - 1) * s;
+
+    while (first < 0) {
+        first += s;
+    }
+
+    uint32_t points_size = WSP_RESIZE_POINTS;
+    wsp_point_t *points = malloc(sizeof(wsp_point_t) * points_size);
+    wsp_point_b *out = malloc(sizeof(wsp_point_b) * WSP_RESIZE_POINTS);
+
+    if (points == NULL || out == NULL) {
+        free(points);
+        free(out);
+        e->type = WSP_ERROR_MALLOC;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    // block of points of an old archive in points.
+    wsp_archive_t *block = NULL;
+    int64_t block_from = 0;
+    uint32_t block_count = 0;
+    wsp_point_t block_base;
+
+    // points of the new archive waiting in out.
+    uint32_t written = 0;
+    uint32_t out_count = 0;
+    int started = 0;
+
+    wsp_return_t result = WSP_OK;
+    int64_t t;
+
+    for (t = first; t <= last; t += s) {
+        wsp_archive_t *a = __wsp_resize_source(src, t, now);
+        double value = 0;
+        int skip = 1;
+
+        if (a != NULL) {
+            uint32_t sp = a->spp;
+            int64_t newest = now - now % sp;
+            int64_t from = (t + sp - 1) / sp * sp;
+            int64_t until = t + s;
+
+            // the points of the interval that are not in the future.
+            if (until > newest + sp) {
+                until = newest + sp;
+            }
+
+            if (from < until) {
+                uint32_t count = (until - from + sp - 1) / sp;
+
+                if (block != a || from < block_from || from + (int64_t)count * sp > block_from + (int64_t)block_count * sp) {
+                    uint32_t n = (newest - from) / sp + 1;
+
+                    if (n > WSP_RESIZE_POINTS) {
+                        n = WSP_RESIZE_POINTS;
+                    }
+
+                    if (n < count) {
+                        n = count;
+                    }
+
+                    if (n > points_size) {
+                        wsp_point_t *tmp = realloc(points, sizeof(wsp_point_t) * n);
+
+                        if (tmp == NULL) {
+                            e->type = WSP_ERROR_MALLOC;
+                            e->syserr = errno;
+                            result = WSP_ERROR;
+                            break;
+                        }
+
+                        points = tmp;
+                        points_size = n;
+                    }
+
+                    if (block != a && wsp_load_point(src, a, 0, &block_base, e) == WSP_ERROR) {
+                        result = WSP_ERROR;
+                        break;
+                    }
+
+                    int offset = (int)((from - (int64_t)block_base.timestamp) / sp);
+
+                    if (wsp_load_points(src, a, offset, n, points, e) == WSP_ERROR) {
+                        result = WSP_ERROR;
+                        break;
+                    }
+
+                    block = a;
+                    block_from = from;
+                    block_count = n;
+                }
+
+                skip = 0;
+
+                wsp_point_t *window = points + (from - block_from) / sp;
+
+                if (dst->meta.aggregate(dst, window, count, &value, &skip, e) == WSP_ERROR) {
+                    result = WSP_ERROR;
+                    break;
+                }
+            }
+        }
+
+        if (!started) {
+            if (skip) {
+                continue;
+            }
+
+            started = 1;
+        }
+
+        if (skip) {
+            // an empty point.
+            memset(out + out_count, 0, sizeof(wsp_point_b));
+        }
+        else {
+            wsp_point_t p = { .timestamp = (wsp_time_t)t, .value = value };
+            __wsp_dump_point(&p, out + out_count);
+        }
+
+        if (++out_count == WSP_RESIZE_POINTS) {
+            wsp_iov_t iov = {
+                .offset = WSP_POINT_OFFSET(archive, written),
+                .size = sizeof(wsp_point_b) * out_count,
+                .buf = out
+            };
+
+            if (__wsp_io_writev(dst, &iov, 1, e) == WSP_ERROR) {
+                result = WSP_ERROR;
+                break;
+            }
+
+            written += out_count;
+            out_count = 0;
+        }
+    }
+
+    if (result == WSP_OK && out_count > 0) {
+        wsp_iov_t iov = {
+            .offset = WSP_POINT_OFFSET(archive, written),
+            .size = sizeof(wsp_point_b) * out_count,
+            .buf = out
+        };
+
+        result = __wsp_io_writev(dst, &iov, 1, e);
+    }
+
+    free(points);
+    free(out);
+    return result;
+} // __wsp_resize_archive }}}
+
+// __wsp_resize_fill {{{
+/*
+ * Fill all archives of a new database from the old one, and sync it.
+ */
+static wsp_return_t __wsp_resize_fill(
+    wsp_t *src,
+    const char *target,
+    wsp_error_t *e
+)
+{
+    wsp_t dst;
+    WSP_INIT(&dst);
+
+    if (wsp_open(&dst, target, WSP_MMAP, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    wsp_time_t now = wsp_time_now();
+    wsp_return_t result = WSP_OK;
+    uint32_t i;
+
+    for (i = 0; i < dst.archives_count && result == WSP_OK; i++) {
+        result = __wsp_resize_archive(src, &dst, dst.archives + i, now, e);
+    }
+
+    if (result == WSP_OK) {
+        result = wsp_sync(&dst, e);
+    }
+
+    wsp_error_t ignored;
+    WSP_ERROR_INIT(&ignored);
+
+    wsp_close(&dst, &ignored);
+    return result;
+} // __wsp_resize_fill }}}
+
+// wsp_resize {{{
+wsp_return_t wsp_resize(
+    const char *path,
+    const char *new_path,
+    wsp_archive_t *archives,
+    uint32_t count,
+    float x_files_factor,
+    wsp_aggregation_t aggregation,
+    wsp_error_t *e
+)
+{
+    wsp_t src;
+    WSP_INIT(&src);
+    src.io_flags = WSP_IO_SEQUENTIAL;
+
+    if (wsp_open(&src, path, WSP_MMAP, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    if (x_files_factor < 0) {
+        x_files_factor = src.meta.x_files_factor;
+    }
+
+    if (aggregation == 0) {
+        aggregation = src.meta.aggregation;
+    }
+
+    char *tmp = NULL;
+    const char *target = new_path;
+
+    if (target == NULL) {
+        size_t length = strlen(path);
+
+        tmp = malloc(length + sizeof(".tmp"));
+
+        if (tmp == NULL) {
+            e->type = WSP_ERROR_MALLOC;
+            e->syserr = errno;
+            wsp_close(&src, e);
+            return WSP_ERROR;
+        }
+
+        memcpy(tmp, path, length);
+        memcpy(tmp + length, ".tmp", sizeof(".tmp"));
+
+        // left behind by an earlier resize.
+        unlink(tmp);
+        target = tmp;
+    }
+
+    wsp_return_t result = wsp_create(target, archives, count, x_files_factor, aggregation, WSP_CREATE_FALLOCATE, e);
+
+    if (result == WSP_OK) {
+        result = __wsp_resize_fill(&src, target, e);
+
+        if (result == WSP_ERROR) {
+            unlink(target);
+        }
+    }
+
+    wsp_error_t ignored;
+    WSP_ERROR_INIT(&ignored);
+
+    wsp_close(&src, &ignored);
+
+    if (result == WSP_OK && tmp != NULL && rename(tmp, path) == -1) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        unlink(tmp);
+        result = WSP_ERROR;
+    }
+
+    free(tmp);
+    return result;
+} // wsp_resize }}}
+
+// resize directory {{{
+typedef struct {
+    // databases to resize.
+    char **paths;
+    uint32_t paths_count;
+    // next database to take, guarded by lock.
+    uint32_t next;
+    pthread_mutex_t lock;
+    // configuration, see wsp_resize.
+    wsp_archive_t *archives;
+    uint32_t archives_count;
+    float x_files_factor;
+    wsp_aggregation_t aggregation;
+    // results, guarded by lock.
+    uint64_t resized;
+    uint64_t failed;
+    wsp_error_t error;
+} wsp_resize_dir_t;
+
+/*
+ * Add the databases below a directory to the list of paths.
+ */
+static wsp_return_t __wsp_resize_collect(
+    const char *dir,
+    char ***paths,
+    uint32_t *count,
+    uint32_t *size,
+    wsp_error_t *e
+)
+{
+    DIR *d = opendir(dir);
+
+    if (d == NULL) {
+        e->type = WSP_ERROR_IO;
+        e->syserr = errno;
+        return WSP_ERROR;
+    }
+
+    wsp_return_t result = WSP_OK;
+    struct dirent *entry;
+
+    while (result == WSP_OK && (entry = readdir(d)) != NULL) {
+        const char *name = entry->d_name;
+
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+
+        size_t dir_length = strlen(dir);
+        size_t name_length = strlen(name);
+        char *path = malloc(dir_length + name_length + 2);
+
+        if (path == NULL) {
+            e->type = WSP_ERROR_MALLOC;
+            e->syserr = errno;
+            result = WSP_ERROR;
+            break;
+        }
+
+        memcpy(path, dir, dir_length);
+        path[dir_length] = '/';
+        memcpy(path + dir_length + 1, name, name_length + 1);
+
+        struct stat st;
+
+        if (lstat(path, &st) == -1) {
+            // removed in the meantime.
+            free(path);
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            result = __wsp_resize_collect(path, paths, count, size, e);
+            free(path);
+            continue;
+        }
+
+        if (!S_ISREG(st.st_mode)
+            || name_length < 4
+            || strcmp(name + name_length - 4, ".wsp") != 0) {
+            free(path);
+            continue;
+        }
+
+        if (*count == *size) {
+            uint32_t new_size = *size == 0 ? 1024 : *size * 2;
+            char **tmp = realloc(*paths, sizeof(char *) * new_size);
+
+            if (tmp == NULL) {
+                e->type = WSP_ERROR_MALLOC;
+                e->syserr = errno;
+                free(path);
+                result = WSP_ERROR;
+                break;
+            }
+
+            *paths = tmp;
+            *size = new_size;
+        }
+
+        (*paths)[(*count)++] = path;
+    }
+
+    closedir(d);
+    return result;
+}
+
+/*
+ * Check if a database already has the configuration it would be resized to.
+ */
+static wsp_return_t __wsp_resize_needed(
+    wsp_resize_dir_t *r,
+    const char *path,
+    int *needed,
+    wsp_error_t *e
+)
+{
+    wsp_t w;
+    WSP_INIT(&w);
+
+    if (wsp_open(&w, path, WSP_MMAP, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    *needed = w.archives_count != r->archives_count
+        || (r->x_files_factor >= 0 && w.meta.x_files_factor != r->x_files_factor)
+        || (r->aggregation != 0 && w.meta.aggregation != r->aggregation);
+
+    uint32_t i, j;
+
+    for (i = 0; i < r->archives_count && !*needed; i++) {
+        for (j = 0; j < w.archives_count; j++) {
+            if (w.archives[j].spp == r->archives[i].spp
+                && w.archives[j].count == r->archives[i].count) {
+                break;
+            }
+        }
+
+        *needed = j == w.archives_count;
+    }
+
+    return wsp_close(&w, e);
+}
+
+static void *__wsp_resize_worker(void *arg)
+{
+    wsp_resize_dir_t *r = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&r->lock);
+        uint32_t index = r->next < r->paths_count ? r->next++ : r->paths_count;
+        pthread_mutex_unlock(&r->lock);
+
+        if (index == r->paths_count) {
+            break;
+        }
+
+        const char *path = r->paths[index];
+        int needed = 0;
+
+        wsp_error_t e;
+        WSP_ERROR_INIT(&e);
+
+        wsp_return_t result = __wsp_resize_needed(r, path, &needed, &e);
+
+        if (result == WSP_OK && needed) {
+            result = wsp_resize(path, NULL, r->archives, r->archives_count,
+                r->x_files_factor, r->aggregation, &e);
+        }
+
+        pthread_mutex_lock(&r->lock);
+
+        if (result == WSP_ERROR) {
+            r->failed++;
+            r->error = e;
+        }
+        else if (needed) {
+            r->resized++;
+        }
+
+        pthread_mutex_unlock(&r->lock);
+    }
+
+    return NULL;
+}
+// }}}
+
+// wsp_resize_dir {{{
+wsp_return_t wsp_resize_dir(
+    const char *dir,
+    wsp_archive_t *archives,
+    uint32_t count,
+    float x_files_factor,
+    wsp_aggregation_t aggregation,
+    uint32_t threads_count,
+    uint64_t *resized,
+    wsp_error_t *e
+)
+{
+    if (threads_count == 0) {
+        e->type = WSP_ERROR_INVALID;
+        return WSP_ERROR;
+    }
+
+    // fail early rather than once for every database.
+    if (wsp_validate_archives(archives, count, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    wsp_resize_dir_t r;
+    memset(&r, 0, sizeof(r));
+
+    r.archives = archives;
+    r.archives_count = count;
+    r.x_files_factor = x_files_factor;
+    r.aggregation = aggregation;
+    WSP_ERROR_INIT(&r.error);
+
+    uint32_t paths_size = 0;
+    wsp_return_t result = __wsp_resize_collect(dir, &r.paths, &r.paths_count, &paths_size, e);
+
+    pthread_t *threads = NULL;
+    uint32_t started = 0;
+    int error;
+
+    if (result == WSP_OK) {
+        threads = malloc(sizeof(pthread_t) * threads_count);
+
+        if (threads == NULL) {
+            e->type = WSP_ERROR_MALLOC;
+            e->syserr = errno;
+            result = WSP_ERROR;
+        }
+    }
+
+    if (result == WSP_OK && (error = pthread_mutex_init(&r.lock, NULL)) != 0) {
+        e->type = WSP_ERROR_THREAD;
+        e->syserr = error;
+        result = WSP_ERROR;
+    }
+
+    if (result == WSP_OK) {
+        for (started = 0; started < threads_count; started++) {
+            error = pthread_create(threads + started, NULL, __wsp_resize_worker, &r);
+
+            if (error != 0) {
+                break;
+            }
+        }
+
+        // the threads that did start do all the work.
+        if (started == 0) {
+            e->type = WSP_ERROR_THREAD;
+            e->syserr = error;
+            result = WSP_ERROR;
+        }
+
+        uint32_t i;
+
+        for (i = 0; i < started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+
+        pthread_mutex_destroy(&r.lock);
+    }
+
+    if (result == WSP_OK && r.failed > 0) {
+        *e = r.error;
+        result = WSP_ERROR;
+    }
+
+    if (resized != NULL) {
+        *resized = r.resized;
+    }
+
+    uint32_t i;
+
+    for (i = 0; i < r.paths_count; i++) {
+        free(r.paths[i]);
+    }
+
+    free(r.paths);
+    free(threads);
+    return result;
+} // wsp_resize_dir }}}
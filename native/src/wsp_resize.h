@@ -0,0 +1,82 @@
+// vim: foldmethod=marker
+/**
+ * Native resizing of databases.
+ *
+ * Every archive of the new database is filled in a single sequential pass:
+ * each of its intervals is aggregated, using the aggregation method and
+ * xFilesFactor of the new database, from the points of the most precise
+ * archive of the old database that still covers the interval. Old archives
+ * are streamed in blocks of points, never loaded whole.
+ *
+ * Example:
+ *
+ *   wsp_archive_t archives[2] = {
+ *       { .spp = 60, .count = 10080 },
+ *       { .spp = 3600, .count = 43800 }
+ *   };
+ *
+ *   if (wsp_resize(path, NULL, archives, 2, -1, 0, &e) == WSP_ERROR) {
+ *       return 1;
+ *   }
+ *
+ * The old database must not be written while it is resized.
+ */
+#ifndef _WSP_RESIZE_H_
+#define _WSP_RESIZE_H_
+
+#include "wsp.h"
+
+/**
+ * Resize a database.
+ *
+ * Unless new_path is given, the resized database is written next to the old
+ * one (with a .tmp suffix), synced and renamed over it.
+ *
+ * path: Path of the database to resize.
+ * new_path: Where to create the resized database instead, or NULL.
+ * archives: Archives of the resized database, only spp and count are used.
+ * count: Number of archives.
+ * x_files_factor: xFilesFactor of the resized database, negative to keep the
+ * one of the old database.
+ * aggregation: Aggregation method of the resized database, 0 to keep the one
+ * of the old database.
+ * e: Error object.
+ */
+wsp_return_t wsp_resize(
+    const char *path,
+    const char *new_path,
+    wsp_archive_t *archives,
+    uint32_t count,
+    float x_files_factor,
+    wsp_aggregation_t aggregation,
+    wsp_error_t *e
+);
+
+/**
+ * Resize every database (*.wsp) below a directory in place, using a number
+ * of threads. Databases that already have the requested configuration are
+ * left alone.
+ *
+ * Keeps going when a database fails, and then fails with the last error.
+ *
+ * dir: Directory to resize the databases of.
+ * archives: See wsp_resize.
+ * count: See wsp_resize.
+ * x_files_factor: See wsp_resize.
+ * aggregation: See wsp_resize.
+ * threads_count: Number of threads.
+ * resized: Where to store the number of databases resized, or NULL.
+ * e: Error object.
+ */
+wsp_return_t wsp_resize_dir(
+    const char *dir,
+    wsp_archive_t *archives,
+    uint32_t count,
+    float x_files_factor,
+    wsp_aggregation_t aggregation,
+    uint32_t threads_count,
+    uint64_t *resized,
+    wsp_error_t *e
+);
+
+#endif /* _WSP_RESIZE_H_ */
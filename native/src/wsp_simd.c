@@ -0,0 +1,790 @@
+// vim: foldmethod=marker
+/**
+ * Bulk point kernels.
+ *
+ * Points are stored as packed 12 byte big-endian records, and are used as
+ * 16 byte host order wsp_point_t structures. Converting between the two is a
+ * byte shuffle, which SSSE3 and AVX2 do for several points per instruction.
+ *
+ * Windows of points are summarized for aggregation with SSE2. 256 bit loads
+ * of 16 byte points split cache lines half of the time, and AVX2 is no
+ * faster here. Columns of values are compared, for merging and diffing
+ * databases, with SSE2 as well.
+ *
+ * The kernel used is picked once, when the library is loaded, from the
+ * features of the running CPU. The scalar kernels are always available and
+ * are used on other architectures.
+ */
+#include "wsp.h"
+#include "wsp_private.h"
+
+#include <string.h>
+#include <math.h>
+
+#if defined(__BYTE_ORDER__)
+#define WSP_LITTLE_ENDIAN (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#else
+#define WSP_LITTLE_ENDIAN (BYTE_ORDER == LITTLE_ENDIAN)
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WSP_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// scalar kernels {{{
+static inline uint32_t __wsp_load_be32(const char *b)
+{
+    uint32_t v;
+    memcpy(&v, b, sizeof(v));
+#if WSP_LITTLE_ENDIAN
+    v = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+#endif
+    return v;
+} // __wsp_load_be32
+
+static inline uint64_t __wsp_load_be64(const char *b)
+{
+    return ((uint64_t)__wsp_load_be32(b) << 32) | __wsp_load_be32(b + 4);
+} // __wsp_load_be64
+
+static inline void __wsp_store_be32(char *b, uint32_t v)
+{
+#if WSP_LITTLE_ENDIAN
+    v = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+#endif
+    memcpy(b, &v, sizeof(v));
+} // __wsp_store_be32
+
+static inline void __wsp_store_be64(char *b, uint64_t v)
+{
+    __wsp_store_be32(b, (uint32_t)(v >> 32));
+    __wsp_store_be32(b + 4, (uint32_t)v);
+} // __wsp_store_be64
+
+static inline wsp_point_t __wsp_decode(const wsp_point_b *raw)
+{
+    wsp_point_t p;
+    uint64_t v = __wsp_load_be64(raw->value);
+
+    memset(&p, 0, sizeof(p));
+    p.timestamp = __wsp_load_be32(raw->timestamp);
+    memcpy(&p.value, &v, sizeof(v));
+    return p;
+} // __wsp_decode
+
+static void __wsp_parse_points__scalar(
+    wsp_point_b *buf,
+    uint32_t count,
+    wsp_point_t *points
+)
+{
+    uint32_t i;
+
+    // backwards and through a copy, so that buf and points may be the same
+    // memory; point i never overlaps the unparsed points before it.
+    for (i = count; i > 0; i--) {
+        points[i - 1] = __wsp_decode(buf + i - 1);
+    }
+} // __wsp_parse_points__scalar
+
+static void __wsp_parse_points_expected__scalar(
+    wsp_point_b *buf,
+    uint32_t count,
+    wsp_time_t expected,
+    uint32_t spp,
+    wsp_point_t *points
+)
+{
+    uint32_t i;
+
+    for (i = count; i > 0; i--) {
+        wsp_point_t p = __wsp_decode(buf + i - 1);
+        wsp_time_t t = expected + (i - 1) * spp;
+
+        if (p.timestamp != t) {
+            p.timestamp = t;
+            p.value = NAN;
+        }
+
+        points[i - 1] = p;
+    }
+} // __wsp_parse_points_expected__scalar
+
+static void __wsp_parse_columns__scalar(
+    wsp_point_b *buf,
+    uint32_t count,
+    wsp_time_t expected,
+    uint32_t spp,
+    wsp_time_t *timestamps,
+    double *values
+)
+{
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        wsp_point_t p = __wsp_decode(buf + i);
+
+        if (timestamps != NULL) {
+            timestamps[i] = p.timestamp;
+        }
+
+        values[i] = p.timestamp == expected + i * spp ? p.value : NAN;
+    }
+} // __wsp_parse_columns__scalar
+
+static void __wsp_dump_points__scalar(
+    wsp_point_t *points,
+    uint32_t count,
+    wsp_point_b *buf
+)
+{
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        uint64_t v;
+        memcpy(&v, &points[i].value, sizeof(v));
+        __wsp_store_be32(buf[i].timestamp, points[i].timestamp);
+        __wsp_store_be64(buf[i].value, v);
+    }
+} // __wsp_dump_points__scalar
+
+/*
+ * Sum lanes: known points are summed into 8 lanes by their index modulo 8,
+ * which are then added together pairwise. Every kernel sums in this order,
+ * so that the result does not depend on the instruction set used.
+ */
+#define WSP_SUM_LANES 8
+
+/*
+ * Summarize the points from start on, continuing from the partial results of
+ * a vector kernel, and fill in the state.
+ */
+static void __wsp_summarize_from(
+    wsp_point_t *points,
+    uint32_t start,
+    uint32_t count,
+    double sum[WSP_SUM_LANES],
+    double min,
+    double max,
+    uint32_t known,
+    wsp_rollup_t *state
+)
+{
+    uint32_t i;
+
+    for (i = start; i < count; i++) {
+        double v = points[i].value;
+
+        if (isnan(v)) {
+            continue;
+        }
+
+        sum[i % WSP_SUM_LANES] += v;
+        min = v < min ? v : min;
+        max = v > max ? v : max;
+        known++;
+    }
+
+    state->known = known;
+    state->sum = ((sum[0] + sum[1]) + (sum[2] + sum[3])) + ((sum[4] + sum[5]) + (sum[6] + sum[7]));
+    state->min = known == 0 ? 0 : min;
+    state->max = known == 0 ? 0 : max;
+    state->last = 0;
+    state->last_timestamp = 0;
+
+    for (i = count; i > 0 && known > 0; i--) {
+        if (!isnan(points[i - 1].value)) {
+            state->last = points[i - 1].value;
+            state->last_timestamp = points[i - 1].timestamp;
+            break;
+        }
+    }
+} // __wsp_summarize_from
+
+static void __wsp_summarize__scalar(
+    wsp_point_t *points,
+    uint32_t count,
+    wsp_rollup_t *state
+)
+{
+    double sum[WSP_SUM_LANES] = {0, 0, 0, 0, 0, 0, 0, 0};
+    __wsp_summarize_from(points, 0, count, sum, INFINITY, -INFINITY, 0, state);
+} // __wsp_summarize__scalar
+
+static uint32_t __wsp_next_difference__scalar(
+    const double *a,
+    const double *b,
+    uint32_t start,
+    uint32_t count
+)
+{
+    uint32_t i;
+
+    for (i = start; i < count; i++) {
+        if (!(a[i] == b[i] || (isnan(a[i]) && isnan(b[i])))) {
+            break;
+        }
+    }
+
+    return i;
+} // __wsp_next_difference__scalar
+// }}}
+
+#ifdef WSP_SIMD_X86
+/*
+ * Shuffle a packed record at byte 0 of a vector into a wsp_point_t: swap the
+ * timestamp into bytes 0-3, zero the padding and swap the value into bytes
+ * 8-15.
+ */
+#define WSP_SHUFFLE_PARSE \
+    3, 2, 1, 0, \
+    -128, -128, -128, -128, \
+    11, 10, 9, 8, 7, 6, 5, 4
+
+// the reverse of WSP_SHUFFLE_PARSE, leaving bytes 12-15 zero.
+#define WSP_SHUFFLE_DUMP \
+    3, 2, 1, 0, \
+    15, 14, 13, 12, 11, 10, 9, 8, \
+    -128, -128, -128, -128
+
+static uint64_t __wsp_nan_bits;
+
+/*
+ * Replace the points of a parsed block whose timestamps are not the expected
+ * ones, used by the vector kernels when a block fails their check. Kept out of
+ * line so that it does not weigh on their loops.
+ */
+__attribute__((noinline, cold))
+static void __wsp_expect_points(
+    wsp_point_t *points,
+    uint32_t count,
+    wsp_time_t expected,
+    uint32_t spp
+)
+{
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        if (points[i].timestamp != expected + i * spp) {
+            points[i].timestamp = expected + i * spp;
+            points[i].value = NAN;
+        }
+    }
+} // __wsp_expect_points
+
+// ssse3 kernels {{{
+/*
+ * Parse 4 records from 48 bytes, all loads are made before any store so that
+ * the records and points may overlap as for __wsp_parse_points.
+ */
+#define WSP_SSSE3_PARSE4(raw, o0, o1, o2, o3) do {\
+    __m128i a = _mm_loadu_si128((const __m128i *)(raw));\
+    __m128i b = _mm_loadu_si128((const __m128i *)((raw) + 16));\
+    __m128i c = _mm_loadu_si128((const __m128i *)((raw) + 32));\
+    o0 = _mm_shuffle_epi8(a, shuffle);\
+    o1 = _mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), shuffle);\
+    o2 = _mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), shuffle);\
+    o3 = _mm_shuffle_epi8(_mm_srli_si128(c, 4), shuffle);\
+} while (0)
+
+/*
+ * Gather the timestamps of 4 parsed points into one vector.
+ */
+#define WSP_SSSE3_TIMESTAMPS(o0, o1, o2, o3) \
+    _mm_unpacklo_epi64(_mm_unpacklo_epi32(o0, o1), _mm_unpacklo_epi32(o2, o3))
+
+__attribute__((target("ssse3")))
+static void __wsp_parse_points__ssse3(
+    wsp_point_b *buf,
+    uint32_t count,
+    wsp_point_t *points
+)
+{
+    const __m128i shuffle = _mm_setr_epi8(WSP_SHUFFLE_PARSE);
+    uint32_t tail = count % 4;
+    uint32_t i;
+
+    __wsp_parse_points__scalar(buf + count - tail, tail, points + count - tail);
+
+    for (i = count - tail; i > 0; i -= 4) {
+        __m128i o0, o1, o2, o3;
+        WSP_SSSE3_PARSE4((const char *)(buf + i - 4), o0, o1, o2, o3);
+        _mm_storeu_si128((__m128i *)(points + i - 4), o0);
+        _mm_storeu_si128((__m128i *)(points + i - 3), o1);
+        _mm_storeu_si128((__m128i *)(points + i - 2), o2);
+        _mm_storeu_si128((__m128i *)(points + i - 1), o3);
+    }
+} // __wsp_parse_points__ssse3
+
+__attribute__((target("ssse3")))
+static void __wsp_parse_points_expected__ssse3(
+    wsp_point_b *buf,
+    uint32_t count,
+    wsp_time_t expected,
+    uint32_t spp,
+    wsp_point_t *points
+)
+{
+    const __m128i shuffle = _mm_setr_epi8(WSP_SHUFFLE_PARSE);
+    const __m128i step = _mm_set1_epi32((int)(4 * spp));
+    uint32_t tail = count % 4;
+    uint32_t i;
+
+    __wsp_parse_points_expected__scalar(buf + count - tail, tail,
+        expected + (count - tail) * spp, spp, points + count - tail);
+
+    // expected timestamps of the block after the last one, going backwards.
+    wsp_time_t first = expected + (count - tail) * spp;
+    __m128i t = _mm_setr_epi32((int)first, (int)(first + spp),
+        (int)(first + 2 * spp), (int)(first + 3 * spp));
+
+    for (i = count - tail; i > 0; i -= 4) {
+        __m128i o0, o1, o2, o3;
+        WSP_SSSE3_PARSE4((const char *)(buf + i - 4), o0, o1, o2, o3);
+        _mm_storeu_si128((__m128i *)(points + i - 4), o0);
+        _mm_storeu_si128((__m128i *)(points + i - 3), o1);
+        _mm_storeu_si128((__m128i *)(points + i - 2), o2);
+        _mm_storeu_si128((__m128i *)(points + i - 1), o3);
+
+        t = _mm_sub_epi32(t, step);
+        __m128i m = _mm_cmpeq_epi32(WSP_SSSE3_TIMESTAMPS(o0, o1, o2, o3), t);
+
+        if (_mm_movemask_epi8(m) != 0xffff) {
+            __wsp_expect_points(points + i - 4, 4, expected + (i - 4) * spp, spp);
+        }
+    }
+} // __wsp_parse_points_expected__ssse3
+
+__attribute__((target("ssse3")))
+static void __wsp_parse_columns__ssse3(
+    wsp_point_b *buf,
+    uint32_t count,
+    wsp_time_t expected,
+    uint32_t spp,
+    wsp_time_t *timestamps,
+    double *values
+)
+{
+    const __m128i shuffle = _mm_setr_epi8(WSP_SHUFFLE_PARSE);
+    const __m128i nan = _mm_set1_epi64x((long long)__wsp_nan_bits);
+    const __m128i step = _mm_set1_epi32((int)(4 * spp));
+    __m128i t = _mm_setr_epi32((int)expected, (int)(expected + spp),
+        (int)(expected + 2 * spp), (int)(expected + 3 * spp));
+    uint32_t i;
+
+    for (i = 0; i + 4 <= count; i += 4) {
+        __m128i o0, o1, o2, o3;
+        WSP_SSSE3_PARSE4((const char *)(buf + i), o0, o1, o2, o3);
+
+        // gather the timestamps and the values of the 4 points.
+        __m128i ts = WSP_SSSE3_TIMESTAMPS(o0, o1, o2, o3);
+        __m128i v01 = _mm_unpackhi_epi64(o0, o1);
+        __m128i v23 = _mm_unpackhi_epi64(o2, o3);
+
+        __m128i m = _mm_cmpeq_epi32(ts, t);
+        __m128i m01 = _mm_unpacklo_epi32(m, m);
+        __m128i m23 = _mm_unpackhi_epi32(m, m);
+        v01 = _mm_or_si128(_mm_and_si128(m01, v01), _mm_andnot_si128(m01, nan));
+        v23 = _mm_or_si128(_mm_and_si128(m23, v23), _mm_andnot_si128(m23, nan));
+
+        if (timestamps != NULL) {
+            _mm_storeu_si128((__m128i *)(timestamps + i), ts);
+        }
+
+        _mm_storeu_si128((__m128i *)(values + i), v01);
+        _mm_storeu_si128((__m128i *)(values + i + 2), v23);
+        t = _mm_add_epi32(t, step);
+    }
+
+    __wsp_parse_columns__scalar(buf + i, count - i, expected + i * spp, spp,
+        timestamps == NULL ? NULL : timestamps + i, values + i);
+} // __wsp_parse_columns__ssse3
+
+__attribute__((target("ssse3")))
+static void __wsp_dump_points__ssse3(
+    wsp_point_t *points,
+    uint32_t count,
+    wsp_point_b *buf
+)
+{
+    const __m128i shuffle = _mm_setr_epi8(WSP_SHUFFLE_DUMP);
+    uint32_t i;
+
+    for (i = 0; i + 4 <= count; i += 4) {
+        __m128i s0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(points + i)), shuffle);
+        __m128i s1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(points + i + 1)), shuffle);
+        __m128i s2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(points + i + 2)), shuffle);
+        __m128i s3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(points + i + 3)), shuffle);
+        char *raw = (char *)(buf + i);
+
+        _mm_storeu_si128((__m128i *)raw, _mm_or_si128(s0, _mm_slli_si128(s1, 12)));
+        _mm_storeu_si128((__m128i *)(raw + 16), _mm_or_si128(_mm_srli_si128(s1, 4), _mm_slli_si128(s2, 8)));
+        _mm_storeu_si128((__m128i *)(raw + 32), _mm_or_si128(_mm_srli_si128(s2, 8), _mm_slli_si128(s3, 4)));
+    }
+
+    __wsp_dump_points__scalar(points + i, count - i, buf + i);
+} // __wsp_dump_points__ssse3
+// }}}
+
+// avx2 kernels {{{
+/*
+ * Parse 8 records, two per 256 bit vector. Every record is loaded with the 4
+ * bytes that follow it, so the 8 records must be followed by another one.
+ */
+#define WSP_AVX2_PARSE8(raw, o0, o1, o2, o3) do {\
+    __m256i r0 = _mm256_inserti128_si256(_mm256_castsi128_si256(\
+        _mm_loadu_si128((const __m128i *)(raw))),\
+        _mm_loadu_si128((const __m128i *)((raw) + 12)), 1);\
+    __m256i r1 = _mm256_inserti128_si256(_mm256_castsi128_si256(\
+        _mm_loadu_si128((const __m128i *)((raw) + 24))),\
+        _mm_loadu_si128((const __m128i *)((raw) + 36)), 1);\
+    __m256i r2 = _mm256_inserti128_si256(_mm256_castsi128_si256(\
+        _mm_loadu_si128((const __m128i *)((raw) + 48))),\
+        _mm_loadu_si128((const __m128i *)((raw) + 60)), 1);\
+    __m256i r3 = _mm256_inserti128_si256(_mm256_castsi128_si256(\
+        _mm_loadu_si128((const __m128i *)((raw) + 72))),\
+        _mm_loadu_si128((const __m128i *)((raw) + 84)), 1);\
+    o0 = _mm256_shuffle_epi8(r0, shuffle);\
+    o1 = _mm256_shuffle_epi8(r1, shuffle);\
+    o2 = _mm256_shuffle_epi8(r2, shuffle);\
+    o3 = _mm256_shuffle_epi8(r3, shuffle);\
+} while (0)
+
+/*
+ * Replace the two parsed points of a vector by (t, NAN) unless their
+ * timestamps are the ones in lanes 0 and 4 of t.
+ */
+#define WSP_AVX2_EXPECT(o, t) do {\
+    __m256i m = _mm256_shuffle_epi32(_mm256_cmpeq_epi32(o, t), 0);\
+    o = _mm256_blendv_epi8(_mm256_or_si256(nan, t), o, m);\
+} while (0)
+
+/*
+ * The block loops are kept out of line from the kernels, which first parse
+ * their tail with the SSSE3 kernels: legacy SSE code is slow to run while
+ * the upper halves of the AVX registers are in use.
+ */
+__attribute__((target("avx2"), noinline))
+static void __wsp_parse_blocks__avx2(
+    wsp_point_b *buf,
+    uint32_t count,
+    wsp_point_t *points
+)
+{
+    const __m256i shuffle = _mm256_setr_epi8(WSP_SHUFFLE_PARSE, WSP_SHUFFLE_PARSE);
+    uint32_t i;
+
+    for (i = count; i > 0; i -= 8) {
+        __m256i o0, o1, o2, o3;
+        WSP_AVX2_PARSE8((const char *)(buf + i - 8), o0, o1, o2, o3);
+        _mm256_storeu_si256((__m256i *)(points + i - 8), o0);
+        _mm256_storeu_si256((__m256i *)(points + i - 6), o1);
+        _mm256_storeu_si256((__m256i *)(points + i - 4), o2);
+        _mm256_storeu_si256((__m256i *)(points + i - 2), o3);
+    }
+} // __wsp_parse_blocks__avx2
+
+__attribute__((target("avx2"), noinline))
+static void __wsp_parse_blocks_expected__avx2(
+    wsp_point_b *buf,
+    uint32_t count,
+    wsp_time_t expected,
+    uint32_t spp,
+    wsp_point_t *points
+)
+{
+    const __m256i shuffle = _mm256_setr_epi8(WSP_SHUFFLE_PARSE, WSP_SHUFFLE_PARSE);
+    const __m256i nan = _mm256_set_epi64x((long long)__wsp_nan_bits, 0, (long long)__wsp_nan_bits, 0);
+    const __m256i step = _mm256_setr_epi32((int)(2 * spp), 0, 0, 0, (int)(2 * spp), 0, 0, 0);
+    const __m256i step4 = _mm256_slli_epi32(step, 2);
+    uint32_t i;
+
+    // expected timestamps of the pair after the last block, going backwards;
+    // the timestamps of the points are in lanes 0 and 4 of every vector.
+    wsp_time_t first = expected + count * spp;
+    __m256i t = _mm256_setr_epi32((int)first, 0, 0, 0, (int)(first + spp), 0, 0, 0);
+
+    for (i = count; i > 0; i -= 8) {
+        __m256i o0, o1, o2, o3;
+        WSP_AVX2_PARSE8((const char *)(buf + i - 8), o0, o1, o2, o3);
+        t = _mm256_sub_epi32(t, step4);
+        __m256i t1 = _mm256_add_epi32(t, step);
+        __m256i t2 = _mm256_add_epi32(t1, step);
+        __m256i t3 = _mm256_add_epi32(t2, step);
+        WSP_AVX2_EXPECT(o0, t);
+        WSP_AVX2_EXPECT(o1, t1);
+        WSP_AVX2_EXPECT(o2, t2);
+        WSP_AVX2_EXPECT(o3, t3);
+        _mm256_storeu_si256((__m256i *)(points + i - 8), o0);
+        _mm256_storeu_si256((__m256i *)(points + i - 6), o1);
+        _mm256_storeu_si256((__m256i *)(points + i - 4), o2);
+        _mm256_storeu_si256((__m256i *)(points + i - 2), o3);
+    }
+} // __wsp_parse_blocks_expected__avx2
+
+static void __wsp_parse_points__avx2(
+    wsp_point_b *buf,
+    uint32_t count,
+    wsp_point_t *points
+)
+{
+    // the last record has no record after it and is always left to the tail.
+    uint32_t tail = count == 0 ? 0 : (count - 1) % 8 + 1;
+
+    __wsp_parse_points__ssse3(buf + count - tail, tail, points + count - tail);
+    __wsp_parse_blocks__avx2(buf, count - tail, points);
+} // __wsp_parse_points__avx2
+
+static void __wsp_parse_points_expected__avx2(
+    wsp_point_b *buf,
+    uint32_t count,
+    wsp_time_t expected,
+    uint32_t spp,
+    wsp_point_t *points
+)
+{
+    uint32_t tail = count == 0 ? 0 : (count - 1) % 8 + 1;
+
+    __wsp_parse_points_expected__ssse3(buf + count - tail, tail,
+        expected + (count - tail) * spp, spp, points + count - tail);
+    __wsp_parse_blocks_expected__avx2(buf, count - tail, expected, spp, points);
+} // __wsp_parse_points_expected__avx2
+// }}}
+
+// summary kernels {{{
+/*
+ * The masks of known values are used to count them, and to sum them as 0
+ * otherwise. min and max return their second operand when the first one is
+ * NAN, which leaves the running minimum and maximum alone.
+ */
+/*
+ * Fold the values of two pairs of points, loaded as doubles, into the running
+ * sum, minimum, maximum and count of known values.
+ */
+#define WSP_SSE2_SUMMARIZE(p, s, min, max, known) do {\
+    __m128d v = _mm_unpackhi_pd(_mm_loadu_pd(p), _mm_loadu_pd((p) + 2));\
+    __m128d m = _mm_cmpord_pd(v, v);\
+    s = _mm_add_pd(s, _mm_and_pd(m, v));\
+    min = _mm_min_pd(v, min);\
+    max = _mm_max_pd(v, max);\
+    known = _mm_sub_epi64(known, _mm_castpd_si128(m));\
+} while (0)
+
+__attribute__((target("sse2")))
+static void __wsp_summarize__sse2(
+    wsp_point_t *points,
+    uint32_t count,
+    wsp_rollup_t *state
+)
+{
+    __m128d s[4] = {_mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd()};
+    __m128d min[2] = {_mm_set1_pd(INFINITY), _mm_set1_pd(INFINITY)};
+    __m128d max[2] = {_mm_set1_pd(-INFINITY), _mm_set1_pd(-INFINITY)};
+    __m128i known = _mm_setzero_si128();
+    uint32_t i;
+
+    for (i = 0; i + WSP_SUM_LANES <= count; i += WSP_SUM_LANES) {
+        const double *p = (const double *)(points + i);
+        WSP_SSE2_SUMMARIZE(p, s[0], min[0], max[0], known);
+        WSP_SSE2_SUMMARIZE(p + 4, s[1], min[1], max[1], known);
+        WSP_SSE2_SUMMARIZE(p + 8, s[2], min[0], max[0], known);
+        WSP_SSE2_SUMMARIZE(p + 12, s[3], min[1], max[1], known);
+    }
+
+    double sum[WSP_SUM_LANES];
+    double mins[2];
+    double maxs[2];
+    uint64_t knowns[2];
+    int j;
+
+    for (j = 0; j < 4; j++) {
+        _mm_storeu_pd(sum + 2 * j, s[j]);
+    }
+
+    _mm_storeu_pd(mins, _mm_min_pd(min[0], min[1]));
+    _mm_storeu_pd(maxs, _mm_max_pd(max[0], max[1]));
+    _mm_storeu_si128((__m128i *)knowns, known);
+
+    __wsp_summarize_from(points, i, count, sum,
+        mins[0] < mins[1] ? mins[0] : mins[1],
+        maxs[0] > maxs[1] ? maxs[0] : maxs[1],
+        (uint32_t)(knowns[0] + knowns[1]), state);
+} // __wsp_summarize__sse2
+
+/*
+ * Mask of the lanes of two pairs of values that are equal, or both unknown.
+ */
+#define WSP_SSE2_SAME(a, b) \
+    _mm_movemask_pd(_mm_or_pd(_mm_cmpeq_pd(a, b), \
+        _mm_and_pd(_mm_cmpunord_pd(a, a), _mm_cmpunord_pd(b, b))))
+
+__attribute__((target("sse2")))
+static uint32_t __wsp_next_difference__sse2(
+    const double *a,
+    const double *b,
+    uint32_t start,
+    uint32_t count
+)
+{
+    uint32_t i;
+
+    // four values per iteration, the lane that differs is found below.
+    for (i = start; i + 4 <= count; i += 4) {
+        int same = WSP_SSE2_SAME(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i))
+            & WSP_SSE2_SAME(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2));
+
+        if (same != 3) {
+            break;
+        }
+    }
+
+    return __wsp_next_difference__scalar(a, b, i, count);
+} // __wsp_next_difference__sse2
+// }}}
+#endif
+
+// dispatch {{{
+static struct {
+    void (*parse_points)(wsp_point_b *, uint32_t, wsp_point_t *);
+    void (*parse_points_expected)(wsp_point_b *, uint32_t, wsp_time_t, uint32_t, wsp_point_t *);
+    void (*parse_columns)(wsp_point_b *, uint32_t, wsp_time_t, uint32_t, wsp_time_t *, double *);
+    void (*dump_points)(wsp_point_t *, uint32_t, wsp_point_b *);
+    void (*summarize)(wsp_point_t *, uint32_t, wsp_rollup_t *);
+    uint32_t (*next_difference)(const double *, const double *, uint32_t, uint32_t);
+} __wsp_codec = {
+    __wsp_parse_points__scalar,
+    __wsp_parse_points_expected__scalar,
+    __wsp_parse_columns__scalar,
+    __wsp_dump_points__scalar,
+    __wsp_summarize__scalar,
+    __wsp_next_difference__scalar
+};
+
+wsp_simd_t __wsp_simd_select(
+    wsp_simd_t simd
+)
+{
+#ifdef WSP_SIMD_X86
+    double nan = NAN;
+    memcpy(&__wsp_nan_bits, &nan, sizeof(nan));
+
+    __builtin_cpu_init();
+
+    if (simd >= WSP_SIMD_AVX2 && !__builtin_cpu_supports("avx2")) {
+        simd = WSP_SIMD_SSSE3;
+    }
+
+    if (simd >= WSP_SIMD_SSSE3 && !__builtin_cpu_supports("ssse3")) {
+        simd = WSP_SIMD_NONE;
+    }
+#else
+    simd = WSP_SIMD_NONE;
+#endif
+
+    switch (simd) {
+#ifdef WSP_SIMD_X86
+    case WSP_SIMD_AVX2:
+        __wsp_codec.parse_points = __wsp_parse_points__avx2;
+        __wsp_codec.parse_points_expected = __wsp_parse_points_expected__avx2;
+        __wsp_codec.parse_columns = __wsp_parse_columns__ssse3;
+        __wsp_codec.dump_points = __wsp_dump_points__ssse3;
+        __wsp_codec.summarize = __wsp_summarize__sse2;
+        __wsp_codec.next_difference = __wsp_next_difference__sse2;
+        break;
+    case WSP_SIMD_SSSE3:
+        __wsp_codec.parse_points = __wsp_parse_points__ssse3;
+        __wsp_codec.parse_points_expected = __wsp_parse_points_expected__ssse3;
+        __wsp_codec.parse_columns = __wsp_parse_columns__ssse3;
+        __wsp_codec.dump_points = __wsp_dump_points__ssse3;
+        __wsp_codec.summarize = __wsp_summarize__sse2;
+        __wsp_codec.next_difference = __wsp_next_difference__sse2;
+        break;
+#endif
+    default:
+        simd = WSP_SIMD_NONE;
+        __wsp_codec.parse_points = __wsp_parse_points__scalar;
+        __wsp_codec.parse_points_expected = __wsp_parse_points_expected__scalar;
+        __wsp_codec.parse_columns = __wsp_parse_columns__scalar;
+        __wsp_codec.dump_points = __wsp_dump_points__scalar;
+        __wsp_codec.summarize = __wsp_summarize__scalar;
+        __wsp_codec.next_difference = __wsp_next_difference__scalar;
+        break;
+    }
+
+    return simd;
+} // __wsp_simd_select
+
+/*
+ * Pick the best kernels before any thread can use them.
+ */
+__attribute__((constructor))
+static void __wsp_simd_init(void)
+{
+    __wsp_simd_select(WSP_SIMD_AVX2);
+} // __wsp_simd_init
+// }}}
+
+// bulk parse & dump functions {{{
+void __wsp_parse_points(
+    wsp_point_b *buf,
+    uint32_t count,
+    wsp_point_t *points
+)
+{
+    __wsp_codec.parse_points(buf, count, points);
+} // __wsp_parse_points
+
+void __wsp_parse_points_expected(
+    wsp_point_b *buf,
+    uint32_t count,
+    wsp_time_t expected,
+    uint32_t spp,
+    wsp_point_t *points
+)
+{
+    __wsp_codec.parse_points_expected(buf, count, expected, spp, points);
+} // __wsp_parse_points_expected
+
+void __wsp_parse_columns(
+    wsp_point_b *buf,
+    uint32_t count,
+    wsp_time_t expected,
+    uint32_t spp,
+    wsp_time_t *timestamps,
+    double *values
+)
+{
+    __wsp_codec.parse_columns(buf, count, expected, spp, timestamps, values);
+} // __wsp_parse_columns
+
+void __wsp_dump_points(
+    wsp_point_t *points,
+    uint32_t count,
+    wsp_point_b *buf
+)
+{
+    __wsp_codec.dump_points(points, count, buf);
+} // __wsp_dump_points
+// }}}
+
+// summary functions {{{
+void __wsp_summarize(
+    wsp_point_t *points,
+    uint32_t count,
+    wsp_rollup_t *state
+)
+{
+    __wsp_codec.summarize(points, count, state);
+} // __wsp_summarize
+
+uint32_t __wsp_next_difference(
+    const double *a,
+    const double *b,
+    uint32_t start,
+    uint32_t count
+)
+{
+    return __wsp_codec.next_difference(a, b, start, count);
+} // __wsp_next_difference
+// }}}
@@ -0,0 +1,115 @@
+// vim: foldmethod=marker
+#include "wsp_view.h"
+#include "wsp_private.h"
+
+#include <math.h>
+
+// wsp_view_points {{{
+wsp_return_t wsp_view_points(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    int offset,
+    uint32_t count,
+    wsp_view_t *view,
+    wsp_error_t *e
+)
+{
+    if (w->io_mmap == NULL) {
+        e->type = WSP_ERROR_NOT_MAPPED;
+        return WSP_ERROR;
+    }
+
+    wsp_point_b *points = (wsp_point_b *)((char *)w->io_mmap + archive->offset);
+    wsp_point_t base;
+
+    __wsp_parse_point(points, &base);
+
+    if (count > archive->count) {
+        count = archive->count;
+    }
+
+    uint32_t index = __wsp_point_mod(offset, archive->count);
+    uint32_t a_size = archive->count - index;
+
+    if (a_size > count) {
+        a_size = count;
+    }
+
+    view->segments[0] = points + index;
+    view->sizes[0] = a_size;
+    view->segments[1] = points;
+    view->sizes[1] = count - a_size;
+    view->count = count;
+    view->expected = base.timestamp + archive->spp * offset;
+    view->spp = archive->spp;
+    return WSP_OK;
+} // wsp_view_points }}}
+
+// wsp_view_time_points {{{
+wsp_return_t wsp_view_time_points(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    wsp_time_t time_from,
+    wsp_time_t time_until,
+    wsp_view_t *view,
+    wsp_error_t *e
+)
+{
+    if (w->io_mmap == NULL) {
+        e->type = WSP_ERROR_NOT_MAPPED;
+        return WSP_ERROR;
+    }
+
+    wsp_point_t base;
+
+    __wsp_parse_point((wsp_point_b *)((char *)w->io_mmap + archive->offset), &base);
+
+    int offset;
+    uint32_t count;
+
+    if (__wsp_time_range(archive, &base, time_from, time_until, &offset, &count, e) == WSP_ERROR) {
+        return WSP_ERROR;
+    }
+
+    return wsp_view_points(w, archive, offset, count, view, e);
+} // wsp_view_time_points }}}
+
+// wsp_view_point {{{
+void wsp_view_point(
+    wsp_view_t *view,
+    uint32_t index,
+    wsp_point_t *point
+)
+{
+    wsp_point_b *raw;
+
+    if (index < view->sizes[0]) {
+        raw = view->segments[0] + index;
+    }
+    else {
+        raw = view->segments[1] + (index - view->sizes[0]);
+    }
+
+    __wsp_parse_point(raw, point);
+
+    wsp_time_t expected = view->expected + view->spp * index;
+
+    if (point->timestamp != expected) {
+        point->timestamp = expected;
+        point->value = NAN;
+    }
+} // wsp_view_point }}}
+
+// wsp_cursor_next {{{
+int wsp_cursor_next(
+    wsp_cursor_t *cursor,
+    wsp_point_t *point
+)
+{
+    if (cursor->index >= cursor->view->count) {
+        return 0;
+    }
+
+    wsp_view_point(cursor->view, cursor->index++, point);
+    return 1;
+} // wsp_cursor_next }}}
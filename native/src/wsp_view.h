@@ -0,0 +1,134 @@
+// vim: foldmethod=marker
+/**
+ * Zero-copy point views.
+ *
+ * A view refers to a range of points straight in the mapped memory of a
+ * WSP_MMAP database, as at most two segments of raw points (when the range
+ * wraps around the end of the archive). Points are only decoded when they
+ * are accessed.
+ *
+ * Example:
+ *
+ *   wsp_view_t v;
+ *   wsp_cursor_t c;
+ *   wsp_point_t p;
+ *
+ *   if (wsp_view_time_points(&w, archive, from, until, &v, &e) == WSP_ERROR) {
+ *       return 1;
+ *   }
+ *
+ *   WSP_CURSOR_INIT(&c, &v);
+ *
+ *   while (wsp_cursor_next(&c, &p)) {
+ *       // ...
+ *   }
+ *
+ * A view is live, it reflects any later writes to the database, and is only
+ * valid until the database is closed.
+ */
+#ifndef _WSP_VIEW_H_
+#define _WSP_VIEW_H_
+
+#include "wsp.h"
+
+struct wsp_view_t;
+struct wsp_cursor_t;
+
+typedef struct wsp_view_t wsp_view_t;
+typedef struct wsp_cursor_t wsp_cursor_t;
+
+struct wsp_view_t {
+    // raw points, in time order; the second segment is empty unless the
+    // range wraps around.
+    wsp_point_b *segments[2];
+    uint32_t sizes[2];
+    // number of points in the view.
+    uint32_t count;
+    // expected timestamp of the first point.
+    wsp_time_t expected;
+    // seconds per point of the archive.
+    uint32_t spp;
+};
+
+struct wsp_cursor_t {
+    wsp_view_t *view;
+    // index of the next point.
+    uint32_t index;
+};
+
+#define WSP_CURSOR_INIT(c, v) do {\
+    (c)->view = (v);\
+    (c)->index = 0;\
+} while(0)
+
+/**
+ * Create a view of points, see wsp_load_points.
+ *
+ * Fails with WSP_ERROR_NOT_MAPPED unless the database was opened using
+ * WSP_MMAP.
+ *
+ * w: Whisper database.
+ * archive: Archive to view points of.
+ * offset: Offset of the first point, relative to the base of the archive.
+ * count: Number of points.
+ * view: View to initialize.
+ * e: Error object.
+ */
+wsp_return_t wsp_view_points(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    int offset,
+    uint32_t count,
+    wsp_view_t *view,
+    wsp_error_t *e
+);
+
+/**
+ * Create a view of points within a time interval, see wsp_load_time_points.
+ *
+ * w: Whisper database.
+ * archive: Archive to view points of.
+ * time_from: Start of the interval.
+ * time_until: End of the interval.
+ * view: View to initialize.
+ * e: Error object.
+ */
+wsp_return_t wsp_view_time_points(
+    wsp_t *w,
+    wsp_archive_t *archive,
+    wsp_time_t time_from,
+    wsp_time_t time_until,
+    wsp_view_t *view,
+    wsp_error_t *e
+);
+
+/**
+ * Decode a single point of a view.
+ *
+ * A point whose timestamp does not match the timestamp expected for its
+ * position is returned with the expected timestamp and a NAN value.
+ *
+ * view: View to read from.
+ * index: Index of the point, must be less than view->count.
+ * point: Where to store the point.
+ */
+void wsp_view_point(
+    wsp_view_t *view,
+    uint32_t index,
+    wsp_point_t *point
+);
+
+/**
+ * Decode the next point of a cursor.
+ *
+ * Returns 0 when there are no more points.
+ *
+ * cursor: Cursor to advance.
+ * point: Where to store the point.
+ */
+int wsp_cursor_next(
+    wsp_cursor_t *cursor,
+    wsp_point_t *point
+);
+
+#endif /* _WSP_VIEW_H_ */
@@ -1,11 +1,214 @@
+import array
+import glob
+import math
+import os
+import shutil
+import struct
 import sys
+import tempfile
+import threading
+import time
+import unittest
 
-sys.path.insert(0, 'build/lib.linux-x86_64-2.7')
+sys.path[:0] = glob.glob('build/lib.*-2.7')
 
 import wsp
 
-w = wsp.open('./test.wsp', wsp.MMAP)
-w = wsp.Whisper()
-w.open('./test.wsp')
-w.update_point(0, 10.0)
-print "done"
+ARCHIVES = [(1, 60), (60, 120)]
+
+
+def same(a, b):
+    return a == b or (math.isnan(a) and math.isnan(b))
+
+
+def same_points(a, b):
+    return len(a) == len(b) and all(p[0] == q[0] and same(p[1], q[1]) for p, q in zip(a, b))
+
+
+class BindingsTest(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.mkdtemp(prefix='wsp_test.')
+        self.path = self.create('test.wsp')
+        self.now = int(time.time())
+        self.points = [(self.now - i, float(i)) for i in range(0, 50) if i % 3 != 0]
+
+    def tearDown(self):
+        shutil.rmtree(self.dir)
+
+    def create(self, name, archives=ARCHIVES):
+        path = os.path.join(self.dir, name)
+        wsp.create(path, archives, 0.0, wsp.AVERAGE)
+        return path
+
+    def fill(self, w):
+        # oldest first, so that the points follow the base.
+        for t, v in sorted(self.points):
+            w.update_point(t, v)
+
+    def values(self, series):
+        return array.array('d', memoryview(series).tobytes())
+
+    def test_load_series(self):
+        w = wsp.open(self.path, wsp.MMAP)
+        self.fill(w)
+
+        known = 0
+
+        for a in w.archives:
+            s = w.load_series(a)
+            m = memoryview(s)
+
+            self.assertEqual(m.format, 'd')
+            self.assertTrue(m.readonly)
+            self.assertEqual(len(s), a.count)
+            self.assertEqual(s.count, a.count)
+            self.assertEqual(s.step, a.spp)
+
+            values = self.values(s)
+
+            # points are in the same order as in the file, from the base.
+            for i, (timestamp, value) in enumerate(w.load_points(a)):
+                self.assertEqual(timestamp, s.start + i * s.step)
+                self.assertTrue(same(values[i], value))
+                known += not math.isnan(value)
+
+            part = w.load_series(a, 5, 10)
+            self.assertEqual(part.start, s.start + 5 * s.step)
+            self.assertEqual(len(part), 10)
+            self.assertTrue(all(same(x, y) for x, y in zip(self.values(part), values[5:15])))
+
+        self.assertTrue(known >= len(self.points))
+        self.assertRaises(TypeError, w.load_series, 1)
+
+    def test_buffers(self):
+        w = wsp.open(self.path, wsp.MMAP)
+        self.fill(w)
+
+        s = w.load_series(w.archives[0])
+        values = self.values(s)
+
+        # the old style buffer.
+        self.assertEqual(str(buffer(s)), memoryview(s).tobytes())
+        self.assertEqual(len(array.array('d', str(buffer(s)))), len(s))
+
+        m = memoryview(s)
+
+        with self.assertRaises(TypeError):
+            m[0] = 'x' * 8
+
+        try:
+            import numpy
+        except ImportError:
+            return
+
+        n = numpy.frombuffer(s, dtype='d')
+        self.assertEqual(len(n), len(s))
+        self.assertTrue(all(same(x, y) for x, y in zip(n, values)))
+
+        # the series outlives the database object.
+        del w, s
+        self.assertEqual(len(n), len(values))
+
+    def test_iter_series(self):
+        w = wsp.open(self.path, wsp.MMAP)
+        self.fill(w)
+
+        for a in w.archives:
+            s = w.load_series(a)
+            values = self.values(s)
+            total = 0
+
+            for part in w.iter_series(a, 7):
+                self.assertEqual(part.start, s.start + total * s.step)
+                self.assertEqual(len(part), min(7, a.count - total))
+
+                v = self.values(part)
+                self.assertTrue(all(same(x, y) for x, y in zip(v, values[total:total + len(v)])))
+
+                total += len(part)
+
+            self.assertEqual(total, a.count)
+
+    def test_update_many(self):
+        paths = [self.create(name) for name in ('tuples.wsp', 'packed.wsp', 'bytearray.wsp', 'points.wsp')]
+        packed = b''.join(struct.pack('=Id', t, v) for t, v in self.points)
+
+        wsp.open(paths[0], wsp.MMAP).update_many(self.points)
+        wsp.open(paths[1], wsp.PREAD).update_many(packed)
+        wsp.open(paths[2], wsp.MMAP).update_many(bytearray(packed))
+
+        self.fill(wsp.open(paths[3], wsp.MMAP))
+
+        data = [open(path, 'rb').read() for path in paths]
+
+        self.assertEqual(data[0], data[1])
+        self.assertEqual(data[0], data[2])
+        self.assertEqual(data[0], data[3])
+
+        w = wsp.open(self.path, wsp.MMAP)
+
+        for bad in (b'x' * 13, [(1,)], [('a', 1.0)], 5, [(-1, 1.0)]):
+            self.assertRaises((ValueError, TypeError), w.update_many, bad)
+
+        w.update_many([])
+        w.update_many(b'')
+
+    def test_sync(self):
+        w = wsp.open(self.path, wsp.PREAD)
+        self.fill(w)
+
+        self.assertEqual(w.sync(), None)
+
+        # written through another handle.
+        r = wsp.open(self.path, wsp.MMAP)
+        self.assertTrue(same_points(w.load_points(w.archives[0]), r.load_points(r.archives[0])))
+
+        self.assertRaises(Exception, wsp.Whisper().sync)
+
+    def test_reopen(self):
+        # large archives, so that reads are still running while reopening.
+        path = self.create('large.wsp', [(1, 100000), (60, 200000)])
+
+        w = wsp.open(path, wsp.MMAP)
+        self.fill(w)
+
+        errors = []
+        done = []
+
+        def reader():
+            try:
+                while not done:
+                    for a in w.archives:
+                        self.assertEqual(len(w.load_series(a)), a.count)
+
+                    w.load_points(w.archives[0])
+            except Exception as e:
+                errors.append(e)
+
+        def writer():
+            try:
+                while not done:
+                    w.update_point(self.now - 1, 1.0)
+            except Exception as e:
+                errors.append(e)
+
+        threads = [threading.Thread(target=f) for f in (reader, reader, writer)]
+
+        for t in threads:
+            t.start()
+
+        try:
+            for i in range(200):
+                w.open(path, wsp.MMAP if i % 2 else wsp.PREAD)
+        finally:
+            done.append(True)
+
+            for t in threads:
+                t.join()
+
+        self.assertEqual(errors, [])
+        self.assertEqual([a.count for a in w.archives], [100000, 200000])
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -1,6 +1,14 @@
 #ifndef _CHECK_UTILS_H_
 #define _CHECK_UTILS_H_
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "../src/wsp.h"
+
 #define CHECK_MAIN(test_f) \
 Suite * \
 test_suite_main() { \
@@ -20,4 +28,126 @@ int main() { \
     return (number_failed == 0) ? 0 : 1; \
 }
 
+/*
+ * Create a temporary directory for the databases of a test, dir must hold
+ * CHECK_TMP_SIZE bytes.
+ */
+#define CHECK_TMP_SIZE 512
+
+static inline void check_tmp_dir(char *dir) {
+    strcpy(dir, "/tmp/wsp_test.XXXXXX");
+    ck_assert(mkdtemp(dir) != NULL);
+}
+
+/*
+ * Path of a file in a temporary directory, path must hold CHECK_TMP_SIZE
+ * bytes.
+ */
+static inline void check_tmp_path(const char *dir, const char *name, char *path) {
+    ck_assert(snprintf(path, CHECK_TMP_SIZE, "%s/%s", dir, name) < CHECK_TMP_SIZE);
+}
+
+/*
+ * Remove a temporary directory and the files in it.
+ */
+static inline void check_tmp_clean(const char *dir) {
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    char path[CHECK_TMP_SIZE];
+
+    if (d == NULL) {
+        return;
+    }
+
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            check_tmp_path(dir, entry->d_name, path);
+            unlink(path);
+        }
+    }
+
+    closedir(d);
+    rmdir(dir);
+}
+
+/*
+ * Create a database with all points empty.
+ */
+static inline void check_create(const char *path, wsp_archive_t *archives, uint32_t count, wsp_aggregation_t aggregation, float xff) {
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_create(path, archives, count, xff, aggregation, WSP_CREATE_SPARSE, &e), WSP_OK);
+}
+
+static inline void check_open(wsp_t *w, const char *path) {
+    wsp_error_t e;
+
+    WSP_INIT(w);
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_open(w, path, WSP_PREAD, &e), WSP_OK);
+}
+
+static inline void check_close(wsp_t *w) {
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_close(w, &e), WSP_OK);
+}
+
+/*
+ * Update points of a database, opening and closing it.
+ */
+static inline void check_update_many(const char *path, wsp_point_t *points, uint32_t count) {
+    wsp_t w;
+    wsp_error_t e;
+
+    WSP_ERROR_INIT(&e);
+
+    check_open(&w, path);
+    ck_assert_int_eq(wsp_update_many(&w, points, count, &e), WSP_OK);
+    check_close(&w);
+}
+
+/*
+ * Series fetched by check_fetch, of at most CHECK_SERIES_SIZE points.
+ */
+#define CHECK_SERIES_SIZE 256
+
+double check_values[CHECK_SERIES_SIZE];
+uint8_t check_valid[CHECK_SERIES_SIZE / 8];
+wsp_series_t check_series;
+
+/*
+ * Fetch a series from an open database into check_series.
+ */
+static inline void check_fetch(wsp_t *w, wsp_time_t from, wsp_time_t until, wsp_time_t now) {
+    wsp_error_t e;
+
+    WSP_ERROR_INIT(&e);
+    WSP_SERIES_INIT(&check_series, check_values, check_valid);
+
+    ck_assert_int_eq(wsp_fetch(w, from, until, now, &check_series, &e), WSP_OK);
+    ck_assert(check_series.count <= CHECK_SERIES_SIZE);
+}
+
+/*
+ * Fetch a series from a database into check_series, opening and closing it.
+ */
+static inline void check_fetch_file(const char *path, wsp_time_t from, wsp_time_t until, wsp_time_t now) {
+    wsp_t w;
+
+    check_open(&w, path);
+    check_fetch(&w, from, until, now);
+    check_close(&w);
+}
+
+/*
+ * Check if the point i of check_series is known.
+ */
+static inline int check_is_valid(uint32_t i) {
+    return (check_series.valid[i / 8] & (1 << (i % 8))) != 0;
+}
+
 #endif /* _CHECK_UTILS_H_ */
@@ -0,0 +1,246 @@
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/wsp.h"
+
+char dir[CHECK_TMP_SIZE];
+char path[CHECK_TMP_SIZE];
+
+wsp_aggregation_t aggregations[] = {
+    WSP_AVERAGE, WSP_SUM, WSP_LAST, WSP_MAX, WSP_MIN
+};
+
+#define AGGREGATIONS_SIZE (sizeof(aggregations) / sizeof(aggregations[0]))
+
+wsp_archive_t archives[] = {
+    { .spp = 1, .count = 120 },
+    { .spp = 60, .count = 120 }
+};
+
+void setup_dir() {
+    check_tmp_dir(dir);
+    check_tmp_path(dir, "test.wsp", path);
+}
+
+void teardown_dir() {
+    check_tmp_clean(dir);
+}
+
+/*
+ * Aggregate values with the aggregate function of a database, returns the
+ * skip flag.
+ */
+int aggregate(wsp_aggregation_t aggregation, float xff, double *values, uint32_t count, double *value) {
+    wsp_t w;
+    wsp_error_t e;
+    wsp_point_t points[64];
+    uint32_t i;
+    int skip = 0;
+
+    ck_assert(count <= 64);
+
+    for (i = 0; i < count; i++) {
+        points[i].timestamp = 1000 + i;
+        points[i].value = values[i];
+    }
+
+    unlink(path);
+    check_create(path, archives, 2, aggregation, xff);
+
+    WSP_ERROR_INIT(&e);
+
+    check_open(&w, path);
+    ck_assert_int_eq(w.meta.aggregate(&w, points, count, value, &skip, &e), WSP_OK);
+    check_close(&w);
+
+    return skip;
+}
+
+START_TEST(test_all_nan)
+{
+    double values[] = { NAN, NAN, NAN, NAN };
+    uint32_t a;
+
+    // nothing is known, whatever the xFilesFactor.
+    for (a = 0; a < AGGREGATIONS_SIZE; a++) {
+        double value = 0;
+
+        ck_assert_int_eq(aggregate(aggregations[a], 0.0, values, 4, &value), 1);
+        ck_assert(isnan(value));
+    }
+}
+END_TEST
+
+START_TEST(test_mixed_nan)
+{
+    double values[] = { 1.0, NAN, 3.0, NAN };
+    double expected[] = { 2.0, 4.0, 3.0, 3.0, 1.0 };
+    uint32_t a;
+
+    for (a = 0; a < AGGREGATIONS_SIZE; a++) {
+        double value = NAN;
+
+        // half of the points are known, which is just enough.
+        ck_assert_int_eq(aggregate(aggregations[a], 0.5, values, 4, &value), 0);
+        ck_assert_msg(value == expected[a], "aggregation %d", aggregations[a]);
+
+        value = 0;
+
+        ck_assert_int_eq(aggregate(aggregations[a], 0.6, values, 4, &value), 1);
+        ck_assert(isnan(value));
+    }
+}
+END_TEST
+
+START_TEST(test_last_known)
+{
+    double values[] = { 1.0, 2.0, NAN, NAN };
+    double value = NAN;
+
+    // the most recent known value, not the most recent point.
+    ck_assert_int_eq(aggregate(WSP_LAST, 0.0, values, 4, &value), 0);
+    ck_assert(value == 2.0);
+}
+END_TEST
+
+START_TEST(test_negative_zero)
+{
+    double zeros[] = { -0.0, -0.0, NAN };
+    double mixed[] = { 0.0, -0.0, -1.0, NAN, 1.0 };
+    double value;
+    uint32_t a;
+
+    // zeros are known values, not missing ones.
+    for (a = 0; a < AGGREGATIONS_SIZE; a++) {
+        value = NAN;
+
+        ck_assert_int_eq(aggregate(aggregations[a], 0.5, zeros, 3, &value), 0);
+        ck_assert_msg(value == 0.0, "aggregation %d", aggregations[a]);
+    }
+
+    value = NAN;
+    ck_assert_int_eq(aggregate(WSP_LAST, 0.5, zeros, 3, &value), 0);
+    ck_assert(signbit(value));
+
+    value = NAN;
+    ck_assert_int_eq(aggregate(WSP_AVERAGE, 0.5, mixed, 5, &value), 0);
+    ck_assert(value == 0.0);
+
+    value = NAN;
+    ck_assert_int_eq(aggregate(WSP_SUM, 0.5, mixed, 5, &value), 0);
+    ck_assert(value == 0.0);
+
+    value = NAN;
+    ck_assert_int_eq(aggregate(WSP_MIN, 0.5, mixed, 5, &value), 0);
+    ck_assert(value == -1.0);
+
+    value = NAN;
+    ck_assert_int_eq(aggregate(WSP_MAX, 0.5, mixed, 5, &value), 0);
+    ck_assert(value == 1.0);
+}
+END_TEST
+
+START_TEST(test_large_window)
+{
+    double values[60];
+    double sum = 0;
+    double min = INFINITY;
+    double max = -INFINITY;
+    double last = NAN;
+    uint32_t known = 0;
+    uint32_t i;
+
+    // larger than the blocks of the vector kernels, with a tail.
+    for (i = 0; i < 60; i++) {
+        if (i % 7 == 3) {
+            values[i] = NAN;
+            continue;
+        }
+
+        values[i] = (double)((i * 37) % 23) - 11.0;
+        sum += values[i];
+        min = values[i] < min ? values[i] : min;
+        max = values[i] > max ? values[i] : max;
+        last = values[i];
+        known++;
+    }
+
+    double expected[] = { sum / known, sum, last, max, min };
+    uint32_t a;
+
+    for (a = 0; a < AGGREGATIONS_SIZE; a++) {
+        double value = NAN;
+
+        ck_assert_int_eq(aggregate(aggregations[a], 0.5, values, 60, &value), 0);
+        ck_assert_msg(value == expected[a], "aggregation %d", aggregations[a]);
+    }
+}
+END_TEST
+
+START_TEST(test_propagation_skip)
+{
+    wsp_t w;
+    wsp_error_t e;
+    wsp_point_t base;
+    wsp_time_t now = wsp_time_now();
+    wsp_time_t minute = wsp_time_floor(now, 60) - 60;
+    uint32_t i;
+
+    WSP_ERROR_INIT(&e);
+
+    check_create(path, archives, 2, WSP_AVERAGE, 0.5);
+
+    check_open(&w, path);
+
+    // 10 of 60 points are not enough to propagate.
+    for (i = 0; i < 10; i++) {
+        wsp_point_t p = { .timestamp = minute + i, .value = 1.0 };
+        ck_assert_int_eq(wsp_update(&w, &p, &e), WSP_OK);
+    }
+
+    ck_assert_int_eq(wsp_load_point(&w, w.archives + 1, 0, &base, &e), WSP_OK);
+    ck_assert_uint_eq(base.timestamp, 0);
+
+    // 30 of 60 points are.
+    for (i = 10; i < 30; i++) {
+        wsp_point_t p = { .timestamp = minute + i, .value = 1.0 };
+        ck_assert_int_eq(wsp_update(&w, &p, &e), WSP_OK);
+    }
+
+    ck_assert_int_eq(wsp_load_point(&w, w.archives + 1, 0, &base, &e), WSP_OK);
+    ck_assert_uint_eq(base.timestamp, minute);
+    ck_assert(base.value == 1.0);
+
+    check_close(&w);
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_aggregate");
+
+    TCase *aggregate = tcase_create("aggregate");
+
+    tcase_add_checked_fixture(aggregate, setup_dir, teardown_dir);
+    tcase_add_test(aggregate, test_all_nan);
+    tcase_add_test(aggregate, test_mixed_nan);
+    tcase_add_test(aggregate, test_last_known);
+    tcase_add_test(aggregate, test_negative_zero);
+    tcase_add_test(aggregate, test_large_window);
+    tcase_add_test(aggregate, test_propagation_skip);
+
+    suite_add_tcase(s, aggregate);
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,347 @@
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "../src/wsp.h"
+#include "../src/wsp_arena.h"
+#include "../src/wsp_private.h"
+
+char dir[CHECK_TMP_SIZE];
+char path_arena[CHECK_TMP_SIZE];
+char path_plain[CHECK_TMP_SIZE];
+
+wsp_archive_t archives[] = {
+    { .spp = 1, .count = 120 },
+    { .spp = 10, .count = 120 },
+    { .spp = 60, .count = 240 }
+};
+
+wsp_arena_t arena;
+
+void setup_arena() {
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_arena_init(&arena, 256, &e), WSP_OK);
+}
+
+void teardown_arena() {
+    wsp_arena_free(&arena);
+}
+
+void setup_dir() {
+    setup_arena();
+
+    check_tmp_dir(dir);
+    check_tmp_path(dir, "arena.wsp", path_arena);
+    check_tmp_path(dir, "plain.wsp", path_plain);
+
+    check_create(path_arena, archives, 3, WSP_AVERAGE, 0.0);
+    check_create(path_plain, archives, 3, WSP_AVERAGE, 0.0);
+}
+
+void teardown_dir() {
+    teardown_arena();
+    check_tmp_clean(dir);
+}
+
+int in_arena(void *p) {
+    return (char *)p >= arena.data && (char *)p < arena.data + arena.size;
+}
+
+START_TEST(test_align)
+{
+    size_t sizes[] = { 1, 3, 16, 17, 0, 40 };
+    size_t used[] = { 16, 32, 48, 80, 96, 144 };
+    uint32_t i;
+
+    ck_assert_uint_eq((uintptr_t)arena.data % WSP_ARENA_ALIGN, 0);
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        char *p = wsp_arena_alloc(&arena, sizes[i]);
+
+        ck_assert(p != NULL);
+        ck_assert_uint_eq((uintptr_t)p % WSP_ARENA_ALIGN, 0);
+        ck_assert_uint_eq(arena.used, used[i]);
+
+        memset(p, 0xff, sizes[i]);
+    }
+
+    ck_assert_uint_eq(arena.peak, 144);
+    ck_assert_uint_eq(arena.overflows, 0);
+
+    wsp_arena_reset(&arena);
+
+    ck_assert_uint_eq(arena.used, 0);
+    ck_assert_uint_eq(arena.peak, 144);
+}
+END_TEST
+
+START_TEST(test_overflow)
+{
+    wsp_t w;
+    wsp_error_t e;
+
+    WSP_INIT(&w);
+    WSP_ERROR_INIT(&e);
+
+    w.arena = &arena;
+
+    char *a = __wsp_scratch_alloc(&w, 200, &e);
+    ck_assert(in_arena(a));
+
+    // does not fit, taken from the heap.
+    char *b = __wsp_scratch_alloc(&w, 100, &e);
+    ck_assert(b != NULL);
+    ck_assert(!in_arena(b));
+    ck_assert_uint_eq(arena.overflows, 1);
+    ck_assert_uint_eq(arena.used, 208);
+
+    memset(b, 0xff, 100);
+
+    // the rest of the arena is still used.
+    char *c = __wsp_scratch_alloc(&w, 48, &e);
+    ck_assert(in_arena(c));
+    ck_assert_uint_eq(arena.used, 256);
+
+    // even empty allocations do not fit anymore, and the end of the arena
+    // is not taken for heap memory.
+    char *d = __wsp_scratch_alloc(&w, 0, &e);
+    ck_assert(d != NULL);
+    ck_assert(!in_arena(d));
+    ck_assert_uint_eq(arena.overflows, 2);
+
+    __wsp_scratch_free(&w, d);
+    __wsp_scratch_free(&w, c);
+    __wsp_scratch_free(&w, b);
+
+    ck_assert_uint_eq(arena.used, 208);
+
+    __wsp_scratch_free(&w, a);
+
+    ck_assert_uint_eq(arena.used, 0);
+    ck_assert_uint_eq(arena.peak, 256);
+
+    // larger than the whole arena.
+    ck_assert(wsp_arena_alloc(&arena, 257) == NULL);
+    ck_assert(wsp_arena_alloc(&arena, SIZE_MAX) == NULL);
+    ck_assert_uint_eq(arena.overflows, 4);
+    ck_assert_uint_eq(arena.used, 0);
+}
+END_TEST
+
+START_TEST(test_release)
+{
+    wsp_t w;
+    wsp_error_t e;
+
+    WSP_INIT(&w);
+    WSP_ERROR_INIT(&e);
+
+    w.arena = &arena;
+
+    char *a = __wsp_scratch_alloc(&w, 10, &e);
+    char *b = __wsp_scratch_alloc(&w, 20, &e);
+    char *c = __wsp_scratch_alloc(&w, 30, &e);
+
+    ck_assert(in_arena(a) && in_arena(b) && in_arena(c));
+    ck_assert(a < b && b < c);
+    ck_assert_uint_eq(arena.used, 80);
+
+    __wsp_scratch_free(&w, NULL);
+    ck_assert_uint_eq(arena.used, 80);
+
+    __wsp_scratch_free(&w, c);
+    ck_assert_uint_eq(arena.used, 48);
+
+    // given back memory is taken again.
+    ck_assert_ptr_eq(__wsp_scratch_alloc(&w, 30, &e), c);
+    __wsp_scratch_free(&w, c);
+
+    __wsp_scratch_free(&w, b);
+    ck_assert_uint_eq(arena.used, 16);
+
+    __wsp_scratch_free(&w, a);
+    ck_assert_uint_eq(arena.used, 0);
+
+    // releasing memory gives back everything taken after it.
+    a = wsp_arena_alloc(&arena, 10);
+    b = wsp_arena_alloc(&arena, 10);
+    wsp_arena_alloc(&arena, 10);
+
+    wsp_arena_release(&arena, b);
+    ck_assert_uint_eq(arena.used, 16);
+}
+END_TEST
+
+void *thread_arena(void *arg) {
+    return wsp_arena_thread();
+}
+
+START_TEST(test_thread)
+{
+    wsp_t w;
+    wsp_error_t e;
+    wsp_arena_t own;
+    pthread_t thread;
+    void *other = &own;
+
+    WSP_INIT(&w);
+    WSP_ERROR_INIT(&e);
+
+    ck_assert(wsp_arena_thread() == NULL);
+
+    // without any arena, from the heap.
+    char *p = __wsp_scratch_alloc(&w, 16, &e);
+    ck_assert(p != NULL && !in_arena(p));
+    __wsp_scratch_free(&w, p);
+
+    ck_assert_int_eq(wsp_arena_attach(&arena, &e), WSP_OK);
+    ck_assert_ptr_eq(wsp_arena_thread(), &arena);
+
+    // only attached to this thread.
+    ck_assert_int_eq(pthread_create(&thread, NULL, thread_arena, NULL), 0);
+    ck_assert_int_eq(pthread_join(thread, &other), 0);
+    ck_assert(other == NULL);
+
+    p = __wsp_scratch_alloc(&w, 16, &e);
+    ck_assert(in_arena(p));
+    ck_assert_uint_eq(arena.used, 16);
+
+    // the arena of a handle comes first.
+    ck_assert_int_eq(wsp_arena_init(&own, 64, &e), WSP_OK);
+    w.arena = &own;
+
+    char *q = __wsp_scratch_alloc(&w, 16, &e);
+    ck_assert_ptr_eq(q, own.data);
+    ck_assert_uint_eq(arena.used, 16);
+
+    __wsp_scratch_free(&w, q);
+    ck_assert_uint_eq(own.used, 0);
+
+    w.arena = NULL;
+    __wsp_scratch_free(&w, p);
+    ck_assert_uint_eq(arena.used, 0);
+
+    wsp_arena_free(&own);
+
+    ck_assert_int_eq(wsp_arena_attach(NULL, &e), WSP_OK);
+    ck_assert(wsp_arena_thread() == NULL);
+}
+END_TEST
+
+/*
+ * Write the same points to both databases, and check that they have the
+ * same series, through an arena that is too small for any operation but
+ * the smallest.
+ */
+START_TEST(test_tiny)
+{
+    wsp_t a, b;
+    wsp_error_t e;
+    wsp_time_t now = wsp_time_now();
+    wsp_point_t points[64];
+    double values[CHECK_SERIES_SIZE];
+    uint8_t valid[CHECK_SERIES_SIZE / 8];
+    uint32_t i;
+
+    WSP_ERROR_INIT(&e);
+
+    wsp_arena_free(&arena);
+    ck_assert_int_eq(wsp_arena_init(&arena, 128, &e), WSP_OK);
+
+    for (i = 0; i < 64; i++) {
+        points[i].timestamp = now - 100 + (i * 37) % 90;
+        points[i].value = (double)(i % 11);
+    }
+
+    check_open(&a, path_arena);
+    check_open(&b, path_plain);
+
+    a.arena = &arena;
+
+    for (i = 0; i < 32; i++) {
+        ck_assert_int_eq(wsp_update(&a, points + i, &e), WSP_OK);
+        ck_assert_int_eq(wsp_update(&b, points + i, &e), WSP_OK);
+        ck_assert_uint_eq(arena.used, 0);
+    }
+
+    ck_assert_int_eq(wsp_update_many(&a, points + 32, 32, &e), WSP_OK);
+    ck_assert_int_eq(wsp_update_many(&b, points + 32, 32, &e), WSP_OK);
+
+    ck_assert_uint_eq(arena.used, 0);
+    ck_assert(arena.overflows > 0);
+    ck_assert(arena.peak > 0);
+
+    wsp_time_t ranges[][2] = {
+        { now - 120, now },
+        { now - 1200, now },
+        { now - 3 * 3600, now }
+    };
+
+    for (i = 0; i < 3; i++) {
+        check_fetch(&b, ranges[i][0], ranges[i][1], now);
+
+        memcpy(values, check_values, sizeof(values));
+        memcpy(valid, check_valid, sizeof(valid));
+        wsp_series_t plain = check_series;
+
+        check_fetch(&a, ranges[i][0], ranges[i][1], now);
+        ck_assert_uint_eq(arena.used, 0);
+
+        ck_assert_uint_eq(check_series.start, plain.start);
+        ck_assert_uint_eq(check_series.step, plain.step);
+        ck_assert_uint_eq(check_series.count, plain.count);
+        ck_assert(memcmp(check_valid, valid, (plain.count + 7) / 8) == 0);
+
+        uint32_t j, known = 0;
+
+        for (j = 0; j < plain.count; j++) {
+            if (check_is_valid(j)) {
+                ck_assert(check_values[j] == values[j]);
+                known++;
+            }
+        }
+
+        ck_assert(known > 0);
+    }
+
+    check_close(&a);
+    check_close(&b);
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_arena");
+
+    TCase *tc_arena = tcase_create("arena");
+
+    tcase_add_checked_fixture(tc_arena, setup_arena, teardown_arena);
+    tcase_add_test(tc_arena, test_align);
+    tcase_add_test(tc_arena, test_overflow);
+    tcase_add_test(tc_arena, test_release);
+    tcase_add_test(tc_arena, test_thread);
+
+    suite_add_tcase(s, tc_arena);
+
+    TCase *tc_update = tcase_create("update");
+
+    tcase_add_checked_fixture(tc_update, setup_dir, teardown_dir);
+    tcase_add_test(tc_update, test_tiny);
+
+    suite_add_tcase(s, tc_update);
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}
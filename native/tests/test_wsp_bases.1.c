@@ -0,0 +1,299 @@
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "../src/wsp.h"
+
+char dir[CHECK_TMP_SIZE];
+char path[CHECK_TMP_SIZE];
+
+wsp_archive_t archives[] = {
+    { .spp = 1, .count = 60 },
+    { .spp = 60, .count = 120 }
+};
+
+wsp_time_t now;
+// a minute only covered by the second archive.
+wsp_time_t old;
+
+void setup_file() {
+    check_tmp_dir(dir);
+    check_tmp_path(dir, "test.wsp", path);
+    check_create(path, archives, 2, WSP_LAST, 0.5);
+
+    now = wsp_time_now();
+    old = wsp_time_floor(now - 2500, 60);
+}
+
+void teardown_file() {
+    check_tmp_clean(dir);
+}
+
+/*
+ * Set the modification time of the database.
+ */
+void set_mtime(struct timespec *mtime) {
+    struct timespec times[2];
+
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1] = *mtime;
+
+    ck_assert_int_eq(utimensat(AT_FDCWD, path, times, 0), 0);
+}
+
+/*
+ * Make the database look untouched for a while, so that cached base points
+ * are kept between operations.
+ */
+void age_file() {
+    struct timespec mtime = { .tv_sec = now - 100, .tv_nsec = 0 };
+    set_mtime(&mtime);
+}
+
+void open_file(wsp_t *w, int io_flags) {
+    wsp_error_t e;
+
+    WSP_INIT(w);
+    WSP_ERROR_INIT(&e);
+
+    w->io_flags = io_flags;
+
+    ck_assert_int_eq(wsp_open(w, path, WSP_PREAD, &e), WSP_OK);
+    ck_assert(w->bases != NULL);
+}
+
+/*
+ * Check if the minute old is known in the second archive, as seen by a
+ * handle.
+ */
+int old_known(wsp_t *w) {
+    check_fetch(w, old - 60, old, now);
+
+    ck_assert_uint_eq(check_series.step, 60);
+    ck_assert_uint_eq(check_series.count, 1);
+    ck_assert_uint_eq(check_series.start, old);
+
+    return check_is_valid(0);
+}
+
+void write_old(wsp_t *w) {
+    wsp_error_t e;
+    wsp_point_t p = { .timestamp = old, .value = 7.0 };
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_update_many(w, &p, 1, &e), WSP_OK);
+}
+
+/*
+ * Check the cached base points of a handle against the file.
+ */
+void check_bases(wsp_t *w) {
+    wsp_t other;
+    wsp_error_t e;
+    wsp_point_t base;
+    uint32_t i;
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert(w->bases_valid);
+
+    check_open(&other, path);
+
+    for (i = 0; i < other.archives_count; i++) {
+        ck_assert_int_eq(wsp_load_point(&other, other.archives + i, 0, &base, &e), WSP_OK);
+        ck_assert_uint_eq(w->bases[i].timestamp, base.timestamp);
+
+        if (base.timestamp != 0) {
+            ck_assert(w->bases[i].value == base.value);
+        }
+    }
+
+    check_close(&other);
+}
+
+START_TEST(test_exclusive)
+{
+    wsp_t w;
+    wsp_error_t e;
+    wsp_point_t p = { .timestamp = now - 10, .value = 1.0 };
+
+    WSP_ERROR_INIT(&e);
+
+    open_file(&w, WSP_IO_EXCLUSIVE);
+
+    // the writes of the handle keep the cache current.
+    ck_assert_int_eq(wsp_update(&w, &p, &e), WSP_OK);
+    check_bases(&w);
+    ck_assert_uint_eq(w.bases[0].timestamp, now - 10);
+
+    p.timestamp = now - 5;
+    p.value = 2.0;
+
+    ck_assert_int_eq(wsp_update(&w, &p, &e), WSP_OK);
+    check_bases(&w);
+    ck_assert_uint_eq(w.bases[0].timestamp, now - 10);
+
+    write_old(&w);
+    check_bases(&w);
+    ck_assert_uint_eq(w.bases[1].timestamp, old);
+
+    ck_assert(old_known(&w));
+
+    check_close(&w);
+}
+END_TEST
+
+START_TEST(test_shared)
+{
+    wsp_t w;
+    wsp_t other;
+    wsp_point_t base;
+    wsp_error_t e;
+
+    WSP_ERROR_INIT(&e);
+
+    age_file();
+    open_file(&w, WSP_IO_DEFAULT);
+
+    ck_assert(!old_known(&w));
+    ck_assert(w.bases_valid);
+    ck_assert(!w.bases_racy);
+    ck_assert_uint_eq(w.bases[1].timestamp, 0);
+
+    // nothing changed, the cache is kept.
+    ck_assert(!old_known(&w));
+    ck_assert(w.bases_valid);
+
+    // another handle writes the empty archive, which changes the
+    // modification time of the file.
+    open_file(&other, WSP_IO_DEFAULT);
+    write_old(&other);
+    check_close(&other);
+
+    ck_assert(old_known(&w));
+    check_bases(&w);
+    ck_assert_uint_eq(w.bases[1].timestamp, old);
+
+    // the own writes of a shared handle can not be told apart from those of
+    // others.
+    wsp_point_t p = { .timestamp = now - 10, .value = 1.0 };
+
+    ck_assert_int_eq(wsp_update(&w, &p, &e), WSP_OK);
+    ck_assert(!w.bases_valid);
+
+    ck_assert_int_eq(wsp_load_point(&w, w.archives, 0, &base, &e), WSP_OK);
+    ck_assert_uint_eq(base.timestamp, now - 10);
+
+    check_close(&w);
+}
+END_TEST
+
+START_TEST(test_racy)
+{
+    wsp_t w;
+    wsp_t other;
+    struct stat st;
+
+    // just created, a write in the same clock tick may not change the
+    // modification time.
+    open_file(&w, WSP_IO_DEFAULT);
+
+    ck_assert(!old_known(&w));
+    ck_assert(w.bases_valid);
+    ck_assert(w.bases_racy);
+
+    ck_assert_int_eq(stat(path, &st), 0);
+
+    open_file(&other, WSP_IO_DEFAULT);
+    write_old(&other);
+    check_close(&other);
+
+    // a write that left the modification time and size as they were.
+    set_mtime(&st.st_mtim);
+
+    ck_assert(old_known(&w));
+    ck_assert_uint_eq(w.bases[1].timestamp, old);
+
+    check_close(&w);
+}
+END_TEST
+
+/*
+ * Writers of a mapping that fail without writing anything.
+ */
+wsp_return_t fail_write(wsp_t *w, long offset, size_t size, void *buf, wsp_error_t *e) {
+    e->type = WSP_ERROR_IO;
+    e->syserr = EIO;
+    return WSP_ERROR;
+}
+
+wsp_return_t fail_writev(wsp_t *w, wsp_iov_t *iov, uint32_t count, wsp_error_t *e) {
+    return fail_write(w, 0, 0, NULL, e);
+}
+
+START_TEST(test_failed_write)
+{
+    wsp_t w;
+    wsp_error_t e;
+    wsp_point_t p = { .timestamp = now - 10, .value = 1.0 };
+    wsp_point_t old_p = { .timestamp = old, .value = 7.0 };
+
+    WSP_ERROR_INIT(&e);
+
+    open_file(&w, WSP_IO_EXCLUSIVE);
+
+    ck_assert_int_eq(wsp_update(&w, &p, &e), WSP_OK);
+    check_bases(&w);
+
+    wsp_io *io = w.io;
+    wsp_io failing = *io;
+
+    failing.write = fail_write;
+    failing.writev = fail_writev;
+    w.io = &failing;
+
+    // the base point of the empty archive is not written, and not cached.
+    ck_assert_int_eq(wsp_update_many(&w, &old_p, 1, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_IO);
+    ck_assert(!w.bases_valid);
+
+    w.io = io;
+
+    ck_assert(!old_known(&w));
+    check_bases(&w);
+    ck_assert_uint_eq(w.bases[1].timestamp, 0);
+
+    check_close(&w);
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_bases");
+
+    TCase *tc = tcase_create("bases");
+
+    tcase_add_checked_fixture(tc, setup_file, teardown_file);
+    tcase_add_test(tc, test_exclusive);
+    tcase_add_test(tc, test_shared);
+    tcase_add_test(tc, test_racy);
+    tcase_add_test(tc, test_failed_write);
+
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,353 @@
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/wsp_cache.h"
+
+char dir[CHECK_TMP_SIZE];
+char path_a[CHECK_TMP_SIZE];
+char path_b[CHECK_TMP_SIZE];
+char path_c[CHECK_TMP_SIZE];
+char path_missing[CHECK_TMP_SIZE];
+
+wsp_archive_t archives[] = {
+    { .spp = 1, .count = 120 },
+    { .spp = 60, .count = 120 }
+};
+
+void setup_files() {
+    check_tmp_dir(dir);
+    check_tmp_path(dir, "a.wsp", path_a);
+    check_tmp_path(dir, "b.wsp", path_b);
+    check_tmp_path(dir, "c.wsp", path_c);
+    check_tmp_path(dir, "missing.wsp", path_missing);
+
+    check_create(path_a, archives, 2, WSP_SUM, 0.5);
+    check_create(path_b, archives, 2, WSP_SUM, 0.5);
+    check_create(path_c, archives, 2, WSP_SUM, 0.5);
+}
+
+void teardown_files() {
+    check_tmp_clean(dir);
+}
+
+void add_point(wsp_cache_t *c, const char *path, wsp_time_t timestamp, double value) {
+    wsp_error_t e;
+    wsp_point_t p = { .timestamp = timestamp, .value = value };
+
+    WSP_ERROR_INIT(&e);
+    ck_assert_int_eq(wsp_cache_add(c, path, &p, &e), WSP_OK);
+}
+
+/*
+ * Load the last count intervals of an archive, through the cache.
+ */
+void load_points(wsp_cache_t *c, const char *path, uint32_t archive, wsp_time_t now, wsp_point_t *result, uint32_t *size) {
+    wsp_t w;
+    wsp_error_t e;
+
+    WSP_INIT(&w);
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_open(&w, path, WSP_PREAD, &e), WSP_OK);
+
+    wsp_archive_t *a = w.archives + archive;
+    wsp_time_t until = wsp_time_floor(now, a->spp) + a->spp;
+
+    ck_assert_int_eq(wsp_cache_load_time_points(c, path, &w, a, until - 10 * a->spp, until, result, size, &e), WSP_OK);
+    ck_assert_int_eq(wsp_close(&w, &e), WSP_OK);
+}
+
+/*
+ * Value of the interval of timestamp in loaded points, NAN if missing.
+ */
+double point_value(wsp_point_t *points, uint32_t size, uint32_t spp, wsp_time_t timestamp) {
+    uint32_t i;
+
+    for (i = 0; i < size; i++) {
+        if (points[i].timestamp == wsp_time_floor(timestamp, spp)) {
+            return points[i].value;
+        }
+    }
+
+    return NAN;
+}
+
+char *order[8];
+int order_count;
+int fail_path_b;
+
+wsp_return_t recording_writer(void *data, char *path, wsp_point_t *points, uint32_t count, wsp_error_t *e) {
+    if (fail_path_b && strcmp(path, path_b) == 0) {
+        e->type = WSP_ERROR_IO;
+        return WSP_ERROR;
+    }
+
+    order[order_count++] = path;
+    free(points);
+    return WSP_OK;
+}
+
+wsp_cache_t *adding_cache;
+wsp_time_t adding_now;
+
+/*
+ * Writer adding points for the path it fails on.
+ */
+wsp_return_t adding_writer(void *data, char *path, wsp_point_t *points, uint32_t count, wsp_error_t *e) {
+    add_point(adding_cache, path, adding_now - 1, 5.0);
+    add_point(adding_cache, path, adding_now - 3, 6.0);
+
+    e->type = WSP_ERROR_IO;
+    return WSP_ERROR;
+}
+
+START_TEST(test_read_your_writes)
+{
+    wsp_cache_t c;
+    wsp_error_t e;
+    wsp_point_t result[16];
+    uint32_t size;
+    wsp_time_t now = wsp_time_now();
+
+    WSP_ERROR_INIT(&e);
+    ck_assert_int_eq(wsp_cache_init(&c, 0, &e), WSP_OK);
+
+    add_point(&c, path_a, now - 5, 1.0);
+    // the last point of an interval wins.
+    add_point(&c, path_a, now - 3, 2.0);
+    add_point(&c, path_a, now - 3, 3.0);
+
+    load_points(&c, path_a, 0, now, result, &size);
+
+    ck_assert_int_eq(size, 10);
+    ck_assert(point_value(result, size, 1, now - 5) == 1.0);
+    ck_assert(point_value(result, size, 1, now - 3) == 3.0);
+    ck_assert(isnan(point_value(result, size, 1, now - 4)));
+
+    // the lower archive holds aggregates, raw pending points are not shown.
+    load_points(&c, path_a, 1, now, result, &size);
+
+    ck_assert(isnan(point_value(result, size, 60, now - 3)));
+
+    // once flushed, the points are read from the file.
+    ck_assert_int_eq(wsp_cache_flush(&c, 0, WSP_PREAD, &e), WSP_OK);
+    ck_assert_int_eq(c.points_count, 0);
+
+    load_points(&c, path_a, 0, now, result, &size);
+
+    ck_assert(point_value(result, size, 1, now - 5) == 1.0);
+    ck_assert(point_value(result, size, 1, now - 3) == 3.0);
+
+    wsp_cache_free(&c, &e);
+}
+END_TEST
+
+START_TEST(test_add_now)
+{
+    wsp_cache_t c;
+    wsp_error_t e;
+    wsp_point_t result[16];
+    uint32_t size;
+
+    WSP_ERROR_INIT(&e);
+    ck_assert_int_eq(wsp_cache_init(&c, 0, &e), WSP_OK);
+
+    wsp_time_t before = wsp_time_now();
+    add_point(&c, path_a, 0, 7.0);
+    wsp_time_t after = wsp_time_now();
+
+    load_points(&c, path_a, 0, after, result, &size);
+
+    ck_assert(point_value(result, size, 1, before) == 7.0 || point_value(result, size, 1, after) == 7.0);
+
+    // a timestamp of 0 is the time of the add, not of the flush.
+    char *path;
+    wsp_point_t *points;
+    uint32_t count;
+
+    ck_assert_int_eq(wsp_cache_pop(&c, &path, &points, &count, &e), WSP_OK);
+    ck_assert_int_eq(count, 1);
+    ck_assert(points[0].timestamp >= before);
+    ck_assert(points[0].timestamp <= after);
+
+    free(path);
+    free(points);
+
+    wsp_cache_free(&c, &e);
+}
+END_TEST
+
+START_TEST(test_cache_full)
+{
+    wsp_cache_t c;
+    wsp_error_t e;
+    wsp_time_t now = wsp_time_now();
+
+    WSP_ERROR_INIT(&e);
+    ck_assert_int_eq(wsp_cache_init(&c, 3, &e), WSP_OK);
+
+    add_point(&c, path_a, now - 1, 1.0);
+    add_point(&c, path_b, now - 1, 1.0);
+    add_point(&c, path_b, now - 2, 1.0);
+
+    wsp_point_t p = { .timestamp = now, .value = 1.0 };
+
+    ck_assert_int_eq(wsp_cache_add(&c, path_c, &p, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_CACHE_FULL);
+    ck_assert_int_eq(c.points_count, 3);
+
+    // flushing the largest backlog makes room.
+    ck_assert_int_eq(wsp_cache_flush(&c, 1, WSP_PREAD, &e), WSP_OK);
+    ck_assert_int_eq(c.points_count, 1);
+    ck_assert_int_eq(c.entries_count, 1);
+
+    WSP_ERROR_INIT(&e);
+    ck_assert_int_eq(wsp_cache_add(&c, path_c, &p, &e), WSP_OK);
+
+    wsp_cache_free(&c, &e);
+}
+END_TEST
+
+START_TEST(test_drain_order)
+{
+    wsp_cache_t c;
+    wsp_error_t e;
+    wsp_time_t now = wsp_time_now();
+
+    WSP_ERROR_INIT(&e);
+    ck_assert_int_eq(wsp_cache_init(&c, 0, &e), WSP_OK);
+
+    add_point(&c, path_a, now - 1, 1.0);
+    add_point(&c, path_b, now - 1, 1.0);
+    add_point(&c, path_b, now - 2, 1.0);
+    add_point(&c, path_b, now - 3, 1.0);
+    add_point(&c, path_c, now - 1, 1.0);
+    add_point(&c, path_c, now - 2, 1.0);
+
+    order_count = 0;
+    fail_path_b = 0;
+
+    ck_assert_int_eq(wsp_cache_drain(&c, 2, recording_writer, NULL, &e), WSP_OK);
+    ck_assert_int_eq(order_count, 2);
+    ck_assert_str_eq(order[0], path_b);
+    ck_assert_str_eq(order[1], path_c);
+    ck_assert_int_eq(c.entries_count, 1);
+    ck_assert_int_eq(c.points_count, 1);
+
+    ck_assert_int_eq(wsp_cache_drain(&c, 0, recording_writer, NULL, &e), WSP_OK);
+    ck_assert_int_eq(order_count, 3);
+    ck_assert_str_eq(order[2], path_a);
+    ck_assert_int_eq(c.entries_count, 0);
+
+    int i;
+
+    for (i = 0; i < order_count; i++) {
+        free(order[i]);
+    }
+
+    wsp_cache_free(&c, &e);
+}
+END_TEST
+
+START_TEST(test_drain_failed)
+{
+    wsp_cache_t c;
+    wsp_error_t e;
+    wsp_time_t now = wsp_time_now();
+
+    WSP_ERROR_INIT(&e);
+    ck_assert_int_eq(wsp_cache_init(&c, 0, &e), WSP_OK);
+
+    add_point(&c, path_a, now - 1, 1.0);
+    add_point(&c, path_b, now - 1, 2.0);
+    add_point(&c, path_b, now - 2, 3.0);
+
+    order_count = 0;
+    fail_path_b = 1;
+
+    // the failed entry is put back, and the others are still written.
+    ck_assert_int_eq(wsp_cache_drain(&c, 0, recording_writer, NULL, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_IO);
+    ck_assert_int_eq(order_count, 1);
+    ck_assert_str_eq(order[0], path_a);
+    ck_assert_int_eq(c.entries_count, 1);
+    ck_assert_int_eq(c.points_count, 2);
+
+    free(order[0]);
+
+    // a flush to a missing database keeps its points too.
+    add_point(&c, path_missing, now - 1, 4.0);
+
+    WSP_ERROR_INIT(&e);
+    ck_assert_int_eq(wsp_cache_flush(&c, 0, WSP_PREAD, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_IO);
+    ck_assert_int_eq(c.entries_count, 1);
+    ck_assert_int_eq(c.points_count, 1);
+
+    wsp_cache_free(&c, &e);
+}
+END_TEST
+
+START_TEST(test_drain_requeue_merge)
+{
+    wsp_cache_t c;
+    wsp_error_t e;
+    wsp_point_t result[16];
+    uint32_t size;
+    wsp_time_t now = wsp_time_now();
+
+    WSP_ERROR_INIT(&e);
+    ck_assert_int_eq(wsp_cache_init(&c, 0, &e), WSP_OK);
+
+    add_point(&c, path_b, now - 2, 1.0);
+    add_point(&c, path_b, now - 1, 2.0);
+
+    adding_cache = &c;
+    adding_now = now;
+
+    ck_assert_int_eq(wsp_cache_drain(&c, 0, adding_writer, NULL, &e), WSP_ERROR);
+    ck_assert_int_eq(c.entries_count, 1);
+    ck_assert_int_eq(c.points_count, 4);
+
+    // points added while writing come after the ones put back.
+    ck_assert_int_eq(wsp_cache_flush(&c, 0, WSP_PREAD, &e), WSP_OK);
+
+    load_points(&c, path_b, 0, now, result, &size);
+
+    ck_assert(point_value(result, size, 1, now - 2) == 1.0);
+    ck_assert(point_value(result, size, 1, now - 1) == 5.0);
+    ck_assert(point_value(result, size, 1, now - 3) == 6.0);
+
+    wsp_cache_free(&c, &e);
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_cache");
+
+    TCase *cache = tcase_create("cache");
+
+    tcase_add_checked_fixture(cache, setup_files, teardown_files);
+    tcase_add_test(cache, test_read_your_writes);
+    tcase_add_test(cache, test_add_now);
+    tcase_add_test(cache, test_cache_full);
+    tcase_add_test(cache, test_drain_order);
+    tcase_add_test(cache, test_drain_failed);
+    tcase_add_test(cache, test_drain_requeue_merge);
+
+    suite_add_tcase(s, cache);
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}
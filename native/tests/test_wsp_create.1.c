@@ -0,0 +1,242 @@
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "../src/wsp.h"
+
+char dir[CHECK_TMP_SIZE];
+char path[CHECK_TMP_SIZE];
+char path_clone[CHECK_TMP_SIZE];
+
+// given out of order.
+wsp_archive_t archives[] = {
+    { .spp = 60, .count = 120 },
+    { .spp = 1, .count = 60 },
+    { .spp = 600, .count = 240 }
+};
+
+#define ARCHIVES_SIZE (sizeof(archives) / sizeof(archives[0]))
+
+wsp_create_mode_t modes[] = {
+    WSP_CREATE_ZERO, WSP_CREATE_SPARSE, WSP_CREATE_FALLOCATE
+};
+
+#define MODES_SIZE (sizeof(modes) / sizeof(modes[0]))
+
+void setup_dir() {
+    check_tmp_dir(dir);
+    check_tmp_path(dir, "test.wsp", path);
+    check_tmp_path(dir, "clone.wsp", path_clone);
+}
+
+void teardown_dir() {
+    check_tmp_clean(dir);
+}
+
+/*
+ * Check that a database has the header of archives, and all points empty.
+ */
+void check_empty(const char *path, wsp_aggregation_t aggregation, float xff) {
+    wsp_t w;
+    wsp_error_t e;
+    wsp_point_t p;
+    struct stat st;
+    uint32_t i, j;
+
+    WSP_ERROR_INIT(&e);
+
+    check_open(&w, path);
+
+    ck_assert_uint_eq(w.meta.aggregation, aggregation);
+    ck_assert(w.meta.x_files_factor == xff);
+    ck_assert_uint_eq(w.meta.max_retention, 600 * 240);
+    ck_assert_uint_eq(w.archives_count, ARCHIVES_SIZE);
+
+    // sorted by precision.
+    ck_assert_uint_eq(w.archives[0].spp, 1);
+    ck_assert_uint_eq(w.archives[1].spp, 60);
+    ck_assert_uint_eq(w.archives[2].spp, 600);
+
+    for (i = 0; i < w.archives_count; i++) {
+        for (j = 0; j < w.archives[i].count; j++) {
+            ck_assert_int_eq(wsp_load_point(&w, w.archives + i, j, &p, &e), WSP_OK);
+            ck_assert_uint_eq(p.timestamp, 0);
+            ck_assert(p.value == 0.0);
+        }
+    }
+
+    wsp_archive_t *last = w.archives + w.archives_count - 1;
+
+    ck_assert_int_eq(stat(path, &st), 0);
+    ck_assert_uint_eq(st.st_size, last->offset + sizeof(wsp_point_b) * last->count);
+
+    check_close(&w);
+}
+
+START_TEST(test_modes)
+{
+    wsp_error_t e;
+    uint32_t i;
+
+    WSP_ERROR_INIT(&e);
+
+    for (i = 0; i < MODES_SIZE; i++) {
+        unlink(path);
+
+        ck_assert_int_eq(wsp_create(path, archives, ARCHIVES_SIZE, 0.25, WSP_MAX, modes[i], &e), WSP_OK);
+        check_empty(path, WSP_MAX, 0.25);
+    }
+}
+END_TEST
+
+START_TEST(test_template)
+{
+    wsp_t w;
+    wsp_error_t e;
+    wsp_time_t now = wsp_time_now();
+    wsp_point_t p = { .timestamp = now - 10, .value = 1.0 };
+
+    WSP_ERROR_INIT(&e);
+
+    check_create(path, archives, ARCHIVES_SIZE, WSP_SUM, 0.75);
+
+    ck_assert_int_eq(wsp_create_template(path_clone, path, &e), WSP_OK);
+    check_empty(path_clone, WSP_SUM, 0.75);
+
+    // the blocks of the copy are its own.
+    check_open(&w, path_clone);
+    ck_assert_int_eq(wsp_update(&w, &p, &e), WSP_OK);
+    check_close(&w);
+
+    check_fetch_file(path_clone, now - 60, now, now);
+    ck_assert(check_is_valid(49));
+
+    check_empty(path, WSP_SUM, 0.75);
+}
+END_TEST
+
+START_TEST(test_exists)
+{
+    wsp_t w;
+    wsp_error_t e;
+    wsp_time_t now = wsp_time_now();
+    wsp_point_t p = { .timestamp = now - 10, .value = 1.0 };
+
+    WSP_ERROR_INIT(&e);
+
+    check_create(path, archives, ARCHIVES_SIZE, WSP_AVERAGE, 0.5);
+    check_create(path_clone, archives, ARCHIVES_SIZE, WSP_AVERAGE, 0.5);
+    check_update_many(path, &p, 1);
+
+    ck_assert_int_eq(wsp_create(path, archives, ARCHIVES_SIZE, 0.5, WSP_AVERAGE, WSP_CREATE_ZERO, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_IO);
+    ck_assert_int_eq(e.syserr, EEXIST);
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_create_template(path, path_clone, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_IO);
+    ck_assert_int_eq(e.syserr, EEXIST);
+
+    // the existing database is neither removed nor overwritten.
+    check_open(&w, path);
+    ck_assert_int_eq(wsp_load_point(&w, w.archives, 0, &p, &e), WSP_OK);
+    ck_assert_uint_eq(p.timestamp, now - 10);
+    check_close(&w);
+}
+END_TEST
+
+/*
+ * Check that a list of archives is rejected, by both wsp_validate_archives
+ * and wsp_create, without creating the database.
+ */
+void check_invalid(wsp_archive_t *list, uint32_t count, wsp_errornum_t type) {
+    wsp_error_t e;
+    struct stat st;
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_validate_archives(list, count, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, type);
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_create(path, list, count, 0.5, WSP_AVERAGE, WSP_CREATE_ZERO, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, type);
+    ck_assert_int_eq(stat(path, &st), -1);
+}
+
+START_TEST(test_validate)
+{
+    wsp_error_t e;
+
+    WSP_ERROR_INIT(&e);
+
+    // unsorted is fine, and left as it was.
+    ck_assert_int_eq(wsp_validate_archives(archives, ARCHIVES_SIZE, &e), WSP_OK);
+    ck_assert_uint_eq(archives[0].spp, 60);
+    ck_assert_uint_eq(archives[1].spp, 1);
+
+    check_invalid(archives, 0, WSP_ERROR_ARCHIVE_CONFIG);
+
+    wsp_archive_t empty[] = { { .spp = 1, .count = 0 } };
+    check_invalid(empty, 1, WSP_ERROR_ARCHIVE_CONFIG);
+
+    // the same precision twice, in any order.
+    wsp_archive_t same[] = {
+        { .spp = 60, .count = 120 },
+        { .spp = 1, .count = 60 },
+        { .spp = 60, .count = 240 }
+    };
+    check_invalid(same, 3, WSP_ERROR_ARCHIVE_CONFIG);
+
+    // 60 is not a multiple of 7.
+    wsp_archive_t misaligned[] = {
+        { .spp = 60, .count = 120 },
+        { .spp = 7, .count = 600 }
+    };
+    check_invalid(misaligned, 2, WSP_ERROR_ARCHIVE_MISALIGNED);
+
+    // the less precise archive must cover a longer time.
+    wsp_archive_t shorter[] = {
+        { .spp = 1, .count = 7200 },
+        { .spp = 60, .count = 120 }
+    };
+    check_invalid(shorter, 2, WSP_ERROR_ARCHIVE_CONFIG);
+
+    // 10 points can not consolidate into a point of 60 seconds.
+    wsp_archive_t few[] = {
+        { .spp = 1, .count = 10 },
+        { .spp = 60, .count = 120 }
+    };
+    check_invalid(few, 2, WSP_ERROR_ARCHIVE_CONFIG);
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_create");
+
+    TCase *tc = tcase_create("create");
+
+    tcase_add_checked_fixture(tc, setup_dir, teardown_dir);
+    tcase_add_test(tc, test_modes);
+    tcase_add_test(tc, test_template);
+    tcase_add_test(tc, test_exists);
+    tcase_add_test(tc, test_validate);
+
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}
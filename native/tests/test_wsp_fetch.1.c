@@ -0,0 +1,232 @@
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/wsp.h"
+
+char dir[CHECK_TMP_SIZE];
+char path[CHECK_TMP_SIZE];
+
+wsp_archive_t archives[] = {
+    { .spp = 1, .count = 60 },
+    { .spp = 60, .count = 120 },
+    { .spp = 3600, .count = 240 }
+};
+
+wsp_t w;
+wsp_time_t now;
+
+/*
+ * Value written for an interval of an archive.
+ */
+double value_of(wsp_time_t interval, uint32_t spp) {
+    return (double)((interval / spp) % 1000);
+}
+
+/*
+ * A database with the last minute in the first archive, and the 98 minutes
+ * before the last two in the second one.
+ */
+void setup_file() {
+    wsp_error_t e;
+    wsp_point_t points[160];
+    uint32_t count = 0;
+    uint32_t i;
+
+    WSP_ERROR_INIT(&e);
+
+    check_tmp_dir(dir);
+    check_tmp_path(dir, "test.wsp", path);
+
+    check_create(path, archives, 3, WSP_LAST, 0.0);
+
+    now = wsp_time_now();
+
+    for (i = 2; i < 100; i++) {
+        wsp_time_t interval = wsp_time_floor(now - 60 * i, 60);
+        points[count].timestamp = interval;
+        points[count].value = value_of(interval, 60);
+        count++;
+    }
+
+    for (i = 0; i < 60; i++) {
+        points[count].timestamp = now - i;
+        points[count].value = value_of(now - i, 1);
+        count++;
+    }
+
+    check_open(&w, path);
+    ck_assert_int_eq(wsp_update_many(&w, points, count, &e), WSP_OK);
+}
+
+void teardown_file() {
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    wsp_close(&w, &e);
+    check_tmp_clean(dir);
+}
+
+START_TEST(test_select_first_archive)
+{
+    uint32_t i;
+
+    check_fetch(&w, now - 30, now, now);
+
+    // intervals are aligned to the step after their timestamp.
+    ck_assert_uint_eq(check_series.step, 1);
+    ck_assert_uint_eq(check_series.start, now - 29);
+    ck_assert_uint_eq(check_series.count, 30);
+
+    for (i = 0; i < check_series.count; i++) {
+        ck_assert(check_is_valid(i));
+        ck_assert(check_series.values[i] == value_of(check_series.start + i, 1));
+    }
+}
+END_TEST
+
+START_TEST(test_select_second_archive)
+{
+    uint32_t i;
+
+    // just past the retention of the first archive.
+    check_fetch(&w, now - 61, now, now);
+
+    ck_assert_uint_eq(check_series.step, 60);
+    ck_assert_uint_eq(check_series.start, wsp_time_floor(now - 61, 60) + 60);
+    ck_assert_uint_eq(check_series.count, (wsp_time_floor(now, 60) - wsp_time_floor(now - 61, 60)) / 60);
+
+    check_fetch(&w, now - 3000, now - 200, now);
+
+    ck_assert_uint_eq(check_series.step, 60);
+    ck_assert_uint_eq(check_series.start, wsp_time_floor(now - 3000, 60) + 60);
+    ck_assert_uint_eq(check_series.count, (wsp_time_floor(now - 200, 60) - wsp_time_floor(now - 3000, 60)) / 60);
+
+    for (i = 0; i < check_series.count; i++) {
+        ck_assert(check_is_valid(i));
+        ck_assert(check_series.values[i] == value_of(check_series.start + i * 60, 60));
+    }
+}
+END_TEST
+
+START_TEST(test_select_last_archive)
+{
+    check_fetch(&w, now - 7201, now, now);
+
+    ck_assert_uint_eq(check_series.step, 3600);
+    ck_assert_uint_eq(check_series.start, wsp_time_floor(now - 7201, 3600) + 3600);
+}
+END_TEST
+
+START_TEST(test_clamp_retention)
+{
+    wsp_time_t oldest = now - 3600 * 240;
+
+    // starts before the retention of the database.
+    check_fetch(&w, oldest - 100000, now - 7201, now);
+
+    ck_assert_uint_eq(check_series.step, 3600);
+    ck_assert_uint_eq(check_series.start, wsp_time_floor(oldest, 3600) + 3600);
+    ck_assert_uint_eq(check_series.count, (wsp_time_floor(now - 7201, 3600) - wsp_time_floor(oldest, 3600)) / 3600);
+
+    // ends before the retention.
+    check_fetch(&w, oldest - 100000, oldest - 1, now);
+
+    ck_assert_uint_eq(check_series.step, 0);
+    ck_assert_uint_eq(check_series.count, 0);
+}
+END_TEST
+
+START_TEST(test_clamp_now)
+{
+    uint32_t i;
+
+    // ends in the future.
+    check_fetch(&w, now - 10, now + 1000, now);
+
+    ck_assert_uint_eq(check_series.step, 1);
+    ck_assert_uint_eq(check_series.start, now - 9);
+    ck_assert_uint_eq(check_series.count, 10);
+
+    // starts in the future.
+    check_fetch(&w, now + 1, now + 1000, now);
+
+    ck_assert_uint_eq(check_series.step, 0);
+    ck_assert_uint_eq(check_series.count, 0);
+
+    // an earlier now selects the archive and clamps relative to it.
+    wsp_time_t at = now - 20;
+
+    check_fetch(&w, at - 30, at + 1000, at);
+
+    ck_assert_uint_eq(check_series.step, 1);
+    ck_assert_uint_eq(check_series.start, at - 29);
+    ck_assert_uint_eq(check_series.count, 30);
+
+    for (i = 0; i < check_series.count; i++) {
+        ck_assert(check_series.values[i] == value_of(check_series.start + i, 1));
+    }
+}
+END_TEST
+
+START_TEST(test_same_interval)
+{
+    // from == until gives the single interval after it.
+    check_fetch(&w, now - 10, now - 10, now);
+
+    ck_assert_uint_eq(check_series.step, 1);
+    ck_assert_uint_eq(check_series.start, now - 9);
+    ck_assert_uint_eq(check_series.count, 1);
+    ck_assert(check_series.values[0] == value_of(now - 9, 1));
+
+    // and so does any range within one interval.
+    wsp_time_t interval = wsp_time_floor(now - 3000, 60);
+
+    check_fetch(&w, interval + 10, interval + 50, now);
+
+    ck_assert_uint_eq(check_series.step, 60);
+    ck_assert_uint_eq(check_series.start, interval + 60);
+    ck_assert_uint_eq(check_series.count, 1);
+    ck_assert(check_series.values[0] == value_of(interval + 60, 60));
+}
+END_TEST
+
+START_TEST(test_invalid_interval)
+{
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_fetch(&w, now, now - 1, now, &check_series, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_TIME_INTERVAL);
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_fetch");
+
+    TCase *tc = tcase_create("fetch");
+
+    tcase_add_checked_fixture(tc, setup_file, teardown_file);
+    tcase_add_test(tc, test_select_first_archive);
+    tcase_add_test(tc, test_select_second_archive);
+    tcase_add_test(tc, test_select_last_archive);
+    tcase_add_test(tc, test_clamp_retention);
+    tcase_add_test(tc, test_clamp_now);
+    tcase_add_test(tc, test_same_interval);
+    tcase_add_test(tc, test_invalid_interval);
+
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,321 @@
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/wsp.h"
+#include "../src/wsp_fetch.h"
+
+char dir[CHECK_TMP_SIZE];
+
+/*
+ * One database per aggregation method, with steps whose least common
+ * multiple is 360, the last one already on that step.
+ */
+struct {
+    uint32_t spp;
+    wsp_aggregation_t aggregation;
+} databases[] = {
+    { 60, WSP_AVERAGE },
+    { 90, WSP_MIN },
+    { 120, WSP_SUM },
+    { 180, WSP_MAX },
+    { 360, WSP_LAST }
+};
+
+#define DATABASES_SIZE (sizeof(databases) / sizeof(databases[0]))
+#define MAX_POINTS 64
+
+char paths[DATABASES_SIZE + 2][CHECK_TMP_SIZE];
+const char *path_list[DATABASES_SIZE + 2];
+
+// points written to every database.
+wsp_point_t points[DATABASES_SIZE][MAX_POINTS];
+uint32_t points_count[DATABASES_SIZE];
+
+wsp_time_t now;
+
+void setup_dir() {
+    uint32_t d;
+    char name[32];
+
+    check_tmp_dir(dir);
+
+    now = wsp_time_now();
+
+    for (d = 0; d < DATABASES_SIZE; d++) {
+        uint32_t spp = databases[d].spp;
+        wsp_archive_t archive = { .spp = spp, .count = 86400 / spp };
+        wsp_time_t t;
+
+        snprintf(name, sizeof(name), "%u.wsp", d);
+        check_tmp_path(dir, name, paths[d]);
+        path_list[d] = paths[d];
+
+        check_create(paths[d], &archive, 1, databases[d].aggregation, 0.5);
+
+        // well within the fetched range, with gaps, and negative values.
+        points_count[d] = 0;
+
+        for (t = wsp_time_floor(now - 3000, spp); t < now - 600; t += spp) {
+            if ((t / spp) % 4 == 1) {
+                continue;
+            }
+
+            ck_assert(points_count[d] < MAX_POINTS);
+
+            points[d][points_count[d]].timestamp = t;
+            points[d][points_count[d]].value = (double)((t / spp) % 17) - 8.0;
+            points_count[d]++;
+        }
+
+        check_update_many(paths[d], points[d], points_count[d]);
+    }
+
+    // one database that does not exist, and one that is not a database.
+    check_tmp_path(dir, "missing.wsp", paths[DATABASES_SIZE]);
+    check_tmp_path(dir, "corrupt.wsp", paths[DATABASES_SIZE + 1]);
+
+    FILE *file = fopen(paths[DATABASES_SIZE + 1], "w");
+    ck_assert(file != NULL);
+    fputs("not a database", file);
+    fclose(file);
+
+    path_list[DATABASES_SIZE] = paths[DATABASES_SIZE];
+    path_list[DATABASES_SIZE + 1] = paths[DATABASES_SIZE + 1];
+}
+
+void teardown_dir() {
+    check_tmp_clean(dir);
+}
+
+/*
+ * Consolidate the points written to a database on the time axis of a fetch.
+ */
+void consolidate(uint32_t d, wsp_fetch_t *f, double *row) {
+    uint32_t known[MAX_POINTS];
+    double sum[MAX_POINTS], min[MAX_POINTS], max[MAX_POINTS], last[MAX_POINTS];
+    uint32_t i, c;
+
+    ck_assert(f->points_count <= MAX_POINTS);
+
+    memset(known, 0, sizeof(known));
+    memset(sum, 0, sizeof(sum));
+
+    for (i = 0; i < points_count[d]; i++) {
+        wsp_point_t *p = points[d] + i;
+
+        c = (p->timestamp - f->from) / f->step;
+        ck_assert(p->timestamp >= f->from && c < f->points_count);
+
+        min[c] = known[c] == 0 || p->value < min[c] ? p->value : min[c];
+        max[c] = known[c] == 0 || p->value > max[c] ? p->value : max[c];
+        sum[c] += p->value;
+        last[c] = p->value;
+        known[c]++;
+    }
+
+    for (c = 0; c < f->points_count; c++) {
+        if (known[c] == 0) {
+            row[c] = NAN;
+            continue;
+        }
+
+        switch (databases[d].aggregation) {
+        case WSP_SUM:
+            row[c] = sum[c];
+            break;
+        case WSP_LAST:
+            row[c] = last[c];
+            break;
+        case WSP_MAX:
+            row[c] = max[c];
+            break;
+        case WSP_MIN:
+            row[c] = min[c];
+            break;
+        default:
+            row[c] = sum[c] / known[c];
+            break;
+        }
+    }
+}
+
+int same_double(double a, double b) {
+    return (isnan(a) && isnan(b)) || a == b;
+}
+
+START_TEST(test_mixed_steps)
+{
+    wsp_fetch_t f;
+    wsp_error_t e;
+    double expected[MAX_POINTS];
+    uint32_t d, c;
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_fetch_many(&f, path_list, DATABASES_SIZE, now - 3600, now, 3, &e), WSP_OK);
+
+    ck_assert_uint_eq(f.series_count, DATABASES_SIZE);
+    ck_assert_uint_eq(f.failed, 0);
+
+    // the least common multiple of all steps, aligned to it.
+    ck_assert_uint_eq(f.step, 360);
+    ck_assert_uint_eq(f.from % 360, 0);
+    ck_assert(f.from >= now - 3600 - 360);
+    ck_assert(f.from + f.points_count * f.step <= now + 360);
+
+    for (d = 0; d < DATABASES_SIZE; d++) {
+        double *row = f.values + d * f.points_count;
+        uint32_t known = 0;
+
+        consolidate(d, &f, expected);
+
+        for (c = 0; c < f.points_count; c++) {
+            ck_assert_msg(same_double(row[c], expected[c]),
+                "database %u, column %u: %f != %f", d, c, row[c], expected[c]);
+
+            known += !isnan(row[c]);
+        }
+
+        ck_assert(known > 0);
+    }
+
+    wsp_fetch_free(&f);
+    ck_assert(f.values == NULL);
+}
+END_TEST
+
+START_TEST(test_same_step)
+{
+    wsp_fetch_t f;
+    wsp_error_t e;
+    double expected[MAX_POINTS];
+    uint32_t c;
+
+    WSP_ERROR_INIT(&e);
+
+    // a single series is put on the axis as is.
+    ck_assert_int_eq(wsp_fetch_many(&f, path_list, 1, now - 3600, now, 1, &e), WSP_OK);
+
+    ck_assert_uint_eq(f.step, 60);
+
+    consolidate(0, &f, expected);
+
+    for (c = 0; c < f.points_count; c++) {
+        ck_assert(same_double(f.values[c], expected[c]));
+    }
+
+    wsp_fetch_free(&f);
+}
+END_TEST
+
+START_TEST(test_failed)
+{
+    wsp_fetch_t f;
+    wsp_error_t e;
+    uint32_t d, c;
+
+    WSP_ERROR_INIT(&e);
+
+    // the databases that can not be read do not fail the fetch.
+    ck_assert_int_eq(wsp_fetch_many(&f, path_list, DATABASES_SIZE + 2, now - 3600, now, 4, &e), WSP_OK);
+
+    ck_assert_uint_eq(f.series_count, DATABASES_SIZE + 2);
+    ck_assert_uint_eq(f.failed, 2);
+    ck_assert_int_ne(f.error.type, WSP_ERROR_NONE);
+    ck_assert_uint_eq(f.step, 360);
+
+    for (d = DATABASES_SIZE; d < DATABASES_SIZE + 2; d++) {
+        for (c = 0; c < f.points_count; c++) {
+            ck_assert(isnan(f.values[d * f.points_count + c]));
+        }
+    }
+
+    wsp_fetch_free(&f);
+
+    // nothing could be read, the time axis is empty.
+    ck_assert_int_eq(wsp_fetch_many(&f, path_list + DATABASES_SIZE, 2, now - 3600, now, 2, &e), WSP_OK);
+
+    ck_assert_uint_eq(f.failed, 2);
+    ck_assert_uint_eq(f.step, 0);
+    ck_assert_uint_eq(f.points_count, 0);
+    ck_assert(f.values == NULL);
+
+    wsp_fetch_free(&f);
+}
+END_TEST
+
+START_TEST(test_no_data)
+{
+    wsp_fetch_t f;
+    wsp_error_t e;
+    uint32_t d;
+
+    WSP_ERROR_INIT(&e);
+
+    // before the retention of every database.
+    ck_assert_int_eq(wsp_fetch_many(&f, path_list, DATABASES_SIZE, now - 200000, now - 100000, 2, &e), WSP_OK);
+
+    ck_assert_uint_eq(f.failed, 0);
+    ck_assert_uint_eq(f.points_count, 0);
+
+    wsp_fetch_free(&f);
+
+    // a range with no known points still has a time axis.
+    ck_assert_int_eq(wsp_fetch_many(&f, path_list, DATABASES_SIZE, now - 86000, now - 80000, 2, &e), WSP_OK);
+
+    ck_assert_uint_eq(f.step, 360);
+    ck_assert(f.points_count > 0);
+
+    for (d = 0; d < DATABASES_SIZE * f.points_count; d++) {
+        ck_assert(isnan(f.values[d]));
+    }
+
+    wsp_fetch_free(&f);
+}
+END_TEST
+
+START_TEST(test_invalid)
+{
+    wsp_fetch_t f;
+    wsp_error_t e;
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_fetch_many(&f, path_list, DATABASES_SIZE, now, now - 1, 2, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_TIME_INTERVAL);
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_fetch_many(&f, path_list, DATABASES_SIZE, now - 3600, now, 0, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_INVALID);
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_fetch_many");
+
+    TCase *tc = tcase_create("fetch_many");
+
+    tcase_add_checked_fixture(tc, setup_dir, teardown_dir);
+    tcase_add_test(tc, test_mixed_steps);
+    tcase_add_test(tc, test_same_step);
+    tcase_add_test(tc, test_failed);
+    tcase_add_test(tc, test_no_data);
+    tcase_add_test(tc, test_invalid);
+
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,219 @@
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "../src/wsp.h"
+#include "../src/wsp_flush.h"
+
+#define PATHS_COUNT 12
+#define ROUNDS 8
+
+char dir[CHECK_TMP_SIZE];
+char paths[PATHS_COUNT][CHECK_TMP_SIZE];
+char path_missing[CHECK_TMP_SIZE];
+
+wsp_archive_t archives[] = {
+    { .spp = 1, .count = 60 },
+    { .spp = 60, .count = 120 }
+};
+
+/*
+ * Syncs made by the workers, replacing the ones of the C library.
+ */
+uint64_t sync_count;
+
+int fdatasync(int fd) {
+    __atomic_add_fetch(&sync_count, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int msync(void *addr, size_t length, int flags) {
+    __atomic_add_fetch(&sync_count, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void setup_dir() {
+    char name[32];
+    uint32_t i;
+
+    check_tmp_dir(dir);
+
+    for (i = 0; i < PATHS_COUNT; i++) {
+        snprintf(name, sizeof(name), "%u.wsp", i);
+        check_tmp_path(dir, name, paths[i]);
+        check_create(paths[i], archives, 2, WSP_LAST, 0.0);
+    }
+
+    check_tmp_path(dir, "missing.wsp", path_missing);
+
+    sync_count = 0;
+}
+
+void teardown_dir() {
+    check_tmp_clean(dir);
+}
+
+/*
+ * Hand over points to the engine, with copies of the path and points it
+ * takes ownership of.
+ */
+void submit(wsp_flush_t *f, const char *path, wsp_point_t *points, uint32_t count) {
+    wsp_error_t e;
+    char *p = strdup(path);
+    wsp_point_t *copy = malloc(sizeof(wsp_point_t) * count);
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert(p != NULL);
+    ck_assert(copy != NULL);
+
+    memcpy(copy, points, sizeof(wsp_point_t) * count);
+    ck_assert_int_eq(wsp_flush_submit(f, p, copy, count, &e), WSP_OK);
+}
+
+/*
+ * Wait up to five seconds for a counter updated by a worker to become
+ * non-zero, returns its value.
+ */
+uint64_t wait_for(uint64_t *counter) {
+    struct timespec delay = { .tv_sec = 0, .tv_nsec = 1000000 };
+    uint64_t value = 0;
+    int i;
+
+    for (i = 0; i < 5000; i++) {
+        value = __atomic_load_n(counter, __ATOMIC_ACQUIRE);
+
+        if (value != 0) {
+            break;
+        }
+
+        nanosleep(&delay, NULL);
+    }
+
+    return value;
+}
+
+START_TEST(test_stop)
+{
+    wsp_flush_t f;
+    wsp_error_t e;
+    wsp_t w;
+    wsp_point_t points[2], loaded[60];
+    wsp_time_t now = wsp_time_now();
+    uint32_t size, r, i;
+
+    WSP_ERROR_INIT(&e);
+
+    // small queues, so that submitting waits for the workers.
+    ck_assert_int_eq(wsp_flush_start(&f, 3, 4, WSP_PREAD, &e), WSP_OK);
+
+    for (r = 0; r < ROUNDS; r++) {
+        for (i = 0; i < PATHS_COUNT; i++) {
+            points[0].timestamp = now - r * 2;
+            points[0].value = (double)(i * 100 + r * 2);
+            points[1].timestamp = now - r * 2 - 1;
+            points[1].value = (double)(i * 100 + r * 2 + 1);
+
+            submit(&f, paths[i], points, 2);
+        }
+    }
+
+    // everything queued is written before the workers stop.
+    ck_assert_int_eq(wsp_flush_stop(&f, &e), WSP_OK);
+    ck_assert(f.shards == NULL);
+
+    for (i = 0; i < PATHS_COUNT; i++) {
+        check_open(&w, paths[i]);
+
+        ck_assert_int_eq(wsp_load_time_points(&w, w.archives, now - ROUNDS * 2 + 1, now + 1, loaded, &size, &e), WSP_OK);
+        ck_assert_uint_eq(size, ROUNDS * 2);
+
+        for (r = 0; r < ROUNDS * 2; r++) {
+            ck_assert_uint_eq(loaded[size - 1 - r].timestamp, now - r);
+            ck_assert(loaded[size - 1 - r].value == (double)(i * 100 + r));
+        }
+
+        check_close(&w);
+    }
+}
+END_TEST
+
+START_TEST(test_failed)
+{
+    wsp_flush_t f;
+    wsp_error_t e;
+    wsp_point_t p = { .timestamp = wsp_time_now(), .value = 1.0 };
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_flush_start(&f, 1, 4, WSP_PREAD, &e), WSP_OK);
+
+    submit(&f, path_missing, &p, 1);
+    submit(&f, paths[0], &p, 1);
+
+    // the job of a missing database fails, the next one is still written.
+    ck_assert_uint_eq(wait_for(&f.shards[0].written), 1);
+    ck_assert_uint_eq(__atomic_load_n(&f.shards[0].failed, __ATOMIC_ACQUIRE), 1);
+
+    ck_assert_int_eq(wsp_flush_stop(&f, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_IO);
+    ck_assert_int_eq(e.syserr, ENOENT);
+}
+END_TEST
+
+START_TEST(test_idle_sync)
+{
+    wsp_flush_t f;
+    wsp_error_t e;
+    wsp_t w;
+    wsp_point_t p = { .timestamp = wsp_time_now(), .value = 1.0 };
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_flush_start(&f, 1, 4, WSP_PREAD, &e), WSP_OK);
+    ck_assert_int_eq(wsp_flush_sync_policy(&f, 100, 0, &e), WSP_OK);
+
+    submit(&f, paths[0], &p, 1);
+
+    // nothing else is submitted, the worker syncs once the interval expires.
+    ck_assert_uint_eq(wait_for(&f.shards[0].written), 1);
+
+    ck_assert_uint_eq(wait_for(&sync_count), 1);
+
+    // nothing is left to sync when the database is closed.
+    ck_assert_int_eq(wsp_flush_stop(&f, &e), WSP_OK);
+    ck_assert_uint_eq(sync_count, 1);
+
+    check_open(&w, paths[0]);
+    ck_assert_int_eq(wsp_load_point(&w, w.archives, 0, &p, &e), WSP_OK);
+    ck_assert(p.value == 1.0);
+    check_close(&w);
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_flush");
+
+    TCase *tc = tcase_create("flush");
+
+    tcase_add_checked_fixture(tc, setup_dir, teardown_dir);
+    tcase_add_test(tc, test_stop);
+    tcase_add_test(tc, test_failed);
+    tcase_add_test(tc, test_idle_sync);
+
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}
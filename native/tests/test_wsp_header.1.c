@@ -0,0 +1,240 @@
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+
+#include "../src/wsp.h"
+#include "../src/wsp_header.h"
+
+char dir[CHECK_TMP_SIZE];
+char path_a[CHECK_TMP_SIZE];
+char path_b[CHECK_TMP_SIZE];
+
+wsp_archive_t archives[] = {
+    { .spp = 1, .count = 60 },
+    { .spp = 60, .count = 120 }
+};
+
+void setup_dir() {
+    check_tmp_dir(dir);
+    check_tmp_path(dir, "a.wsp", path_a);
+    check_tmp_path(dir, "b.wsp", path_b);
+
+    check_create(path_a, archives, 2, WSP_AVERAGE, 0.5);
+    check_create(path_b, archives, 2, WSP_AVERAGE, 0.5);
+}
+
+void teardown_dir() {
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    wsp_header_cache_disable(&e);
+    check_tmp_clean(dir);
+}
+
+void enable(uint32_t size) {
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_header_cache_enable(size, &e), WSP_OK);
+}
+
+/*
+ * Rewrite the xFilesFactor of a database in place. If keep_mtime is set, the
+ * modification time is restored, so that the change can not be noticed.
+ */
+void set_xff(const char *path, float xff, int keep_mtime) {
+    struct stat st;
+    uint32_t raw;
+
+    ck_assert_int_eq(stat(path, &st), 0);
+
+    memcpy(&raw, &xff, sizeof(raw));
+    raw = htonl(raw);
+
+    int fd = open(path, O_WRONLY);
+    ck_assert(fd != -1);
+    ck_assert_int_eq(pwrite(fd, &raw, sizeof(raw), 8), sizeof(raw));
+    ck_assert_int_eq(close(fd), 0);
+
+    if (keep_mtime) {
+        struct timespec times[2] = { st.st_atim, st.st_mtim };
+        ck_assert_int_eq(utimensat(AT_FDCWD, path, times, 0), 0);
+    }
+}
+
+/*
+ * The xFilesFactor of a database as seen through the cache.
+ */
+float xff_of(const char *path) {
+    wsp_t w;
+
+    check_open(&w, path);
+    ck_assert(w.header != NULL);
+
+    float xff = w.meta.x_files_factor;
+
+    check_close(&w);
+    return xff;
+}
+
+START_TEST(test_shared)
+{
+    wsp_t a, b;
+
+    enable(16);
+
+    check_open(&a, path_a);
+    check_open(&b, path_a);
+
+    ck_assert(a.header != NULL);
+    ck_assert_ptr_eq(a.header, b.header);
+    ck_assert_ptr_eq(a.archives, b.archives);
+    ck_assert_uint_eq(a.header->refs, 2);
+    ck_assert_uint_eq(a.archives_count, 2);
+    ck_assert_uint_eq(a.archives[1].spp, 60);
+
+    wsp_header_t *h = a.header;
+
+    check_close(&a);
+
+    ck_assert(a.header == NULL);
+    ck_assert(a.archives == NULL);
+    ck_assert_uint_eq(h->refs, 1);
+
+    // the other handle still uses it.
+    ck_assert_uint_eq(b.archives[1].count, 120);
+
+    check_close(&b);
+
+    // kept for the next open.
+    check_open(&a, path_a);
+    ck_assert_ptr_eq(a.header, h);
+    ck_assert_uint_eq(h->refs, 1);
+    check_close(&a);
+}
+END_TEST
+
+START_TEST(test_rewritten)
+{
+    enable(16);
+
+    ck_assert(xff_of(path_a) == 0.5);
+
+    // a change that keeps the size and modification time is not noticed.
+    set_xff(path_a, 0.25, 1);
+    ck_assert(xff_of(path_a) == 0.5);
+
+    // any other is.
+    set_xff(path_a, 0.75, 0);
+    ck_assert(xff_of(path_a) == 0.75);
+
+    wsp_archive_t more[] = {
+        { .spp = 1, .count = 120 },
+        { .spp = 60, .count = 120 }
+    };
+    wsp_t w;
+
+    // as is a file replaced by another.
+    unlink(path_a);
+    check_create(path_a, more, 2, WSP_AVERAGE, 0.5);
+
+    check_open(&w, path_a);
+    ck_assert_uint_eq(w.archives[0].count, 120);
+    ck_assert(w.meta.x_files_factor == 0.5);
+    check_close(&w);
+}
+END_TEST
+
+START_TEST(test_evict)
+{
+    enable(1);
+
+    ck_assert(xff_of(path_a) == 0.5);
+    set_xff(path_a, 0.25, 1);
+
+    // still cached.
+    ck_assert(xff_of(path_a) == 0.5);
+
+    // evicted by the header of another file, and read again.
+    ck_assert(xff_of(path_b) == 0.5);
+    ck_assert(xff_of(path_a) == 0.25);
+
+    // two fit.
+    enable(2);
+
+    set_xff(path_a, 0.75, 1);
+    ck_assert(xff_of(path_b) == 0.5);
+    ck_assert(xff_of(path_a) == 0.25);
+
+    // shrinking the cache evicts the least recently used.
+    set_xff(path_b, 0.75, 1);
+    enable(1);
+
+    ck_assert(xff_of(path_a) == 0.25);
+    ck_assert(xff_of(path_b) == 0.75);
+}
+END_TEST
+
+START_TEST(test_disable_open)
+{
+    wsp_t w, other;
+    wsp_error_t e;
+
+    WSP_ERROR_INIT(&e);
+
+    enable(16);
+
+    check_open(&w, path_a);
+    ck_assert(w.header != NULL);
+
+    ck_assert_int_eq(wsp_header_cache_disable(&e), WSP_OK);
+
+    // the open handle keeps its header until it is closed.
+    ck_assert_uint_eq(w.header->refs, 1);
+    ck_assert_uint_eq(w.archives[1].spp, 60);
+
+    // new handles read their own.
+    check_open(&other, path_a);
+    ck_assert(other.header == NULL);
+    ck_assert(other.archives != w.archives);
+    check_close(&other);
+
+    check_close(&w);
+    ck_assert(w.header == NULL);
+
+    // the header was released, not kept in the cache.
+    set_xff(path_a, 0.25, 1);
+    enable(16);
+
+    ck_assert(xff_of(path_a) == 0.25);
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_header");
+
+    TCase *tc = tcase_create("header");
+
+    tcase_add_checked_fixture(tc, setup_dir, teardown_dir);
+    tcase_add_test(tc, test_shared);
+    tcase_add_test(tc, test_rewritten);
+    tcase_add_test(tc, test_evict);
+    tcase_add_test(tc, test_disable_open);
+
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}
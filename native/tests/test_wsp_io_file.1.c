@@ -34,8 +34,9 @@ START_TEST(test_failed_malloc)
 {
     testcase = 1;
     wsp_error_t e;
+    void *buf = NULL;
 
-    int ret = wsp_io_file.read(NULL, 0, 0, NULL, &e);
+    int ret = wsp_io_file.read(NULL, 0, 0, &buf, &e);
 
     ck_assert_int_eq(ret, WSP_ERROR);
     ck_assert_int_eq(e.type, WSP_ERROR_MALLOC);
@@ -52,7 +53,9 @@ START_TEST(test_failed_ftell)
         .io_fd = ref_fd
     };
 
-    int ret = wsp_io_file.read(&w, ref_offset, ref_size, NULL, &e);
+    void *buf = NULL;
+
+    int ret = wsp_io_file.read(&w, ref_offset, ref_size, &buf, &e);
 
     ck_assert_int_eq(ret, WSP_ERROR);
     ck_assert_int_eq(e.type, WSP_ERROR_OFFSET);
@@ -0,0 +1,158 @@
+// preadv and pwritev, declared by the system headers included first
+#define _DEFAULT_SOURCE
+
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../src/wsp_io_pread.h"
+
+int testcase = 0;
+
+int ref_fileno = 42;
+long ref_offset = 100;
+size_t ref_size = 24;
+char malloc_b2[24];
+
+int malloc_called;
+int pread_called;
+int free_called;
+
+void setup_calls() {
+    malloc_called = 0;
+    pread_called = 0;
+    free_called = 0;
+}
+
+void teardown_calls() {
+    ck_assert_int_eq(malloc_called, 0);
+    ck_assert_int_eq(pread_called, 0);
+    ck_assert_int_eq(free_called, 0);
+}
+
+START_TEST(test_short_reads)
+{
+    testcase = 1;
+    wsp_error_t e;
+    wsp_t w = {
+        .io_fileno = ref_fileno
+    };
+
+    char buf[24];
+    void *rbuf = buf;
+
+    int ret = wsp_io_pread.read(&w, ref_offset, ref_size, &rbuf, &e);
+
+    ck_assert_int_eq(ret, WSP_OK);
+    ck_assert(rbuf == buf);
+    ck_assert_int_eq(buf[0], 1);
+    ck_assert_int_eq(buf[23], 2);
+
+    pread_called -= 2;
+}
+END_TEST
+
+START_TEST(test_failed_eof)
+{
+    testcase = 2;
+    wsp_error_t e;
+    wsp_t w = {
+        .io_fileno = ref_fileno
+    };
+
+    void *rbuf = NULL;
+
+    int ret = wsp_io_pread.read(&w, ref_offset, ref_size, &rbuf, &e);
+
+    ck_assert_int_eq(ret, WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_OFFSET);
+    ck_assert(rbuf == NULL);
+
+    malloc_called -= 1;
+    pread_called -= 1;
+    free_called -= 1;
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_io_pread");
+
+    TCase *pread_read = tcase_create("pread read");
+
+    tcase_add_checked_fixture(pread_read, setup_calls, teardown_calls);
+    tcase_add_test(pread_read, test_short_reads);
+    tcase_add_test(pread_read, test_failed_eof);
+
+    suite_add_tcase(s, pread_read);
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}
+
+void *__malloc(size_t size) {
+    malloc_called += 1;
+
+    if (testcase == 2) {
+        ck_assert(size == ref_size);
+        return malloc_b2;
+    }
+
+    ck_abort();
+    return NULL;
+}
+
+ssize_t __pread(int fd, void *buf, size_t size, off_t offset) {
+    pread_called += 1;
+    ck_assert(fd == ref_fileno);
+
+    if (testcase == 1) {
+        // first call returns half of the data.
+        if (pread_called == 1) {
+            ck_assert(offset == ref_offset);
+            ck_assert(size == ref_size);
+            ((char *)buf)[0] = 1;
+            return ref_size / 2;
+        }
+
+        ck_assert(offset == ref_offset + (long)ref_size / 2);
+        ck_assert(size == ref_size / 2);
+        ((char *)buf)[size - 1] = 2;
+        return size;
+    }
+
+    if (testcase == 2) {
+        ck_assert(buf == malloc_b2);
+        return 0;
+    }
+
+    ck_abort();
+    return -1;
+}
+
+void __free(void *buffer) {
+    free_called += 1;
+
+    if (testcase == 2) {
+        ck_assert(buffer == malloc_b2);
+        return;
+    }
+
+    ck_abort();
+}
+
+#define malloc(s) __malloc(s)
+#define pread(f, b, s, o) __pread(f, b, s, o)
+#define free(s) __free(s)
+#include "../src/wsp_io_pread.c"
+#undef malloc
+#undef pread
+#undef free
@@ -0,0 +1,359 @@
+#define _GNU_SOURCE
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/syscall.h>
+
+#include "../src/wsp.h"
+#include "../src/wsp_io_uring.h"
+#include "../src/wsp_private.h"
+
+char dir[CHECK_TMP_SIZE];
+char path[CHECK_TMP_SIZE];
+
+wsp_archive_t archives[] = {
+    { .spp = 1, .count = 60 },
+    { .spp = 60, .count = 120 }
+};
+
+/*
+ * errno of io_uring_enter calls submitting operations, 0 to let them through.
+ */
+int enter_error = 0;
+
+/*
+ * Wraps the system calls of the ring, so that submitting can be made to fail
+ * while waiting for operations in flight still works.
+ */
+long syscall(long number, ...) {
+    static long (*next)(long, ...) = NULL;
+    long a[6];
+    va_list ap;
+    int i;
+
+    va_start(ap, number);
+
+    for (i = 0; i < 6; i++) {
+        a[i] = va_arg(ap, long);
+    }
+
+    va_end(ap);
+
+    if (number == __NR_io_uring_enter && enter_error != 0 && a[1] > 0) {
+        errno = enter_error;
+        return -1;
+    }
+
+    if (next == NULL) {
+        // the usual POSIX idiom, ISO C has no conversion to a function pointer.
+        *(void **)&next = dlsym(RTLD_NEXT, "syscall");
+    }
+
+    return next(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+void setup_file() {
+    check_tmp_dir(dir);
+    check_tmp_path(dir, "test.wsp", path);
+    check_create(path, archives, 2, WSP_AVERAGE, 0.0);
+    enter_error = 0;
+}
+
+void teardown_file() {
+    check_tmp_clean(dir);
+}
+
+/*
+ * Set up a ring and open the database with it, returns 0 if io_uring is not
+ * available.
+ */
+int open_ring(wsp_t *w, wsp_uring_t *ring, uint32_t entries) {
+    wsp_error_t e;
+
+    WSP_ERROR_INIT(&e);
+
+    if (wsp_uring_init(ring, entries, &e) == WSP_ERROR) {
+        // not supported by the kernel, or not allowed.
+        ck_assert(e.syserr == ENOSYS || e.syserr == EPERM);
+        return 0;
+    }
+
+    ck_assert_uint_eq(ring->entries, entries);
+
+    WSP_INIT(w);
+    w->io_uring = ring;
+
+    ck_assert_int_eq(wsp_open(w, path, WSP_URING, &e), WSP_OK);
+    return 1;
+}
+
+/*
+ * Flags of the operation queued last.
+ */
+uint8_t last_flags(wsp_uring_t *ring) {
+    return ring->sqes[(*ring->sq_tail - 1) & *ring->sq_mask].flags;
+}
+
+/*
+ * Read a range of the file, bypassing the ring.
+ */
+void read_file(long offset, size_t size, char *buf) {
+    int fd = open(path, O_RDONLY);
+
+    ck_assert(fd != -1);
+    ck_assert_int_eq(pread(fd, buf, size, offset), size);
+    close(fd);
+}
+
+START_TEST(test_overlap)
+{
+    wsp_uring_t ring;
+    wsp_t w;
+    wsp_error_t e;
+    char a[12], b[12], c[12], buf[18], expected[18];
+
+    WSP_ERROR_INIT(&e);
+
+    if (!open_ring(&w, &ring, 8)) {
+        return;
+    }
+
+    long offset = w.archives[0].offset;
+
+    memset(a, 'a', sizeof(a));
+    memset(b, 'b', sizeof(b));
+    memset(c, 'c', sizeof(c));
+
+    ck_assert_int_eq(w.io->write(&w, offset, sizeof(a), a, &e), WSP_OK);
+    ck_assert(!(last_flags(&ring) & IOSQE_IO_DRAIN));
+
+    // overlaps the queued write, it must not be reordered with it.
+    ck_assert_int_eq(w.io->write(&w, offset + 6, sizeof(b), b, &e), WSP_OK);
+    ck_assert(last_flags(&ring) & IOSQE_IO_DRAIN);
+
+    ck_assert_int_eq(w.io->write(&w, offset + 100, sizeof(c), c, &e), WSP_OK);
+    ck_assert(!(last_flags(&ring) & IOSQE_IO_DRAIN));
+    ck_assert_uint_eq(ring.queued, 3);
+
+    // so does a read of both.
+    void *p = buf;
+
+    ck_assert_int_eq(w.io->read(&w, offset, sizeof(buf), &p, &e), WSP_OK);
+    ck_assert(last_flags(&ring) & IOSQE_IO_DRAIN);
+
+    memset(expected, 'a', 6);
+    memset(expected + 6, 'b', 12);
+    ck_assert(memcmp(buf, expected, sizeof(buf)) == 0);
+
+    ck_assert_int_eq(wsp_uring_wait(&ring, &e), WSP_OK);
+
+    // completed writes are no reason to wait.
+    ck_assert_int_eq(w.io->write(&w, offset, sizeof(c), c, &e), WSP_OK);
+    ck_assert(!(last_flags(&ring) & IOSQE_IO_DRAIN));
+
+    ck_assert_int_eq(wsp_close(&w, &e), WSP_OK);
+    ck_assert_int_eq(wsp_uring_free(&ring, &e), WSP_OK);
+
+    read_file(offset, sizeof(buf), buf);
+    memset(expected, 'c', 12);
+    ck_assert(memcmp(buf, expected, sizeof(buf)) == 0);
+}
+END_TEST
+
+START_TEST(test_slots)
+{
+    wsp_uring_t ring;
+    wsp_t w;
+    wsp_error_t e;
+    char data[12], buf[12];
+    uint32_t i;
+
+    WSP_ERROR_INIT(&e);
+
+    if (!open_ring(&w, &ring, 4)) {
+        return;
+    }
+
+    long offset = w.archives[0].offset;
+
+    for (i = 0; i < 4; i++) {
+        memset(data, 'a' + i, sizeof(data));
+        ck_assert_int_eq(w.io->write(&w, offset + i * 12, sizeof(data), data, &e), WSP_OK);
+    }
+
+    ck_assert(ring.free_slots == NULL);
+    ck_assert_uint_eq(ring.queued, 4);
+
+    // no slot is left, the queued writes are submitted to free one.
+    for (; i < 10; i++) {
+        memset(data, 'a' + i, sizeof(data));
+        ck_assert_int_eq(w.io->write(&w, offset + i * 12, sizeof(data), data, &e), WSP_OK);
+        ck_assert(ring.queued + ring.inflight <= ring.entries);
+    }
+
+    // and so is a read.
+    void *p = buf;
+
+    ck_assert_int_eq(w.io->read(&w, offset + 9 * 12, sizeof(buf), &p, &e), WSP_OK);
+    memset(data, 'a' + 9, sizeof(data));
+    ck_assert(memcmp(buf, data, sizeof(buf)) == 0);
+
+    ck_assert_int_eq(wsp_close(&w, &e), WSP_OK);
+    ck_assert_int_eq(wsp_uring_free(&ring, &e), WSP_OK);
+
+    for (i = 0; i < 10; i++) {
+        read_file(offset + i * 12, sizeof(buf), buf);
+        memset(data, 'a' + i, sizeof(data));
+        ck_assert(memcmp(buf, data, sizeof(buf)) == 0);
+    }
+}
+END_TEST
+
+START_TEST(test_points)
+{
+    wsp_uring_t ring;
+    wsp_t w;
+    wsp_error_t e;
+    wsp_point_t p, loaded[60], expected[60];
+    wsp_time_t now = wsp_time_now();
+    uint32_t i;
+
+    WSP_ERROR_INIT(&e);
+
+    if (!open_ring(&w, &ring, 4)) {
+        return;
+    }
+
+    // far more writes than the ring has entries.
+    for (i = 0; i < 40; i++) {
+        p.timestamp = now - i;
+        p.value = (double)i;
+        ck_assert_int_eq(wsp_update(&w, &p, &e), WSP_OK);
+    }
+
+    ck_assert_int_eq(wsp_uring_wait(&ring, &e), WSP_OK);
+    ck_assert_uint_eq(ring.queued, 0);
+    ck_assert_uint_eq(ring.inflight, 0);
+
+    // read back through the ring.
+    ck_assert_int_eq(wsp_load_points(&w, w.archives, 0, 60, loaded, &e), WSP_OK);
+
+    ck_assert_int_eq(wsp_close(&w, &e), WSP_OK);
+    ck_assert_int_eq(wsp_uring_free(&ring, &e), WSP_OK);
+
+    check_open(&w, path);
+
+    for (i = 0; i < 40; i++) {
+        ck_assert_int_eq(wsp_load_point(&w, w.archives, __wsp_point_mod(-(int)i, 60), &p, &e), WSP_OK);
+        ck_assert_uint_eq(p.timestamp, now - i);
+        ck_assert(p.value == (double)i);
+    }
+
+    ck_assert_int_eq(wsp_load_points(&w, w.archives, 0, 60, expected, &e), WSP_OK);
+
+    for (i = 0; i < 60; i++) {
+        ck_assert_uint_eq(loaded[i].timestamp, expected[i].timestamp);
+        ck_assert(memcmp(&loaded[i].value, &expected[i].value, sizeof(double)) == 0);
+    }
+
+    check_close(&w);
+}
+END_TEST
+
+START_TEST(test_failed)
+{
+    wsp_uring_t ring;
+    wsp_t w;
+    wsp_error_t e;
+    char data[12], buf[12], empty[12];
+
+    WSP_ERROR_INIT(&e);
+
+    if (!open_ring(&w, &ring, 8)) {
+        return;
+    }
+
+    long offset = w.archives[0].offset;
+
+    memset(data, 'a', sizeof(data));
+    memset(empty, 0, sizeof(empty));
+
+    ck_assert_int_eq(w.io->write(&w, offset, sizeof(data), data, &e), WSP_OK);
+    ck_assert_int_eq(wsp_uring_submit(&ring, &e), WSP_OK);
+
+    ck_assert_int_eq(w.io->write(&w, offset + 12, sizeof(data), data, &e), WSP_OK);
+    ck_assert_uint_eq(ring.queued, 1);
+
+    // submitting the read fails, what is in flight is waited for while the
+    // queued write and the read are never submitted.
+    enter_error = EIO;
+
+    void *p = buf;
+
+    memset(buf, 'x', sizeof(buf));
+
+    ck_assert_int_eq(w.io->read(&w, offset, sizeof(buf), &p, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_IO);
+    ck_assert_int_eq(e.syserr, EIO);
+    ck_assert_int_eq(ring.failed, EIO);
+    ck_assert_uint_eq(ring.inflight, 0);
+
+    enter_error = 0;
+
+    // the ring stays failed.
+    WSP_ERROR_INIT(&e);
+    ck_assert_int_eq(w.io->write(&w, offset + 24, sizeof(data), data, &e), WSP_ERROR);
+    ck_assert_int_eq(e.syserr, EIO);
+
+    WSP_ERROR_INIT(&e);
+    ck_assert_int_eq(wsp_uring_wait(&ring, &e), WSP_ERROR);
+    ck_assert_int_eq(e.syserr, EIO);
+
+    WSP_ERROR_INIT(&e);
+    ck_assert_int_eq(wsp_close(&w, &e), WSP_ERROR);
+
+    WSP_ERROR_INIT(&e);
+    ck_assert_int_eq(wsp_uring_free(&ring, &e), WSP_ERROR);
+
+    memset(data, 'x', sizeof(data));
+    ck_assert(memcmp(buf, data, sizeof(buf)) == 0);
+
+    memset(data, 'a', sizeof(data));
+    read_file(offset, sizeof(buf), buf);
+    ck_assert(memcmp(buf, data, sizeof(buf)) == 0);
+
+    read_file(offset + 12, sizeof(buf), buf);
+    ck_assert(memcmp(buf, empty, sizeof(buf)) == 0);
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_io_uring");
+
+    TCase *tc = tcase_create("io_uring");
+
+    tcase_add_checked_fixture(tc, setup_file, teardown_file);
+    tcase_add_test(tc, test_overlap);
+    tcase_add_test(tc, test_slots);
+    tcase_add_test(tc, test_points);
+    tcase_add_test(tc, test_failed);
+
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,315 @@
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/wsp.h"
+#include "../src/wsp_private.h"
+#include "../src/wsp_merge.h"
+
+char dir[CHECK_TMP_SIZE];
+char path_from[CHECK_TMP_SIZE];
+char path_to[CHECK_TMP_SIZE];
+
+wsp_archive_t archives[] = {
+    { .spp = 1, .count = 60 },
+    { .spp = 60, .count = 120 }
+};
+
+/*
+ * Differences received from wsp_diff.
+ */
+#define DIFFS_SIZE 16
+
+typedef struct {
+    uint32_t archive;
+    wsp_time_t timestamp;
+    double from;
+    double to;
+} diff_t;
+
+diff_t diffs[DIFFS_SIZE];
+uint32_t diffs_count;
+// number of differences to accept before failing.
+uint32_t diffs_limit;
+
+wsp_return_t collect_diff(void *data, uint32_t archive, wsp_time_t timestamp, double from, double to, wsp_error_t *e) {
+    (void)data;
+
+    if (diffs_count == diffs_limit) {
+        e->type = WSP_ERROR_INVALID;
+        return WSP_ERROR;
+    }
+
+    ck_assert(diffs_count < DIFFS_SIZE);
+
+    diffs[diffs_count].archive = archive;
+    diffs[diffs_count].timestamp = timestamp;
+    diffs[diffs_count].from = from;
+    diffs[diffs_count].to = to;
+    diffs_count++;
+
+    return WSP_OK;
+}
+
+void setup_dir() {
+    check_tmp_dir(dir);
+    check_tmp_path(dir, "from.wsp", path_from);
+    check_tmp_path(dir, "to.wsp", path_to);
+
+    diffs_count = 0;
+    diffs_limit = DIFFS_SIZE;
+}
+
+void teardown_dir() {
+    check_tmp_clean(dir);
+}
+
+uint64_t merge() {
+    wsp_error_t e;
+    uint64_t merged = 0;
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_merge(path_from, path_to, &merged, &e), WSP_OK);
+    return merged;
+}
+
+void diff(int ignore_empty) {
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    diffs_count = 0;
+    ck_assert_int_eq(wsp_diff(path_from, path_to, ignore_empty, collect_diff, NULL, &e), WSP_OK);
+}
+
+START_TEST(test_merge)
+{
+    wsp_point_t from_points[11];
+    uint32_t i;
+
+    check_create(path_from, archives, 2, WSP_LAST, 0.0);
+    check_create(path_to, archives, 2, WSP_LAST, 0.0);
+
+    wsp_time_t now = wsp_time_now();
+    wsp_time_t old = wsp_time_floor(now, 60) - 3000;
+
+    for (i = 0; i < 10; i++) {
+        from_points[i].timestamp = now - 10 + i;
+        from_points[i].value = i + 1;
+    }
+
+    // only in the second archive.
+    from_points[10].timestamp = old;
+    from_points[10].value = 7.0;
+
+    wsp_point_t to_points[] = {
+        { .timestamp = now - 20, .value = 50.0 },
+        { .timestamp = now - 5, .value = 100.0 }
+    };
+
+    check_update_many(path_from, from_points, 11);
+    check_update_many(path_to, to_points, 2);
+
+    // the 10 seconds and the old minute, the minutes propagated from the
+    // seconds are already the same.
+    ck_assert_uint_eq(merge(), 11);
+
+    check_fetch_file(path_to, now - 30, now, now);
+
+    ck_assert_uint_eq(check_series.step, 1);
+
+    for (i = 0; i < check_series.count; i++) {
+        wsp_time_t t = check_series.start + i;
+
+        if (t == now - 20) {
+            // points only the destination knows are kept.
+            ck_assert(check_is_valid(i));
+            ck_assert(check_series.values[i] == 50.0);
+        }
+        else if (t >= now - 10 && t < now) {
+            ck_assert(check_is_valid(i));
+            ck_assert(check_series.values[i] == t - (now - 11));
+        }
+        else {
+            ck_assert(!check_is_valid(i));
+        }
+    }
+
+    check_fetch_file(path_to, old - 60, old, now);
+
+    ck_assert_uint_eq(check_series.step, 60);
+    ck_assert_uint_eq(check_series.count, 1);
+    ck_assert(check_is_valid(0));
+    ck_assert(check_series.values[0] == 7.0);
+
+    // nothing left to merge.
+    ck_assert_uint_eq(merge(), 0);
+}
+END_TEST
+
+START_TEST(test_merge_whole_retention)
+{
+    wsp_t w;
+    wsp_error_t e;
+    wsp_point_t base;
+
+    WSP_ERROR_INIT(&e);
+
+    check_create(path_from, archives, 2, WSP_LAST, 0.0);
+    check_create(path_to, archives, 2, WSP_LAST, 0.0);
+
+    wsp_time_t minute = wsp_time_floor(wsp_time_now(), 60);
+
+    // a minute also covered by the first archive, only known to the second.
+    wsp_point_t p = { .timestamp = minute, .value = 5.0 };
+
+    check_open(&w, path_from);
+    ck_assert_int_eq(__wsp_archive_update_many(&w, w.archives + 1, &p, 1, &e), WSP_OK);
+    check_close(&w);
+
+    // diff stops the second archive where the first one starts.
+    diff(0);
+    ck_assert_uint_eq(diffs_count, 0);
+
+    // merge does not.
+    ck_assert_uint_eq(merge(), 1);
+
+    check_open(&w, path_to);
+    ck_assert_int_eq(wsp_load_point(&w, w.archives + 1, 0, &base, &e), WSP_OK);
+    check_close(&w);
+
+    ck_assert_uint_eq(base.timestamp, minute);
+    ck_assert(base.value == 5.0);
+}
+END_TEST
+
+START_TEST(test_diff)
+{
+    // too few points to propagate.
+    check_create(path_from, archives, 2, WSP_LAST, 0.5);
+    check_create(path_to, archives, 2, WSP_LAST, 0.5);
+
+    wsp_time_t now = wsp_time_now();
+    wsp_time_t old = wsp_time_floor(now, 60) - 3000;
+
+    wsp_point_t from_points[] = {
+        { .timestamp = now - 3, .value = 2.0 },
+        { .timestamp = now - 2, .value = 1.0 },
+        { .timestamp = old, .value = 7.0 }
+    };
+    wsp_point_t to_points[] = {
+        { .timestamp = now - 4, .value = 3.0 },
+        { .timestamp = now - 2, .value = 1.0 },
+        { .timestamp = old, .value = 8.0 }
+    };
+
+    check_update_many(path_from, from_points, 3);
+    check_update_many(path_to, to_points, 3);
+
+    // in the order of archives and time.
+    diff(0);
+
+    ck_assert_uint_eq(diffs_count, 3);
+
+    ck_assert_uint_eq(diffs[0].archive, 0);
+    ck_assert_uint_eq(diffs[0].timestamp, now - 4);
+    ck_assert(isnan(diffs[0].from));
+    ck_assert(diffs[0].to == 3.0);
+
+    ck_assert_uint_eq(diffs[1].archive, 0);
+    ck_assert_uint_eq(diffs[1].timestamp, now - 3);
+    ck_assert(diffs[1].from == 2.0);
+    ck_assert(isnan(diffs[1].to));
+
+    ck_assert_uint_eq(diffs[2].archive, 1);
+    ck_assert_uint_eq(diffs[2].timestamp, old);
+    ck_assert(diffs[2].from == 7.0);
+    ck_assert(diffs[2].to == 8.0);
+
+    // only the points known on both sides.
+    diff(1);
+
+    ck_assert_uint_eq(diffs_count, 1);
+    ck_assert_uint_eq(diffs[0].timestamp, old);
+}
+END_TEST
+
+START_TEST(test_diff_callback_error)
+{
+    wsp_error_t e;
+
+    WSP_ERROR_INIT(&e);
+
+    check_create(path_from, archives, 2, WSP_LAST, 0.5);
+    check_create(path_to, archives, 2, WSP_LAST, 0.5);
+
+    wsp_time_t now = wsp_time_now();
+
+    wsp_point_t points[] = {
+        { .timestamp = now - 3, .value = 1.0 },
+        { .timestamp = now - 2, .value = 2.0 }
+    };
+
+    check_update_many(path_from, points, 2);
+
+    // the error of the callback stops the diff.
+    diffs_limit = 1;
+
+    ck_assert_int_eq(wsp_diff(path_from, path_to, 0, collect_diff, NULL, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_INVALID);
+    ck_assert_uint_eq(diffs_count, 1);
+}
+END_TEST
+
+START_TEST(test_incompatible)
+{
+    wsp_archive_t other[] = {
+        { .spp = 1, .count = 120 },
+        { .spp = 60, .count = 120 }
+    };
+    wsp_error_t e;
+    uint64_t merged = 0;
+
+    WSP_ERROR_INIT(&e);
+
+    check_create(path_from, archives, 2, WSP_LAST, 0.5);
+    check_create(path_to, other, 2, WSP_LAST, 0.5);
+
+    ck_assert_int_eq(wsp_merge(path_from, path_to, &merged, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_ARCHIVE_CONFIG);
+    ck_assert_uint_eq(merged, 0);
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_diff(path_from, path_to, 0, collect_diff, NULL, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_ARCHIVE_CONFIG);
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_merge");
+
+    TCase *tc = tcase_create("merge");
+
+    tcase_add_checked_fixture(tc, setup_dir, teardown_dir);
+    tcase_add_test(tc, test_merge);
+    tcase_add_test(tc, test_merge_whole_retention);
+    tcase_add_test(tc, test_diff);
+    tcase_add_test(tc, test_diff_callback_error);
+    tcase_add_test(tc, test_incompatible);
+
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}
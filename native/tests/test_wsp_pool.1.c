@@ -0,0 +1,617 @@
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../src/wsp.h"
+#include "../src/wsp_private.h"
+#include "../src/wsp_pool.h"
+#include "../src/wsp_io_uring.h"
+
+char dir[CHECK_TMP_SIZE];
+char path_a[CHECK_TMP_SIZE];
+char path_b[CHECK_TMP_SIZE];
+char path_c[CHECK_TMP_SIZE];
+char path_missing[CHECK_TMP_SIZE];
+
+wsp_archive_t archives[] = {
+    { .spp = 1, .count = 60 },
+    { .spp = 60, .count = 120 }
+};
+
+wsp_pool_t pool;
+
+/*
+ * Syncs made by the databases, replacing the ones of the C library. Setting
+ * sync_fail makes them fail with EIO.
+ */
+int sync_count;
+int sync_fd;
+void *sync_addr;
+size_t sync_length;
+int sync_fail;
+
+int fdatasync(int fd) {
+    if (sync_fail) {
+        errno = EIO;
+        return -1;
+    }
+
+    sync_count++;
+    sync_fd = fd;
+    return 0;
+}
+
+int msync(void *addr, size_t length, int flags) {
+    if (sync_fail) {
+        errno = EIO;
+        return -1;
+    }
+
+    sync_count++;
+    sync_addr = addr;
+    sync_length = length;
+    return 0;
+}
+
+void setup_dir() {
+    check_tmp_dir(dir);
+    check_tmp_path(dir, "a.wsp", path_a);
+    check_tmp_path(dir, "b.wsp", path_b);
+    check_tmp_path(dir, "c.wsp", path_c);
+    check_tmp_path(dir, "missing.wsp", path_missing);
+
+    check_create(path_a, archives, 2, WSP_LAST, 0.5);
+    check_create(path_b, archives, 2, WSP_LAST, 0.5);
+    check_create(path_c, archives, 2, WSP_LAST, 0.5);
+
+    sync_count = 0;
+    sync_fd = -1;
+    sync_addr = NULL;
+    sync_length = 0;
+    sync_fail = 0;
+}
+
+void teardown_dir() {
+    check_tmp_clean(dir);
+}
+
+void setup_pool() {
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    setup_dir();
+    ck_assert_int_eq(wsp_pool_init(&pool, 2, 2, WSP_PREAD, &e), WSP_OK);
+}
+
+void teardown_pool() {
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    if (pool.buckets != NULL) {
+        wsp_pool_free(&pool, &e);
+    }
+
+    teardown_dir();
+}
+
+/*
+ * Check if the pool has an entry for a path.
+ */
+int pooled(const char *path) {
+    uint32_t i;
+
+    for (i = 0; i < pool.buckets_count; i++) {
+        wsp_pool_entry_t *entry;
+
+        for (entry = pool.buckets[i]; entry != NULL; entry = entry->next) {
+            if (strcmp(entry->path, path) == 0) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+wsp_t *acquire(const char *path) {
+    wsp_t *w = NULL;
+    wsp_error_t e;
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_pool_acquire(&pool, path, &w, &e), WSP_OK);
+    ck_assert(w != NULL);
+    return w;
+}
+
+void release(wsp_t *w) {
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_pool_release(&pool, w, &e), WSP_OK);
+}
+
+/*
+ * Write a point of the last minute to an acquired handle.
+ */
+void write_point(wsp_t *w, double value) {
+    wsp_error_t e;
+    wsp_point_t p = { .timestamp = wsp_time_now() - 1, .value = value };
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_update(w, &p, &e), WSP_OK);
+    ck_assert(w->io_dirty_from != w->io_dirty_until);
+}
+
+START_TEST(test_reuse)
+{
+    wsp_t *w = acquire(path_a);
+    int fd = w->io_fileno;
+
+    release(w);
+
+    // the idle handle is handed out again, with the same file open.
+    ck_assert_ptr_eq(acquire(path_a), w);
+    ck_assert_int_eq(w->io_fileno, fd);
+    ck_assert_uint_eq(pool.count, 1);
+
+    release(w);
+}
+END_TEST
+
+START_TEST(test_evict)
+{
+    wsp_error_t e;
+    wsp_t *w;
+
+    WSP_ERROR_INIT(&e);
+
+    release(acquire(path_a));
+    release(acquire(path_b));
+    // a is now the most recently used.
+    release(acquire(path_a));
+
+    release(acquire(path_c));
+
+    ck_assert_uint_eq(pool.count, 2);
+    ck_assert(pooled(path_a));
+    ck_assert(!pooled(path_b));
+    ck_assert(pooled(path_c));
+
+    // with both handles acquired, nothing can be evicted.
+    wsp_t *a = acquire(path_a);
+    wsp_t *c = acquire(path_c);
+
+    ck_assert_int_eq(wsp_pool_acquire(&pool, path_b, &w, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_POOL_FULL);
+    ck_assert_uint_eq(pool.count, 2);
+
+    release(a);
+    release(c);
+}
+END_TEST
+
+START_TEST(test_rename)
+{
+    wsp_archive_t other[] = {
+        { .spp = 1, .count = 120 },
+        { .spp = 60, .count = 120 }
+    };
+    char path_new[CHECK_TMP_SIZE];
+    struct stat st;
+
+    wsp_t *w = acquire(path_a);
+    ck_assert_uint_eq(w->archives[0].count, 60);
+    release(w);
+
+    // replaced the way whisper-resize.py does.
+    check_tmp_path(dir, "a.wsp.tmp", path_new);
+    check_create(path_new, other, 2, WSP_LAST, 0.5);
+    ck_assert_int_eq(rename(path_new, path_a), 0);
+    ck_assert_int_eq(stat(path_a, &st), 0);
+
+    w = acquire(path_a);
+
+    ck_assert_uint_eq(w->archives[0].count, 120);
+    ck_assert_uint_eq(pool.count, 1);
+
+    wsp_pool_entry_t *entry = (wsp_pool_entry_t *)w;
+    ck_assert(entry->ino == st.st_ino);
+
+    release(w);
+}
+END_TEST
+
+START_TEST(test_discard)
+{
+    wsp_t *w = acquire(path_a);
+
+    wsp_pool_discard(&pool, w);
+
+    ck_assert_uint_eq(pool.count, 0);
+    ck_assert(!pooled(path_a));
+    ck_assert(pool.idle_head == NULL);
+
+    // opened again on the next acquire.
+    release(acquire(path_a));
+    ck_assert_uint_eq(pool.count, 1);
+}
+END_TEST
+
+START_TEST(test_missing)
+{
+    wsp_error_t e;
+    wsp_t *w = NULL;
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_pool_acquire(&pool, path_missing, &w, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_IO);
+    ck_assert_int_eq(e.syserr, ENOENT);
+    ck_assert_uint_eq(pool.count, 0);
+    ck_assert(!pooled(path_missing));
+
+    // a pooled database removed since it was released.
+    release(acquire(path_a));
+    ck_assert_int_eq(unlink(path_a), 0);
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_pool_acquire(&pool, path_a, &w, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_IO);
+    ck_assert_uint_eq(pool.count, 0);
+    ck_assert(!pooled(path_a));
+
+    wsp_pool_free(&pool, &e);
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_pool_acquire(&pool, path_b, &w, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_NOT_INITIALIZED);
+}
+END_TEST
+
+START_TEST(test_sync_bytes)
+{
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_pool_sync_policy(&pool, 0, 1 << 20, &e), WSP_OK);
+
+    // below the limit, the handle is left dirty.
+    wsp_t *w = acquire(path_a);
+    write_point(w, 1.0);
+    release(w);
+
+    ck_assert_int_eq(sync_count, 0);
+    ck_assert_ptr_eq(pool.dirty_head, (wsp_pool_entry_t *)w);
+    ck_assert(pool.dirty_bytes == w->io_dirty_bytes);
+    ck_assert(pool.dirty_bytes > 0);
+
+    // reaching it syncs every dirty handle on release.
+    ck_assert_int_eq(wsp_pool_sync_policy(&pool, 0, pool.dirty_bytes + 1, &e), WSP_OK);
+
+    wsp_t *b = acquire(path_b);
+    write_point(b, 2.0);
+    release(b);
+
+    ck_assert_int_eq(sync_count, 2);
+    ck_assert(pool.dirty_head == NULL);
+    ck_assert(pool.dirty_bytes == 0);
+    ck_assert(w->io_dirty_from == w->io_dirty_until);
+    ck_assert(b->io_dirty_from == b->io_dirty_until);
+}
+END_TEST
+
+START_TEST(test_sync_interval)
+{
+    wsp_error_t e;
+    int64_t timeout = 0;
+    struct timespec pause = { .tv_sec = 0, .tv_nsec = 20000000 };
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_pool_sync_policy(&pool, 60000, 0, &e), WSP_OK);
+
+    // nothing to sync.
+    ck_assert_int_eq(wsp_pool_sync_timeout(&pool, &timeout, &e), WSP_OK);
+    ck_assert(timeout == -1);
+
+    wsp_t *w = acquire(path_a);
+    write_point(w, 1.0);
+    release(w);
+
+    ck_assert_int_eq(sync_count, 0);
+    ck_assert_int_eq(wsp_pool_sync_timeout(&pool, &timeout, &e), WSP_OK);
+    ck_assert(timeout > 0 && timeout <= 60000);
+
+    // without further releases, the user of the pool syncs it.
+    ck_assert_int_eq(wsp_pool_sync(&pool, &e), WSP_OK);
+
+    ck_assert_int_eq(sync_count, 1);
+    ck_assert_int_eq(sync_fd, w->io_fileno);
+    ck_assert(pool.dirty_head == NULL);
+    ck_assert(pool.dirty_bytes == 0);
+
+    ck_assert_int_eq(wsp_pool_sync_timeout(&pool, &timeout, &e), WSP_OK);
+    ck_assert(timeout == -1);
+
+    // an expired interval syncs on release.
+    ck_assert_int_eq(wsp_pool_sync_policy(&pool, 10, 0, &e), WSP_OK);
+
+    w = acquire(path_a);
+    write_point(w, 2.0);
+    ck_assert_int_eq(nanosleep(&pause, NULL), 0);
+    release(w);
+
+    ck_assert_int_eq(sync_count, 2);
+    ck_assert(pool.dirty_head == NULL);
+}
+END_TEST
+
+START_TEST(test_sync_failed)
+{
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_pool_sync_policy(&pool, 0, 1 << 20, &e), WSP_OK);
+
+    wsp_t *w = acquire(path_a);
+    write_point(w, 1.0);
+    release(w);
+
+    sync_fail = 1;
+
+    ck_assert_int_eq(wsp_pool_sync(&pool, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_IO);
+    ck_assert_int_eq(e.syserr, EIO);
+
+    // still dirty, and synced by the next group.
+    ck_assert_ptr_eq(pool.dirty_head, (wsp_pool_entry_t *)w);
+    ck_assert(pool.dirty_bytes > 0);
+
+    sync_fail = 0;
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_pool_sync(&pool, &e), WSP_OK);
+    ck_assert_int_eq(sync_count, 1);
+    ck_assert(pool.dirty_head == NULL);
+}
+END_TEST
+
+START_TEST(test_sync_closed)
+{
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_pool_sync_policy(&pool, 0, 1 << 20, &e), WSP_OK);
+
+    wsp_t *w = acquire(path_a);
+    write_point(w, 1.0);
+    int fd = w->io_fileno;
+    release(w);
+
+    release(acquire(path_b));
+
+    // a, the least recently used, is synced before it is evicted.
+    release(acquire(path_c));
+
+    ck_assert(!pooled(path_a));
+    ck_assert_int_eq(sync_count, 1);
+    ck_assert_int_eq(sync_fd, fd);
+    ck_assert(pool.dirty_head == NULL);
+    ck_assert(pool.dirty_bytes == 0);
+
+    // and before it is discarded.
+    w = acquire(path_b);
+    write_point(w, 2.0);
+    fd = w->io_fileno;
+    wsp_pool_discard(&pool, w);
+
+    ck_assert_int_eq(sync_count, 2);
+    ck_assert_int_eq(sync_fd, fd);
+
+    // and when the pool is freed.
+    w = acquire(path_c);
+    write_point(w, 3.0);
+    fd = w->io_fileno;
+    release(w);
+
+    ck_assert_int_eq(wsp_pool_free(&pool, &e), WSP_OK);
+    ck_assert_int_eq(sync_count, 3);
+    ck_assert_int_eq(sync_fd, fd);
+}
+END_TEST
+
+START_TEST(test_sync_disabled)
+{
+    wsp_error_t e;
+    WSP_ERROR_INIT(&e);
+
+    wsp_t *w = acquire(path_a);
+    write_point(w, 1.0);
+    release(w);
+
+    ck_assert(pool.dirty_head == NULL);
+
+    release(acquire(path_b));
+    release(acquire(path_c));
+
+    ck_assert(!pooled(path_a));
+    ck_assert_int_eq(wsp_pool_free(&pool, &e), WSP_OK);
+    ck_assert_int_eq(sync_count, 0);
+}
+END_TEST
+
+/*
+ * Write the base point of the second archive with a mapping and check what
+ * wsp_sync syncs.
+ */
+void check_sync(wsp_t *w) {
+    wsp_error_t e;
+    wsp_point_t p = { .timestamp = 60000, .value = 42.0 };
+    wsp_point_b buf;
+    wsp_iov_t iov = { .offset = w->archives[1].offset, .size = sizeof(buf), .buf = &buf };
+
+    WSP_ERROR_INIT(&e);
+
+    __wsp_dump_point(&p, &buf);
+    ck_assert_int_eq(__wsp_io_writev(w, &iov, 1, &e), WSP_OK);
+
+    long from = w->io_dirty_from;
+    long until = w->io_dirty_until;
+
+    ck_assert(from == iov.offset && until == iov.offset + (long)iov.size);
+    ck_assert(w->io_dirty_bytes == iov.size);
+
+    // a failed sync keeps the range.
+    sync_fail = 1;
+
+    ck_assert_int_eq(wsp_sync(w, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_IO);
+    ck_assert(w->io_dirty_from == from && w->io_dirty_until == until);
+
+    sync_fail = 0;
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_sync(w, &e), WSP_OK);
+    ck_assert_int_eq(sync_count, 1);
+    ck_assert(w->io_dirty_from == w->io_dirty_until);
+    ck_assert(w->io_dirty_bytes == 0);
+
+    if (w->io_mapping == WSP_MMAP) {
+        // the pages of the range.
+        long page = sysconf(_SC_PAGESIZE);
+        char *base = w->io_mmap;
+
+        ck_assert((uintptr_t)sync_addr % page == 0);
+        ck_assert((char *)sync_addr <= base + from);
+        ck_assert((char *)sync_addr + sync_length >= base + until);
+    }
+    else {
+        ck_assert_int_eq(sync_fd, w->io_mapping == WSP_FILE ? fileno(w->io_fd) : w->io_fileno);
+    }
+
+    // nothing left to sync.
+    ck_assert_int_eq(wsp_sync(w, &e), WSP_OK);
+    ck_assert_int_eq(sync_count, 1);
+
+    // the point reached the file.
+    wsp_t check;
+    wsp_point_t stored;
+
+    check_open(&check, path_a);
+    ck_assert_int_eq(wsp_load_point(&check, check.archives + 1, 0, &stored, &e), WSP_OK);
+    ck_assert_uint_eq(stored.timestamp, 60000);
+    ck_assert(stored.value == 42.0);
+    check_close(&check);
+}
+
+void check_sync_mapping(wsp_mapping_t mapping) {
+    wsp_t w;
+    wsp_error_t e;
+
+    WSP_INIT(&w);
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_open(&w, path_a, mapping, &e), WSP_OK);
+    check_sync(&w);
+    ck_assert_int_eq(wsp_close(&w, &e), WSP_OK);
+}
+
+START_TEST(test_sync_file)
+{
+    // the stream buffer is flushed as well.
+    check_sync_mapping(WSP_FILE);
+}
+END_TEST
+
+START_TEST(test_sync_mmap)
+{
+    check_sync_mapping(WSP_MMAP);
+}
+END_TEST
+
+START_TEST(test_sync_pread)
+{
+    check_sync_mapping(WSP_PREAD);
+}
+END_TEST
+
+START_TEST(test_sync_uring)
+{
+    wsp_uring_t ring;
+    wsp_t w;
+    wsp_error_t e;
+
+    WSP_ERROR_INIT(&e);
+
+    if (wsp_uring_init(&ring, 8, &e) == WSP_ERROR) {
+        // not supported by the kernel, or not allowed.
+        ck_assert(e.syserr == ENOSYS || e.syserr == EPERM);
+        return;
+    }
+
+    WSP_INIT(&w);
+    w.io_uring = &ring;
+
+    ck_assert_int_eq(wsp_open(&w, path_a, WSP_URING, &e), WSP_OK);
+
+    // the queued write completes before the file is synced.
+    check_sync(&w);
+    ck_assert_uint_eq(ring.queued, 0);
+    ck_assert_uint_eq(ring.inflight, 0);
+
+    ck_assert_int_eq(wsp_close(&w, &e), WSP_OK);
+    ck_assert_int_eq(wsp_uring_free(&ring, &e), WSP_OK);
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_pool");
+
+    TCase *tc = tcase_create("pool");
+    tcase_add_checked_fixture(tc, setup_pool, teardown_pool);
+    tcase_add_test(tc, test_reuse);
+    tcase_add_test(tc, test_evict);
+    tcase_add_test(tc, test_rename);
+    tcase_add_test(tc, test_discard);
+    tcase_add_test(tc, test_missing);
+    suite_add_tcase(s, tc);
+
+    tc = tcase_create("group_commit");
+    tcase_add_checked_fixture(tc, setup_pool, teardown_pool);
+    tcase_add_test(tc, test_sync_bytes);
+    tcase_add_test(tc, test_sync_interval);
+    tcase_add_test(tc, test_sync_failed);
+    tcase_add_test(tc, test_sync_closed);
+    tcase_add_test(tc, test_sync_disabled);
+    suite_add_tcase(s, tc);
+
+    tc = tcase_create("sync");
+    tcase_add_checked_fixture(tc, setup_dir, teardown_dir);
+    tcase_add_test(tc, test_sync_file);
+    tcase_add_test(tc, test_sync_mmap);
+    tcase_add_test(tc, test_sync_pread);
+    tcase_add_test(tc, test_sync_uring);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}
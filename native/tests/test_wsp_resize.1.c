@@ -0,0 +1,351 @@
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../src/wsp.h"
+#include "../src/wsp_resize.h"
+
+char dir[CHECK_TMP_SIZE];
+char path[CHECK_TMP_SIZE];
+
+void setup_dir() {
+    check_tmp_dir(dir);
+    check_tmp_path(dir, "test.wsp", path);
+}
+
+void teardown_dir() {
+    check_tmp_clean(dir);
+}
+
+/*
+ * Check the configuration of a database.
+ */
+void check_config(const char *file, wsp_archive_t *archives, uint32_t count, wsp_aggregation_t aggregation, float xff) {
+    wsp_t w;
+    uint32_t i;
+
+    check_open(&w, file);
+    ck_assert_uint_eq(w.archives_count, count);
+    ck_assert_int_eq(w.meta.aggregation, aggregation);
+    ck_assert(w.meta.x_files_factor == xff);
+
+    for (i = 0; i < count; i++) {
+        ck_assert_uint_eq(w.archives[i].spp, archives[i].spp);
+        ck_assert_uint_eq(w.archives[i].count, archives[i].count);
+    }
+
+    check_close(&w);
+}
+
+ino_t inode_of(const char *file) {
+    struct stat st;
+
+    ck_assert_int_eq(stat(file, &st), 0);
+    return st.st_ino;
+}
+
+START_TEST(test_resize_finer)
+{
+    wsp_archive_t old_archives[] = {
+        { .spp = 60, .count = 120 },
+        { .spp = 3600, .count = 240 }
+    };
+    wsp_archive_t new_archives[] = {
+        { .spp = 10, .count = 60 },
+        { .spp = 60, .count = 120 },
+        { .spp = 3600, .count = 240 }
+    };
+    wsp_error_t e;
+    wsp_point_t points[100];
+    uint32_t i;
+
+    WSP_ERROR_INIT(&e);
+
+    check_create(path, old_archives, 2, WSP_AVERAGE, 0.0);
+
+    wsp_time_t now = wsp_time_now();
+    wsp_time_t minute = wsp_time_floor(now, 60);
+
+    // the 100 minutes before the current one.
+    for (i = 0; i < 100; i++) {
+        points[i].timestamp = minute - 60 * (i + 1);
+        points[i].value = i + 1;
+    }
+
+    check_update_many(path, points, 100);
+
+    ck_assert_int_eq(wsp_resize(path, NULL, new_archives, 3, -1, 0, &e), WSP_OK);
+
+    check_config(path, new_archives, 3, WSP_AVERAGE, 0.0);
+
+    // the finer archive only has the points at the start of the minutes.
+    check_fetch_file(path, now - 500, now, now);
+
+    ck_assert_uint_eq(check_series.step, 10);
+    ck_assert_uint_eq(check_series.count, 50);
+
+    for (i = 0; i < check_series.count; i++) {
+        wsp_time_t t = check_series.start + i * 10;
+
+        if (t % 60 != 0 || t == minute) {
+            ck_assert(!check_is_valid(i));
+            continue;
+        }
+
+        ck_assert(check_is_valid(i));
+        ck_assert(check_series.values[i] == (minute - t) / 60);
+    }
+
+    // the archive found in both databases is kept as is.
+    check_fetch_file(path, now - 5000, now, now);
+
+    ck_assert_uint_eq(check_series.step, 60);
+
+    for (i = 0; i < check_series.count; i++) {
+        wsp_time_t t = check_series.start + i * 60;
+
+        ck_assert(check_is_valid(i) == (t != minute));
+
+        if (t != minute) {
+            ck_assert(check_series.values[i] == (minute - t) / 60);
+        }
+    }
+
+    // no temporary file is left behind.
+    char tmp[CHECK_TMP_SIZE];
+
+    check_tmp_path(dir, "test.wsp.tmp", tmp);
+    ck_assert_int_eq(access(tmp, F_OK), -1);
+}
+END_TEST
+
+START_TEST(test_resize_coarser)
+{
+    wsp_archive_t old_archives[] = {
+        { .spp = 1, .count = 120 },
+        { .spp = 60, .count = 120 }
+    };
+    wsp_archive_t new_archives[] = {
+        { .spp = 60, .count = 120 },
+        { .spp = 3600, .count = 240 }
+    };
+    wsp_error_t e;
+    wsp_point_t points[61];
+    char new_path[CHECK_TMP_SIZE];
+    uint32_t i;
+
+    WSP_ERROR_INIT(&e);
+
+    check_tmp_path(dir, "new.wsp", new_path);
+    check_create(path, old_archives, 2, WSP_SUM, 0.0);
+
+    wsp_time_t now = wsp_time_now();
+    // the last complete minute, within the retention of the first archive.
+    wsp_time_t minute = wsp_time_floor(now, 60) - 60;
+    wsp_time_t old = wsp_time_floor(now, 60) - 3000;
+
+    for (i = 0; i < 60; i++) {
+        points[i].timestamp = minute + i;
+        points[i].value = i + 1;
+    }
+
+    // only in the second archive.
+    points[60].timestamp = old;
+    points[60].value = 7.0;
+
+    check_update_many(path, points, 61);
+
+    ck_assert_int_eq(wsp_resize(path, new_path, new_archives, 2, 0.5, WSP_MAX, &e), WSP_OK);
+
+    // the old database is left alone.
+    check_config(path, old_archives, 2, WSP_SUM, 0.0);
+    check_config(new_path, new_archives, 2, WSP_MAX, 0.5);
+
+    check_fetch_file(new_path, now - 5000, now, now);
+
+    ck_assert_uint_eq(check_series.step, 60);
+
+    for (i = 0; i < check_series.count; i++) {
+        wsp_time_t t = check_series.start + i * 60;
+
+        if (t == minute) {
+            // aggregated from the seconds with the new aggregation method.
+            ck_assert(check_is_valid(i));
+            ck_assert(check_series.values[i] == 60.0);
+        }
+        else if (t == old) {
+            // copied from the old archive with the same precision.
+            ck_assert(check_is_valid(i));
+            ck_assert(check_series.values[i] == 7.0);
+        }
+        else {
+            ck_assert(!check_is_valid(i));
+        }
+    }
+}
+END_TEST
+
+START_TEST(test_resize_empty)
+{
+    wsp_archive_t old_archives[] = {
+        { .spp = 1, .count = 60 },
+        { .spp = 60, .count = 120 }
+    };
+    wsp_archive_t new_archives[] = {
+        { .spp = 10, .count = 60 },
+        { .spp = 60, .count = 120 }
+    };
+    wsp_t w;
+    wsp_error_t e;
+    wsp_point_t base;
+    uint32_t i;
+
+    WSP_ERROR_INIT(&e);
+
+    check_create(path, old_archives, 2, WSP_LAST, 0.5);
+
+    ck_assert_int_eq(wsp_resize(path, NULL, new_archives, 2, -1, 0, &e), WSP_OK);
+
+    check_config(path, new_archives, 2, WSP_LAST, 0.5);
+
+    // no archive was started.
+    check_open(&w, path);
+
+    for (i = 0; i < w.archives_count; i++) {
+        ck_assert_int_eq(wsp_load_point(&w, w.archives + i, 0, &base, &e), WSP_OK);
+        ck_assert_uint_eq(base.timestamp, 0);
+    }
+
+    check_close(&w);
+
+    wsp_time_t now = wsp_time_now();
+
+    check_fetch_file(path, now - 500, now, now);
+
+    for (i = 0; i < check_series.count; i++) {
+        ck_assert(!check_is_valid(i));
+    }
+}
+END_TEST
+
+START_TEST(test_resize_dir_skip)
+{
+    wsp_archive_t archives[] = {
+        { .spp = 1, .count = 60 },
+        { .spp = 60, .count = 120 }
+    };
+    wsp_archive_t other_archives[] = {
+        { .spp = 1, .count = 120 },
+        { .spp = 60, .count = 120 }
+    };
+    wsp_archive_t fewer_archives[] = {
+        { .spp = 1, .count = 60 }
+    };
+    char same[CHECK_TMP_SIZE];
+    char other[CHECK_TMP_SIZE];
+    char fewer[CHECK_TMP_SIZE];
+    char aggregation[CHECK_TMP_SIZE];
+    char xff[CHECK_TMP_SIZE];
+    char ignored[CHECK_TMP_SIZE];
+    wsp_error_t e;
+    uint64_t resized = 0;
+
+    WSP_ERROR_INIT(&e);
+
+    check_tmp_path(dir, "same.wsp", same);
+    check_tmp_path(dir, "other.wsp", other);
+    check_tmp_path(dir, "fewer.wsp", fewer);
+    check_tmp_path(dir, "aggregation.wsp", aggregation);
+    check_tmp_path(dir, "xff.wsp", xff);
+    check_tmp_path(dir, "ignored.dat", ignored);
+
+    check_create(same, archives, 2, WSP_AVERAGE, 0.5);
+    check_create(other, other_archives, 2, WSP_AVERAGE, 0.5);
+    check_create(fewer, fewer_archives, 1, WSP_AVERAGE, 0.5);
+    check_create(aggregation, archives, 2, WSP_MAX, 0.5);
+    check_create(xff, archives, 2, WSP_AVERAGE, 0.0);
+    // not a database name, never opened.
+    check_create(ignored, other_archives, 2, WSP_AVERAGE, 0.5);
+
+    ino_t same_inode = inode_of(same);
+    ino_t ignored_inode = inode_of(ignored);
+
+    ck_assert_int_eq(wsp_resize_dir(dir, archives, 2, 0.5, WSP_AVERAGE, 2, &resized, &e), WSP_OK);
+    ck_assert_uint_eq(resized, 4);
+
+    ck_assert(inode_of(same) == same_inode);
+    ck_assert(inode_of(ignored) == ignored_inode);
+
+    check_config(same, archives, 2, WSP_AVERAGE, 0.5);
+    check_config(other, archives, 2, WSP_AVERAGE, 0.5);
+    check_config(fewer, archives, 2, WSP_AVERAGE, 0.5);
+    check_config(aggregation, archives, 2, WSP_AVERAGE, 0.5);
+    check_config(xff, archives, 2, WSP_AVERAGE, 0.5);
+    check_config(ignored, other_archives, 2, WSP_AVERAGE, 0.5);
+
+    // everything has the requested configuration now.
+    ck_assert_int_eq(wsp_resize_dir(dir, archives, 2, 0.5, WSP_AVERAGE, 2, &resized, &e), WSP_OK);
+    ck_assert_uint_eq(resized, 0);
+
+    // only the archives are compared when the rest is kept.
+    check_create(path, archives, 2, WSP_MIN, 0.1);
+
+    ck_assert_int_eq(wsp_resize_dir(dir, archives, 2, -1, 0, 1, &resized, &e), WSP_OK);
+    ck_assert_uint_eq(resized, 0);
+
+    ck_assert_int_eq(wsp_resize_dir(dir, other_archives, 2, -1, 0, 1, &resized, &e), WSP_OK);
+    ck_assert_uint_eq(resized, 6);
+
+    check_config(path, other_archives, 2, WSP_MIN, 0.1);
+    check_config(same, other_archives, 2, WSP_AVERAGE, 0.5);
+}
+END_TEST
+
+START_TEST(test_resize_dir_invalid)
+{
+    wsp_archive_t archives[] = {
+        { .spp = 1, .count = 10 },
+        { .spp = 60, .count = 120 }
+    };
+    wsp_error_t e;
+
+    WSP_ERROR_INIT(&e);
+
+    check_create(path, archives + 1, 1, WSP_AVERAGE, 0.5);
+
+    // too few points to aggregate into the second archive, nothing is
+    // resized to it.
+    ck_assert_int_eq(wsp_resize_dir(dir, archives, 2, -1, 0, 1, NULL, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_ARCHIVE_CONFIG);
+
+    check_config(path, archives + 1, 1, WSP_AVERAGE, 0.5);
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_resize");
+
+    TCase *resize = tcase_create("resize");
+
+    tcase_add_checked_fixture(resize, setup_dir, teardown_dir);
+    tcase_add_test(resize, test_resize_finer);
+    tcase_add_test(resize, test_resize_coarser);
+    tcase_add_test(resize, test_resize_empty);
+    tcase_add_test(resize, test_resize_dir_skip);
+    tcase_add_test(resize, test_resize_dir_invalid);
+
+    suite_add_tcase(s, resize);
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}
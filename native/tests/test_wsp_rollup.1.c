@@ -0,0 +1,214 @@
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/wsp.h"
+
+char dir[CHECK_TMP_SIZE];
+char path_rollup[CHECK_TMP_SIZE];
+char path_plain[CHECK_TMP_SIZE];
+
+wsp_archive_t archives[] = {
+    { .spp = 1, .count = 600 },
+    { .spp = 10, .count = 1200 },
+    { .spp = 60, .count = 2400 }
+};
+
+wsp_aggregation_t aggregations[] = {
+    WSP_AVERAGE, WSP_SUM, WSP_LAST, WSP_MAX, WSP_MIN
+};
+
+float xffs[] = { 0.0, 0.5, 1.0 };
+
+#define AGGREGATIONS_SIZE (sizeof(aggregations) / sizeof(aggregations[0]))
+#define XFFS_SIZE (sizeof(xffs) / sizeof(xffs[0]))
+#define POINTS_SIZE 256
+
+// the sequence written to both databases.
+wsp_point_t points[POINTS_SIZE];
+uint32_t points_count;
+
+void add_point(wsp_time_t timestamp, double value) {
+    ck_assert(points_count < POINTS_SIZE);
+
+    points[points_count].timestamp = timestamp;
+    points[points_count].value = value;
+    points_count++;
+}
+
+/*
+ * Two minutes and a half of seconds with gaps, so that some intervals do not
+ * reach the xFilesFactor, and with points out of order within the current
+ * interval and over known points.
+ */
+void setup_points() {
+    wsp_time_t start = wsp_time_floor(wsp_time_now() - 300, 60);
+    uint32_t i;
+
+    points_count = 0;
+
+    for (i = 0; i < 150; i++) {
+        // every third interval of 10 seconds is only 30% known.
+        if ((i / 10) % 3 == 2 && i % 10 >= 3) {
+            continue;
+        }
+
+        add_point(start + i, (double)(i % 7) - 3.0);
+
+        if (i == 35) {
+            // back into the current interval.
+            add_point(start + 31, 10.0);
+            add_point(start + 33, -10.0);
+        }
+
+        if (i == 47) {
+            // over known points of the current and of a past interval.
+            add_point(start + 47, 4.0);
+            add_point(start + 12, 8.0);
+        }
+
+        if (i == 64 || i == 94) {
+            // over the only maximum, and the only minimum of the interval.
+            add_point(start + i, i == 64 ? 9.0 : -9.0);
+            add_point(start + i, i == 64 ? -5.0 : 5.0);
+        }
+
+        if (i == 121) {
+            // a whole interval back, and then an older minute.
+            add_point(start + 115, 2.0);
+            add_point(start + 59, -6.0);
+        }
+    }
+}
+
+void setup_dir() {
+    check_tmp_dir(dir);
+    check_tmp_path(dir, "rollup.wsp", path_rollup);
+    check_tmp_path(dir, "plain.wsp", path_plain);
+
+    setup_points();
+}
+
+void teardown_dir() {
+    check_tmp_clean(dir);
+}
+
+void write_points(const char *path, int rollup) {
+    wsp_t w;
+    wsp_error_t e;
+    uint32_t i;
+
+    WSP_ERROR_INIT(&e);
+
+    check_open(&w, path);
+
+    if (rollup) {
+        ck_assert_int_eq(wsp_rollup_enable(&w, &e), WSP_OK);
+    }
+
+    for (i = 0; i < points_count; i++) {
+        ck_assert_int_eq(wsp_update(&w, points + i, &e), WSP_OK);
+    }
+
+    check_close(&w);
+}
+
+/*
+ * Averages of averages are summed in another order by the running aggregate,
+ * they may differ in the last bits.
+ */
+int same_value(double a, double b) {
+    if (isnan(a) || isnan(b)) {
+        return isnan(a) && isnan(b);
+    }
+
+    return fabs(a - b) <= 1e-12 * fmax(1.0, fabs(a));
+}
+
+/*
+ * Compare every slot of every archive of both databases.
+ */
+void compare_archives(wsp_aggregation_t aggregation, float xff) {
+    wsp_t a, b;
+    wsp_error_t e;
+    wsp_point_t pa, pb;
+    uint32_t i, j;
+    uint32_t known = 0;
+
+    WSP_ERROR_INIT(&e);
+
+    check_open(&a, path_rollup);
+    check_open(&b, path_plain);
+
+    for (i = 0; i < a.archives_count; i++) {
+        for (j = 0; j < a.archives[i].count; j++) {
+            ck_assert_int_eq(wsp_load_point(&a, a.archives + i, j, &pa, &e), WSP_OK);
+            ck_assert_int_eq(wsp_load_point(&b, b.archives + i, j, &pb, &e), WSP_OK);
+
+            ck_assert_msg(pa.timestamp == pb.timestamp,
+                "aggregation %d, xff %.1f, archive %u, index %u: %u != %u",
+                aggregation, xff, i, j, pa.timestamp, pb.timestamp);
+
+            if (pa.timestamp == 0) {
+                continue;
+            }
+
+            ck_assert_msg(same_value(pa.value, pb.value),
+                "aggregation %d, xff %.1f, archive %u, at %u: %.17g != %.17g",
+                aggregation, xff, i, pa.timestamp, pa.value, pb.value);
+
+            known += i > 0;
+        }
+    }
+
+    // something was propagated.
+    ck_assert(known > 0);
+
+    check_close(&a);
+    check_close(&b);
+}
+
+START_TEST(test_same_archives)
+{
+    uint32_t a, x;
+
+    for (a = 0; a < AGGREGATIONS_SIZE; a++) {
+        for (x = 0; x < XFFS_SIZE; x++) {
+            unlink(path_rollup);
+            unlink(path_plain);
+
+            check_create(path_rollup, archives, 3, aggregations[a], xffs[x]);
+            check_create(path_plain, archives, 3, aggregations[a], xffs[x]);
+
+            write_points(path_rollup, 1);
+            write_points(path_plain, 0);
+
+            compare_archives(aggregations[a], xffs[x]);
+        }
+    }
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_rollup");
+
+    TCase *tc = tcase_create("rollup");
+
+    tcase_add_checked_fixture(tc, setup_dir, teardown_dir);
+    tcase_add_test(tc, test_same_archives);
+
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}
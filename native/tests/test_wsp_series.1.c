@@ -0,0 +1,267 @@
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/wsp.h"
+
+char dir[CHECK_TMP_SIZE];
+char path[CHECK_TMP_SIZE];
+
+wsp_archive_t archives[] = {
+    { .spp = 1, .count = 60 },
+    { .spp = 60, .count = 120 }
+};
+
+wsp_mapping_t mappings[] = { WSP_PREAD, WSP_MMAP };
+
+#define MAPPINGS_SIZE (sizeof(mappings) / sizeof(mappings[0]))
+
+wsp_time_t now;
+// the first point written, the base of the first archive.
+wsp_time_t first;
+
+double values[120];
+uint8_t valid[120 / 8];
+wsp_point_t points[120];
+
+void setup_file() {
+    wsp_point_t written[60];
+    uint32_t count = 0;
+    uint32_t i;
+
+    check_tmp_dir(dir);
+    check_tmp_path(dir, "test.wsp", path);
+    check_create(path, archives, 2, WSP_AVERAGE, 0.0);
+
+    now = wsp_time_now();
+    first = now - 20;
+
+    wsp_point_t base = { .timestamp = first, .value = 100.0 };
+    check_update_many(path, &base, 1);
+
+    // older points are written before the base in the ring, so that ranges
+    // wrap around; every third one is missing.
+    for (i = 1; i <= 50; i++) {
+        if (i % 3 == 0 || i == 20) {
+            continue;
+        }
+
+        written[count].timestamp = now - i;
+        written[count].value = (double)i - 25.0;
+        count++;
+    }
+
+    check_update_many(path, written, count);
+}
+
+void teardown_file() {
+    check_tmp_clean(dir);
+}
+
+void open_mapping(wsp_t *w, wsp_mapping_t mapping) {
+    wsp_error_t e;
+
+    WSP_INIT(w);
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_open(w, path, mapping, &e), WSP_OK);
+}
+
+/*
+ * Check a series against the points loaded for it, returns the number of
+ * known points.
+ */
+uint32_t check_points(wsp_series_t *series, wsp_point_t *points, uint32_t count, uint32_t spp) {
+    uint32_t i;
+    uint32_t known = 0;
+
+    ck_assert_uint_eq(series->count, count);
+    ck_assert_uint_eq(series->step, spp);
+
+    if (count > 0) {
+        ck_assert_uint_eq(series->start, points[0].timestamp);
+    }
+
+    for (i = 0; i < count; i++) {
+        ck_assert_uint_eq(series->start + i * series->step, points[i].timestamp);
+
+        int is_known = !isnan(points[i].value);
+
+        if (series->valid != NULL) {
+            ck_assert_int_eq((series->valid[i / 8] >> (i % 8)) & 1, is_known);
+        }
+
+        if (is_known) {
+            ck_assert(series->values[i] == points[i].value);
+            known++;
+        }
+        else {
+            ck_assert(isnan(series->values[i]));
+        }
+    }
+
+    // bits past the series are cleared.
+    if (series->valid != NULL && count % 8 != 0) {
+        ck_assert_int_eq(series->valid[count / 8] >> (count % 8), 0);
+    }
+
+    return known;
+}
+
+START_TEST(test_series)
+{
+    wsp_t w;
+    wsp_error_t e;
+    wsp_series_t series;
+    int offsets[] = { -100, -45, -30, -1, 0, 1, 15, 39, 40, 59, 75 };
+    uint32_t counts[] = { 0, 1, 7, 30, 59, 60, 80 };
+    uint32_t m, i, j;
+    uint32_t known = 0;
+
+    WSP_ERROR_INIT(&e);
+
+    for (m = 0; m < MAPPINGS_SIZE; m++) {
+        open_mapping(&w, mappings[m]);
+
+        for (i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+            for (j = 0; j < sizeof(counts) / sizeof(counts[0]); j++) {
+                uint32_t count = counts[j] > 60 ? 60 : counts[j];
+
+                ck_assert_int_eq(wsp_load_points(&w, w.archives, offsets[i], counts[j], points, &e), WSP_OK);
+
+                memset(valid, 0xff, sizeof(valid));
+                WSP_SERIES_INIT(&series, values, valid);
+
+                ck_assert_int_eq(wsp_load_series(&w, w.archives, offsets[i], counts[j], &series, &e), WSP_OK);
+                known += check_points(&series, points, count, 1);
+
+                // without a bitmap.
+                WSP_SERIES_INIT(&series, values, NULL);
+
+                ck_assert_int_eq(wsp_load_series(&w, w.archives, offsets[i], counts[j], &series, &e), WSP_OK);
+                check_points(&series, points, count, 1);
+            }
+        }
+
+        check_close(&w);
+    }
+
+    ck_assert(known > 0);
+}
+END_TEST
+
+START_TEST(test_time_series)
+{
+    wsp_t w;
+    wsp_error_t e;
+    wsp_series_t series;
+    uint32_t size;
+    uint32_t m, i;
+
+    WSP_ERROR_INIT(&e);
+
+    wsp_time_t ranges[][2] = {
+        // wraps around the base.
+        { now - 50, now - 1 },
+        { now - 30, now - 10 },
+        { first, now },
+        // more than the archive holds.
+        { now - 500, now },
+        { now - 5, now - 4 }
+    };
+
+    for (m = 0; m < MAPPINGS_SIZE; m++) {
+        open_mapping(&w, mappings[m]);
+
+        for (i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++) {
+            ck_assert_int_eq(wsp_load_time_points(&w, w.archives, ranges[i][0], ranges[i][1], points, &size, &e), WSP_OK);
+
+            memset(valid, 0xff, sizeof(valid));
+            WSP_SERIES_INIT(&series, values, valid);
+
+            ck_assert_int_eq(wsp_load_time_series(&w, w.archives, ranges[i][0], ranges[i][1], &series, &e), WSP_OK);
+            check_points(&series, points, size, 1);
+        }
+
+        // the propagated minutes, up to the current one.
+        ck_assert_int_eq(wsp_load_time_points(&w, w.archives + 1, now - 7140, now + 60, points, &size, &e), WSP_OK);
+        ck_assert_int_eq(wsp_load_time_series(&w, w.archives + 1, now - 7140, now + 60, &series, &e), WSP_OK);
+        ck_assert(check_points(&series, points, size, 60) > 0);
+
+        // across the wrap: known, missing and the base.
+        ck_assert_int_eq(wsp_load_time_series(&w, w.archives, now - 50, now - 1, &series, &e), WSP_OK);
+        ck_assert_uint_eq(series.start, now - 50);
+        ck_assert_uint_eq(series.count, 49);
+        ck_assert(series.values[0] == 25.0);
+        ck_assert(isnan(series.values[2]));
+        ck_assert(!(series.valid[0] & (1 << 2)));
+        ck_assert(series.values[30] == 100.0);
+        ck_assert(series.valid[30 / 8] & (1 << (30 % 8)));
+
+        WSP_ERROR_INIT(&e);
+        ck_assert_int_eq(wsp_load_time_series(&w, w.archives, now, now - 1, &series, &e), WSP_ERROR);
+        ck_assert_int_eq(e.type, WSP_ERROR_TIME_INTERVAL);
+
+        check_close(&w);
+    }
+}
+END_TEST
+
+START_TEST(test_empty)
+{
+    wsp_t w;
+    wsp_error_t e;
+    wsp_series_t series;
+    uint32_t i;
+
+    WSP_ERROR_INIT(&e);
+
+    unlink(path);
+    check_create(path, archives, 2, WSP_AVERAGE, 0.0);
+
+    check_open(&w, path);
+
+    memset(valid, 0xff, sizeof(valid));
+    WSP_SERIES_INIT(&series, values, valid);
+
+    // nothing written, not even a point with a timestamp of 0.
+    ck_assert_int_eq(wsp_load_series(&w, w.archives + 1, 0, 120, &series, &e), WSP_OK);
+    ck_assert_uint_eq(series.count, 120);
+
+    for (i = 0; i < series.count; i++) {
+        ck_assert(isnan(series.values[i]));
+    }
+
+    for (i = 0; i < sizeof(valid); i++) {
+        ck_assert_uint_eq(valid[i], 0);
+    }
+
+    check_close(&w);
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_series");
+
+    TCase *tc = tcase_create("series");
+
+    tcase_add_checked_fixture(tc, setup_file, teardown_file);
+    tcase_add_test(tc, test_series);
+    tcase_add_test(tc, test_time_series);
+    tcase_add_test(tc, test_empty);
+
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,395 @@
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/wsp.h"
+#include "../src/wsp_private.h"
+
+/*
+ * Point counts covering empty input, the 4 and 8 point blocks of the vector
+ * kernels and every tail length after them.
+ */
+uint32_t counts[] = {
+    0, 1, 2, 3, 4, 5, 7, 8, 9, 11, 15, 16, 17, 23, 24, 25, 31, 32, 33, 63, 64,
+    65, 100, 257
+};
+
+#define COUNTS_SIZE (sizeof(counts) / sizeof(counts[0]))
+#define MAX_COUNT 257
+#define ROUNDS 20
+
+wsp_simd_t levels[] = { WSP_SIMD_SSSE3, WSP_SIMD_AVX2 };
+
+#define LEVELS_SIZE (sizeof(levels) / sizeof(levels[0]))
+
+uint64_t random_state;
+
+uint64_t random_next() {
+    // xorshift64*, so that failures can be reproduced.
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return random_state * 0x2545f4914f6cdd1dull;
+}
+
+/*
+ * A value with all the cases the kernels treat specially: unknown (NAN),
+ * signed zeros, infinities, and arbitrary bit patterns.
+ */
+double random_value() {
+    uint64_t bits;
+    double v;
+
+    switch (random_next() % 8) {
+    case 0:
+        return NAN;
+    case 1:
+        return -0.0;
+    case 2:
+        return 0.0;
+    case 3:
+        return random_next() % 2 ? INFINITY : -INFINITY;
+    case 4:
+        bits = random_next();
+        memcpy(&v, &bits, sizeof(v));
+        return v;
+    default:
+        return (double)(int64_t)(random_next() % 2000001) / 1000.0 - 1000.0;
+    }
+}
+
+/*
+ * Raw points with the timestamps expected, expected + spp, ..., except for a
+ * few that are off by one interval, 0 or random.
+ */
+void random_raw(wsp_point_b *buf, uint32_t count, wsp_time_t expected, uint32_t spp) {
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        wsp_point_t p;
+        uint64_t r = random_next() % 16;
+
+        p.timestamp = expected + i * spp;
+        p.value = random_value();
+
+        if (r == 0) {
+            p.timestamp += spp;
+        }
+        else if (r == 1) {
+            p.timestamp = 0;
+        }
+        else if (r == 2) {
+            p.timestamp = (wsp_time_t)random_next();
+        }
+
+        __wsp_dump_point(&p, buf + i);
+    }
+}
+
+void random_points(wsp_point_t *points, uint32_t count) {
+    uint32_t i;
+
+    memset(points, 0, sizeof(wsp_point_t) * count);
+
+    for (i = 0; i < count; i++) {
+        points[i].timestamp = (wsp_time_t)random_next();
+        points[i].value = random_value();
+    }
+}
+
+wsp_time_t random_expected() {
+    // close to the end of the 32 bit range now and then.
+    if (random_next() % 8 == 0) {
+        return UINT32_MAX - (wsp_time_t)(random_next() % 1000);
+    }
+
+    return (wsp_time_t)random_next();
+}
+
+uint32_t random_spp() {
+    uint32_t spps[] = { 1, 10, 60, 3600 };
+    return spps[random_next() % 4];
+}
+
+int same_double(double a, double b) {
+    return (isnan(a) && isnan(b)) || memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+/*
+ * Compare parsed points field by field, their padding is undefined.
+ */
+int same_points(wsp_point_t *a, wsp_point_t *b, uint32_t count) {
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        if (a[i].timestamp != b[i].timestamp
+            || memcmp(&a[i].value, &b[i].value, sizeof(double)) != 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void setup_simd() {
+    random_state = 0x9e3779b97f4a7c15ull;
+}
+
+void teardown_simd() {
+    __wsp_simd_select(WSP_SIMD_AVX2);
+}
+
+START_TEST(test_parse_points)
+{
+    wsp_point_b buf[MAX_COUNT];
+    wsp_point_t expected[MAX_COUNT];
+    wsp_point_t points[MAX_COUNT];
+    uint32_t c, l, round;
+
+    for (round = 0; round < ROUNDS; round++) {
+        for (c = 0; c < COUNTS_SIZE; c++) {
+            uint32_t count = counts[c];
+
+            random_raw(buf, count, random_expected(), random_spp());
+
+            __wsp_simd_select(WSP_SIMD_NONE);
+            __wsp_parse_points(buf, count, expected);
+
+            for (l = 0; l < LEVELS_SIZE; l++) {
+                __wsp_simd_select(levels[l]);
+
+                memset(points, 0xff, sizeof(points));
+                __wsp_parse_points(buf, count, points);
+
+                ck_assert_msg(same_points(points, expected, count),
+                    "level %d, count %u, round %u", levels[l], count, round);
+            }
+        }
+    }
+}
+END_TEST
+
+START_TEST(test_parse_points_expected)
+{
+    wsp_point_b buf[MAX_COUNT];
+    wsp_point_t expected[MAX_COUNT];
+    wsp_point_t points[MAX_COUNT];
+    uint32_t c, l, round;
+
+    for (round = 0; round < ROUNDS; round++) {
+        for (c = 0; c < COUNTS_SIZE; c++) {
+            uint32_t count = counts[c];
+            wsp_time_t from = random_expected();
+            uint32_t spp = random_spp();
+
+            random_raw(buf, count, from, spp);
+
+            __wsp_simd_select(WSP_SIMD_NONE);
+            __wsp_parse_points_expected(buf, count, from, spp, expected);
+
+            for (l = 0; l < LEVELS_SIZE; l++) {
+                __wsp_simd_select(levels[l]);
+
+                memset(points, 0xff, sizeof(points));
+                __wsp_parse_points_expected(buf, count, from, spp, points);
+
+                ck_assert_msg(same_points(points, expected, count),
+                    "level %d, count %u, round %u", levels[l], count, round);
+
+                // in place, as done when reading into the result.
+                memcpy(points, buf, sizeof(wsp_point_b) * count);
+                __wsp_parse_points_expected((wsp_point_b *)points, count, from, spp, points);
+
+                ck_assert_msg(same_points(points, expected, count),
+                    "in place, level %d, count %u, round %u", levels[l], count, round);
+            }
+        }
+    }
+}
+END_TEST
+
+START_TEST(test_parse_columns)
+{
+    wsp_point_b buf[MAX_COUNT];
+    wsp_time_t expected_timestamps[MAX_COUNT];
+    double expected_values[MAX_COUNT];
+    wsp_time_t timestamps[MAX_COUNT];
+    double values[MAX_COUNT];
+    uint32_t c, l, i, round;
+
+    for (round = 0; round < ROUNDS; round++) {
+        for (c = 0; c < COUNTS_SIZE; c++) {
+            uint32_t count = counts[c];
+            wsp_time_t from = random_expected();
+            uint32_t spp = random_spp();
+
+            random_raw(buf, count, from, spp);
+
+            __wsp_simd_select(WSP_SIMD_NONE);
+            __wsp_parse_columns(buf, count, from, spp, expected_timestamps, expected_values);
+
+            for (l = 0; l < LEVELS_SIZE; l++) {
+                __wsp_simd_select(levels[l]);
+
+                __wsp_parse_columns(buf, count, from, spp, timestamps, values);
+
+                for (i = 0; i < count; i++) {
+                    ck_assert_msg(timestamps[i] == expected_timestamps[i]
+                        && memcmp(values + i, expected_values + i, sizeof(double)) == 0,
+                        "level %d, count %u, point %u, round %u", levels[l], count, i, round);
+                }
+
+                // without timestamps.
+                __wsp_parse_columns(buf, count, from, spp, NULL, values);
+
+                for (i = 0; i < count; i++) {
+                    ck_assert_msg(memcmp(values + i, expected_values + i, sizeof(double)) == 0,
+                        "no timestamps, level %d, count %u, point %u, round %u", levels[l], count, i, round);
+                }
+            }
+        }
+    }
+}
+END_TEST
+
+START_TEST(test_dump_points)
+{
+    wsp_point_t points[MAX_COUNT];
+    wsp_point_b expected[MAX_COUNT];
+    wsp_point_b buf[MAX_COUNT];
+    uint32_t c, l, round;
+
+    for (round = 0; round < ROUNDS; round++) {
+        for (c = 0; c < COUNTS_SIZE; c++) {
+            uint32_t count = counts[c];
+
+            random_points(points, count);
+
+            __wsp_simd_select(WSP_SIMD_NONE);
+            __wsp_dump_points(points, count, expected);
+
+            for (l = 0; l < LEVELS_SIZE; l++) {
+                __wsp_simd_select(levels[l]);
+
+                memset(buf, 0xff, sizeof(buf));
+                __wsp_dump_points(points, count, buf);
+
+                ck_assert_msg(memcmp(buf, expected, sizeof(wsp_point_b) * count) == 0,
+                    "level %d, count %u, round %u", levels[l], count, round);
+            }
+        }
+    }
+}
+END_TEST
+
+START_TEST(test_summarize)
+{
+    wsp_point_t points[MAX_COUNT];
+    uint32_t c, l, round;
+
+    for (round = 0; round < ROUNDS; round++) {
+        for (c = 0; c < COUNTS_SIZE; c++) {
+            uint32_t count = counts[c];
+            wsp_rollup_t expected;
+            wsp_rollup_t state;
+
+            random_points(points, count);
+
+            WSP_ROLLUP_INIT(&expected);
+            __wsp_simd_select(WSP_SIMD_NONE);
+            __wsp_summarize(points, count, &expected);
+
+            for (l = 0; l < LEVELS_SIZE; l++) {
+                WSP_ROLLUP_INIT(&state);
+                __wsp_simd_select(levels[l]);
+                __wsp_summarize(points, count, &state);
+
+                // the minimum and maximum of equal signed zeros may be either.
+                ck_assert_msg(state.known == expected.known
+                    && same_double(state.sum, expected.sum)
+                    && state.min == expected.min
+                    && state.max == expected.max
+                    && same_double(state.last, expected.last)
+                    && state.last_timestamp == expected.last_timestamp,
+                    "level %d, count %u, round %u", levels[l], count, round);
+            }
+        }
+    }
+}
+END_TEST
+
+START_TEST(test_next_difference)
+{
+    double a[MAX_COUNT];
+    double b[MAX_COUNT];
+    uint32_t c, l, i, round;
+
+    for (round = 0; round < ROUNDS; round++) {
+        for (c = 0; c < COUNTS_SIZE; c++) {
+            uint32_t count = counts[c];
+
+            for (i = 0; i < count; i++) {
+                a[i] = random_value();
+                b[i] = a[i];
+
+                // an unknown value on one side only is a difference, also
+                // keep some runs long enough to cross blocks.
+                switch (random_next() % 32) {
+                case 0:
+                    b[i] = random_value();
+                    break;
+                case 1:
+                    b[i] = NAN;
+                    break;
+                case 2:
+                    b[i] = -a[i];
+                    break;
+                }
+            }
+
+            uint32_t start;
+
+            for (start = 0; start <= count; start += 1 + start / 4) {
+                __wsp_simd_select(WSP_SIMD_NONE);
+                uint32_t expected = __wsp_next_difference(a, b, start, count);
+
+                for (l = 0; l < LEVELS_SIZE; l++) {
+                    __wsp_simd_select(levels[l]);
+
+                    ck_assert_msg(__wsp_next_difference(a, b, start, count) == expected,
+                        "level %d, count %u, start %u, round %u", levels[l], count, start, round);
+                }
+            }
+        }
+    }
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_simd");
+
+    TCase *simd = tcase_create("simd");
+
+    tcase_add_checked_fixture(simd, setup_simd, teardown_simd);
+    tcase_add_test(simd, test_parse_points);
+    tcase_add_test(simd, test_parse_points_expected);
+    tcase_add_test(simd, test_parse_columns);
+    tcase_add_test(simd, test_dump_points);
+    tcase_add_test(simd, test_summarize);
+    tcase_add_test(simd, test_next_difference);
+
+    suite_add_tcase(s, simd);
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}
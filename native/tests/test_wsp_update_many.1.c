@@ -0,0 +1,323 @@
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/wsp.h"
+
+char dir[CHECK_TMP_SIZE];
+char path[CHECK_TMP_SIZE];
+
+void setup_dir() {
+    check_tmp_dir(dir);
+    check_tmp_path(dir, "test.wsp", path);
+}
+
+void teardown_dir() {
+    check_tmp_clean(dir);
+}
+
+/*
+ * Value stored for timestamp, checking that it sits in the ring slot given by
+ * the base point of the archive.
+ */
+double value_at(uint32_t archive, wsp_time_t timestamp) {
+    wsp_t w;
+    wsp_error_t e;
+    wsp_point_t base;
+    wsp_point_t p;
+
+    WSP_ERROR_INIT(&e);
+
+    check_open(&w, path);
+
+    wsp_archive_t *a = w.archives + archive;
+
+    ck_assert_int_eq(wsp_load_point(&w, a, 0, &base, &e), WSP_OK);
+
+    wsp_time_t interval = wsp_time_floor(timestamp, a->spp);
+    int distance = ((int)interval - (int)base.timestamp) / (int)a->spp;
+    uint32_t index = ((distance % (int)a->count) + a->count) % a->count;
+
+    ck_assert_int_eq(wsp_load_point(&w, a, index, &p, &e), WSP_OK);
+    ck_assert_uint_eq(p.timestamp, interval);
+
+    check_close(&w);
+    return p.value;
+}
+
+/*
+ * Timestamp of the base point of an archive, 0 if it was never written.
+ */
+wsp_time_t base_of(uint32_t archive) {
+    wsp_t w;
+    wsp_error_t e;
+    wsp_point_t base;
+
+    WSP_ERROR_INIT(&e);
+
+    check_open(&w, path);
+    ck_assert_int_eq(wsp_load_point(&w, w.archives + archive, 0, &base, &e), WSP_OK);
+    check_close(&w);
+
+    return base.timestamp;
+}
+
+START_TEST(test_dedupe)
+{
+    wsp_archive_t archives[] = {
+        { .spp = 1, .count = 60 },
+        { .spp = 60, .count = 120 }
+    };
+
+    check_create(path, archives, 2, WSP_LAST, 0.5);
+
+    wsp_time_t now = wsp_time_now();
+
+    wsp_point_t points[] = {
+        { .timestamp = now - 5, .value = 1.0 },
+        { .timestamp = now - 3, .value = 2.0 },
+        { .timestamp = now - 5, .value = 3.0 },
+        { .timestamp = now - 4, .value = 4.0 },
+        { .timestamp = now - 3, .value = 5.0 }
+    };
+
+    check_update_many(path, points, 5);
+
+    // the last point given for an interval wins.
+    ck_assert(value_at(0, now - 5) == 3.0);
+    ck_assert(value_at(0, now - 4) == 4.0);
+    ck_assert(value_at(0, now - 3) == 5.0);
+}
+END_TEST
+
+START_TEST(test_wrap_around)
+{
+    wsp_archive_t archives[] = {
+        { .spp = 1, .count = 10 },
+        { .spp = 10, .count = 20 }
+    };
+
+    check_create(path, archives, 2, WSP_LAST, 0.5);
+
+    wsp_time_t now = wsp_time_now();
+
+    // sets the base point of the first archive.
+    wsp_point_t first = { .timestamp = now - 7, .value = 100.0 };
+    check_update_many(path, &first, 1);
+
+    ck_assert_uint_eq(base_of(0), now - 7);
+
+    // one run starting before the base point, so it wraps around the end of
+    // the archive.
+    wsp_point_t points[10];
+    uint32_t i;
+
+    for (i = 0; i < 10; i++) {
+        points[i].timestamp = now - 9 + i;
+        points[i].value = i;
+    }
+
+    check_update_many(path, points, 10);
+
+    ck_assert_uint_eq(base_of(0), now - 7);
+
+    for (i = 0; i < 10; i++) {
+        ck_assert(value_at(0, now - 9 + i) == i);
+    }
+}
+END_TEST
+
+START_TEST(test_run_longer_than_archive)
+{
+    wsp_archive_t archives[] = {
+        { .spp = 1, .count = 10 },
+        { .spp = 10, .count = 20 }
+    };
+
+    check_create(path, archives, 2, WSP_LAST, 0.5);
+
+    wsp_time_t now = wsp_time_now();
+
+    // now - 10 is within the retention, but the run has one point more than
+    // the archive can hold.
+    wsp_point_t points[11];
+    uint32_t i;
+
+    for (i = 0; i < 11; i++) {
+        points[i].timestamp = now - 10 + i;
+        points[i].value = i;
+    }
+
+    check_update_many(path, points, 11);
+
+    ck_assert_uint_eq(base_of(0), now - 9);
+
+    for (i = 1; i < 11; i++) {
+        ck_assert(value_at(0, now - 10 + i) == i);
+    }
+}
+END_TEST
+
+START_TEST(test_propagation)
+{
+    wsp_archive_t archives[] = {
+        { .spp = 1, .count = 240 },
+        { .spp = 60, .count = 480 }
+    };
+
+    check_create(path, archives, 2, WSP_SUM, 0.0);
+
+    wsp_time_t now = wsp_time_now();
+    wsp_time_t minute = wsp_time_floor(now, 60) - 120;
+
+    wsp_point_t points[14];
+    uint32_t i;
+
+    for (i = 0; i < 10; i++) {
+        points[i].timestamp = minute + i;
+        points[i].value = i + 1;
+    }
+
+    points[10].timestamp = minute + 60;
+    points[10].value = 100.0;
+    points[11].timestamp = minute + 61;
+    points[11].value = 200.0;
+    // replaces the first point of the next minute.
+    points[12].timestamp = minute + 60;
+    points[12].value = 300.0;
+    // only covered by the second archive.
+    points[13].timestamp = now - 1000;
+    points[13].value = 7.0;
+
+    check_update_many(path, points, 14);
+
+    ck_assert(value_at(0, minute) == 1.0);
+    ck_assert(value_at(0, minute + 60) == 300.0);
+
+    ck_assert(value_at(1, minute) == 55.0);
+    ck_assert(value_at(1, minute + 60) == 500.0);
+    ck_assert(value_at(1, now - 1000) == 7.0);
+}
+END_TEST
+
+START_TEST(test_future_points)
+{
+    wsp_archive_t archives[] = {
+        { .spp = 1, .count = 60 },
+        { .spp = 60, .count = 120 }
+    };
+
+    check_create(path, archives, 2, WSP_LAST, 0.5);
+
+    wsp_time_t now = wsp_time_now();
+
+    // only future points, nothing is written.
+    wsp_point_t future[] = {
+        { .timestamp = now + 100, .value = 1.0 },
+        { .timestamp = now + 200, .value = 2.0 }
+    };
+
+    check_update_many(path, future, 2);
+
+    ck_assert_uint_eq(base_of(0), 0);
+    ck_assert_uint_eq(base_of(1), 0);
+
+    // future points are dropped, the rest of the batch is written.
+    wsp_point_t points[] = {
+        { .timestamp = now + 100, .value = 1.0 },
+        { .timestamp = now - 2, .value = 2.0 },
+        { .timestamp = now + 200, .value = 3.0 }
+    };
+
+    check_update_many(path, points, 3);
+
+    ck_assert_uint_eq(base_of(0), now - 2);
+    ck_assert(value_at(0, now - 2) == 2.0);
+}
+END_TEST
+
+START_TEST(test_load_offsets)
+{
+    wsp_archive_t archives[] = {
+        { .spp = 1, .count = 10 },
+        { .spp = 10, .count = 20 }
+    };
+
+    check_create(path, archives, 2, WSP_LAST, 0.5);
+
+    wsp_time_t now = wsp_time_now();
+    wsp_time_t base = now - 7;
+
+    wsp_point_t first = { .timestamp = base, .value = 100.0 };
+    check_update_many(path, &first, 1);
+
+    wsp_t w;
+    wsp_error_t e;
+    wsp_point_t written;
+    wsp_point_t points[10];
+    uint32_t i;
+
+    WSP_ERROR_INIT(&e);
+
+    check_open(&w, path);
+
+    // a point one lap behind the base, in the slot of base - 2.
+    ck_assert_int_eq(wsp_update_point(&w, w.archives, base - 12, 1.0, &written, &e), WSP_OK);
+
+    // offsets beyond the archive are not clamped, the slot is the offset
+    // modulo the archive and the points expected are the ones of the offset.
+    ck_assert_int_eq(wsp_load_points(&w, w.archives, -12, 3, points, &e), WSP_OK);
+    ck_assert_uint_eq(points[0].timestamp, base - 12);
+    ck_assert(points[0].value == 1.0);
+    ck_assert_uint_eq(points[2].timestamp, base - 10);
+    ck_assert(isnan(points[2].value));
+
+    ck_assert_int_eq(wsp_load_points(&w, w.archives, -2, 1, points, &e), WSP_OK);
+    ck_assert_uint_eq(points[0].timestamp, base - 2);
+    ck_assert(isnan(points[0].value));
+
+    ck_assert_int_eq(wsp_load_points(&w, w.archives, 10, 1, points, &e), WSP_OK);
+    ck_assert_uint_eq(points[0].timestamp, base + 10);
+    ck_assert(isnan(points[0].value));
+
+    // the whole archive, from the base.
+    ck_assert_int_eq(wsp_load_points(&w, w.archives, 0, 10, points, &e), WSP_OK);
+
+    for (i = 0; i < 10; i++) {
+        ck_assert_uint_eq(points[i].timestamp, base + i);
+    }
+
+    ck_assert(points[0].value == 100.0);
+
+    check_close(&w);
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_update_many");
+
+    TCase *update = tcase_create("update_many");
+
+    tcase_add_checked_fixture(update, setup_dir, teardown_dir);
+    tcase_add_test(update, test_dedupe);
+    tcase_add_test(update, test_wrap_around);
+    tcase_add_test(update, test_run_longer_than_archive);
+    tcase_add_test(update, test_propagation);
+    tcase_add_test(update, test_future_points);
+    tcase_add_test(update, test_load_offsets);
+
+    suite_add_tcase(s, update);
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}
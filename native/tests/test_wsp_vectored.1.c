@@ -0,0 +1,337 @@
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/wsp.h"
+#include "../src/wsp_private.h"
+
+char dir[CHECK_TMP_SIZE];
+char path_vectored[CHECK_TMP_SIZE];
+char path_sequential[CHECK_TMP_SIZE];
+
+/*
+ * Small rings, so that they wrap around, and windows of 4 points.
+ */
+wsp_archive_t archives[] = {
+    { .spp = 1, .count = 24 },
+    { .spp = 4, .count = 24 },
+    { .spp = 16, .count = 24 }
+};
+
+wsp_aggregation_t aggregations[] = {
+    WSP_AVERAGE, WSP_SUM, WSP_LAST, WSP_MAX, WSP_MIN
+};
+
+float xffs[] = { 0.0, 0.5, 1.0 };
+
+wsp_mapping_t mappings[] = { WSP_PREAD, WSP_MMAP };
+
+#define AGGREGATIONS_SIZE (sizeof(aggregations) / sizeof(aggregations[0]))
+#define XFFS_SIZE (sizeof(xffs) / sizeof(xffs[0]))
+#define MAPPINGS_SIZE (sizeof(mappings) / sizeof(mappings[0]))
+
+/*
+ * Seconds before now of the points written, far enough from the retention
+ * of every archive that the clock moving on does not change the archives
+ * written.
+ */
+wsp_time_t diffs[] = {
+    // into the first three archives.
+    6, 2, 5, 8, 3, 0, 7, 1, 4, 6, 2,
+    // into the last two only.
+    50, 31, 62, 44, 57, 36, 48, 70, 33,
+    // a few more of all three, over what is there.
+    3, 5, 1, 7, 14, 19
+};
+
+#define DIFFS_SIZE (sizeof(diffs) / sizeof(diffs[0]))
+
+void setup_dir() {
+    check_tmp_dir(dir);
+    check_tmp_path(dir, "vectored.wsp", path_vectored);
+    check_tmp_path(dir, "sequential.wsp", path_sequential);
+}
+
+void teardown_dir() {
+    check_tmp_clean(dir);
+}
+
+void open_mapping(wsp_t *w, const char *path, wsp_mapping_t mapping) {
+    wsp_error_t e;
+
+    WSP_INIT(w);
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_open(w, path, mapping, &e), WSP_OK);
+}
+
+/*
+ * Load the point of an archive at a timestamp, which is unknown if its slot
+ * holds another one.
+ */
+int load_at(wsp_t *w, wsp_archive_t *archive, wsp_time_t timestamp, double *value) {
+    wsp_error_t e;
+    wsp_point_t base, p;
+
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_load_point(w, archive, 0, &base, &e), WSP_OK);
+
+    if (base.timestamp == 0) {
+        return 0;
+    }
+
+    int distance = ((int)timestamp - (int)base.timestamp) / (int)archive->spp;
+    uint32_t index = __wsp_point_mod(distance, archive->count);
+
+    ck_assert_int_eq(wsp_load_point(w, archive, index, &p, &e), WSP_OK);
+
+    if (p.timestamp != timestamp) {
+        return 0;
+    }
+
+    *value = p.value;
+    return 1;
+}
+
+/*
+ * Aggregate the window of the higher archive covering the interval of the
+ * lower one, like whisper.py does. Returns 0 if there are not enough known
+ * points.
+ *
+ * Values are summed in eight lanes like __wsp_summarize, so that averages
+ * are the same to the last bit.
+ */
+int aggregate(wsp_t *w, wsp_archive_t *higher, wsp_archive_t *lower, wsp_time_t interval, double *value) {
+    uint32_t count = lower->spp / higher->spp;
+    uint32_t known = 0;
+    double sums[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    double last = 0.0, max = -INFINITY, min = INFINITY;
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        double v;
+
+        if (!load_at(w, higher, interval + i * higher->spp, &v)) {
+            continue;
+        }
+
+        known++;
+        sums[i % 8] += v;
+        last = v;
+        max = fmax(max, v);
+        min = fmin(min, v);
+    }
+
+    if (known == 0 || (float)known / (float)count < w->meta.x_files_factor) {
+        return 0;
+    }
+
+    double sum = ((sums[0] + sums[1]) + (sums[2] + sums[3])) + ((sums[4] + sums[5]) + (sums[6] + sums[7]));
+
+    switch (w->meta.aggregation) {
+    case WSP_AVERAGE:
+        *value = sum / known;
+        break;
+    case WSP_SUM:
+        *value = sum;
+        break;
+    case WSP_LAST:
+        *value = last;
+        break;
+    case WSP_MAX:
+        *value = max;
+        break;
+    case WSP_MIN:
+        *value = min;
+        break;
+    }
+
+    return 1;
+}
+
+/*
+ * Write a point archive by archive, reading every window after the archive
+ * before it was written.
+ */
+void update_sequential(wsp_t *w, wsp_point_t *p) {
+    wsp_error_t e;
+    wsp_point_t base;
+    wsp_time_t diff = wsp_time_now() - p->timestamp;
+    uint32_t i = 0;
+
+    WSP_ERROR_INIT(&e);
+
+    while (w->archives[i].retention < diff) {
+        i++;
+    }
+
+    ck_assert_int_eq(wsp_update_point(w, w->archives + i, p->timestamp, p->value, &base, &e), WSP_OK);
+
+    for (i = i + 1; i < w->archives_count; i++) {
+        wsp_archive_t *lower = w->archives + i;
+        wsp_time_t interval = wsp_time_floor(p->timestamp, lower->spp);
+        double value;
+
+        if (!aggregate(w, lower - 1, lower, interval, &value)) {
+            break;
+        }
+
+        ck_assert_int_eq(wsp_update_point(w, lower, interval, value, &base, &e), WSP_OK);
+    }
+}
+
+/*
+ * Compare every slot of every archive of both databases, returns the number
+ * of known points of the lower archives.
+ */
+uint32_t compare_archives(wsp_t *a, wsp_t *b, const char *what) {
+    wsp_error_t e;
+    wsp_point_t pa, pb;
+    uint32_t i, j;
+    uint32_t known = 0;
+
+    WSP_ERROR_INIT(&e);
+
+    for (i = 0; i < a->archives_count; i++) {
+        for (j = 0; j < a->archives[i].count; j++) {
+            ck_assert_int_eq(wsp_load_point(a, a->archives + i, j, &pa, &e), WSP_OK);
+            ck_assert_int_eq(wsp_load_point(b, b->archives + i, j, &pb, &e), WSP_OK);
+
+            ck_assert_msg(pa.timestamp == pb.timestamp,
+                "%s, archive %u, index %u: %u != %u",
+                what, i, j, pa.timestamp, pb.timestamp);
+
+            if (pa.timestamp == 0) {
+                continue;
+            }
+
+            ck_assert_msg(pa.value == pb.value,
+                "%s, archive %u, at %u: %.17g != %.17g",
+                what, i, pa.timestamp, pa.value, pb.value);
+
+            known += i > 0;
+        }
+    }
+
+    return known;
+}
+
+START_TEST(test_same_archives)
+{
+    wsp_t a, b;
+    wsp_error_t e;
+    char what[128];
+    uint32_t m, g, x, i;
+    uint32_t known = 0;
+
+    WSP_ERROR_INIT(&e);
+
+    for (m = 0; m < MAPPINGS_SIZE; m++) {
+        for (g = 0; g < AGGREGATIONS_SIZE; g++) {
+            for (x = 0; x < XFFS_SIZE; x++) {
+                unlink(path_vectored);
+                unlink(path_sequential);
+
+                check_create(path_vectored, archives, 3, aggregations[g], xffs[x]);
+                check_create(path_sequential, archives, 3, aggregations[g], xffs[x]);
+
+                open_mapping(&a, path_vectored, mappings[m]);
+                open_mapping(&b, path_sequential, mappings[m]);
+
+                wsp_time_t now = wsp_time_now();
+
+                // the first point is written to empty archives, in the middle
+                // of an interval of the second archive, so that its window
+                // wraps around the ring of the first.
+                wsp_time_t first = wsp_time_floor(now - 6, 4) + 2;
+
+                for (i = 0; i < DIFFS_SIZE; i++) {
+                    wsp_point_t p = {
+                        .timestamp = i == 0 ? first : now - diffs[i],
+                        .value = (double)((i * 7) % 13) - 6.0
+                    };
+
+                    ck_assert_int_eq(wsp_update(&a, &p, &e), WSP_OK);
+                    update_sequential(&b, &p);
+
+                    snprintf(what, sizeof(what), "mapping %d, aggregation %d, xff %.1f, point %u",
+                        mappings[m], aggregations[g], xffs[x], i);
+
+                    known += compare_archives(&a, &b, what);
+                }
+
+                check_close(&a);
+                check_close(&b);
+            }
+        }
+    }
+
+    // something was propagated.
+    ck_assert(known > 0);
+}
+END_TEST
+
+START_TEST(test_stop)
+{
+    wsp_t a, b;
+    wsp_error_t e;
+    wsp_point_t base;
+    wsp_time_t now = wsp_time_now();
+    wsp_time_t interval = wsp_time_floor(now - 8, 16);
+    double value;
+
+    WSP_ERROR_INIT(&e);
+
+    check_create(path_vectored, archives, 3, WSP_AVERAGE, 0.5);
+    check_create(path_sequential, archives, 3, WSP_AVERAGE, 0.5);
+
+    check_open(&a, path_vectored);
+    check_open(&b, path_sequential);
+
+    // half of the window of the third archive is known.
+    ck_assert_int_eq(wsp_update_point(&a, a.archives + 1, interval, 1.0, &base, &e), WSP_OK);
+    ck_assert_int_eq(wsp_update_point(&a, a.archives + 1, interval + 4, 2.0, &base, &e), WSP_OK);
+    ck_assert_int_eq(wsp_update_point(&b, b.archives + 1, interval, 1.0, &base, &e), WSP_OK);
+    ck_assert_int_eq(wsp_update_point(&b, b.archives + 1, interval + 4, 2.0, &base, &e), WSP_OK);
+
+    // not enough of the window of the second is, the point propagates no
+    // further than the first archive, even though the third has enough.
+    wsp_point_t p = { .timestamp = interval + 8, .value = 3.0 };
+
+    ck_assert_int_eq(wsp_update(&a, &p, &e), WSP_OK);
+    update_sequential(&b, &p);
+
+    ck_assert_uint_eq(compare_archives(&a, &b, "stop"), 2);
+    ck_assert(!load_at(&a, a.archives + 1, interval + 8, &value));
+    ck_assert(!load_at(&a, a.archives + 2, interval, &value));
+
+    check_close(&a);
+    check_close(&b);
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_vectored");
+
+    TCase *tc = tcase_create("vectored");
+
+    tcase_add_checked_fixture(tc, setup_dir, teardown_dir);
+    tcase_add_test(tc, test_same_archives);
+    tcase_add_test(tc, test_stop);
+
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}
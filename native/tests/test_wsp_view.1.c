@@ -0,0 +1,274 @@
+#include <check.h>
+#include "check_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../src/wsp.h"
+#include "../src/wsp_view.h"
+
+char dir[CHECK_TMP_SIZE];
+char path[CHECK_TMP_SIZE];
+
+wsp_archive_t archives[] = {
+    { .spp = 1, .count = 60 },
+    { .spp = 60, .count = 120 }
+};
+
+wsp_time_t now;
+// the first point written, the base of the first archive.
+wsp_time_t first;
+
+void setup_file() {
+    wsp_point_t points[60];
+    uint32_t count = 0;
+    uint32_t i;
+
+    check_tmp_dir(dir);
+    check_tmp_path(dir, "test.wsp", path);
+    check_create(path, archives, 2, WSP_AVERAGE, 0.5);
+
+    now = wsp_time_now();
+    first = now - 20;
+
+    wsp_point_t base = { .timestamp = first, .value = 100.0 };
+    check_update_many(path, &base, 1);
+
+    // older points are written before the base in the ring, so that ranges
+    // wrap around; every third one is missing.
+    for (i = 1; i <= 50; i++) {
+        if (i % 3 == 0 || i == 20) {
+            continue;
+        }
+
+        points[count].timestamp = now - i;
+        points[count].value = (double)i;
+        count++;
+    }
+
+    check_update_many(path, points, count);
+}
+
+void teardown_file() {
+    check_tmp_clean(dir);
+}
+
+void open_mapping(wsp_t *w, wsp_mapping_t mapping) {
+    wsp_error_t e;
+
+    WSP_INIT(w);
+    WSP_ERROR_INIT(&e);
+
+    ck_assert_int_eq(wsp_open(w, path, mapping, &e), WSP_OK);
+}
+
+void check_point(wsp_point_t *a, wsp_point_t *b) {
+    ck_assert_uint_eq(a->timestamp, b->timestamp);
+
+    if (isnan(b->value)) {
+        ck_assert(isnan(a->value));
+    }
+    else {
+        ck_assert(a->value == b->value);
+    }
+}
+
+/*
+ * Check that a view has the points loaded, using both a cursor and direct
+ * access. Returns the number of known points.
+ */
+uint32_t check_view(wsp_view_t *view, wsp_point_t *points, uint32_t count) {
+    wsp_cursor_t c;
+    wsp_point_t p;
+    uint32_t i;
+    uint32_t known = 0;
+
+    ck_assert_uint_eq(view->count, count);
+    ck_assert_uint_eq(view->sizes[0] + view->sizes[1], count);
+
+    WSP_CURSOR_INIT(&c, view);
+
+    for (i = 0; i < count; i++) {
+        ck_assert(wsp_cursor_next(&c, &p));
+        check_point(&p, points + i);
+
+        wsp_view_point(view, i, &p);
+        check_point(&p, points + i);
+
+        known += !isnan(p.value);
+    }
+
+    ck_assert(!wsp_cursor_next(&c, &p));
+    return known;
+}
+
+START_TEST(test_points)
+{
+    wsp_t w;
+    wsp_error_t e;
+    wsp_view_t view;
+    wsp_point_t points[60];
+    uint32_t wrapped = 0;
+    uint32_t known = 0;
+    int offsets[] = { -100, -60, -45, -30, -1, 0, 1, 15, 39, 40, 59, 60, 75 };
+    uint32_t counts[] = { 0, 1, 10, 30, 59, 60, 80 };
+    uint32_t i, j;
+
+    WSP_ERROR_INIT(&e);
+
+    open_mapping(&w, WSP_MMAP);
+
+    for (i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+        for (j = 0; j < sizeof(counts) / sizeof(counts[0]); j++) {
+            uint32_t count = counts[j] > 60 ? 60 : counts[j];
+
+            ck_assert_int_eq(wsp_load_points(&w, w.archives, offsets[i], counts[j], points, &e), WSP_OK);
+            ck_assert_int_eq(wsp_view_points(&w, w.archives, offsets[i], counts[j], &view, &e), WSP_OK);
+
+            known += check_view(&view, points, count);
+            wrapped += view.sizes[1] > 0;
+        }
+    }
+
+    ck_assert(known > 0);
+    ck_assert(wrapped > 0);
+
+    check_close(&w);
+}
+END_TEST
+
+START_TEST(test_time_points)
+{
+    wsp_t w;
+    wsp_error_t e;
+    wsp_view_t view;
+    wsp_point_t points[60];
+    uint32_t size;
+
+    WSP_ERROR_INIT(&e);
+
+    open_mapping(&w, WSP_MMAP);
+
+    wsp_time_t ranges[][2] = {
+        // wraps around the base.
+        { now - 50, now - 1 },
+        { now - 30, now - 10 },
+        { first, now },
+        // more than the archive holds.
+        { now - 500, now },
+        { now - 5, now - 4 }
+    };
+
+    uint32_t i;
+
+    for (i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++) {
+        ck_assert_int_eq(wsp_load_time_points(&w, w.archives, ranges[i][0], ranges[i][1], points, &size, &e), WSP_OK);
+        ck_assert_int_eq(wsp_view_time_points(&w, w.archives, ranges[i][0], ranges[i][1], &view, &e), WSP_OK);
+
+        check_view(&view, points, size);
+    }
+
+    ck_assert_int_eq(wsp_view_time_points(&w, w.archives, now - 50, now - 1, &view, &e), WSP_OK);
+    ck_assert_uint_eq(view.count, 49);
+    ck_assert_uint_eq(view.expected, now - 50);
+    ck_assert_uint_eq(view.sizes[0], 30);
+    ck_assert_uint_eq(view.sizes[1], 19);
+
+    wsp_point_t p;
+
+    // known, missing and the base, across the wrap.
+    wsp_view_point(&view, 0, &p);
+    ck_assert(p.value == 50.0);
+    wsp_view_point(&view, 2, &p);
+    ck_assert_uint_eq(p.timestamp, now - 48);
+    ck_assert(isnan(p.value));
+    wsp_view_point(&view, 30, &p);
+    ck_assert_uint_eq(p.timestamp, first);
+    ck_assert(p.value == 100.0);
+
+    // an empty interval.
+    ck_assert_int_eq(wsp_view_time_points(&w, w.archives, now, now - 1, &view, &e), WSP_ERROR);
+    ck_assert_int_eq(e.type, WSP_ERROR_TIME_INTERVAL);
+
+    check_close(&w);
+}
+END_TEST
+
+START_TEST(test_live)
+{
+    wsp_t w;
+    wsp_error_t e;
+    wsp_view_t view;
+    wsp_point_t p;
+
+    WSP_ERROR_INIT(&e);
+
+    open_mapping(&w, WSP_MMAP);
+
+    ck_assert_int_eq(wsp_view_time_points(&w, w.archives, now - 3, now - 2, &view, &e), WSP_OK);
+
+    wsp_view_point(&view, 0, &p);
+    ck_assert(isnan(p.value));
+
+    p.timestamp = now - 3;
+    p.value = 42.0;
+
+    // written through the mapping, seen by the view.
+    ck_assert_int_eq(wsp_update_many(&w, &p, 1, &e), WSP_OK);
+
+    wsp_view_point(&view, 0, &p);
+    ck_assert_uint_eq(p.timestamp, now - 3);
+    ck_assert(p.value == 42.0);
+
+    check_close(&w);
+}
+END_TEST
+
+START_TEST(test_not_mapped)
+{
+    wsp_mapping_t mappings[] = { WSP_FILE, WSP_PREAD };
+    wsp_t w;
+    wsp_error_t e;
+    wsp_view_t view;
+    uint32_t i;
+
+    for (i = 0; i < sizeof(mappings) / sizeof(mappings[0]); i++) {
+        open_mapping(&w, mappings[i]);
+
+        WSP_ERROR_INIT(&e);
+        ck_assert_int_eq(wsp_view_points(&w, w.archives, 0, 10, &view, &e), WSP_ERROR);
+        ck_assert_int_eq(e.type, WSP_ERROR_NOT_MAPPED);
+
+        WSP_ERROR_INIT(&e);
+        ck_assert_int_eq(wsp_view_time_points(&w, w.archives, now - 10, now, &view, &e), WSP_ERROR);
+        ck_assert_int_eq(e.type, WSP_ERROR_NOT_MAPPED);
+
+        check_close(&w);
+    }
+}
+END_TEST
+
+Suite *
+test_suite_main() {
+    Suite *s = suite_create("wsp_view");
+
+    TCase *tc = tcase_create("view");
+
+    tcase_add_checked_fixture(tc, setup_file, teardown_file);
+    tcase_add_test(tc, test_points);
+    tcase_add_test(tc, test_time_points);
+    tcase_add_test(tc, test_live);
+    tcase_add_test(tc, test_not_mapped);
+
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main() {
+    Suite *s = test_suite_main();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? 0 : 1;
+}